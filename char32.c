@@ -127,6 +127,38 @@ UNITTEST
     xassert(c32cmp(dst, U"foobar12345678") == 0);
 }
 
+UNITTEST
+{
+    xassert(c32width(U'\0') == 0);
+    xassert(c32width(U'\x1b') == -1);
+    xassert(c32width(U'\x85') == -1);
+    xassert(c32width(U'a') == 1);
+    xassert(c32width(U'å') == 1);
+    xassert(c32width(U'─') == 1);
+    xassert(c32width(U'\u0301') == 0);  /* COMBINING ACUTE ACCENT */
+    xassert(c32width(U'\u200b') == 0);  /* ZERO WIDTH SPACE */
+    xassert(c32width(U'\u00ad') == 1);  /* SOFT HYPHEN */
+    xassert(c32width(U'漢') == 2);
+    xassert(c32width(U'ｱ') == 1);       /* HALFWIDTH KATAKANA LETTER A */
+    xassert(c32width(U'Ａ') == 2);       /* FULLWIDTH LATIN CAPITAL LETTER A */
+    xassert(c32width(U'👍') == 2);
+    xassert(c32width(U'\U0001f1e6') == 2); /* REGIONAL INDICATOR SYMBOL LETTER A */
+    xassert(c32width(U'\u2028') == -1);    /* LINE SEPARATOR */
+    xassert(c32width(0xd800) == -1);        /* Surrogate */
+
+    /* Unassigned */
+    xassert(c32width(0x0378) == 1);
+    xassert(c32width(0x2fffd) == 2);
+    xassert(c32width(0x10ffff) == 1);
+    xassert(c32width(0x110000) == -1);
+
+    xassert(c32swidth(U"", 0) == 0);
+    xassert(c32swidth(U"foo漢字", 5) == 7);
+    xassert(c32swidth(U"foo漢字", 4) == 5);
+    xassert(c32swidth(U"foo\0bar", 7) == 3);
+    xassert(c32swidth(U"foo\x1b", 4) == -1);
+}
+
 UNITTEST
 {
     char32_t *c = c32dup(U"foobar");
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <uchar.h>
 #include <stddef.h>
 #include <stdarg.h>
@@ -68,12 +69,31 @@ static inline bool isc32graph(char32_t c32) {
     return iswgraph((wint_t)c32);
 }
 
+/* unicode-width.c, generated by scripts/generate-unicode-width.py */
+extern const uint8_t c32width_blocks[];
+extern const int8_t c32width_table[][256];
+
+/*
+ * Like wcwidth(), but uses foot's own width table, rather than the
+ * locale's. Thus, widths are the same regardless of which libc, and
+ * which version of it, foot runs on. Unlike wcwidth(), unassigned
+ * code points are not -1; see generate-unicode-width.py.
+ */
 static inline int c32width(char32_t c) {
-    return wcwidth((wchar_t)c);
+    if (c >= 0x110000)
+        return -1;
+    return c32width_table[c32width_blocks[c >> 8]][c & 0xff];
 }
 
 static inline int c32swidth(const char32_t *s, size_t n) {
-    return wcswidth((const wchar_t *)s, n);
+    int width = 0;
+    for (size_t i = 0; i < n && s[i] != U'\0'; i++) {
+        const int w = c32width(s[i]);
+        if (w < 0)
+            return -1;
+        width += w;
+    }
+    return width;
 }
 
 size_t mbsntoc32(char32_t *dst, const char *src, size_t nms, size_t len);
@@ -18,6 +18,9 @@ cmd_scrollback_up(struct terminal *term, int rows)
     if (urls_mode_is_active(term))
         return;
 
+    /* Make sure the rows we're scrolling to have been reflowed */
+    term_reflow_scrollback(term, rows);
+
     const struct grid *grid = term->grid;
     const int view = grid->view;
     const int grid_rows = grid->num_rows;
@@ -33,13 +36,13 @@ cmd_scrollback_up(struct terminal *term, int rows)
         return;
 
     int new_view = (view + grid_rows) - rows;
-    new_view &= grid_rows - 1;
+    new_view = _grid_row_wrap(new_view, grid_rows);
 
     xassert(new_view != view);
     xassert(grid->rows[new_view] != NULL);
 #if defined(_DEBUG)
     for (int r = 0; r < term->rows; r++)
-        xassert(grid->rows[(new_view + r) & (grid->num_rows - 1)] != NULL);
+        xassert(grid->rows[grid_row_wrap(grid, new_view + r)] != NULL);
 #endif
 
     LOG_DBG("scrollback UP: %d -> %d (offset = %d, rows = %d)",
@@ -87,13 +90,13 @@ cmd_scrollback_down(struct terminal *term, int rows)
     if (rows == 0)
         return;
 
-    int new_view = (view + rows) & (grid_rows - 1);
+    int new_view = _grid_row_wrap(view + rows, grid_rows);
 
     xassert(new_view != view);
     xassert(grid->rows[new_view] != NULL);
 #if defined(_DEBUG)
     for (int r = 0; r < term->rows; r++)
-        xassert(grid->rows[(new_view + r) & (grid_rows - 1)] != NULL);
+        xassert(grid->rows[_grid_row_wrap(new_view + r, grid_rows)] != NULL);
 #endif
 
     LOG_DBG("scrollback DOWN: %d -> %d (offset = %d, rows = %d)",
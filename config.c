@@ -2513,6 +2513,32 @@ parse_section_tweak(struct context *ctx)
     else if (strcmp(key, "sixel") == 0)
         return value_to_bool(ctx, &conf->tweak.sixel);
 
+    else if (strcmp(key, "threaded-parser") == 0)
+        return value_to_bool(ctx, &conf->tweak.threaded_parser);
+
+    else if (strcmp(key, "glyph-cache-size") == 0) {
+        uint32_t size;
+        if (!value_to_uint32(ctx, 10, &size))
+            return false;
+
+        if (size > 65536) {
+            LOG_CONTEXTUAL_ERR("must not exceed 65536 cells");
+            return false;
+        }
+
+        conf->tweak.glyph_cache_size = size;
+        return true;
+    }
+
+    else if (strcmp(key, "scrollback-compress-distance") == 0)
+        return value_to_uint32(ctx, 10, &conf->tweak.scrollback_compress_distance);
+
+    else if (strcmp(key, "scrollback-spill") == 0)
+        return value_to_bool(ctx, &conf->tweak.scrollback_spill);
+
+    else if (strcmp(key, "scrollback-spill-dir") == 0)
+        return value_to_str(ctx, &conf->tweak.scrollback_spill_dir);
+
     else if (strcmp(key, "bold-text-in-bright-amount") == 0)
         return value_to_float(ctx, &conf->bold_in_bright.amount);
 
@@ -3106,6 +3132,11 @@ config_load(struct config *conf, const char *conf_path,
             .box_drawing_solid_shades = true,
             .font_monospace_warn = true,
             .sixel = true,
+            .threaded_parser = false,
+            .glyph_cache_size = 0,
+            .scrollback_compress_distance = 0,
+            .scrollback_spill = false,
+            .scrollback_spill_dir = NULL,
         },
 
         .touch = {
@@ -3406,6 +3437,10 @@ config_clone(const struct config *old)
     conf->utmp_helper_path =
         old->utmp_helper_path != NULL ? xstrdup(old->utmp_helper_path) : NULL;
 
+    conf->tweak.scrollback_spill_dir =
+        old->tweak.scrollback_spill_dir != NULL
+        ? xstrdup(old->tweak.scrollback_spill_dir) : NULL;
+
     conf->notifications.length = 0;
     conf->notifications.head = conf->notifications.tail = 0;
     tll_foreach(old->notifications, it) {
@@ -3477,6 +3512,7 @@ config_free(struct config *conf)
     }
 
     free(conf->utmp_helper_path);
+    free(conf->tweak.scrollback_spill_dir);
     user_notifications_free(&conf->notifications);
 }
 
@@ -350,6 +350,11 @@ struct config {
         bool box_drawing_solid_shades;
         bool font_monospace_warn;
         bool sixel;
+        bool threaded_parser;
+        uint32_t glyph_cache_size;
+        uint32_t scrollback_compress_distance;
+        bool scrollback_spill;
+        char *scrollback_spill_dir;
     } tweak;
 
     struct {
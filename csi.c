@@ -259,6 +259,266 @@ csi_sgr(struct terminal *term)
     }
 }
 
+static inline uint64_t
+attrs_as_u64(struct attributes attrs)
+{
+    uint64_t v;
+    memcpy(&v, &attrs, sizeof(v));
+    return v;
+}
+
+static void
+sgr_apply_delta(struct terminal *term, uint64_t mask, uint64_t value)
+{
+    uint64_t attrs = attrs_as_u64(term->vt.attrs);
+    attrs = (attrs & ~mask) | value;
+    memcpy(&term->vt.attrs, &attrs, sizeof(attrs));
+}
+
+static uint32_t
+sgr_cache_hash(const uint8_t *params, size_t len)
+{
+    /* FNV-1a */
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= params[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * SGR fast path. 'params' is the parameter string of a complete SGR
+ * sequence (i.e. everything between "CSI" and 'm'), consisting of
+ * digits and ';' only.
+ *
+ * Recently seen parameter strings are looked up in a small, direct
+ * mapped, cache. Each entry holds the attribute bits changed by the
+ * sequence, and their new values; applying a cached sequence is thus
+ * a single mask-and-or.
+ *
+ * On a cache miss, the parameters are decoded directly from the
+ * string. To find out which bits the sequence changes, it is applied
+ * to two attribute sets: one with all bits cleared, and one with all
+ * bits set. Bits that are equal in both afterwards were written by the
+ * sequence.
+ *
+ * Returns false if the sequence uses a parameter not handled here. The
+ * caller must then run it through the regular parser, and
+ * csi_dispatch().
+ */
+bool
+csi_sgr_fast(struct terminal *term, const uint8_t *params, size_t len)
+{
+    struct sgr_cache_entry *entry = NULL;
+
+    if (len > 0 && len <= sizeof(entry->params)) {
+        entry = &term->vt.sgr_cache[
+            sgr_cache_hash(params, len) % ALEN(term->vt.sgr_cache)];
+
+        if (entry->len == len && memcmp(entry->params, params, len) == 0) {
+            sgr_apply_delta(term, entry->mask, entry->value);
+            return true;
+        }
+    }
+
+    /* Split parameter string, same limits as the regular parser */
+    unsigned v[ALEN(term->vt.params.v)];
+    size_t count = 0;
+    unsigned cur = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        const uint8_t c = params[i];
+
+        if (c == ';') {
+            if (unlikely(count >= ALEN(v) - 1))
+                return false;
+            v[count++] = cur;
+            cur = 0;
+        } else {
+            xassert(c >= '0' && c <= '9');
+            cur = cur * 10 + c - '0';
+        }
+    }
+
+    v[count++] = cur;
+
+    struct attributes lo = {0};
+    struct attributes hi;
+    memset(&hi, 0xff, sizeof(hi));
+
+#define set(field, val) do { lo.field = (val); hi.field = (val); } while (0)
+
+    for (size_t i = 0; i < count; i++) {
+        const unsigned param = v[i];
+
+        switch (param) {
+        case 0: lo = hi = (struct attributes){0}; break;
+
+        case 1: set(bold, true); break;
+        case 2: set(dim, true); break;
+        case 3: set(italic, true); break;
+        case 4: set(underline, true); break;
+        case 5: set(blink, true); break;
+        case 7: set(reverse, true); break;
+        case 8: set(conceal, true); break;
+        case 9: set(strikethrough, true); break;
+
+        case 21: break;
+        case 22: set(bold, false); set(dim, false); break;
+        case 23: set(italic, false); break;
+        case 24: set(underline, false); break;
+        case 25: set(blink, false); break;
+        case 26: break;
+        case 27: set(reverse, false); break;
+        case 28: set(conceal, false); break;
+        case 29: set(strikethrough, false); break;
+
+        case 30: case 31: case 32: case 33:
+        case 34: case 35: case 36: case 37:
+            set(fg_src, COLOR_BASE16);
+            set(fg, param - 30);
+            break;
+
+        case 39: set(fg_src, COLOR_DEFAULT); break;
+
+        case 40: case 41: case 42: case 43:
+        case 44: case 45: case 46: case 47:
+            set(bg_src, COLOR_BASE16);
+            set(bg, param - 40);
+            break;
+
+        case 49: set(bg_src, COLOR_DEFAULT); break;
+
+        case 90: case 91: case 92: case 93:
+        case 94: case 95: case 96: case 97:
+            set(fg_src, COLOR_BASE16);
+            set(fg, param - 90 + 8);
+            break;
+
+        case 100: case 101: case 102: case 103:
+        case 104: case 105: case 106: case 107:
+            set(bg_src, COLOR_BASE16);
+            set(bg, param - 100 + 8);
+            break;
+
+        case 38:
+        case 48: {
+            uint32_t color;
+            enum color_source src;
+
+            /* Indexed: 38;5;<idx> */
+            if (count - i - 1 >= 2 && v[i + 1] == 5) {
+                src = COLOR_BASE256;
+                color = min(v[i + 2], ALEN(term->colors.table) - 1);
+                i += 2;
+            }
+
+            /* RGB: 38;2;<r>;<g>;<b> */
+            else if (count - i - 1 >= 4 && v[i + 1] == 2) {
+                uint8_t r = v[i + 2];
+                uint8_t g = v[i + 3];
+                uint8_t b = v[i + 4];
+                src = COLOR_RGB;
+                color = r << 16 | g << 8 | b;
+                i += 4;
+            }
+
+            else
+                return false;
+
+            if (param == 38) {
+                set(fg_src, src);
+                set(fg, color);
+            } else {
+                set(bg_src, src);
+                set(bg, color);
+            }
+            break;
+        }
+
+        default:
+            /* Rare, or unhandled; let the regular path deal with it */
+            return false;
+        }
+    }
+
+#undef set
+
+    const uint64_t mask = ~(attrs_as_u64(lo) ^ attrs_as_u64(hi));
+    const uint64_t value = attrs_as_u64(lo) & mask;
+
+    if (entry != NULL) {
+        entry->mask = mask;
+        entry->value = value;
+        entry->len = len;
+        memcpy(entry->params, params, len);
+    }
+
+    sgr_apply_delta(term, mask, value);
+    return true;
+}
+
+UNITTEST
+{
+    /* The fast path must give the same result as csi_sgr() */
+    static const char *const sequences[] = {
+        "", "0", "1", "0;1;31", "1;2;3;4;5;7;8;9", "22;23;24;25;27;28;29",
+        "21;26", "31", "39;49", "97;107", "38;5;208", "48;5;999", "38;2;1;2;3",
+        "0;38;2;255;128;0;48;2;0;0;0", "1;38;5;12;4", "38;2;256;257;258",
+        ";1", "1;", "0;;31",
+    };
+
+    static const struct attributes initial[] = {
+        {0},
+        {.bold = true, .italic = true, .fg_src = COLOR_RGB, .fg = 0x123456,
+         .bg_src = COLOR_BASE256, .bg = 17, .url = true},
+    };
+
+    struct terminal term = {.vt = {.state = 0}};
+
+    for (size_t i = 0; i < ALEN(sequences); i++) {
+        const char *seq = sequences[i];
+        const size_t len = strlen(seq);
+
+        for (size_t j = 0; j < ALEN(initial); j++) {
+            /* Regular path */
+            term.vt.params.idx = 0;
+            if (len > 0) {
+                term.vt.params.idx = 1;
+                term.vt.params.v[0] = (struct vt_param){0};
+
+                for (size_t k = 0; k < len; k++) {
+                    if (seq[k] == ';')
+                        term.vt.params.v[term.vt.params.idx++] =
+                            (struct vt_param){0};
+                    else {
+                        unsigned *value =
+                            &term.vt.params.v[term.vt.params.idx - 1].value;
+                        *value = *value * 10 + seq[k] - '0';
+                    }
+                }
+            }
+
+            term.vt.attrs = initial[j];
+            csi_sgr(&term);
+            const uint64_t expected = attrs_as_u64(term.vt.attrs);
+
+            /* Fast path, twice; the second time hits the cache */
+            for (int k = 0; k < 2; k++) {
+                term.vt.attrs = initial[j];
+                xassert(csi_sgr_fast(&term, (const uint8_t *)seq, len));
+                xassert(attrs_as_u64(term.vt.attrs) == expected);
+            }
+        }
+    }
+
+    /* Not handled by the fast path */
+    xassert(!csi_sgr_fast(&term, (const uint8_t *)"6", 1));
+    xassert(!csi_sgr_fast(&term, (const uint8_t *)"38;3", 4));
+    xassert(!csi_sgr_fast(&term, (const uint8_t *)"58;5;1", 6));
+}
+
 static void
 decset_decrst(struct terminal *term, unsigned param, bool enable)
 {
@@ -978,7 +1238,11 @@ csi_dispatch(struct terminal *term, uint8_t final)
 
             for (size_t c = 0; c < remaining; c++)
                 term->grid->cur_row->cells[term->grid->cursor.point.col + c].attrs.clean = 0;
-            term->grid->cur_row->dirty = true;
+            if (remaining > 0) {
+                grid_row_dirty_range(
+                    term->grid->cur_row, term->grid->cursor.point.col,
+                    term->grid->cursor.point.col + remaining - 1);
+            }
 
             /* Erase the remainder of the line */
             const struct coord *cursor = &term->grid->cursor.point;
@@ -1006,7 +1270,11 @@ csi_dispatch(struct terminal *term, uint8_t final)
                     remaining * sizeof(term->grid->cur_row->cells[0]));
             for (size_t c = 0; c < remaining; c++)
                 term->grid->cur_row->cells[term->grid->cursor.point.col + count + c].attrs.clean = 0;
-            term->grid->cur_row->dirty = true;
+            if (remaining > 0) {
+                grid_row_dirty_range(
+                    term->grid->cur_row, term->grid->cursor.point.col + count,
+                    term->cols - 1);
+            }
 
             /* Erase (insert space characters) */
             const struct coord *cursor = &term->grid->cursor.point;
@@ -4,3 +4,4 @@
 #include "terminal.h"
 
 void csi_dispatch(struct terminal *term, uint8_t final);
+bool csi_sgr_fast(struct terminal *term, const uint8_t *params, size_t len);
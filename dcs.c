@@ -476,6 +476,14 @@ dcs_put(struct terminal *term, uint8_t c)
         term->vt.dcs.put_handler(term, c);
 }
 
+void
+dcs_put_many(struct terminal *term, const uint8_t *data, size_t len)
+{
+    /* Note: the handler may replace itself (e.g. sixel) */
+    for (size_t i = 0; i < len && term->vt.dcs.put_handler != NULL; i++)
+        term->vt.dcs.put_handler(term, data[i]);
+}
+
 void
 dcs_unhook(struct terminal *term)
 {
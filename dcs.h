@@ -5,4 +5,5 @@
 
 void dcs_hook(struct terminal *term, uint8_t final);
 void dcs_put(struct terminal *term, uint8_t c);
+void dcs_put_many(struct terminal *term, const uint8_t *data, size_t len);
 void dcs_unhook(struct terminal *term);
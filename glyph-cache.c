@@ -0,0 +1,271 @@
+#include "glyph-cache.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+
+#define LOG_MODULE "glyph-cache"
+#define LOG_ENABLE_DBG 0
+#include "log.h"
+#include "debug.h"
+#include "macros.h"
+#include "util.h"
+#include "xmalloc.h"
+
+/* Number of slots in each atlas row */
+#define SLOTS_PER_ROW 32
+
+struct glyph_cache_entry {
+    struct glyph_cache_key key;
+    uint32_t hash;
+
+    int32_t hash_next;  /* Next entry in the same bucket, or -1 */
+    int32_t lru_prev;   /* More recently used entry, or -1 */
+    int32_t lru_next;   /* Less recently used entry, or -1 */
+};
+
+static uint32_t
+key_hash(const struct glyph_cache_key *key)
+{
+    uint64_t h = (uint64_t)(uintptr_t)key->glyph * 0x9e3779b97f4a7c15ull;
+    h ^= ((uint64_t)key->fg << 32 | key->bg) * 0xff51afd7ed558ccdull;
+    h ^= (uint64_t)key->alpha << 16 | (uint64_t)key->subpixel << 4 | key->cols;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 29;
+    return (uint32_t)h;
+}
+
+static bool
+key_equal(const struct glyph_cache_key *a, const struct glyph_cache_key *b)
+{
+    return a->glyph == b->glyph &&
+           a->fg == b->fg &&
+           a->bg == b->bg &&
+           a->alpha == b->alpha &&
+           a->subpixel == b->subpixel &&
+           a->cols == b->cols;
+}
+
+struct glyph_cache *
+glyph_cache_new(size_t capacity, pixman_format_code_t format,
+                int cell_width, int cell_height)
+{
+    xassert(capacity > 0);
+    xassert(capacity <= INT32_MAX);
+
+    struct glyph_cache *cache = xmalloc(sizeof(*cache));
+    *cache = (struct glyph_cache){
+        .format = format,
+        .cell_width = cell_width,
+        .cell_height = cell_height,
+    };
+
+    const int slots_per_row = min(capacity, (size_t)SLOTS_PER_ROW);
+    const int atlas_rows = (capacity + SLOTS_PER_ROW - 1) / SLOTS_PER_ROW;
+
+    pixman_image_t *atlas = pixman_image_create_bits(
+        format, slots_per_row * 2 * cell_width, atlas_rows * cell_height,
+        NULL, 0);
+
+    if (atlas == NULL) {
+        LOG_ERR("failed to allocate a %zu entries large glyph cache",
+                capacity);
+        return cache;
+    }
+
+    size_t bucket_count = 1;
+    while (bucket_count < capacity)
+        bucket_count <<= 1;
+
+    cache->atlas = atlas;
+    cache->capacity = capacity;
+    cache->entries = xmalloc(capacity * sizeof(cache->entries[0]));
+    cache->bucket_mask = bucket_count - 1;
+    cache->buckets = xmalloc(bucket_count * sizeof(cache->buckets[0]));
+
+    glyph_cache_clear(cache);
+    return cache;
+}
+
+void
+glyph_cache_destroy(struct glyph_cache *cache)
+{
+    if (cache == NULL)
+        return;
+
+    LOG_DBG("glyph cache: %"PRIu64" hits, %"PRIu64" misses",
+            cache->hits, cache->misses);
+
+    if (cache->atlas != NULL)
+        pixman_image_unref(cache->atlas);
+    free(cache->entries);
+    free(cache->buckets);
+    free(cache);
+}
+
+bool
+glyph_cache_is_compatible(const struct glyph_cache *cache,
+                          pixman_format_code_t format,
+                          int cell_width, int cell_height)
+{
+    return cache->format == format &&
+           cache->cell_width == cell_width &&
+           cache->cell_height == cell_height;
+}
+
+void
+glyph_cache_clear(struct glyph_cache *cache)
+{
+    cache->count = 0;
+    cache->lru_head = cache->lru_tail = -1;
+
+    if (cache->buckets == NULL)
+        return;
+
+    for (size_t i = 0; i <= cache->bucket_mask; i++)
+        cache->buckets[i] = -1;
+}
+
+static void
+lru_unlink(struct glyph_cache *cache, int32_t idx)
+{
+    struct glyph_cache_entry *e = &cache->entries[idx];
+
+    if (e->lru_prev >= 0)
+        cache->entries[e->lru_prev].lru_next = e->lru_next;
+    else
+        cache->lru_head = e->lru_next;
+
+    if (e->lru_next >= 0)
+        cache->entries[e->lru_next].lru_prev = e->lru_prev;
+    else
+        cache->lru_tail = e->lru_prev;
+}
+
+static void
+lru_push_front(struct glyph_cache *cache, int32_t idx)
+{
+    struct glyph_cache_entry *e = &cache->entries[idx];
+
+    e->lru_prev = -1;
+    e->lru_next = cache->lru_head;
+
+    if (cache->lru_head >= 0)
+        cache->entries[cache->lru_head].lru_prev = idx;
+    else
+        cache->lru_tail = idx;
+
+    cache->lru_head = idx;
+}
+
+static void
+bucket_remove(struct glyph_cache *cache, int32_t idx)
+{
+    int32_t *link = &cache->buckets[cache->entries[idx].hash & cache->bucket_mask];
+
+    while (*link != idx) {
+        xassert(*link >= 0);
+        link = &cache->entries[*link].hash_next;
+    }
+
+    *link = cache->entries[idx].hash_next;
+}
+
+static void
+slot_position(const struct glyph_cache *cache, int32_t idx, int *x, int *y)
+{
+    *x = (idx % SLOTS_PER_ROW) * 2 * cache->cell_width;
+    *y = (idx / SLOTS_PER_ROW) * cache->cell_height;
+}
+
+bool
+glyph_cache_get(struct glyph_cache *cache, const struct glyph_cache_key *key,
+                int *x, int *y)
+{
+    xassert(key->cols >= 1 && key->cols <= 2);
+
+    const uint32_t hash = key_hash(key);
+    int32_t *bucket = &cache->buckets[hash & cache->bucket_mask];
+
+    for (int32_t idx = *bucket; idx >= 0; idx = cache->entries[idx].hash_next) {
+        struct glyph_cache_entry *e = &cache->entries[idx];
+
+        if (e->hash != hash || !key_equal(&e->key, key))
+            continue;
+
+        if (idx != cache->lru_head) {
+            lru_unlink(cache, idx);
+            lru_push_front(cache, idx);
+        }
+
+        cache->hits++;
+        slot_position(cache, idx, x, y);
+        return true;
+    }
+
+    cache->misses++;
+
+    int32_t idx;
+    if (cache->count < cache->capacity)
+        idx = cache->count++;
+    else {
+        /* Evict the least recently used entry */
+        idx = cache->lru_tail;
+        bucket_remove(cache, idx);
+        lru_unlink(cache, idx);
+    }
+
+    struct glyph_cache_entry *e = &cache->entries[idx];
+    e->key = *key;
+    e->hash = hash;
+    e->hash_next = *bucket;
+    *bucket = idx;
+
+    lru_push_front(cache, idx);
+    slot_position(cache, idx, x, y);
+    return false;
+}
+
+UNITTEST
+{
+    struct glyph_cache *cache = glyph_cache_new(2, PIXMAN_a8r8g8b8, 8, 16);
+    xassert(cache != NULL);
+    xassert(glyph_cache_is_compatible(cache, PIXMAN_a8r8g8b8, 8, 16));
+    xassert(!glyph_cache_is_compatible(cache, PIXMAN_a8r8g8b8, 9, 16));
+
+    static const struct fcft_glyph glyphs[2];
+
+    struct glyph_cache_key a = {
+        .glyph = &glyphs[0], .fg = 0xffffff, .bg = 0x000000,
+        .alpha = 0xffff, .subpixel = FCFT_SUBPIXEL_NONE, .cols = 1};
+    struct glyph_cache_key b = a;
+    b.fg = 0xff0000;
+    struct glyph_cache_key c = a;
+    c.glyph = &glyphs[1];
+
+    int ax, ay, bx, by, x, y;
+
+    xassert(!glyph_cache_get(cache, &a, &ax, &ay));
+    xassert(!glyph_cache_get(cache, &b, &bx, &by));
+    xassert(ax != bx || ay != by);
+
+    xassert(glyph_cache_get(cache, &a, &x, &y));
+    xassert(x == ax && y == ay);
+
+    /* 'b' is now the least recently used entry */
+    xassert(!glyph_cache_get(cache, &c, &x, &y));
+    xassert(x == bx && y == by);
+
+    xassert(glyph_cache_get(cache, &a, &x, &y));
+    xassert(glyph_cache_get(cache, &c, &x, &y));
+    xassert(!glyph_cache_get(cache, &b, &x, &y));
+    xassert(x == ax && y == ay);
+
+    xassert(cache->hits == 3);
+    xassert(cache->misses == 4);
+
+    glyph_cache_clear(cache);
+    xassert(!glyph_cache_get(cache, &c, &x, &y));
+
+    glyph_cache_destroy(cache);
+}
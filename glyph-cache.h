@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fcft/fcft.h>
+#include <pixman.h>
+
+/*
+ * LRU cache of pre-composited cells: a single glyph, drawn in a
+ * given foreground color, on top of a given background color.
+ *
+ * All entries live in a single atlas image, in fixed size slots (two
+ * cells wide). A cached cell is drawn with a single SRC blit from the
+ * atlas.
+ *
+ * The cache is *not* thread safe; each render thread has its own.
+ *
+ * Glyphs are identified by their address. The cache must be cleared
+ * when the fonts they belong to are destroyed.
+ */
+
+struct glyph_cache_entry;
+
+struct glyph_cache_key {
+    const struct fcft_glyph *glyph;
+    uint32_t fg;
+    uint32_t bg;
+    uint16_t alpha;                 /* Background alpha */
+    enum fcft_subpixel subpixel;
+    int cols;                       /* 1 or 2 */
+};
+
+struct glyph_cache {
+    pixman_image_t *atlas;
+    pixman_format_code_t format;
+    int cell_width;
+    int cell_height;
+
+    size_t capacity;
+    size_t count;
+    struct glyph_cache_entry *entries;
+
+    size_t bucket_mask;
+    int32_t *buckets;
+
+    int32_t lru_head;   /* Most recently used */
+    int32_t lru_tail;   /* Least recently used */
+
+    uint64_t hits;
+    uint64_t misses;
+};
+
+/*
+ * If the atlas cannot be allocated, a cache *without* an atlas is
+ * returned. It must not be used, but can be kept (to not retry the
+ * allocation) until the cell size, or format, changes.
+ */
+struct glyph_cache *glyph_cache_new(
+    size_t capacity, pixman_format_code_t format,
+    int cell_width, int cell_height);
+void glyph_cache_destroy(struct glyph_cache *cache);
+
+bool glyph_cache_is_compatible(
+    const struct glyph_cache *cache, pixman_format_code_t format,
+    int cell_width, int cell_height);
+void glyph_cache_clear(struct glyph_cache *cache);
+
+/*
+ * Looks up 'key', and returns the position of its slot in the
+ * atlas.
+ *
+ * Returns true if the cell was cached. Otherwise, a slot is
+ * allocated for it (evicting the least recently used entry, if the
+ * cache is full), and false is returned; the caller is then
+ * responsible for rendering the cell into the slot.
+ */
+bool glyph_cache_get(
+    struct glyph_cache *cache, const struct glyph_cache_key *key,
+    int *x, int *y);
@@ -1,14 +1,23 @@
 #include "grid.h"
 
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
+#include <threads.h>
 
 #define LOG_MODULE "grid"
 #define LOG_ENABLE_DBG 0
 #include "log.h"
 #include "debug.h"
 #include "macros.h"
+#include "render.h"
 #include "sixel.h"
+#include "spill.h"
 #include "stride.h"
 #include "util.h"
 #include "xmalloc.h"
@@ -16,619 +25,2386 @@
 #define TIME_REFLOW 0
 
 /*
- * “sb” (scrollback relative) coordinates
+ * Row arena
  *
- * The scrollback relative row number 0 is the *first*, and *oldest*
- * row in the scrollback history (and thus the *first* row to be
- * scrolled out). Thus, a higher number means further *down* in the
- * scrollback, with the *highest* number being at the bottom of the
- * screen, where new input appears.
+ * Rows are allocated from a per-grid arena. The row struct, and its
+ * cells, are co-allocated, and carved out of large slabs. Freed rows
+ * are put on a free list, and are recycled by the next allocation.
+ *
+ * All rows in an arena have the same number of columns. When the
+ * grid is resized, the new rows are allocated from a new arena, and
+ * the old arena is released in one go.
+ *
+ * Arenas are reference counted; a grid snapshot shares its rows, and
+ * thus the arena, with the grid it was taken from.
  */
+#define ROW_SLAB_SIZE (128 * 1024)
+
+struct row_slab {
+    struct row_slab *next;
+    /* Rows follow */
+};
+
+struct free_row {
+    struct free_row *next;
+};
+
+struct row_arena {
+    int ref_count;
+    int cols;
+    size_t row_size;            /* struct row + cells */
+    size_t rows_per_slab;
+
+    struct row_slab *slabs;     /* Newest first */
+    size_t slab_used;           /* Rows handed out from the newest slab */
+    struct free_row *free_list;
+    size_t live;                /* Allocated, and not yet free:d, rows */
+};
+
+static struct row_arena *
+row_arena_new(int cols)
+{
+    const size_t align = _Alignof(struct row);
+    const size_t row_size =
+        (sizeof(struct row) + cols * sizeof(struct cell) + align - 1) & ~(align - 1);
+
+    struct row_arena *arena = xmalloc(sizeof(*arena));
+    *arena = (struct row_arena){
+        .ref_count = 1,
+        .cols = cols,
+        .row_size = row_size,
+        .rows_per_slab = max(ROW_SLAB_SIZE / row_size, (size_t)1),
+    };
+    return arena;
+}
 
-int
-grid_row_abs_to_sb(const struct grid *grid, int screen_rows, int abs_row)
+static void
+row_arena_release_slabs(struct row_arena *arena)
 {
-    const int scrollback_start = grid->offset + screen_rows;
-    int rebased_row = abs_row - scrollback_start + grid->num_rows;
+    struct row_slab *slab = arena->slabs;
+    while (slab != NULL) {
+        struct row_slab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
 
-    rebased_row &= grid->num_rows - 1;
-    return rebased_row;
+    arena->slabs = NULL;
+    arena->slab_used = 0;
+    arena->free_list = NULL;
 }
 
-int grid_row_sb_to_abs(const struct grid *grid, int screen_rows, int sb_rel_row)
+static struct row_arena *
+row_arena_ref(struct row_arena *arena)
 {
-    const int scrollback_start = grid->offset + screen_rows;
-    int abs_row = sb_rel_row + scrollback_start;
-
-    abs_row &= grid->num_rows - 1;
-    return abs_row;
+    arena->ref_count++;
+    return arena;
 }
 
-int
-grid_sb_start_ignore_uninitialized(const struct grid *grid, int screen_rows)
+static void
+row_arena_destroy(struct row_arena *arena)
 {
-    int scrollback_start = grid->offset + screen_rows;
-    scrollback_start &= grid->num_rows - 1;
+    if (arena == NULL)
+        return;
 
-    while (grid->rows[scrollback_start] == NULL) {
-        scrollback_start++;
-        scrollback_start &= grid->num_rows - 1;
-    }
+    xassert(arena->ref_count > 0);
+    if (--arena->ref_count > 0)
+        return;
 
-    return scrollback_start;
+    row_arena_release_slabs(arena);
+    free(arena);
 }
 
-int
-grid_row_abs_to_sb_precalc_sb_start(const struct grid *grid, int sb_start,
-                                    int abs_row)
+static struct row *
+row_arena_alloc(struct row_arena *arena, bool initialize)
 {
-    int rebased_row = abs_row - sb_start + grid->num_rows;
-    rebased_row &= grid->num_rows - 1;
-    return rebased_row;
+    struct row *row;
+
+    if (arena->free_list != NULL) {
+        row = (struct row *)arena->free_list;
+        arena->free_list = arena->free_list->next;
+    } else {
+        if (arena->slabs == NULL || arena->slab_used >= arena->rows_per_slab) {
+            struct row_slab *slab = xmalloc(
+                sizeof(*slab) + arena->rows_per_slab * arena->row_size);
+            slab->next = arena->slabs;
+            arena->slabs = slab;
+            arena->slab_used = 0;
+        }
+
+        row = (struct row *)(
+            (char *)(arena->slabs + 1) + arena->slab_used++ * arena->row_size);
+    }
+
+    arena->live++;
+
+    row->cells = (struct cell *)(row + 1);
+    row->extra = NULL;
+    row->dirty = false;
+    row->dirty_start = row->dirty_end = 0;
+    row->linebreak = false;
+    row->prompt_marker = false;
+    row->compressed = false;
+    row->blank = false;
+    row->shared = 0;
+
+    if (initialize) {
+        memset(row->cells, 0, arena->cols * sizeof(row->cells[0]));
+        for (size_t c = 0; c < arena->cols; c++)
+            row->cells[c].attrs.clean = 1;
+    }
+
+    return row;
 }
 
-int
-grid_row_sb_to_abs_precalc_sb_start(const struct grid *grid, int sb_start,
-                                    int sb_rel_row)
+static void
+row_arena_free(struct row_arena *arena, struct row *row)
 {
-    int abs_row = sb_rel_row + sb_start;
-    abs_row &= grid->num_rows - 1;
-    return abs_row;
+    xassert(arena->live > 0);
+
+    struct free_row *free_row = (struct free_row *)row;
+    free_row->next = arena->free_list;
+    arena->free_list = free_row;
+
+    /* Give the memory back when the last row is free:d (e.g. on reset) */
+    if (--arena->live == 0)
+        row_arena_release_slabs(arena);
 }
 
+/* Moves all rows (and slabs) from 'from' to 'into', and destroys 'from' */
 static void
-ensure_row_has_extra_data(struct row *row)
+row_arena_merge(struct row_arena *into, struct row_arena *from)
 {
-    if (row->extra == NULL)
-        row->extra = xcalloc(1, sizeof(*row->extra));
+    if (from == NULL)
+        return;
+
+    xassert(into->row_size == from->row_size);
+    xassert(from->ref_count == 1);
+
+    if (from->slabs != NULL) {
+        struct row_slab *last = from->slabs;
+        while (last->next != NULL)
+            last = last->next;
+
+        if (into->slabs != NULL) {
+            /* Keep our newest slab first; 'slab_used' refers to it */
+            last->next = into->slabs->next;
+            into->slabs->next = from->slabs;
+        } else {
+            into->slabs = from->slabs;
+            into->slab_used = from->slab_used;
+        }
+    }
+
+    if (from->free_list != NULL) {
+        struct free_row *last = from->free_list;
+        while (last->next != NULL)
+            last = last->next;
+
+        last->next = into->free_list;
+        into->free_list = from->free_list;
+    }
+
+    into->live += from->live;
+    free(from);
 }
 
-static void
-verify_no_overlapping_uris(const struct row_data *extra)
+/* Deep copies a row's URI ranges */
+static struct row_data *
+row_data_dup(const struct row_data *extra)
 {
-#if defined(_DEBUG)
-    for (size_t i = 0; i < extra->uri_ranges.count; i++) {
-        const struct row_uri_range *r1 = &extra->uri_ranges.v[i];
+    if (extra == NULL)
+        return NULL;
 
-        for (size_t j = i + 1; j < extra->uri_ranges.count; j++) {
-            const struct row_uri_range *r2 = &extra->uri_ranges.v[j];
-            xassert(r1 != r2);
+    struct row_data *copy = xcalloc(1, sizeof(*copy));
+    const uint32_t count = extra->uri_ranges.count;
 
-            if ((r1->start <= r2->start && r1->end >= r2->start) ||
-                (r1->start <= r2->end && r1->end >= r2->end))
-            {
-                BUG("OSC-8 URI overlap: %s: %d-%d: %s: %d-%d",
-                    r1->uri, r1->start, r1->end,
-                    r2->uri, r2->start, r2->end);
-            }
+    if (count > 0) {
+        copy->uri_ranges.v = xmalloc(count * sizeof(copy->uri_ranges.v[0]));
+        copy->uri_ranges.size = copy->uri_ranges.count = count;
+
+        for (uint32_t i = 0; i < count; i++) {
+            copy->uri_ranges.v[i] = extra->uri_ranges.v[i];
+            copy->uri_ranges.v[i].uri = xstrdup(extra->uri_ranges.v[i].uri);
         }
     }
-#endif
+
+    return copy;
 }
 
-static void
-verify_uris_are_sorted(const struct row_data *extra)
+/*
+ * Compressed rows
+ *
+ * Scrollback rows that are far enough from the screen are compressed
+ * (see term_scroll_partial()). A compressed row is a single heap
+ * allocation; the row struct (with 'cells' set to NULL), followed by
+ * the encoded cells:
+ *
+ *   - the number of text cells (trailing empty cells are dropped)
+ *   - the text cells' code points
+ *   - attribute runs; the run length, followed by the (raw)
+ *     attributes
+ *
+ * Numbers are LEB128 encoded (7 bits per byte). For ASCII, this is
+ * the same as UTF-8, but it also handles combining characters and
+ * spacers, which are outside the Unicode range.
+ *
+ * If the grid has a spill file, the encoded cells are stored there,
+ * instead of in the heap.
+ *
+ * Compressed rows are decompressed, into regular arena rows, when
+ * accessed through grid_row_abs(), or any of the other grid_row*()
+ * accessors.
+ *
+ * Blank rows (see grid_row_blank()) are compressed rows too, but
+ * instead of encoded cells, they hold the attributes shared by all
+ * cells. They are never spilled.
+ */
+struct compressed_row {
+    struct row row;
+    uint32_t size;              /* Of the encoded cells */
+    bool spilled;               /* Encoded cells are in grid->spill */
+    uint64_t offset;            /* Into grid->spill, if spilled */
+    uint8_t data[];             /* Encoded cells, if not spilled */
+};
+
+struct blank_row {
+    struct row row;
+    struct attributes attrs;
+};
+
+static size_t
+varint_put(uint8_t *out, uint32_t value)
 {
-#if defined(_DEBUG)
-    const struct row_uri_range *last = NULL;
+    size_t len = 0;
 
-    for (size_t i = 0; i < extra->uri_ranges.count; i++) {
-        const struct row_uri_range *r = &extra->uri_ranges.v[i];
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
 
-        if (last != NULL) {
-            if (last->start >= r->start || last->end >= r->end) {
-                BUG("OSC-8 URI not sorted correctly: "
-                    "%s: %d-%d came before %s: %d-%d",
-                    last->uri, last->start, last->end,
-                    r->uri, r->start, r->end);
-            }
-        }
+        if (out != NULL)
+            out[len] = byte | (value != 0 ? 0x80 : 0);
+        len++;
+    } while (value != 0);
 
-        last = r;
+    return len;
+}
+
+static uint32_t
+varint_get(const uint8_t **in)
+{
+    uint32_t value = 0;
+
+    for (int shift = 0;; shift += 7) {
+        const uint8_t byte = *(*in)++;
+        value |= (uint32_t)(byte & 0x7f) << shift;
+
+        if (!(byte & 0x80))
+            return value;
     }
-#endif
 }
 
-static void
-uri_range_ensure_size(struct row_data *extra, uint32_t count_to_add)
+/* Encodes 'cells' into 'out', and returns the encoded size. If 'out'
+ * is NULL, only the size is calculated */
+static size_t
+row_encode(const struct cell *cells, int cols, uint8_t *out)
 {
-    if (extra->uri_ranges.count + count_to_add > extra->uri_ranges.size) {
-        extra->uri_ranges.size = extra->uri_ranges.count + count_to_add;
-        extra->uri_ranges.v = xrealloc(
-            extra->uri_ranges.v,
-            extra->uri_ranges.size * sizeof(extra->uri_ranges.v[0]));
+    size_t len = 0;
+
+#define put(value) len += varint_put(out != NULL ? &out[len] : NULL, value)
+
+    int text_count = cols;
+    while (text_count > 0 && cells[text_count - 1].wc == 0)
+        text_count--;
+
+    put(text_count);
+    for (int c = 0; c < text_count; c++)
+        put(cells[c].wc);
+
+    for (int c = 0; c < cols;) {
+        const struct attributes *attrs = &cells[c].attrs;
+
+        int run = 1;
+        while (c + run < cols &&
+               memcmp(&cells[c + run].attrs, attrs, sizeof(*attrs)) == 0)
+        {
+            run++;
+        }
+
+        put(run);
+        if (out != NULL)
+            memcpy(&out[len], attrs, sizeof(*attrs));
+        len += sizeof(*attrs);
+
+        c += run;
     }
 
-    xassert(extra->uri_ranges.count + count_to_add <= extra->uri_ranges.size);
+#undef put
+    return len;
 }
 
-/*
- * Be careful! This function may xrealloc() the URI range vector, thus
- * invalidating pointers into it.
- */
 static void
-uri_range_insert(struct row_data *extra, size_t idx, int start, int end,
-                 uint64_t id, const char *uri)
+row_decode(const uint8_t *in, struct cell *cells, int cols)
 {
-    uri_range_ensure_size(extra, 1);
+    const int text_count = varint_get(&in);
+    xassert(text_count <= cols);
 
-    xassert(idx <= extra->uri_ranges.count);
+    for (int c = 0; c < text_count; c++)
+        cells[c].wc = varint_get(&in);
+    for (int c = text_count; c < cols; c++)
+        cells[c].wc = 0;
 
-    const size_t move_count = extra->uri_ranges.count - idx;
-    memmove(&extra->uri_ranges.v[idx + 1],
-            &extra->uri_ranges.v[idx],
-            move_count * sizeof(extra->uri_ranges.v[0]));
+    for (int c = 0; c < cols;) {
+        const int run = varint_get(&in);
+        xassert(run > 0 && c + run <= cols);
 
-    extra->uri_ranges.count++;
-    extra->uri_ranges.v[idx] = (struct row_uri_range){
-        .start = start,
-        .end = end,
-        .id = id,
-        .uri = xstrdup(uri),
-    };
+        struct attributes attrs;
+        memcpy(&attrs, in, sizeof(attrs));
+        in += sizeof(attrs);
+
+        for (int end = c + run; c < end; c++)
+            cells[c].attrs = attrs;
+    }
 }
 
-static void
-uri_range_append_no_strdup(struct row_data *extra, int start, int end,
-                           uint64_t id, char *uri)
+static const uint8_t *
+compressed_row_data(const struct grid *grid, const struct row *row)
 {
-    uri_range_ensure_size(extra, 1);
-    extra->uri_ranges.v[extra->uri_ranges.count++] = (struct row_uri_range){
-        .start = start,
-        .end = end,
-        .id = id,
-        .uri = uri,
-    };
+    xassert(row->compressed);
+
+    const struct compressed_row *compressed =
+        (const struct compressed_row *)row;
+
+    return compressed->spilled
+        ? spill_file_data(grid->spill, compressed->offset)
+        : compressed->data;
 }
 
+/* Note: does *not* free row->extra */
 static void
-uri_range_append(struct row_data *extra, int start, int end, uint64_t id,
-                 const char *uri)
+compressed_row_free(struct grid *grid, struct row *row)
 {
-    uri_range_append_no_strdup(extra, start, end, id, xstrdup(uri));
+    const struct compressed_row *compressed =
+        (const struct compressed_row *)row;
+
+    if (!row->blank && compressed->spilled)
+        spill_file_release(grid->spill, compressed->size);
+    free(row);
 }
 
-static void
-uri_range_delete(struct row_data *extra, size_t idx)
+static int
+spilled_row_cmp(const void *_a, const void *_b)
 {
-    xassert(idx < extra->uri_ranges.count);
-    grid_row_uri_range_destroy(&extra->uri_ranges.v[idx]);
+    const struct compressed_row *a = *(const struct compressed_row **)_a;
+    const struct compressed_row *b = *(const struct compressed_row **)_b;
 
-    const size_t move_count = extra->uri_ranges.count - idx - 1;
-    memmove(&extra->uri_ranges.v[idx],
-            &extra->uri_ranges.v[idx + 1],
-            move_count * sizeof(extra->uri_ranges.v[0]));
-    extra->uri_ranges.count--;
+    return a->offset < b->offset ? -1 : a->offset > b->offset;
 }
 
-struct grid *
-grid_snapshot(const struct grid *grid)
+/*
+ * Scrollback that hasn't been reflowed yet. 'old' is the grid as it
+ * was before the resize, minus the rows that *have* been reflowed.
+ * What's left are the 'count' rows starting at 'start' (an absolute
+ * row number in the old grid).
+ */
+struct grid_reflow {
+    struct grid old;
+    int start;
+    int count;
+};
+
+/* Moves all spilled rows to the beginning of the spill file */
+static void
+spill_compact(struct grid *grid)
 {
-    struct grid *clone = xmalloc(sizeof(*clone));
-    clone->num_rows = grid->num_rows;
-    clone->num_cols = grid->num_cols;
-    clone->offset = grid->offset;
-    clone->view = grid->view;
-    clone->cursor = grid->cursor;
-    clone->saved_cursor = grid->saved_cursor;
-    clone->kitty_kbd = grid->kitty_kbd;
-    clone->rows = xcalloc(grid->num_rows, sizeof(clone->rows[0]));
-    memset(&clone->scroll_damage, 0, sizeof(clone->scroll_damage));
-    memset(&clone->sixel_images, 0, sizeof(clone->sixel_images));
+    /* Rows not yet reflowed share the spill file with the grid */
+    const struct grid *old = grid->reflow != NULL ? &grid->reflow->old : NULL;
+    const int total_rows = grid->num_rows + (old != NULL ? old->num_rows : 0);
 
-    tll_foreach(grid->scroll_damage, it)
-        tll_push_back(clone->scroll_damage, it->item);
+    struct compressed_row **spilled =
+        xmalloc(total_rows * sizeof(spilled[0]));
+    size_t count = 0;
 
-    for (int r = 0; r < grid->num_rows; r++) {
-        const struct row *row = grid->rows[r];
+    for (int r = 0; r < total_rows; r++) {
+        struct row *row = r < grid->num_rows
+            ? grid->rows[r]
+            : old->rows[r - grid->num_rows];
 
-        if (row == NULL)
+        if (row == NULL || !row->compressed || row->blank)
             continue;
 
-        struct row *clone_row = xmalloc(sizeof(*row));
-        clone->rows[r] = clone_row;
+        struct compressed_row *compressed = (struct compressed_row *)row;
+        if (compressed->spilled)
+            spilled[count++] = compressed;
+    }
 
-        clone_row->cells = xmalloc(grid->num_cols * sizeof(clone_row->cells[0]));
-        clone_row->linebreak = row->linebreak;
-        clone_row->dirty = row->dirty;
-        clone_row->prompt_marker = row->prompt_marker;
+    /* Moving rows in offset order never overwrites a row not yet moved */
+    qsort(spilled, count, sizeof(spilled[0]), &spilled_row_cmp);
 
-        for (int c = 0; c < grid->num_cols; c++)
-            clone_row->cells[c] = row->cells[c];
+    uint64_t offset = 0;
+    for (size_t i = 0; i < count; i++) {
+        spill_file_move(
+            grid->spill, offset, spilled[i]->offset, spilled[i]->size);
+        spilled[i]->offset = offset;
+        offset += spilled[i]->size;
+    }
 
-        const struct row_data *extra = row->extra;
+    spill_file_truncate(grid->spill, offset);
+    free(spilled);
 
-        if (extra != NULL) {
-            struct row_data *clone_extra = xcalloc(1, sizeof(*clone_extra));
-            clone_row->extra = clone_extra;
+    LOG_DBG("compacted spill file: %zu rows, %"PRIu64" bytes", count, offset);
+}
 
-            uri_range_ensure_size(clone_extra, extra->uri_ranges.count);
+void
+grid_row_compress(struct grid *grid, int abs_row)
+{
+    struct row *row = grid->rows[abs_row];
 
-            for (size_t i = 0; i < extra->uri_ranges.count; i++) {
-                const struct row_uri_range *range = &extra->uri_ranges.v[i];
-                uri_range_append(
-                    clone_extra,
-                    range->start, range->end, range->id, range->uri);
-            }
-        } else
-            clone_row->extra = NULL;
-    }
+    xassert(row != NULL);
+    xassert(row != grid->cur_row);
 
-    tll_foreach(grid->sixel_images, it) {
-        int original_width = it->item.original.width;
-        int original_height = it->item.original.height;
-        pixman_image_t *original_pix = it->item.original.pix;
-        pixman_format_code_t original_pix_fmt = pixman_image_get_format(original_pix);
-        int original_stride = stride_for_format_and_width(original_pix_fmt, original_width);
+    if (row->compressed)
+        return;
 
-        size_t original_size = original_stride * original_height;
-        void *new_original_data = xmalloc(original_size);
-        memcpy(new_original_data, it->item.original.data, original_size);
+    const size_t size = row_encode(row->cells, grid->num_cols, NULL);
 
-        pixman_image_t *new_original_pix = pixman_image_create_bits_no_clear(
-            original_pix_fmt, original_width, original_height,
-            new_original_data, original_stride);
+    struct compressed_row *compressed = NULL;
+    uint8_t *data = NULL;
 
-        void *new_scaled_data = NULL;
-        pixman_image_t *new_scaled_pix = NULL;
-        int scaled_width = -1;
-        int scaled_height = -1;
+    if (grid->spill != NULL) {
+        if (spill_file_needs_compaction(grid->spill))
+            spill_compact(grid);
 
-        if (it->item.scaled.data != NULL) {
-            scaled_width = it->item.scaled.width;
-            scaled_height = it->item.scaled.height;
+        uint64_t offset;
+        data = spill_file_append(grid->spill, size, &offset);
 
-            pixman_image_t *scaled_pix = it->item.scaled.pix;
-            pixman_format_code_t scaled_pix_fmt = pixman_image_get_format(scaled_pix);
-            int scaled_stride = stride_for_format_and_width(scaled_pix_fmt, scaled_width);
+        if (data != NULL) {
+            compressed = xmalloc(sizeof(*compressed));
+            compressed->spilled = true;
+            compressed->offset = offset;
+        }
+    }
 
-            size_t scaled_size = scaled_stride * scaled_height;
-            new_scaled_data = xmalloc(scaled_size);
-            memcpy(new_scaled_data, it->item.scaled.data, scaled_size);
+    if (compressed == NULL) {
+        compressed = xmalloc(sizeof(*compressed) + size);
+        compressed->spilled = false;
+        data = compressed->data;
+    }
 
-            new_scaled_pix = pixman_image_create_bits_no_clear(
-                scaled_pix_fmt, scaled_width, scaled_height, new_scaled_data,
-                scaled_stride);
-        }
+    compressed->row = *row;
+    compressed->row.cells = NULL;
+    compressed->row.compressed = true;
+    compressed->row.shared = 0;
+    compressed->size = size;
+    row_encode(row->cells, grid->num_cols, data);
+
+    if (row->shared > 0) {
+        /* The row is left as is, for the other grid(s) */
+        compressed->row.extra = row_data_dup(row->extra);
+        row->shared--;
+    } else {
+        /* URI ranges (row->extra) are now owned by the compressed row */
+        row_arena_free(grid->arena, row);
+    }
 
-        struct sixel six = {
-            .pix = (it->item.pix == it->item.original.pix
-                    ? new_original_pix
-                    : (it->item.pix == it->item.scaled.pix
-                       ? new_scaled_pix
-                       : NULL)),
-            .width = it->item.width,
-            .height = it->item.height,
-            .rows = it->item.rows,
-            .cols = it->item.cols,
-            .pos = it->item.pos,
-            .opaque = it->item.opaque,
-            .cell_width = it->item.cell_width,
-            .cell_height = it->item.cell_height,
-            .original = {
-                .data = new_original_data,
-                .pix = new_original_pix,
-                .width = original_width,
-                .height = original_height,
-            },
-            .scaled = {
-                .data = new_scaled_data,
-                .pix = new_scaled_pix,
-                .width = scaled_width,
-                .height = scaled_height,
-            },
-        };
+    grid->rows[abs_row] = &compressed->row;
+}
 
-        tll_push_back(clone->sixel_images, six);
+/*
+ * Copies the flags of 'src' to 'dst'. Cells, and URI ranges, are
+ * *not* copied.
+ */
+static void
+row_copy_flags(struct row *dst, const struct row *src)
+{
+    dst->dirty = src->dirty;
+    dst->dirty_start = src->dirty_start;
+    dst->dirty_end = src->dirty_end;
+    dst->linebreak = src->linebreak;
+    dst->prompt_marker = src->prompt_marker;
+}
+
+static void
+blank_cells(struct cell *cells, int cols, struct attributes attrs)
+{
+    for (int c = 0; c < cols; c++)
+        cells[c] = (struct cell){.attrs = attrs};
+}
+
+/*
+ * Copies the cells, and flags, of 'src' (compressed, blank, or not)
+ * to 'dst'. URI ranges are *not* copied.
+ */
+static void
+row_copy(const struct grid *grid, struct row *dst, const struct row *src)
+{
+    row_copy_flags(dst, src);
+
+    if (src->blank)
+        blank_cells(dst->cells, grid->num_cols, *grid_row_blank_attrs(src));
+    else if (src->compressed)
+        row_decode(compressed_row_data(grid, src), dst->cells, grid->num_cols);
+    else
+        memcpy(dst->cells, src->cells, grid->num_cols * sizeof(dst->cells[0]));
+}
+
+static struct row *
+blank_row_new(struct attributes attrs)
+{
+    struct blank_row *blank = xmalloc(sizeof(*blank));
+    *blank = (struct blank_row){
+        .row = {.compressed = true, .blank = true},
+        .attrs = attrs,
+    };
+    return &blank->row;
+}
+
+/* Copies a blank row, flags and all */
+static struct row *
+blank_row_dup(const struct row *src)
+{
+    struct row *row = blank_row_new(*grid_row_blank_attrs(src));
+    row_copy_flags(row, src);
+    return row;
+}
+
+struct attributes *
+grid_row_blank_attrs(const struct row *row)
+{
+    xassert(row->blank);
+    return &((struct blank_row *)row)->attrs;
+}
+
+struct row *
+grid_row_blank(struct grid *grid, int abs_row, struct attributes attrs)
+{
+    struct row *old = grid->rows[abs_row];
+    struct row *row;
+
+    attrs.clean = 0;
+
+    if (old != NULL && old->blank && old->shared == 0) {
+        row = old;
+        *grid_row_blank_attrs(row) = attrs;
+    } else {
+        row = blank_row_new(attrs);
+
+        if (old != NULL) {
+            row->linebreak = old->linebreak;
+            row->prompt_marker = old->prompt_marker;
+            grid_row_free(grid, old);
+        }
+
+        grid->rows[abs_row] = row;
     }
 
-    return clone;
+    grid_row_dirty_all(row);
+    return row;
 }
 
-void
-grid_free(struct grid *grid)
+bool
+grid_row_blank_if_empty(struct grid *grid, int abs_row)
 {
-    if (grid == NULL)
-        return;
+    struct row *row = grid->rows[abs_row];
+    xassert(row != NULL);
+    xassert(row != grid->cur_row);
 
-    for (int r = 0; r < grid->num_rows; r++)
-        grid_row_free(grid->rows[r]);
+    if (row->compressed || row->shared > 0)
+        return false;
 
-    tll_foreach(grid->sixel_images, it) {
-        sixel_destroy(&it->item);
-        tll_remove(grid->sixel_images, it);
+    if (row->extra != NULL && row->extra->uri_ranges.count > 0)
+        return false;
+
+    /* Render state; the row is re-rendered when it is shown again */
+    struct attributes attrs = row->cells[0].attrs;
+    attrs.clean = 0;
+    attrs.confined = false;
+
+    if (attrs.selected || attrs.url)
+        return false;
+
+    for (int c = 0; c < grid->num_cols; c++) {
+        const struct cell *cell = &row->cells[c];
+
+        if (cell->wc != 0)
+            return false;
+
+        struct attributes cell_attrs = cell->attrs;
+        cell_attrs.clean = 0;
+        cell_attrs.confined = false;
+
+        if (memcmp(&cell_attrs, &attrs, sizeof(attrs)) != 0)
+            return false;
     }
 
-    free(grid->rows);
-    tll_free(grid->scroll_damage);
+    struct row *blank = blank_row_new(attrs);
+    row_copy_flags(blank, row);
+
+    grid_row_free(grid, row);
+    grid->rows[abs_row] = blank;
+    return true;
 }
 
-void
-grid_swap_row(struct grid *grid, int row_a, int row_b)
+struct row *
+grid_row_decompress(struct grid *grid, int abs_row)
 {
-    xassert(grid->offset >= 0);
-    xassert(row_a != row_b);
+    struct row *compressed = grid->rows[abs_row];
+    xassert(compressed != NULL);
+    xassert(compressed->compressed);
+    xassert(compressed->shared == 0);
 
-    int real_a = (grid->offset + row_a) & (grid->num_rows - 1);
-    int real_b = (grid->offset + row_b) & (grid->num_rows - 1);
+    struct row *row = grid_row_alloc(grid, false);
+    row->extra = compressed->extra;
+    row_copy(grid, row, compressed);
 
-    struct row *a = grid->rows[real_a];
-    struct row *b = grid->rows[real_b];
+    /* Blank rows are re-created by erasing, not by compress_scrollback() */
+    if (!compressed->blank)
+        grid->decompressed = true;
 
-    grid->rows[real_a] = b;
-    grid->rows[real_b] = a;
+    compressed_row_free(grid, compressed);
+    grid->rows[abs_row] = row;
+    return row;
+}
+
+const struct row *
+grid_row_peek(const struct grid *grid, int abs_row, struct row *scratch)
+{
+    const struct row *row = grid->rows[abs_row];
+
+    if (row == NULL || !row->compressed)
+        return row;
+
+    struct cell *cells = scratch->cells;
+    *scratch = *row;
+    scratch->cells = cells;
+    scratch->compressed = false;
+    scratch->blank = false;
+
+    if (row->blank)
+        blank_cells(cells, grid->num_cols, *grid_row_blank_attrs(row));
+    else
+        row_decode(compressed_row_data(grid, row), cells, grid->num_cols);
+    return scratch;
 }
 
 struct row *
-grid_row_alloc(int cols, bool initialize)
+grid_row_unshare(struct grid *grid, int abs_row)
 {
-    struct row *row = xmalloc(sizeof(*row));
-    row->dirty = false;
-    row->linebreak = false;
-    row->extra = NULL;
-    row->prompt_marker = false;
+    struct row *shared = grid->rows[abs_row];
+    xassert(shared != NULL);
+    xassert(shared->shared > 0);
 
-    if (initialize) {
-        row->cells = xcalloc(cols, sizeof(row->cells[0]));
-        for (size_t c = 0; c < cols; c++)
-            row->cells[c].attrs.clean = 1;
-    } else
-        row->cells = xmalloc(cols * sizeof(row->cells[0]));
+    struct row *row;
+
+    if (shared->blank)
+        row = blank_row_dup(shared);
+    else {
+        row = grid_row_alloc(grid, false);
+        row->extra = row_data_dup(shared->extra);
+        row_copy(grid, row, shared);
+
+        if (shared->compressed)
+            grid->decompressed = true;
+    }
 
+    shared->shared--;
+    grid->rows[abs_row] = row;
     return row;
 }
 
-void
-grid_row_free(struct row *row)
+/*
+ * Drops one reference to a row, and frees it if it was the last one.
+ * Rows in an arena of their own are left to row_arena_destroy().
+ */
+static void
+row_release(struct grid *grid, struct row *row, bool shared_arena)
 {
     if (row == NULL)
         return;
 
+    if (row->shared > 0) {
+        row->shared--;
+        return;
+    }
+
     grid_row_reset_extra(row);
-    free(row->extra);
-    free(row->cells);
-    free(row);
+    if (row->compressed)
+        compressed_row_free(grid, row);
+    else if (shared_arena)
+        row_arena_free(grid->arena, row);
 }
 
-void
-grid_resize_without_reflow(
-    struct grid *grid, int new_rows, int new_cols,
-    int old_screen_rows, int new_screen_rows)
+/* Whether a grid snapshot's 'abs_row' is one of its view rows */
+static bool
+snapshot_row_in_view(const struct grid *grid, int abs_row)
 {
-    struct row *const *old_grid = grid->rows;
-    const int old_rows = grid->num_rows;
-    const int old_cols = grid->num_cols;
+    return grid_row_wrap(grid, abs_row - grid->view) < grid->snapshot.view_rows;
+}
 
-    struct row **new_grid = xcalloc(new_rows, sizeof(new_grid[0]));
+/*
+ * Releases all rows, and the arena, in one go. Unless the arena is
+ * shared with a grid snapshot; then the grid's own rows are returned
+ * to it one by one.
+ */
+static void
+grid_free_rows(struct grid *grid, struct row *const *rows, int count)
+{
+    const bool shared_arena =
+        grid->arena != NULL && grid->arena->ref_count > 1;
 
-    tll(struct sixel) untranslated_sixels = tll_init();
-    tll_foreach(grid->sixel_images, it)
-        tll_push_back(untranslated_sixels, it->item);
-    tll_free(grid->sixel_images);
+    for (int r = 0; r < count; r++)
+        row_release(grid, rows[r], shared_arena);
 
-    int new_offset = 0;
+    row_arena_destroy(grid->arena);
+    grid->arena = NULL;
+}
 
-    /* Copy old lines, truncating them if old rows were longer */
-    for (int r = 0, n = min(old_screen_rows, new_screen_rows); r < n; r++) {
-        const int old_row_idx = (grid->offset + r) & (old_rows - 1);
-        const int new_row_idx = (new_offset + r) & (new_rows - 1);
+/* Like grid_free_rows(), but for the rows held by a grid snapshot */
+static void
+grid_free_snapshot_rows(struct grid *grid)
+{
+    const bool shared_arena =
+        grid->arena != NULL && grid->arena->ref_count > 1;
 
-        const struct row *old_row = old_grid[old_row_idx];
-        xassert(old_row != NULL);
+    for (int r = 0; r < grid->snapshot.view_rows; r++)
+        row_release(grid, grid->rows[grid_row_wrap(grid, grid->view + r)], shared_arena);
 
-        struct row *new_row = grid_row_alloc(new_cols, false);
-        new_grid[new_row_idx] = new_row;
+    const int cursor_row = grid_row_absolute(grid, grid->cursor.point.row);
+    if (!snapshot_row_in_view(grid, cursor_row))
+        row_release(grid, grid->rows[cursor_row], shared_arena);
 
-        memcpy(new_row->cells,
-               old_row->cells,
-               sizeof(struct cell) * min(old_cols, new_cols));
+    row_arena_destroy(grid->arena);
+    grid->arena = NULL;
+}
 
-        new_row->dirty = old_row->dirty;
-        new_row->linebreak = false;
-        new_row->prompt_marker = old_row->prompt_marker;
+/*
+ * Reclaimer
+ *
+ * Freeing a large scrollback means free:ing every compressed row, and
+ * every row's URI ranges, and all the arena slabs. Instead of stalling
+ * the main thread (and thus all windows of a 'foot --server'
+ * instance), grid_free() and grid_free_scrollback() detach the rows,
+ * and hand them over to a background thread, shared by all
+ * terminals in the process.
+ *
+ * Compressed rows are free:d *without* releasing their spilled data;
+ * the spill file is either destroyed (along with the rows), or
+ * cleared, by the caller.
+ */
+struct grid_reclaimer {
+    size_t ref_count;
+    thrd_t thread;
+    mtx_t lock;
+    cnd_t cond;
+    bool quit;
 
-        if (new_cols > old_cols) {
-            /* Clear "new" columns */
-            memset(&new_row->cells[old_cols], 0,
-                   sizeof(struct cell) * (new_cols - old_cols));
-            new_row->dirty = true;
-        } else if (old_cols > new_cols) {
-            /* Make sure we don't cut a multi-column character in two */
-            for (int i = new_cols; i > 0 && old_row->cells[i].wc > CELL_SPACER; i--)
-                new_row->cells[i - 1].wc = 0;
-        }
+    /* Detached rows; only 'rows', 'num_rows', 'arena' and 'spill' are set */
+    tll(struct grid *) queue;
+};
 
-        /* Map sixels on current "old" row to current "new row" */
-        tll_foreach(untranslated_sixels, it) {
-            if (it->item.pos.row != old_row_idx)
-                continue;
+static struct grid_reclaimer *reclaimer = NULL;
 
-            struct sixel sixel = it->item;
-            sixel.pos.row = new_row_idx;
+static void
+reclaim(struct grid *garbage)
+{
+    for (int r = 0; r < garbage->num_rows; r++) {
+        struct row *row = garbage->rows[r];
+        if (row == NULL)
+            continue;
 
-            if (sixel.pos.col < new_cols)
-                tll_push_back(grid->sixel_images, sixel);
-            else
-                sixel_destroy(&it->item);
-            tll_remove(untranslated_sixels, it);
-        }
+        xassert(row->shared == 0);
+        grid_row_reset_extra(row);
 
-        /* Copy URI ranges, truncating them if necessary */
-        const struct row_data *old_extra = old_row->extra;
-        if (old_extra == NULL)
-            continue;
+        if (row->compressed)
+            free(row);
+    }
 
-        ensure_row_has_extra_data(new_row);
-        struct row_data *new_extra = new_row->extra;
+    row_arena_destroy(garbage->arena);
+    spill_file_destroy(garbage->spill);
+    free(garbage->rows);
+    free(garbage);
+}
 
-        uri_range_ensure_size(new_extra, old_extra->uri_ranges.count);
+static int
+reclaimer_thread(void *data)
+{
+    struct grid_reclaimer *rc = data;
 
-        for (size_t i = 0; i < old_extra->uri_ranges.count; i++) {
-            const struct row_uri_range *range = &old_extra->uri_ranges.v[i];
+    sigset_t mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_SETMASK, &mask, NULL);
+
+    if (pthread_setname_np(pthread_self(), "foot:reclaim") < 0)
+        LOG_ERRNO("reclaimer: failed to set process title");
+
+    /*
+     * Not SCHED_IDLE; the rows are free:d with free(), i.e. while
+     * holding the allocator's locks. A starved idle thread holding
+     * them would block the main thread's malloc() instead.
+     * SCHED_BATCH still gets its fair share of the CPU, but doesn't
+     * preempt the main thread when woken.
+     */
+#if defined(SCHED_BATCH)
+    const struct sched_param param = {.sched_priority = 0};
+    int err = pthread_setschedparam(pthread_self(), SCHED_BATCH, &param);
+    if (err != 0) {
+        errno = err;
+        LOG_ERRNO("reclaimer: failed to set scheduling policy");
+    }
+#endif
+
+    mtx_lock(&rc->lock);
+
+    while (true) {
+        while (tll_length(rc->queue) == 0 && !rc->quit)
+            cnd_wait(&rc->cond, &rc->lock);
+
+        /* Drain the queue before quitting */
+        if (tll_length(rc->queue) == 0)
+            break;
+
+        struct grid *garbage = tll_pop_front(rc->queue);
+
+        mtx_unlock(&rc->lock);
+        reclaim(garbage);
+        mtx_lock(&rc->lock);
+    }
+
+    mtx_unlock(&rc->lock);
+    return 0;
+}
+
+struct grid_reclaimer *
+grid_reclaimer_ref(void)
+{
+    if (reclaimer != NULL) {
+        reclaimer->ref_count++;
+        return reclaimer;
+    }
+
+    struct grid_reclaimer *rc = xmalloc(sizeof(*rc));
+    *rc = (struct grid_reclaimer){.ref_count = 1, .queue = tll_init()};
+
+    if (mtx_init(&rc->lock, mtx_plain) != thrd_success) {
+        LOG_ERR("failed to instantiate reclaimer mutex");
+        goto err_free;
+    }
+
+    if (cnd_init(&rc->cond) != thrd_success) {
+        LOG_ERR("failed to instantiate reclaimer condition variable");
+        goto err_mtx;
+    }
+
+    int ret = thrd_create(&rc->thread, &reclaimer_thread, rc);
+    if (ret != thrd_success) {
+        LOG_ERR("failed to create reclaimer thread: %s (%d)",
+                thrd_err_as_string(ret), ret);
+        goto err_cnd;
+    }
+
+    reclaimer = rc;
+    return rc;
+
+err_cnd:
+    cnd_destroy(&rc->cond);
+err_mtx:
+    mtx_destroy(&rc->lock);
+err_free:
+    free(rc);
+    return NULL;
+}
+
+void
+grid_reclaimer_unref(struct grid_reclaimer *rc)
+{
+    if (rc == NULL)
+        return;
+
+    xassert(rc == reclaimer);
+    xassert(rc->ref_count > 0);
+
+    if (--rc->ref_count > 0)
+        return;
+
+    mtx_lock(&rc->lock);
+    rc->quit = true;
+    cnd_signal(&rc->cond);
+    mtx_unlock(&rc->lock);
+
+    thrd_join(rc->thread, NULL);
+
+    xassert(tll_length(rc->queue) == 0);
+    cnd_destroy(&rc->cond);
+    mtx_destroy(&rc->lock);
+    free(rc);
+    reclaimer = NULL;
+}
+
+/* Returns true if the grid's rows can be free:d by the reclaimer */
+static bool
+reclaimer_can_take(const struct grid *grid)
+{
+    /* Rows in a shared arena may be referenced by a grid snapshot */
+    return reclaimer != NULL &&
+           grid->arena != NULL && grid->arena->ref_count == 1;
+}
+
+/* Hands the rows, the arena and (optionally) the spill file over to the reclaimer */
+static void
+reclaimer_take(struct row **rows, int num_rows, struct row_arena *arena,
+               struct spill_file *spill)
+{
+    xassert(reclaimer != NULL);
+
+    struct grid *garbage = xmalloc(sizeof(*garbage));
+    *garbage = (struct grid){
+        .num_rows = num_rows,
+        .rows = rows,
+        .arena = arena,
+        .spill = spill,
+    };
+
+    mtx_lock(&reclaimer->lock);
+    tll_push_back(reclaimer->queue, garbage);
+    cnd_signal(&reclaimer->cond);
+    mtx_unlock(&reclaimer->lock);
+}
+
+/*
+ * “sb” (scrollback relative) coordinates
+ *
+ * The scrollback relative row number 0 is the *first*, and *oldest*
+ * row in the scrollback history (and thus the *first* row to be
+ * scrolled out). Thus, a higher number means further *down* in the
+ * scrollback, with the *highest* number being at the bottom of the
+ * screen, where new input appears.
+ */
+
+int
+grid_row_abs_to_sb(const struct grid *grid, int screen_rows, int abs_row)
+{
+    const int scrollback_start = grid->offset + screen_rows;
+    int rebased_row = abs_row - scrollback_start + grid->num_rows;
+
+    rebased_row = grid_row_wrap(grid, rebased_row);
+    return rebased_row;
+}
+
+int grid_row_sb_to_abs(const struct grid *grid, int screen_rows, int sb_rel_row)
+{
+    const int scrollback_start = grid->offset + screen_rows;
+    int abs_row = sb_rel_row + scrollback_start;
+
+    abs_row = grid_row_wrap(grid, abs_row);
+    return abs_row;
+}
+
+int
+grid_sb_start_ignore_uninitialized(const struct grid *grid, int screen_rows)
+{
+    if (grid->snapshot.view_rows > 0) {
+        /* The snapshot doesn't hold the scrollback (see grid_snapshot()) */
+        xassert(grid->snapshot.sb_start >= 0);
+        return grid->snapshot.sb_start;
+    }
+
+    int scrollback_start = grid->offset + screen_rows;
+    scrollback_start = grid_row_wrap(grid, scrollback_start);
+
+    while (grid->rows[scrollback_start] == NULL) {
+        scrollback_start++;
+        scrollback_start = grid_row_wrap(grid, scrollback_start);
+    }
+
+    return scrollback_start;
+}
+
+int
+grid_row_abs_to_sb_precalc_sb_start(const struct grid *grid, int sb_start,
+                                    int abs_row)
+{
+    int rebased_row = abs_row - sb_start + grid->num_rows;
+    rebased_row = grid_row_wrap(grid, rebased_row);
+    return rebased_row;
+}
+
+int
+grid_row_sb_to_abs_precalc_sb_start(const struct grid *grid, int sb_start,
+                                    int sb_rel_row)
+{
+    int abs_row = sb_rel_row + sb_start;
+    abs_row = grid_row_wrap(grid, abs_row);
+    return abs_row;
+}
+
+static void
+ensure_row_has_extra_data(struct row *row)
+{
+    if (row->extra == NULL)
+        row->extra = xcalloc(1, sizeof(*row->extra));
+}
+
+static void
+verify_no_overlapping_uris(const struct row_data *extra)
+{
+#if defined(_DEBUG)
+    for (size_t i = 0; i < extra->uri_ranges.count; i++) {
+        const struct row_uri_range *r1 = &extra->uri_ranges.v[i];
+
+        for (size_t j = i + 1; j < extra->uri_ranges.count; j++) {
+            const struct row_uri_range *r2 = &extra->uri_ranges.v[j];
+            xassert(r1 != r2);
+
+            if ((r1->start <= r2->start && r1->end >= r2->start) ||
+                (r1->start <= r2->end && r1->end >= r2->end))
+            {
+                BUG("OSC-8 URI overlap: %s: %d-%d: %s: %d-%d",
+                    r1->uri, r1->start, r1->end,
+                    r2->uri, r2->start, r2->end);
+            }
+        }
+    }
+#endif
+}
+
+static void
+verify_uris_are_sorted(const struct row_data *extra)
+{
+#if defined(_DEBUG)
+    const struct row_uri_range *last = NULL;
+
+    for (size_t i = 0; i < extra->uri_ranges.count; i++) {
+        const struct row_uri_range *r = &extra->uri_ranges.v[i];
+
+        if (last != NULL) {
+            if (last->start >= r->start || last->end >= r->end) {
+                BUG("OSC-8 URI not sorted correctly: "
+                    "%s: %d-%d came before %s: %d-%d",
+                    last->uri, last->start, last->end,
+                    r->uri, r->start, r->end);
+            }
+        }
+
+        last = r;
+    }
+#endif
+}
+
+static void
+uri_range_ensure_size(struct row_data *extra, uint32_t count_to_add)
+{
+    if (extra->uri_ranges.count + count_to_add > extra->uri_ranges.size) {
+        extra->uri_ranges.size = extra->uri_ranges.count + count_to_add;
+        extra->uri_ranges.v = xrealloc(
+            extra->uri_ranges.v,
+            extra->uri_ranges.size * sizeof(extra->uri_ranges.v[0]));
+    }
+
+    xassert(extra->uri_ranges.count + count_to_add <= extra->uri_ranges.size);
+}
+
+/*
+ * Be careful! This function may xrealloc() the URI range vector, thus
+ * invalidating pointers into it.
+ */
+static void
+uri_range_insert(struct row_data *extra, size_t idx, int start, int end,
+                 uint64_t id, const char *uri)
+{
+    uri_range_ensure_size(extra, 1);
+
+    xassert(idx <= extra->uri_ranges.count);
+
+    const size_t move_count = extra->uri_ranges.count - idx;
+    memmove(&extra->uri_ranges.v[idx + 1],
+            &extra->uri_ranges.v[idx],
+            move_count * sizeof(extra->uri_ranges.v[0]));
+
+    extra->uri_ranges.count++;
+    extra->uri_ranges.v[idx] = (struct row_uri_range){
+        .start = start,
+        .end = end,
+        .id = id,
+        .uri = xstrdup(uri),
+    };
+}
+
+static void
+uri_range_append_no_strdup(struct row_data *extra, int start, int end,
+                           uint64_t id, char *uri)
+{
+    uri_range_ensure_size(extra, 1);
+    extra->uri_ranges.v[extra->uri_ranges.count++] = (struct row_uri_range){
+        .start = start,
+        .end = end,
+        .id = id,
+        .uri = uri,
+    };
+}
+
+static void
+uri_range_append(struct row_data *extra, int start, int end, uint64_t id,
+                 const char *uri)
+{
+    uri_range_append_no_strdup(extra, start, end, id, xstrdup(uri));
+}
+
+static void
+uri_range_delete(struct row_data *extra, size_t idx)
+{
+    xassert(idx < extra->uri_ranges.count);
+    grid_row_uri_range_destroy(&extra->uri_ranges.v[idx]);
+
+    const size_t move_count = extra->uri_ranges.count - idx - 1;
+    memmove(&extra->uri_ranges.v[idx],
+            &extra->uri_ranges.v[idx + 1],
+            move_count * sizeof(extra->uri_ranges.v[0]));
+    extra->uri_ranges.count--;
+}
+
+/* Shares 'row' with a snapshot, or gives it a copy, if that's not possible */
+static struct row *
+snapshot_share_row(struct grid *clone, struct row *row)
+{
+    if (row == NULL)
+        return NULL;
+
+    if (likely(row->shared < UINT8_MAX)) {
+        row->shared++;
+        return row;
+    }
+
+    /* Too many references; give the snapshot a copy of its own */
+    if (row->blank)
+        return blank_row_dup(row);
+
+    struct row *copy = grid_row_alloc(clone, false);
+    copy->extra = row_data_dup(row->extra);
+    row_copy(clone, copy, row);
+
+    if (row->compressed)
+        clone->decompressed = true;
+    return copy;
+}
+
+struct grid *
+grid_snapshot(struct grid *grid, int view_rows)
+{
+    xassert(view_rows > 0);
+
+    struct grid *clone = xmalloc(sizeof(*clone));
+    clone->num_rows = grid->num_rows;
+    clone->num_cols = grid->num_cols;
+    clone->offset = grid->offset;
+    clone->view = grid->view;
+    clone->cursor = grid->cursor;
+    clone->saved_cursor = grid->saved_cursor;
+    clone->kitty_kbd = grid->kitty_kbd;
+    clone->rows = xcalloc(grid->num_rows, sizeof(clone->rows[0]));
+    clone->cur_row = NULL;
+    clone->arena = grid->arena != NULL ? row_arena_ref(grid->arena) : NULL;
+    clone->decompressed = false;
+    clone->spill = grid->spill != NULL ? spill_file_ref(grid->spill) : NULL;
+    clone->reflow = NULL;
+    clone->snapshot.view_rows = view_rows;
+
+    /* Only used by the scrollback position indicator */
+    clone->snapshot.sb_start = grid->view != grid->offset
+        ? grid_sb_start_ignore_uninitialized(grid, view_rows)
+        : -1;
+
+    memset(&clone->scroll_damage, 0, sizeof(clone->scroll_damage));
+    memset(&clone->sixel_images, 0, sizeof(clone->sixel_images));
+
+    tll_foreach(grid->scroll_damage, it)
+        tll_push_back(clone->scroll_damage, it->item);
+
+    /*
+     * Share the view rows, and the cursor row (always rendered), with
+     * the snapshot. Shared rows are copied by grid_row_abs(), by
+     * whichever grid accesses them first. Thus, only the rows
+     * actually modified (by the terminal), or rendered (from the
+     * snapshot) are ever copied.
+     *
+     * The scrollback is left out; it is never shown from the
+     * snapshot, and leaving it out keeps the cost of a snapshot
+     * independent of the scrollback size.
+     */
+    for (int r = 0; r < view_rows; r++) {
+        const int idx = grid_row_wrap(grid, grid->view + r);
+        clone->rows[idx] = snapshot_share_row(clone, grid->rows[idx]);
+    }
+
+    const int cursor_row = grid_row_absolute(grid, grid->cursor.point.row);
+    if (!snapshot_row_in_view(clone, cursor_row))
+        clone->rows[cursor_row] = snapshot_share_row(clone, grid->rows[cursor_row]);
+
+    /* The current row is written to directly, not via grid_row_abs() */
+    if (grid->cur_row != NULL) {
+        grid->cur_row = grid_row_abs(
+            grid, grid_row_absolute(grid, grid->cursor.point.row));
+    }
+
+    tll_foreach(grid->sixel_images, it) {
+        int original_width = it->item.original.width;
+        int original_height = it->item.original.height;
+        pixman_image_t *original_pix = it->item.original.pix;
+        pixman_format_code_t original_pix_fmt = pixman_image_get_format(original_pix);
+        int original_stride = stride_for_format_and_width(original_pix_fmt, original_width);
+
+        size_t original_size = original_stride * original_height;
+        void *new_original_data = xmalloc(original_size);
+        memcpy(new_original_data, it->item.original.data, original_size);
+
+        pixman_image_t *new_original_pix = pixman_image_create_bits_no_clear(
+            original_pix_fmt, original_width, original_height,
+            new_original_data, original_stride);
+
+        void *new_scaled_data = NULL;
+        pixman_image_t *new_scaled_pix = NULL;
+        int scaled_width = -1;
+        int scaled_height = -1;
+
+        if (it->item.scaled.data != NULL) {
+            scaled_width = it->item.scaled.width;
+            scaled_height = it->item.scaled.height;
+
+            pixman_image_t *scaled_pix = it->item.scaled.pix;
+            pixman_format_code_t scaled_pix_fmt = pixman_image_get_format(scaled_pix);
+            int scaled_stride = stride_for_format_and_width(scaled_pix_fmt, scaled_width);
+
+            size_t scaled_size = scaled_stride * scaled_height;
+            new_scaled_data = xmalloc(scaled_size);
+            memcpy(new_scaled_data, it->item.scaled.data, scaled_size);
+
+            new_scaled_pix = pixman_image_create_bits_no_clear(
+                scaled_pix_fmt, scaled_width, scaled_height, new_scaled_data,
+                scaled_stride);
+        }
+
+        struct sixel six = {
+            .pix = (it->item.pix == it->item.original.pix
+                    ? new_original_pix
+                    : (it->item.pix == it->item.scaled.pix
+                       ? new_scaled_pix
+                       : NULL)),
+            .width = it->item.width,
+            .height = it->item.height,
+            .rows = it->item.rows,
+            .cols = it->item.cols,
+            .pos = it->item.pos,
+            .opaque = it->item.opaque,
+            .cell_width = it->item.cell_width,
+            .cell_height = it->item.cell_height,
+            .original = {
+                .data = new_original_data,
+                .pix = new_original_pix,
+                .width = original_width,
+                .height = original_height,
+            },
+            .scaled = {
+                .data = new_scaled_data,
+                .pix = new_scaled_pix,
+                .width = scaled_width,
+                .height = scaled_height,
+            },
+        };
+
+        tll_push_back(clone->sixel_images, six);
+    }
+
+    return clone;
+}
+
+static void reflow_discard(struct grid *grid, bool background);
+
+void
+grid_free(struct grid *grid)
+{
+    if (grid == NULL)
+        return;
+
+    if (grid->snapshot.view_rows > 0) {
+        xassert(grid->reflow == NULL);
+        grid_free_snapshot_rows(grid);
+        spill_file_destroy(grid->spill);
+    } else if (reclaimer_can_take(grid)) {
+        /* Spilled data is dropped along with the spill file */
+        reflow_discard(grid, true);
+        reclaimer_take(grid->rows, grid->num_rows, grid->arena, grid->spill);
+        grid->rows = NULL;
+        grid->arena = NULL;
+    } else {
+        grid_reflow_discard(grid);
+        grid_free_rows(grid, grid->rows, grid->num_rows);
+        spill_file_destroy(grid->spill);
+    }
+
+    grid->spill = NULL;
+
+    tll_foreach(grid->sixel_images, it) {
+        sixel_destroy(&it->item);
+        tll_remove(grid->sixel_images, it);
+    }
+
+    free(grid->rows);
+    tll_free(grid->scroll_damage);
+}
+
+void
+grid_swap_row(struct grid *grid, int row_a, int row_b)
+{
+    xassert(grid->offset >= 0);
+    xassert(row_a != row_b);
+
+    int real_a = grid_row_wrap(grid, grid->offset + row_a);
+    int real_b = grid_row_wrap(grid, grid->offset + row_b);
+
+    struct row *a = grid->rows[real_a];
+    struct row *b = grid->rows[real_b];
+
+    grid->rows[real_a] = b;
+    grid->rows[real_b] = a;
+}
+
+struct row *
+grid_row_alloc(struct grid *grid, bool initialize)
+{
+    if (grid->arena == NULL)
+        grid->arena = row_arena_new(grid->num_cols);
+
+    xassert(grid->arena->cols == grid->num_cols);
+    return row_arena_alloc(grid->arena, initialize);
+}
+
+void
+grid_row_free(struct grid *grid, struct row *row)
+{
+    if (row == NULL)
+        return;
+
+    if (row->shared > 0) {
+        /* Still referenced by another grid */
+        row->shared--;
+        return;
+    }
+
+    grid_row_reset_extra(row);
+
+    if (row->compressed)
+        compressed_row_free(grid, row);
+    else
+        row_arena_free(grid->arena, row);
+}
+
+void
+grid_resize_without_reflow(
+    struct grid *grid, int new_rows, int new_cols,
+    int old_screen_rows, int new_screen_rows)
+{
+    /* Finish the previous resize's reflow first */
+    grid_reflow_scrollback(grid, NULL, old_screen_rows, -1);
+
+    struct row *const *old_grid = grid->rows;
+    const int old_rows = grid->num_rows;
+    const int old_cols = grid->num_cols;
+
+    struct row **new_grid = xcalloc(new_rows, sizeof(new_grid[0]));
+    struct row_arena *new_arena = row_arena_new(new_cols);
+
+    tll(struct sixel) untranslated_sixels = tll_init();
+    tll_foreach(grid->sixel_images, it)
+        tll_push_back(untranslated_sixels, it->item);
+    tll_free(grid->sixel_images);
+
+    int new_offset = 0;
+
+    /* Copy old lines, truncating them if old rows were longer */
+    for (int r = 0, n = min(old_screen_rows, new_screen_rows); r < n; r++) {
+        const int old_row_idx = _grid_row_wrap(grid->offset + r, old_rows);
+        const int new_row_idx = _grid_row_wrap(new_offset + r, new_rows);
+
+        const struct row *old_row = grid_row_abs(grid, old_row_idx);
+        xassert(old_row != NULL);
+
+        struct row *new_row = row_arena_alloc(new_arena, false);
+        new_grid[new_row_idx] = new_row;
+
+        memcpy(new_row->cells,
+               old_row->cells,
+               sizeof(struct cell) * min(old_cols, new_cols));
+
+        new_row->dirty = old_row->dirty;
+        new_row->dirty_start = old_row->dirty_start;
+        new_row->dirty_end = old_row->dirty_end;
+        new_row->linebreak = false;
+        new_row->prompt_marker = old_row->prompt_marker;
+
+        if (new_cols > old_cols) {
+            /* Clear "new" columns */
+            memset(&new_row->cells[old_cols], 0,
+                   sizeof(struct cell) * (new_cols - old_cols));
+            grid_row_dirty_range(new_row, old_cols, new_cols - 1);
+        } else if (old_cols > new_cols) {
+            /* Make sure we don't cut a multi-column character in two */
+            for (int i = new_cols; i > 0 && old_row->cells[i].wc > CELL_SPACER; i--)
+                new_row->cells[i - 1].wc = 0;
+        }
+
+        /* Map sixels on current "old" row to current "new row" */
+        tll_foreach(untranslated_sixels, it) {
+            if (it->item.pos.row != old_row_idx)
+                continue;
+
+            struct sixel sixel = it->item;
+            sixel.pos.row = new_row_idx;
+
+            if (sixel.pos.col < new_cols)
+                tll_push_back(grid->sixel_images, sixel);
+            else
+                sixel_destroy(&it->item);
+            tll_remove(untranslated_sixels, it);
+        }
+
+        /* Copy URI ranges, truncating them if necessary */
+        const struct row_data *old_extra = old_row->extra;
+        if (old_extra == NULL)
+            continue;
+
+        ensure_row_has_extra_data(new_row);
+        struct row_data *new_extra = new_row->extra;
+
+        uri_range_ensure_size(new_extra, old_extra->uri_ranges.count);
+
+        for (size_t i = 0; i < old_extra->uri_ranges.count; i++) {
+            const struct row_uri_range *range = &old_extra->uri_ranges.v[i];
+
+            if (range->start >= new_cols) {
+                /* The whole range is truncated */
+                continue;
+            }
+
+            const int start = range->start;
+            const int end = min(range->end, new_cols - 1);
+            uri_range_append(new_extra, start, end, range->id, range->uri);
+        }
+    }
+
+    /* Clear "new" lines */
+    for (int r = min(old_screen_rows, new_screen_rows); r < new_screen_rows; r++) {
+        struct row *new_row = row_arena_alloc(new_arena, false);
+        new_grid[_grid_row_wrap(new_offset + r, new_rows)] = new_row;
+
+        memset(new_row->cells, 0, sizeof(struct cell) * new_cols);
+        grid_row_dirty_all(new_row);
+    }
+
+#if defined(_DEBUG)
+    for (size_t r = 0; r < new_rows; r++) {
+        const struct row *row = new_grid[r];
+
+        if (row == NULL)
+            continue;
+        if (row->extra == NULL)
+            continue;
+
+        verify_no_overlapping_uris(row->extra);
+        verify_uris_are_sorted(row->extra);
+    }
+#endif
+
+    /* Free old grid */
+    grid_free_rows(grid, old_grid, grid->num_rows);
+    free(grid->rows);
+
+    grid->rows = new_grid;
+    grid->arena = new_arena;
+    grid->num_rows = new_rows;
+    grid->num_cols = new_cols;
+
+    grid->view = grid->offset = new_offset;
+
+    /* Keep cursor at current position, but clamp to new dimensions */
+    struct coord cursor = grid->cursor.point;
+    if (cursor.row == old_screen_rows - 1) {
+        /* 'less' breaks if the cursor isn't at the bottom */
+        cursor.row = new_screen_rows - 1;
+    }
+    cursor.row = min(cursor.row, new_screen_rows - 1);
+    cursor.col = min(cursor.col, new_cols - 1);
+    grid->cursor.point = cursor;
+
+    struct coord saved_cursor = grid->saved_cursor.point;
+    if (saved_cursor.row == old_screen_rows - 1)
+        saved_cursor.row = new_screen_rows - 1;
+    saved_cursor.row = min(saved_cursor.row, new_screen_rows - 1);
+    saved_cursor.col = min(saved_cursor.col, new_cols - 1);
+    grid->saved_cursor.point = saved_cursor;
+
+    grid->cur_row = new_grid[_grid_row_wrap(grid->offset + cursor.row, new_rows)];
+    xassert(grid->cur_row != NULL);
+
+    grid->cursor.lcf = false;
+    grid->saved_cursor.lcf = false;
+
+    /* Free sixels we failed to "map" to the new grid */
+    tll_foreach(untranslated_sixels, it)
+        sixel_destroy(&it->item);
+    tll_free(untranslated_sixels);
+
+#if defined(_DEBUG)
+    for (int r = 0; r < new_screen_rows; r++)
+        grid_row_in_view(grid, r);
+#endif
+}
+
+static void
+reflow_uri_range_start(struct row_uri_range *range, struct row *new_row,
+                       int new_col_idx)
+{
+    ensure_row_has_extra_data(new_row);
+    uri_range_append_no_strdup
+        (new_row->extra, new_col_idx, -1, range->id, range->uri);
+    range->uri = NULL;
+}
+
+static void
+reflow_uri_range_end(struct row_uri_range *range, struct row *new_row,
+                     int new_col_idx)
+{
+    struct row_data *extra = new_row->extra;
+    xassert(extra->uri_ranges.count > 0);
+
+    struct row_uri_range *new_range =
+        &extra->uri_ranges.v[extra->uri_ranges.count - 1];
+
+    xassert(new_range->id == range->id);
+    xassert(new_range->end < 0);
+    new_range->end = new_col_idx;
+}
+
+/* Reflow everything right away, if less than this would be left */
+#define REFLOW_LAZY_MIN_ROWS 1024
+
+/* Rows in 'from' are reflowed into 'to' */
+struct reflow {
+    struct grid *from;
+    struct grid *to;
+
+    struct row *new_row;
+    int new_row_idx;
+    int new_col_idx;
+
+    /* Sorted tracking points, terminated by a {-1, -1} point */
+    struct coord **next_tp;
+
+    /*
+     * Set when reflowing in parallel (see reflow_rows_parallel()). The
+     * old grid is then shared, and must not be modified; compressed
+     * rows are decoded into 'scratch', URI ranges are copied to
+     * 'scratch_extra', and reflowed rows are not free:d. Furthermore,
+     * 'to' is grown as needed, up to 'max_rows' rows.
+     */
+    struct row *scratch;
+    struct row_data *scratch_extra;
+    int max_rows;
+};
+
+/*
+ * Copies the URI ranges of a row in a shared old grid. Reflowing
+ * consumes (steals, or frees) the URIs of the ranges it moves.
+ */
+static struct row_data *
+reflow_copy_uri_ranges(struct row_data *copy, const struct row_data *extra)
+{
+    xassert(copy->uri_ranges.count == 0);
+    uri_range_ensure_size(copy, extra->uri_ranges.count);
+
+    for (uint32_t i = 0; i < extra->uri_ranges.count; i++) {
+        const struct row_uri_range *range = &extra->uri_ranges.v[i];
+        uri_range_append(copy, range->start, range->end, range->id, range->uri);
+    }
+
+    return copy;
+}
+
+/* Grows a reflow target grid that hasn't wrapped around yet */
+static void
+reflow_grow(struct grid *to, int max_rows)
+{
+    const int old_size = to->num_rows;
+    const int new_size = min(2 * old_size, max_rows);
+
+    to->rows = xrealloc(to->rows, new_size * sizeof(to->rows[0]));
+    memset(&to->rows[old_size], 0, (new_size - old_size) * sizeof(to->rows[0]));
+    to->num_rows = new_size;
+}
+
+static struct row *
+_line_wrap(struct grid *to, struct row *row, int *row_idx, int *col_idx)
+{
+    *col_idx = 0;
+    *row_idx = grid_row_wrap(to, *row_idx + 1);
+
+    struct row *new_row = to->rows[*row_idx];
+
+    if (new_row == NULL) {
+        /* Scrollback not yet full, allocate a completely new row */
+        new_row = grid_row_alloc(to, false);
+        to->rows[*row_idx] = new_row;
+    } else {
+        /* Scrollback is full, need to reuse a row */
+        if (new_row->blank) {
+            /* No cells to re-use (see reflow_row()) */
+            grid_row_free(to, new_row);
+            new_row = grid_row_alloc(to, false);
+            to->rows[*row_idx] = new_row;
+        }
+
+        grid_row_reset_extra(new_row);
+        new_row->linebreak = false;
+        new_row->prompt_marker = false;
+
+        tll_foreach(to->sixel_images, it) {
+            if (it->item.pos.row == *row_idx) {
+                sixel_destroy(&it->item);
+                tll_remove(to->sixel_images, it);
+            }
+        }
+
+        /*
+         * TODO: detect if the reused row is covered by the
+         * selection. Of so, cancel the selection. The problem: we
+         * don’t know if we’ve translated the selection coordinates
+         * yet.
+         */
+    }
+
+    struct row_data *extra = row->extra;
+    if (extra == NULL)
+        return new_row;
+
+    /*
+     * URI ranges are per row. Thus, we need to ‘close’ the still-open
+     * ranges on the previous row, and re-open them on the
+     * next/current row.
+     */
+    if (extra->uri_ranges.count > 0) {
+        struct row_uri_range *range =
+            &extra->uri_ranges.v[extra->uri_ranges.count - 1];
+
+        if (range->end < 0) {
+
+            /* Terminate URI range on the previous row */
+            range->end = to->num_cols - 1;
+
+            /* Open a new range on the new/current row */
+            ensure_row_has_extra_data(new_row);
+            uri_range_append(new_row->extra, 0, -1, range->id, range->uri);
+        }
+    }
+
+    return new_row;
+}
+
+/*
+ * Reflows a single row, at 'old_row_idx' in the old grid, and frees
+ * it. 'last' is true for the last (newest) row being reflowed.
+ */
+static void
+reflow_row(struct reflow *rf, int old_row_idx, bool last)
+{
+    struct grid *from = rf->from;
+    struct grid *to = rf->to;
+
+    const int old_cols = from->num_cols;
+    const int new_cols = to->num_cols;
+
+    struct row *new_row = rf->new_row;
+    int new_row_idx = rf->new_row_idx;
+    int new_col_idx = rf->new_col_idx;
+    struct coord **next_tp = rf->next_tp;
+
+    /* Unallocated (empty) rows we can simply skip */
+    const struct row *old_row = from->rows[old_row_idx];
+    if (old_row == NULL)
+        return;
+
+    /* Blank rows have no cells to copy, unless tracking points need them */
+    const bool blank = old_row->blank && (*next_tp)->row != old_row_idx;
+
+    if (!blank) {
+        old_row = rf->scratch != NULL
+            ? grid_row_peek(from, old_row_idx, rf->scratch)
+            : grid_row_abs(from, old_row_idx);
+    }
+
+    /* Map sixels on current "old" row to current "new row" */
+    tll_foreach(from->sixel_images, it) {
+        if (it->item.pos.row != old_row_idx)
+            continue;
+
+        struct sixel sixel = it->item;
+        sixel.pos.row = new_row_idx;
+
+        tll_push_back(to->sixel_images, sixel);
+        tll_remove(from->sixel_images, it);
+    }
+
+#define line_wrap()                                                 \
+    do {                                                            \
+        if (unlikely(new_row_idx + 1 == to->num_rows &&             \
+                     to->num_rows < rf->max_rows))                  \
+            reflow_grow(to, rf->max_rows);                          \
+        new_row = _line_wrap(                                       \
+            to, new_row, &new_row_idx, &new_col_idx);               \
+    } while (0)
+
+    /* Find last non-empty cell */
+    int col_count = 0;
+    for (int c = old_cols - 1; !blank && c >= 0; c--) {
+        const struct cell *cell = &old_row->cells[c];
+        if (!(cell->wc == 0 || cell->wc == CELL_SPACER)) {
+            col_count = c + 1;
+            break;
+        }
+    }
+
+    if (!old_row->linebreak && col_count > 0) {
+        /* Don’t truncate logical lines */
+        col_count = old_cols;
+    }
+
+    xassert(col_count >= 0 && col_count <= old_cols);
+
+    /* Do we have a (at least one) tracking point on this row */
+    struct coord *tp;
+    if (unlikely((*next_tp)->row == old_row_idx)) {
+        tp = *next_tp;
+
+        /* Find the *last* tracking point on this row */
+        struct coord *last_on_row = tp;
+        for (struct coord **iter = next_tp; (*iter)->row == old_row_idx; iter++)
+            last_on_row = *iter;
+
+        /* And make sure its end point is included in the col range */
+        xassert(last_on_row->row == old_row_idx);
+        col_count = max(col_count, last_on_row->col + 1);
+    } else
+        tp = NULL;
+
+    /* Does this row have any URIs? */
+    struct row_uri_range *range, *range_terminator;
+    struct row_data *extra = old_row->extra;
+
+    if (extra != NULL && extra->uri_ranges.count > 0) {
+        if (rf->scratch != NULL)
+            extra = reflow_copy_uri_ranges(rf->scratch_extra, extra);
+
+        range = &extra->uri_ranges.v[0];
+        range_terminator = &extra->uri_ranges.v[extra->uri_ranges.count];
+
+        /* Make sure the *last* URI range's end point is included
+         * in the copy */
+        const struct row_uri_range *last_on_row =
+            &extra->uri_ranges.v[extra->uri_ranges.count - 1];
+        col_count = max(col_count, last_on_row->end + 1);
+    } else
+        range = range_terminator = NULL;
+
+    for (int start = 0, left = col_count; left > 0;) {
+        int end;
+        bool tp_break = false;
+        bool uri_break = false;
+
+        /*
+         * Set end-coordinate for this chunk, by finding the next
+         * point-of-interest on this row.
+         *
+         * If there are no more tracking points, or URI ranges,
+         * the end-coordinate will be at the end of the row,
+         */
+        if (range != range_terminator) {
+            int uri_col = (range->start >= start ? range->start : range->end) + 1;
+
+            if (tp != NULL) {
+                int tp_col = tp->col + 1;
+                end = min(tp_col, uri_col);
+
+                tp_break = end == tp_col;
+                uri_break = end == uri_col;
+                LOG_DBG("tp+uri break at %d (%d, %d)", end, tp_col, uri_col);
+            } else {
+                end = uri_col;
+                uri_break = true;
+                LOG_DBG("uri break at %d", end);
+            }
+        } else if (tp != NULL) {
+            end = tp->col + 1;
+            tp_break = true;
+            LOG_DBG("TP break at %d", end);
+        } else
+            end = col_count;
+
+        int cols = end - start;
+        xassert(cols > 0);
+        xassert(start + cols <= old_cols);
+
+        /*
+         * Copy the row chunk to the new grid. Note that there may
+         * be fewer cells left on the new row than what we have in
+         * the chunk. I.e. the chunk may have to be split up into
+         * multiple memcpy:ies.
+         */
+
+        for (int count = cols, from_col = start; count > 0;) {
+            xassert(new_col_idx <= new_cols);
+            int new_row_cells_left = new_cols - new_col_idx;
+
+            /* Row full, emit newline and get a new, fresh, row */
+            if (new_row_cells_left <= 0) {
+                line_wrap();
+                new_row_cells_left = new_cols;
+            }
+
+            /* Number of cells we can copy */
+            int amount = min(count, new_row_cells_left);
+            xassert(amount > 0);
+
+            /*
+             * If we’re going to reach the end of the new row, we
+             * need to make sure we don’t end in the middle of a
+             * multi-column character.
+             */
+            int spacers = 0;
+            if (new_col_idx + amount >= new_cols) {
+                /*
+                 * While the cell *after* the last cell is a CELL_SPACER
+                 *
+                 * This means we have a multi-column character
+                 * that doesn’t fit on the current row. We need to
+                 * push it to the next row, and insert CELL_SPACER
+                 * cells as padding.
+                 */
+                while (
+                    unlikely(
+                        amount > 1 &&
+                        from_col + amount < old_cols &&
+                        old_row->cells[from_col + amount].wc >= CELL_SPACER + 1))
+                {
+                    amount--;
+                    spacers++;
+                }
+
+                xassert(
+                    amount == 1 ||
+                    old_row->cells[from_col + amount - 1].wc <= CELL_SPACER + 1);
+            }
+
+            xassert(new_col_idx + amount <= new_cols);
+            xassert(from_col + amount <= old_cols);
+
+            if (from_col == 0)
+                new_row->prompt_marker = old_row->prompt_marker;
+
+            memcpy(
+                &new_row->cells[new_col_idx], &old_row->cells[from_col],
+                amount * sizeof(struct cell));
+
+            count -= amount;
+            from_col += amount;
+            new_col_idx += amount;
+
+            xassert(new_col_idx <= new_cols);
+
+            if (unlikely(spacers > 0)) {
+                xassert(new_col_idx + spacers == new_cols);
+
+                const struct cell *cell = &old_row->cells[from_col - 1];
+
+                for (int i = 0; i < spacers; i++, new_col_idx++) {
+                    new_row->cells[new_col_idx].wc = CELL_SPACER;
+                    new_row->cells[new_col_idx].attrs = cell->attrs;
+                }
+            }
+        }
+
+        xassert(new_col_idx > 0);
+
+        if (tp_break) {
+            do {
+                xassert(tp != NULL);
+                xassert(tp->row == old_row_idx);
+                xassert(tp->col == end - 1);
+
+                tp->row = new_row_idx;
+                tp->col = new_col_idx - 1;
+
+                next_tp++;
+                tp = *next_tp;
+            } while (tp->row == old_row_idx && tp->col == end - 1);
+
+            if (tp->row != old_row_idx)
+                tp = NULL;
+
+            LOG_DBG("next TP (tp=%p): %dx%d",
+                    (void*)tp, (*next_tp)->row, (*next_tp)->col);
+        }
+
+        if (uri_break) {
+            xassert(range != NULL);
+
+            if (range->start == end - 1)
+                reflow_uri_range_start(range, new_row, new_col_idx - 1);
+
+            if (range->end == end - 1) {
+                reflow_uri_range_end(range, new_row, new_col_idx - 1);
+                grid_row_uri_range_destroy(range);
+                range++;
+            }
+        }
+
+        left -= cols;
+        start += cols;
+    }
+
+    if (old_row->linebreak) {
+        if (blank && new_col_idx == 0 && new_row->extra == NULL && !last) {
+            /* An empty line; keep it blank, instead of erasing its cells */
+            new_row = grid_row_blank(to, new_row_idx, (struct attributes){0});
+        } else {
+            /* Erase the remaining cells */
+            memset(&new_row->cells[new_col_idx], 0,
+                   (new_cols - new_col_idx) * sizeof(new_row->cells[0]));
+        }
+        new_row->linebreak = true;
+
+        if (!last)
+            line_wrap();
+        else if (new_row->extra != NULL &&
+                 new_row->extra->uri_ranges.count > 0)
+        {
+            /*
+             * line_wrap() "closes" still-open URIs. Since this is
+             * the *last* row, and since we’re line-breaking due
+             * to a hard line-break (rather than running out of
+             * cells in the "new_row"), there shouldn’t be an open
+             * URI (it would have been closed when we reached the
+             * end of the URI while reflowing the last "old"
+             * row).
+             */
+            uint32_t last_idx = new_row->extra->uri_ranges.count - 1;
+            xassert(new_row->extra->uri_ranges.v[last_idx].end >= 0);
+        }
+    }
+
+    if (rf->scratch == NULL) {
+        grid_row_free(from, from->rows[old_row_idx]);
+        from->rows[old_row_idx] = NULL;
+    } else if (extra != NULL) {
+        /* Free the copied ranges that were not consumed */
+        for (; range != range_terminator; range++)
+            grid_row_uri_range_destroy(range);
+        rf->scratch_extra->uri_ranges.count = 0;
+    }
+
+#undef line_wrap
+
+    rf->new_row = new_row;
+    rf->new_row_idx = new_row_idx;
+    rf->new_col_idx = new_col_idx;
+    rf->next_tp = next_tp;
+}
+
+/*
+ * Parallel reflow
+ *
+ * Logical lines are reflowed independently of each other. Large
+ * reflows are therefore split up into segments, at hard line breaks,
+ * and the segments are reflowed by the render worker threads (and the
+ * main thread).
+ *
+ * Each segment is reflowed into a ring buffer of its own, with its own
+ * row arena. Once all segments are done, the main thread stitches
+ * them together, in the target grid. This is equivalent to reflowing
+ * all rows in one go; if the segments don't fit the target grid, the
+ * oldest rows are dropped.
+ */
+
+/* Reflow in parallel only if each segment gets at least this many rows */
+#define REFLOW_SEGMENT_MIN_ROWS 1024
+
+/* Number of segments per thread, for load balancing */
+#define REFLOW_SEGMENTS_PER_THREAD 4
+
+struct reflow_segment {
+    int first;              /* First old row (relative to the job's 'start') */
+    int end;                /* One past the last old row */
+
+    struct grid from;       /* Shallow copy of the old grid */
+    struct grid to;
+    struct coord **tps;     /* The segment's tracking points */
+    struct reflow rf;
+
+    int new_rows;           /* Number of rows in 'to', once reflowed */
+};
+
+struct reflow_job {
+    struct reflow_segment *segments;
+    size_t count;
+    int start;              /* Absolute row, in the old grid */
+    int max_rows;           /* Of the target grid */
+    atomic_size_t next;     /* Next segment to claim */
+};
+
+static void
+reflow_segment(struct reflow_segment *seg, int start, int max_rows)
+{
+    struct row scratch = {
+        .cells = xmalloc(seg->from.num_cols * sizeof(scratch.cells[0])),
+    };
+    struct row_data scratch_extra = {.uri_ranges = {0}};
+
+    /* Most reflows grow the number of rows less than 2x */
+    seg->to.num_rows = min(max(2 * (seg->end - seg->first), 64), max_rows);
+    seg->to.rows = xcalloc(seg->to.num_rows, sizeof(seg->to.rows[0]));
+
+    seg->rf = (struct reflow){
+        .from = &seg->from,
+        .to = &seg->to,
+        .new_row = grid_row_alloc(&seg->to, false),
+        .new_row_idx = 0,
+        .new_col_idx = 0,
+        .next_tp = seg->tps,
+        .scratch = &scratch,
+        .scratch_extra = &scratch_extra,
+        .max_rows = max_rows,
+    };
+    seg->to.rows[0] = seg->rf.new_row;
+
+    for (int r = seg->first; r < seg->end; r++) {
+        reflow_row(
+            &seg->rf, grid_row_wrap(&seg->from, start + r), r + 1 == seg->end);
+    }
+
+    /* Erase the remaining cells */
+    memset(&seg->rf.new_row->cells[seg->rf.new_col_idx], 0,
+           (seg->to.num_cols - seg->rf.new_col_idx) * sizeof(scratch.cells[0]));
+
+    const bool wrapped =
+        seg->to.rows[grid_row_wrap(&seg->to, seg->rf.new_row_idx + 1)] != NULL;
+    seg->new_rows = wrapped ? seg->to.num_rows : seg->rf.new_row_idx + 1;
+
+    seg->rf.scratch = NULL;
+    seg->rf.scratch_extra = NULL;
+    free(scratch.cells);
+    free(scratch_extra.uri_ranges.v);
+}
+
+static void
+reflow_job_run(void *data)
+{
+    struct reflow_job *job = data;
+
+    while (true) {
+        const size_t idx = atomic_fetch_add_explicit(
+            &job->next, 1, memory_order_relaxed);
+
+        if (idx >= job->count)
+            break;
+
+        reflow_segment(&job->segments[idx], job->start, job->max_rows);
+    }
+}
+
+/*
+ * Splits the old rows [first, end) into (at most) 'max_count'
+ * segments, at hard line breaks, and reflows them in parallel.
+ */
+static void
+reflow_rows_parallel(struct reflow *rf, int start, int first, int end,
+                     size_t max_count, struct render_worker_pool *workers)
+{
+    struct grid *from = rf->from;
+    struct grid *to = rf->to;
+
+    /* Segments allocate their own first row */
+    xassert(rf->new_row_idx == 0);
+    xassert(rf->new_col_idx == 0);
+    xassert(to->rows[0] == rf->new_row);
+    grid_row_free(to, rf->new_row);
+    to->rows[0] = NULL;
+
+    struct reflow_segment *segs = xcalloc(max_count, sizeof(segs[0]));
+    size_t count = 0;
+
+    /* Split, at the first logical line start after each target size */
+    const int size = (end - first) / max_count;
+    for (int seg_first = first; seg_first < end; count++) {
+        /* A long logical line may have pushed us close to the end */
+        int seg_end = count + 1 < max_count ? min(seg_first + size, end) : end;
+
+        for (; seg_end < end; seg_end++) {
+            const struct row *row =
+                from->rows[grid_row_wrap(from, start + seg_end - 1)];
+            if (row != NULL && row->linebreak)
+                break;
+        }
+
+        struct reflow_segment *seg = &segs[count];
+        seg->first = seg_first;
+        seg->end = seg_end;
+        seg->from = *from;
+        memset(&seg->from.scroll_damage, 0, sizeof(seg->from.scroll_damage));
+        memset(&seg->from.sixel_images, 0, sizeof(seg->from.sixel_images));
+        seg->to = (struct grid){.num_cols = to->num_cols};
+
+        seg_first = seg_end;
+    }
+
+    /* Give each segment its own tracking points, and sixels */
+    struct coord terminator = {-1, -1};
+    struct coord **tp = rf->next_tp;
+
+    for (size_t i = 0; i < count; i++) {
+        struct reflow_segment *seg = &segs[i];
+        struct coord **seg_tp = tp;
+
+        /* The terminator's row is -1 */
+        while ((*tp)->row >= 0 &&
+               grid_row_wrap(from, (*tp)->row - start) < seg->end)
+        {
+            tp++;
+        }
+
+        const size_t tp_count = tp - seg_tp;
+        seg->tps = xmalloc((tp_count + 1) * sizeof(seg->tps[0]));
+        memcpy(seg->tps, seg_tp, tp_count * sizeof(seg->tps[0]));
+        seg->tps[tp_count] = &terminator;
+    }
+
+    rf->next_tp = tp;
+
+    tll_foreach(from->sixel_images, it) {
+        const int row = grid_row_wrap(from, it->item.pos.row - start);
+
+        for (size_t i = 0; i < count; i++) {
+            struct reflow_segment *seg = &segs[i];
+            if (row < seg->first || row >= seg->end)
+                continue;
+
+            tll_push_back(seg->from.sixel_images, it->item);
+            tll_remove(from->sixel_images, it);
+            break;
+        }
+    }
+
+    struct reflow_job job = {
+        .segments = segs,
+        .count = count,
+        .start = start,
+        .max_rows = to->num_rows,
+    };
+
+    render_worker_pool_run(workers, count - 1, &reflow_job_run, &job);
+
+    /*
+     * Stitch the segments together.
+     *
+     * A segment that wrapped around has already overwritten its
+     * oldest rows; what is left are its 'new_rows' newest rows. A
+     * row's 'pos' is its position in the concatenation of what is
+     * left of all segments. Rows before 'drop' don't fit, and are
+     * scrolled out.
+     *
+     * Rows are placed as if all segments had been reflowed in one
+     * go, into 'to'. I.e. the row at index 'idx' in a segment ends up
+     * at index 'slot + idx', where 'slot' is the number of rows (mod
+     * 'to's size) reflowed by the preceding segments.
+     */
+    int total = 0;
+    for (size_t i = 0; i < count; i++)
+        total += segs[i].new_rows;
+
+    const int num_rows = to->num_rows;
+    const int drop = max(total - num_rows, 0);
+
+    xassert(to->arena != NULL);
+
+    int pos_base = 0;
+    int slot = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        struct reflow_segment *seg = &segs[i];
+        const int seg_rows = seg->new_rows;
+        const int last_idx = seg->rf.new_row_idx;
+
+        row_arena_merge(to->arena, seg->to.arena);
+        seg->to.arena = NULL;
 
-            if (range->start >= new_cols) {
-                /* The whole range is truncated */
-                continue;
-            }
+#define pos_of(idx) \
+        (pos_base + grid_row_wrap(&seg->to, (idx) - last_idx - 1 + seg_rows))
+#define slot_of(idx) ((slot + (idx)) % num_rows)
 
-            const int start = range->start;
-            const int end = min(range->end, new_cols - 1);
-            uri_range_append(new_extra, start, end, range->id, range->uri);
+        for (int r = 0; r < seg_rows; r++) {
+            const int idx = grid_row_wrap(&seg->to, last_idx - seg_rows + 1 + r);
+            struct row *row = seg->to.rows[idx];
+
+            if (pos_base + r < drop)
+                grid_row_free(to, row);
+            else
+                to->rows[slot_of(idx)] = row;
         }
-    }
 
-    /* Clear "new" lines */
-    for (int r = min(old_screen_rows, new_screen_rows); r < new_screen_rows; r++) {
-        struct row *new_row = grid_row_alloc(new_cols, false);
-        new_grid[(new_offset + r) & (new_rows - 1)] = new_row;
+        tll_foreach(seg->to.sixel_images, it) {
+            struct sixel sixel = it->item;
 
-        memset(new_row->cells, 0, sizeof(struct cell) * new_cols);
-        new_row->dirty = true;
-    }
+            if (pos_of(sixel.pos.row) < drop)
+                sixel_destroy(&sixel);
+            else {
+                sixel.pos.row = slot_of(sixel.pos.row);
+                tll_push_back(to->sixel_images, sixel);
+            }
 
-#if defined(_DEBUG)
-    for (size_t r = 0; r < new_rows; r++) {
-        const struct row *row = new_grid[r];
+            tll_remove(seg->to.sixel_images, it);
+        }
 
-        if (row == NULL)
-            continue;
-        if (row->extra == NULL)
-            continue;
+        xassert(*seg->rf.next_tp == &terminator);
+        for (struct coord **seg_tp = seg->tps; *seg_tp != &terminator; seg_tp++)
+            (*seg_tp)->row = slot_of((*seg_tp)->row);
 
-        verify_no_overlapping_uris(row->extra);
-        verify_uris_are_sorted(row->extra);
-    }
-#endif
+        if (i + 1 == count) {
+            rf->new_row_idx = slot_of(last_idx);
+            rf->new_row = to->rows[rf->new_row_idx];
+            rf->new_col_idx = seg->rf.new_col_idx;
+        }
 
-    /* Free old grid */
-    for (int r = 0; r < grid->num_rows; r++)
-        grid_row_free(old_grid[r]);
-    free(grid->rows);
+        /* Sixels we failed to map go back to the old grid */
+        tll_foreach(seg->from.sixel_images, it) {
+            tll_push_back(from->sixel_images, it->item);
+            tll_remove(seg->from.sixel_images, it);
+        }
 
-    grid->rows = new_grid;
-    grid->num_rows = new_rows;
-    grid->num_cols = new_cols;
+        free(seg->to.rows);
+        free(seg->tps);
 
-    grid->view = grid->offset = new_offset;
+        pos_base += seg_rows;
+        slot = slot_of(last_idx + 1);
 
-    /* Keep cursor at current position, but clamp to new dimensions */
-    struct coord cursor = grid->cursor.point;
-    if (cursor.row == old_screen_rows - 1) {
-        /* 'less' breaks if the cursor isn't at the bottom */
-        cursor.row = new_screen_rows - 1;
+#undef pos_of
+#undef slot_of
     }
-    cursor.row = min(cursor.row, new_screen_rows - 1);
-    cursor.col = min(cursor.col, new_cols - 1);
-    grid->cursor.point = cursor;
-
-    struct coord saved_cursor = grid->saved_cursor.point;
-    if (saved_cursor.row == old_screen_rows - 1)
-        saved_cursor.row = new_screen_rows - 1;
-    saved_cursor.row = min(saved_cursor.row, new_screen_rows - 1);
-    saved_cursor.col = min(saved_cursor.col, new_cols - 1);
-    grid->saved_cursor.point = saved_cursor;
-
-    grid->cur_row = new_grid[(grid->offset + cursor.row) & (new_rows - 1)];
-    xassert(grid->cur_row != NULL);
 
-    grid->cursor.lcf = false;
-    grid->saved_cursor.lcf = false;
+    /* Free the reflowed old rows (which the workers could not) */
+    for (int r = first; r < end; r++) {
+        const int idx = grid_row_wrap(from, start + r);
+        grid_row_free(from, from->rows[idx]);
+        from->rows[idx] = NULL;
+    }
 
-    /* Free sixels we failed to "map" to the new grid */
-    tll_foreach(untranslated_sixels, it)
-        sixel_destroy(&it->item);
-    tll_free(untranslated_sixels);
+    free(segs);
 
-#if defined(_DEBUG)
-    for (int r = 0; r < new_screen_rows; r++)
-        grid_row_in_view(grid, r);
-#endif
+    LOG_DBG("reflowed %d rows in %zu segments: %d rows (%d dropped)",
+            end - first, count, total, drop);
 }
 
+/* Reflows the old rows [first, end), relative to the absolute row 'start' */
 static void
-reflow_uri_range_start(struct row_uri_range *range, struct row *new_row,
-                       int new_col_idx)
+reflow_rows(struct reflow *rf, int start, int first, int end,
+            struct render_worker_pool *workers)
 {
-    ensure_row_has_extra_data(new_row);
-    uri_range_append_no_strdup
-        (new_row->extra, new_col_idx, -1, range->id, range->uri);
-    range->uri = NULL;
+    const size_t threads =
+        1 + (workers != NULL ? render_worker_pool_size(workers) : 0);
+    const size_t segments = min(
+        threads * REFLOW_SEGMENTS_PER_THREAD,
+        (size_t)max(end - first, 0) / REFLOW_SEGMENT_MIN_ROWS);
+
+    if (threads > 1 && segments > 1) {
+        reflow_rows_parallel(rf, start, first, end, segments, workers);
+        return;
+    }
+
+    for (int r = first; r < end; r++)
+        reflow_row(rf, grid_row_wrap(rf->from, start + r), r + 1 == end);
 }
 
+/*
+ * Frees the old grid, once all rows that are going to be reflowed
+ * have been. With 'background', the rows are free:d by the reclaimer
+ * (if running), and their spilled data is *not* released.
+ */
 static void
-reflow_uri_range_end(struct row_uri_range *range, struct row *new_row,
-                     int new_col_idx)
+reflow_old_free(struct grid *old, bool background)
 {
-    struct row_data *extra = new_row->extra;
-    xassert(extra->uri_ranges.count > 0);
-
-    struct row_uri_range *new_range =
-        &extra->uri_ranges.v[extra->uri_ranges.count - 1];
+    if (background && reclaimer_can_take(old))
+        reclaimer_take(old->rows, old->num_rows, old->arena, NULL);
+    else {
+        grid_free_rows(old, old->rows, old->num_rows);
+        free(old->rows);
+    }
 
-    xassert(new_range->id == range->id);
-    xassert(new_range->end < 0);
-    new_range->end = new_col_idx;
+    /* Free sixels we failed to "map" to the new grid */
+    tll_foreach(old->sixel_images, it) {
+        sixel_destroy(&it->item);
+        tll_remove(old->sixel_images, it);
+    }
 }
 
-static struct row *
-_line_wrap(struct grid *old_grid, struct row **new_grid, struct row *row,
-           int *row_idx, int *col_idx, int row_count, int col_count)
+/* Number of cells reflow_row() copies; a lower bound for compressed rows */
+static int
+reflow_cell_count(const struct row *row, int cols)
 {
-    *col_idx = 0;
-    *row_idx = (*row_idx + 1) & (row_count - 1);
+    if (row->compressed)
+        return 0;
 
-    struct row *new_row = new_grid[*row_idx];
-
-    if (new_row == NULL) {
-        /* Scrollback not yet full, allocate a completely new row */
-        new_row = grid_row_alloc(col_count, false);
-        new_grid[*row_idx] = new_row;
-    } else {
-        /* Scrollback is full, need to reuse a row */
-        grid_row_reset_extra(new_row);
-        new_row->linebreak = false;
-        new_row->prompt_marker = false;
+    for (int c = cols - 1; c >= 0; c--) {
+        const struct cell *cell = &row->cells[c];
+        if (!(cell->wc == 0 || cell->wc == CELL_SPACER))
+            return row->linebreak ? c + 1 : cols;
+    }
 
-        tll_foreach(old_grid->sixel_images, it) {
-            if (it->item.pos.row == *row_idx) {
-                sixel_destroy(&it->item);
-                tll_remove(old_grid->sixel_images, it);
-            }
-        }
+    return 0;
+}
 
-        /*
-         * TODO: detect if the reused row is covered by the
-         * selection. Of so, cancel the selection. The problem: we
-         * don’t know if we’ve translated the selection coordinates
-         * yet.
-         */
-    }
+/*
+ * Returns the (scrollback relative) row, in the old grid, at which
+ * to start reflowing right away. Rows before it are reflowed later,
+ * by grid_reflow_scrollback().
+ *
+ * The returned row always starts a logical line, is at, or before,
+ * 'last_row', and is far enough back to fill (at least)
+ * 'min_new_rows' rows in the new grid.
+ */
+static int
+reflow_first_row(const struct grid *old, int sb_start, int last_row,
+                 int new_cols, int min_new_rows)
+{
+    const int old_rows = old->num_rows;
 
-    struct row_data *extra = row->extra;
-    if (extra == NULL)
-        return new_row;
+    /* A lower bound; multi-column characters may add padding */
+    int new_row_count = 0;
+    int cells = 0;
 
-    /*
-     * URI ranges are per row. Thus, we need to ‘close’ the still-open
-     * ranges on the previous row, and re-open them on the
-     * next/current row.
-     */
-    if (extra->uri_ranges.count > 0) {
-        struct row_uri_range *range =
-            &extra->uri_ranges.v[extra->uri_ranges.count - 1];
+    for (int r = old_rows - 1; r >= 0; r--) {
+        const struct row *row = old->rows[_grid_row_wrap(sb_start + r, old_rows)];
 
-        if (range->end < 0) {
+        if (row == NULL) {
+            /* Reached the scrollback start */
+            return 0;
+        }
 
-            /* Terminate URI range on the previous row */
-            range->end = col_count - 1;
+        if (row->linebreak && r < old_rows - 1) {
+            /* Row r + 1 starts a logical line */
+            new_row_count += max(1, (cells + new_cols - 1) / new_cols);
+            cells = 0;
 
-            /* Open a new range on the new/current row */
-            ensure_row_has_extra_data(new_row);
-            uri_range_append(new_row->extra, 0, -1, range->id, range->uri);
+            if (r + 1 <= last_row && new_row_count >= min_new_rows)
+                return r + 1 >= REFLOW_LAZY_MIN_ROWS ? r + 1 : 0;
         }
+
+        cells += reflow_cell_count(row, old->num_cols);
     }
 
-    return new_row;
+    return 0;
 }
 
 static struct {
@@ -645,8 +2421,8 @@ tp_cmp(const void *_a, const void *_b)
     int scrollback_start = tp_cmp_ctx.scrollback_start;
     int num_rows = tp_cmp_ctx.rows;
 
-    int a_row = (a->row - scrollback_start + num_rows) & (num_rows - 1);
-    int b_row = (b->row - scrollback_start + num_rows) & (num_rows - 1);
+    int a_row = _grid_row_wrap(a->row - scrollback_start, num_rows);
+    int b_row = _grid_row_wrap(b->row - scrollback_start, num_rows);
 
     xassert(a_row >= 0);
     xassert(a_row < num_rows || num_rows == 0);
@@ -671,7 +2447,8 @@ tp_cmp(const void *_a, const void *_b)
 
 void
 grid_resize_and_reflow(
-    struct grid *grid, int new_rows, int new_cols,
+    struct grid *grid, struct render_worker_pool *workers,
+    int new_rows, int new_cols,
     int old_screen_rows, int new_screen_rows,
     size_t tracking_points_count,
     struct coord *const _tracking_points[static tracking_points_count])
@@ -681,353 +2458,123 @@ grid_resize_and_reflow(
     clock_gettime(CLOCK_MONOTONIC, &start);
 #endif
 
-    struct row *const *old_grid = grid->rows;
-    const int old_rows = grid->num_rows;
-    const int old_cols = grid->num_cols;
+    /* Finish the previous resize's reflow first */
+    grid_reflow_scrollback(grid, workers, old_screen_rows, -1);
 
-    /* Is viewpoint tracking current grid offset? */
-    const bool view_follows = grid->view == grid->offset;
+    /*
+     * Move the old rows, and sixels, to a grid of their own. The
+     * sixels are moved back as their rows are reflowed.
+     */
+    struct grid old = *grid;
+    memset(&old.scroll_damage, 0, sizeof(old.scroll_damage));
 
-    int new_col_idx = 0;
-    int new_row_idx = 0;
+    const int old_rows = old.num_rows;
 
-    struct row **new_grid = xcalloc(new_rows, sizeof(new_grid[0]));
-    struct row *new_row = new_grid[new_row_idx];
+    /* Is viewpoint tracking current grid offset? */
+    const bool view_follows = grid->view == grid->offset;
 
-    xassert(new_row == NULL);
-    new_row = grid_row_alloc(new_cols, false);
-    new_grid[new_row_idx] = new_row;
+    grid->rows = xcalloc(new_rows, sizeof(grid->rows[0]));
+    grid->num_rows = new_rows;
+    grid->num_cols = new_cols;
+    grid->arena = row_arena_new(new_cols);
+    memset(&grid->sixel_images, 0, sizeof(grid->sixel_images));
+
+    struct reflow rf = {
+        .from = &old,
+        .to = grid,
+        .new_row = grid_row_alloc(grid, false),
+        .new_row_idx = 0,
+        .new_col_idx = 0,
+    };
+    grid->rows[0] = rf.new_row;
 
     /* Start at the beginning of the old grid's scrollback. That is,
      * at the output that is *oldest* */
-    int offset = grid->offset + old_screen_rows;
-
-    tll(struct sixel) untranslated_sixels = tll_init();
-    tll_foreach(grid->sixel_images, it)
-        tll_push_back(untranslated_sixels, it->item);
-    tll_free(grid->sixel_images);
+    int offset = old.offset + old_screen_rows;
 
     /* Turn cursor coordinates into grid absolute coordinates */
     struct coord cursor = grid->cursor.point;
-    cursor.row += grid->offset;
-    cursor.row &= old_rows - 1;
-
-    struct coord saved_cursor = grid->saved_cursor.point;
-    saved_cursor.row += grid->offset;
-    saved_cursor.row &= old_rows - 1;
-
-    size_t tp_count =
-        tracking_points_count +
-        1 +                       /* cursor */
-        1 +                       /* saved cursor */
-        !view_follows +           /* viewport */
-        1;                        /* terminator */
-
-    struct coord *tracking_points[tp_count];
-    memcpy(tracking_points, _tracking_points, tracking_points_count * sizeof(_tracking_points[0]));
-    tracking_points[tracking_points_count] = &cursor;
-    tracking_points[tracking_points_count + 1] = &saved_cursor;
-
-    struct coord viewport = {0, grid->view};
-    if (!view_follows)
-        tracking_points[tracking_points_count + 2] = &viewport;
-
-    /* Not thread safe! */
-    tp_cmp_ctx.scrollback_start = offset;
-    tp_cmp_ctx.rows = old_rows;
-    qsort(
-        tracking_points, tp_count - 1, sizeof(tracking_points[0]), &tp_cmp);
-
-    /* NULL terminate */
-    struct coord terminator = {-1, -1};
-    tracking_points[tp_count - 1] = &terminator;
-    struct coord **next_tp = &tracking_points[0];
-
-    LOG_DBG("scrollback-start=%d", offset);
-    for (size_t i = 0; i < tp_count - 1; i++) {
-        LOG_DBG("TP #%zu: row=%d, col=%d",
-                i, tracking_points[i]->row, tracking_points[i]->col);
-    }
-
-    /*
-     * Walk the old grid
-     */
-    for (int r = 0; r < old_rows; r++) {
-
-        const size_t old_row_idx = (offset + r) & (old_rows - 1);
-
-        /* Unallocated (empty) rows we can simply skip */
-        const struct row *old_row = old_grid[old_row_idx];
-        if (old_row == NULL)
-            continue;
-
-        /* Map sixels on current "old" row to current "new row" */
-        tll_foreach(untranslated_sixels, it) {
-            if (it->item.pos.row != old_row_idx)
-                continue;
-
-            struct sixel sixel = it->item;
-            sixel.pos.row = new_row_idx;
-
-            tll_push_back(grid->sixel_images, sixel);
-            tll_remove(untranslated_sixels, it);
-        }
-
-#define line_wrap()                                                 \
-        new_row = _line_wrap(                                       \
-            grid, new_grid, new_row, &new_row_idx, &new_col_idx,    \
-            new_rows, new_cols)
-
-        /* Find last non-empty cell */
-        int col_count = 0;
-        for (int c = old_cols - 1; c >= 0; c--) {
-            const struct cell *cell = &old_row->cells[c];
-            if (!(cell->wc == 0 || cell->wc == CELL_SPACER)) {
-                col_count = c + 1;
-                break;
-            }
-        }
-
-        if (!old_row->linebreak && col_count > 0) {
-            /* Don’t truncate logical lines */
-            col_count = old_cols;
-        }
-
-        xassert(col_count >= 0 && col_count <= old_cols);
-
-        /* Do we have a (at least one) tracking point on this row */
-        struct coord *tp;
-        if (unlikely((*next_tp)->row == old_row_idx)) {
-            tp = *next_tp;
-
-            /* Find the *last* tracking point on this row */
-            struct coord *last_on_row = tp;
-            for (struct coord **iter = next_tp; (*iter)->row == old_row_idx; iter++)
-                last_on_row = *iter;
-
-            /* And make sure its end point is included in the col range */
-            xassert(last_on_row->row == old_row_idx);
-            col_count = max(col_count, last_on_row->col + 1);
-        } else
-            tp = NULL;
-
-        /* Does this row have any URIs? */
-        struct row_uri_range *range, *range_terminator;
-        struct row_data *extra = old_row->extra;
-
-        if (extra != NULL && extra->uri_ranges.count > 0) {
-            range = &extra->uri_ranges.v[0];
-            range_terminator = &extra->uri_ranges.v[extra->uri_ranges.count];
-
-            /* Make sure the *last* URI range's end point is included
-             * in the copy */
-            const struct row_uri_range *last_on_row =
-                &extra->uri_ranges.v[extra->uri_ranges.count - 1];
-            col_count = max(col_count, last_on_row->end + 1);
-        } else
-            range = range_terminator = NULL;
-
-        for (int start = 0, left = col_count; left > 0;) {
-            int end;
-            bool tp_break = false;
-            bool uri_break = false;
-
-            /*
-             * Set end-coordinate for this chunk, by finding the next
-             * point-of-interest on this row.
-             *
-             * If there are no more tracking points, or URI ranges,
-             * the end-coordinate will be at the end of the row,
-             */
-            if (range != range_terminator) {
-                int uri_col = (range->start >= start ? range->start : range->end) + 1;
-
-                if (tp != NULL) {
-                    int tp_col = tp->col + 1;
-                    end = min(tp_col, uri_col);
-
-                    tp_break = end == tp_col;
-                    uri_break = end == uri_col;
-                    LOG_DBG("tp+uri break at %d (%d, %d)", end, tp_col, uri_col);
-                } else {
-                    end = uri_col;
-                    uri_break = true;
-                    LOG_DBG("uri break at %d", end);
-                }
-            } else if (tp != NULL) {
-                end = tp->col + 1;
-                tp_break = true;
-                LOG_DBG("TP break at %d", end);
-            } else
-                end = col_count;
-
-            int cols = end - start;
-            xassert(cols > 0);
-            xassert(start + cols <= old_cols);
-
-            /*
-             * Copy the row chunk to the new grid. Note that there may
-             * be fewer cells left on the new row than what we have in
-             * the chunk. I.e. the chunk may have to be split up into
-             * multiple memcpy:ies.
-             */
-
-            for (int count = cols, from = start; count > 0;) {
-                xassert(new_col_idx <= new_cols);
-                int new_row_cells_left = new_cols - new_col_idx;
-
-                /* Row full, emit newline and get a new, fresh, row */
-                if (new_row_cells_left <= 0) {
-                    line_wrap();
-                    new_row_cells_left = new_cols;
-                }
-
-                /* Number of cells we can copy */
-                int amount = min(count, new_row_cells_left);
-                xassert(amount > 0);
-
-                /*
-                 * If we’re going to reach the end of the new row, we
-                 * need to make sure we don’t end in the middle of a
-                 * multi-column character.
-                 */
-                int spacers = 0;
-                if (new_col_idx + amount >= new_cols) {
-                    /*
-                     * While the cell *after* the last cell is a CELL_SPACER
-                     *
-                     * This means we have a multi-column character
-                     * that doesn’t fit on the current row. We need to
-                     * push it to the next row, and insert CELL_SPACER
-                     * cells as padding.
-                     */
-                    while (
-                        unlikely(
-                            amount > 1 &&
-                            from + amount < old_cols &&
-                            old_row->cells[from + amount].wc >= CELL_SPACER + 1))
-                    {
-                        amount--;
-                        spacers++;
-                    }
-
-                    xassert(
-                        amount == 1 ||
-                        old_row->cells[from + amount - 1].wc <= CELL_SPACER + 1);
-                }
-
-                xassert(new_col_idx + amount <= new_cols);
-                xassert(from + amount <= old_cols);
-
-                if (from == 0)
-                    new_row->prompt_marker = old_row->prompt_marker;
-
-                memcpy(
-                    &new_row->cells[new_col_idx], &old_row->cells[from],
-                    amount * sizeof(struct cell));
-
-                count -= amount;
-                from += amount;
-                new_col_idx += amount;
-
-                xassert(new_col_idx <= new_cols);
-
-                if (unlikely(spacers > 0)) {
-                    xassert(new_col_idx + spacers == new_cols);
-
-                    const struct cell *cell = &old_row->cells[from - 1];
-
-                    for (int i = 0; i < spacers; i++, new_col_idx++) {
-                        new_row->cells[new_col_idx].wc = CELL_SPACER;
-                        new_row->cells[new_col_idx].attrs = cell->attrs;
-                    }
-                }
-            }
-
-            xassert(new_col_idx > 0);
-
-            if (tp_break) {
-                do {
-                    xassert(tp != NULL);
-                    xassert(tp->row == old_row_idx);
-                    xassert(tp->col == end - 1);
+    cursor.row += old.offset;
+    cursor.row = _grid_row_wrap(cursor.row, old_rows);
 
-                    tp->row = new_row_idx;
-                    tp->col = new_col_idx - 1;
+    struct coord saved_cursor = grid->saved_cursor.point;
+    saved_cursor.row += old.offset;
+    saved_cursor.row = _grid_row_wrap(saved_cursor.row, old_rows);
 
-                    next_tp++;
-                    tp = *next_tp;
-                } while (tp->row == old_row_idx && tp->col == end - 1);
+    size_t tp_count =
+        tracking_points_count +
+        1 +                       /* cursor */
+        1 +                       /* saved cursor */
+        !view_follows +           /* viewport */
+        1;                        /* terminator */
 
-                if (tp->row != old_row_idx)
-                    tp = NULL;
+    struct coord *tracking_points[tp_count];
+    memcpy(tracking_points, _tracking_points, tracking_points_count * sizeof(_tracking_points[0]));
+    tracking_points[tracking_points_count] = &cursor;
+    tracking_points[tracking_points_count + 1] = &saved_cursor;
 
-                LOG_DBG("next TP (tp=%p): %dx%d",
-                        (void*)tp, (*next_tp)->row, (*next_tp)->col);
-            }
+    struct coord viewport = {0, grid->view};
+    if (!view_follows)
+        tracking_points[tracking_points_count + 2] = &viewport;
 
-            if (uri_break) {
-                xassert(range != NULL);
+    /* Not thread safe! */
+    tp_cmp_ctx.scrollback_start = offset;
+    tp_cmp_ctx.rows = old_rows;
+    qsort(
+        tracking_points, tp_count - 1, sizeof(tracking_points[0]), &tp_cmp);
 
-                if (range->start == end - 1)
-                    reflow_uri_range_start(range, new_row, new_col_idx - 1);
+    /* Scrollback relative row of the *first* tracking point */
+    const int first_tp_row = _grid_row_wrap(tracking_points[0]->row - offset, old_rows);
 
-                if (range->end == end - 1) {
-                    reflow_uri_range_end(range, new_row, new_col_idx - 1);
-                    grid_row_uri_range_destroy(range);
-                    range++;
-                }
-            }
+    /* NULL terminate */
+    struct coord terminator = {-1, -1};
+    tracking_points[tp_count - 1] = &terminator;
+    rf.next_tp = &tracking_points[0];
 
-            left -= cols;
-            start += cols;
-        }
+    LOG_DBG("scrollback-start=%d", offset);
+    for (size_t i = 0; i < tp_count - 1; i++) {
+        LOG_DBG("TP #%zu: row=%d, col=%d",
+                i, tracking_points[i]->row, tracking_points[i]->col);
+    }
 
-        if (old_row->linebreak) {
-            /* Erase the remaining cells */
-            memset(&new_row->cells[new_col_idx], 0,
-                   (new_cols - new_col_idx) * sizeof(new_row->cells[0]));
-            new_row->linebreak = true;
+    /* Oldest allocated row, in scrollback relative coordinates */
+    const int old_sb_start = old_rows > 0
+        ? _grid_row_wrap(
+            grid_sb_start_ignore_uninitialized(&old, old_screen_rows) - offset,
+            old_rows)
+        : 0;
 
-            if (r + 1 < old_rows)
-                line_wrap();
-            else if (new_row->extra != NULL &&
-                     new_row->extra->uri_ranges.count > 0)
-            {
-                /*
-                 * line_wrap() "closes" still-open URIs. Since this is
-                 * the *last* row, and since we’re line-breaking due
-                 * to a hard line-break (rather than running out of
-                 * cells in the "new_row"), there shouldn’t be an open
-                 * URI (it would have been closed when we reached the
-                 * end of the URI while reflowing the last "old"
-                 * row).
-                 */
-                uint32_t last_idx = new_row->extra->uri_ranges.count - 1;
-                xassert(new_row->extra->uri_ranges.v[last_idx].end >= 0);
-            }
-        }
+    /*
+     * Only reflow the screen, the tracking points, and one screen of
+     * scrollback, right away. The rest is reflowed later, by
+     * grid_reflow_scrollback().
+     */
+    const int first = reflow_first_row(
+        &old, offset, first_tp_row, new_cols, 2 * new_screen_rows);
 
-        grid_row_free(old_grid[old_row_idx]);
-        grid->rows[old_row_idx] = NULL;
+    /*
+     * Walk the old grid
+     */
+    reflow_rows(&rf, offset, first, old_rows, workers);
 
-#undef line_wrap
-    }
+    struct row *const new_row = rf.new_row;
+    const int new_row_idx = rf.new_row_idx;
+    const int new_col_idx = rf.new_col_idx;
 
     /* Erase the remaining cells */
     memset(&new_row->cells[new_col_idx], 0,
            (new_cols - new_col_idx) * sizeof(new_row->cells[0]));
 
-    for (struct coord **tp = next_tp; *tp != &terminator; tp++) {
+    for (struct coord **tp = rf.next_tp; *tp != &terminator; tp++) {
         LOG_DBG("TP: row=%d, col=%d (old cols: %d, new cols: %d)",
-                (*tp)->row, (*tp)->col, old_cols, new_cols);
+                (*tp)->row, (*tp)->col, old.num_cols, new_cols);
     }
-    xassert(old_rows == 0 || *next_tp == &terminator);
+    xassert(old_rows == 0 || *rf.next_tp == &terminator);
 
 #if defined(_DEBUG)
     /* Verify all URI ranges have been “closed” */
     for (int r = 0; r < new_rows; r++) {
-        const struct row *row = new_grid[r];
+        const struct row *row = grid->rows[r];
 
         if (row == NULL)
             continue;
@@ -1041,33 +2588,47 @@ grid_resize_and_reflow(
         verify_uris_are_sorted(row->extra);
     }
 
-    /* Verify all old rows have been free:d */
-    for (int i = 0; i < old_rows; i++)
-        xassert(grid->rows[i] == NULL);
+    /* Verify all reflowed old rows have been free:d */
+    for (int r = first; r < old_rows; r++)
+        xassert(old.rows[_grid_row_wrap(offset + r, old_rows)] == NULL);
 #endif
 
+    /*
+     * Keep the old rows we haven’t reflowed, unless the new grid
+     * is already full (in which case they would have been scrolled
+     * out anyway).
+     */
+    const bool new_grid_full =
+        grid->rows[_grid_row_wrap(new_row_idx + 1, new_rows)] != NULL;
+
+    if (first > old_sb_start && !new_grid_full) {
+        struct grid_reflow *reflow = xmalloc(sizeof(*reflow));
+        *reflow = (struct grid_reflow){
+            .old = old,
+            .start = _grid_row_wrap(offset + old_sb_start, old_rows),
+            .count = first - old_sb_start,
+        };
+        grid->reflow = reflow;
+
+        LOG_DBG("reflow: %d rows left", reflow->count);
+    } else
+        reflow_old_free(&old, false);
+
     /* Set offset such that the last reflowed row is at the bottom */
     grid->offset = new_row_idx - new_screen_rows + 1;
 
     while (grid->offset < 0)
         grid->offset += new_rows;
-    while (new_grid[grid->offset] == NULL)
-        grid->offset = (grid->offset + 1) & (new_rows - 1);
+    while (grid->rows[grid->offset] == NULL)
+        grid->offset = _grid_row_wrap(grid->offset + 1, new_rows);
 
     /* Ensure all visible rows have been allocated */
     for (int r = 0; r < new_screen_rows; r++) {
-        int idx = (grid->offset + r) & (new_rows - 1);
-        if (new_grid[idx] == NULL)
-            new_grid[idx] = grid_row_alloc(new_cols, true);
+        int idx = _grid_row_wrap(grid->offset + r, new_rows);
+        if (grid->rows[idx] == NULL)
+            grid->rows[idx] = grid_row_alloc(grid, true);
     }
 
-    /* Free old grid (rows already free:d) */
-    free(grid->rows);
-
-    grid->rows = new_grid;
-    grid->num_rows = new_rows;
-    grid->num_cols = new_cols;
-
     /*
      * Set new viewport, making sure it’s not too far down.
      *
@@ -1092,7 +2653,9 @@ grid_resize_and_reflow(
     saved_cursor.row = min(saved_cursor.row, new_screen_rows - 1);
     saved_cursor.col = min(saved_cursor.col, new_cols - 1);
 
-    grid->cur_row = new_grid[(grid->offset + cursor.row) & (new_rows - 1)];
+    /* The cursor may have been clamped to a blank row */
+    grid->cur_row = grid_row_abs(
+        grid, _grid_row_wrap(grid->offset + cursor.row, new_rows));
     xassert(grid->cur_row != NULL);
 
     grid->cursor.point = cursor;
@@ -1101,10 +2664,8 @@ grid_resize_and_reflow(
     grid->cursor.lcf = false;
     grid->saved_cursor.lcf = false;
 
-    /* Free sixels we failed to "map" to the new grid */
-    tll_foreach(untranslated_sixels, it)
-        sixel_destroy(&it->item);
-    tll_free(untranslated_sixels);
+    /* Let compressed scrollback pick up the new rows */
+    grid->decompressed = true;
 
 #if defined(TIME_REFLOW) && TIME_REFLOW
     struct timespec stop;
@@ -1113,12 +2674,190 @@ grid_resize_and_reflow(
     struct timespec diff;
     timespec_sub(&stop, &start, &diff);
     LOG_INFO("reflowed %d -> %d rows in %lds %ldns",
-             old_rows, new_rows,
+             old_rows - first, new_rows,
              (long)diff.tv_sec,
              diff.tv_nsec);
 #endif
 }
 
+bool
+grid_reflow_scrollback(struct grid *grid, struct render_worker_pool *workers,
+                       int screen_rows, int count)
+{
+    struct grid_reflow *reflow = grid->reflow;
+    if (reflow == NULL)
+        return false;
+
+    struct grid *old = &reflow->old;
+
+    /*
+     * The reflowed rows are inserted before the (current) scrollback
+     * start. Rows that don’t fit have been scrolled out.
+     */
+    const int sb_start = grid_sb_start_ignore_uninitialized(grid, screen_rows);
+    const int free_rows = grid_row_wrap(grid, sb_start - (grid->offset + screen_rows));
+
+    if (free_rows == 0) {
+        grid_reflow_discard(grid);
+        return false;
+    }
+
+    /* Extend the chunk upwards, to the start of a logical line */
+    int first = count >= 0 ? max(reflow->count - count, 0) : 0;
+    while (first > 0) {
+        const struct row *row =
+            old->rows[grid_row_wrap(old, reflow->start + first - 1)];
+
+        if (row == NULL || row->linebreak)
+            break;
+        first--;
+    }
+
+    /*
+     * Reflow the chunk into a temporary ring buffer, holding exactly
+     * the number of free rows. If it wraps around, the oldest rows
+     * are overwritten, just like a regular reflow would have.
+     */
+    struct grid chunk = {
+        .num_rows = free_rows,
+        .num_cols = grid->num_cols,
+        .rows = xcalloc(free_rows, sizeof(chunk.rows[0])),
+        .arena = grid->arena,
+    };
+
+    struct coord terminator = {-1, -1};
+    struct coord *tracking_points[] = {&terminator};
+
+    struct reflow rf = {
+        .from = old,
+        .to = &chunk,
+        .new_row = grid_row_alloc(&chunk, false),
+        .new_row_idx = 0,
+        .new_col_idx = 0,
+        .next_tp = tracking_points,
+    };
+    chunk.rows[0] = rf.new_row;
+
+    reflow_rows(&rf, reflow->start, first, reflow->count, workers);
+
+    /* Erase the remaining cells */
+    memset(&rf.new_row->cells[rf.new_col_idx], 0,
+           (chunk.num_cols - rf.new_col_idx) * sizeof(rf.new_row->cells[0]));
+
+    const bool chunk_full =
+        chunk.rows[grid_row_wrap(&chunk, rf.new_row_idx + 1)] != NULL;
+    const int new_count = chunk_full ? free_rows : rf.new_row_idx + 1;
+
+    /* Insert, newest row first, before the scrollback start */
+    for (int i = 0; i < new_count; i++) {
+        const int idx = grid_row_wrap(grid, sb_start - 1 - i);
+        xassert(grid->rows[idx] == NULL);
+        grid->rows[idx] = chunk.rows[grid_row_wrap(&chunk, rf.new_row_idx - i)];
+    }
+
+    tll_foreach(chunk.sixel_images, it) {
+        struct sixel sixel = it->item;
+        sixel.pos.row = grid_row_wrap(
+            grid,
+            sb_start - 1 - grid_row_wrap(&chunk, rf.new_row_idx - sixel.pos.row));
+
+        tll_push_back(grid->sixel_images, sixel);
+        tll_remove(chunk.sixel_images, it);
+    }
+
+    free(chunk.rows);
+
+    /* Let compressed scrollback pick up the new rows */
+    grid->decompressed = true;
+
+    LOG_DBG("reflow: %d -> %d rows, %d rows left",
+            reflow->count - first, new_count, first);
+
+    reflow->count = first;
+    if (first == 0 || chunk_full) {
+        grid_reflow_discard(grid);
+        return false;
+    }
+
+    return true;
+}
+
+static void
+reflow_discard(struct grid *grid, bool background)
+{
+    struct grid_reflow *reflow = grid->reflow;
+    if (reflow == NULL)
+        return;
+
+    reflow_old_free(&reflow->old, background);
+    free(reflow);
+    grid->reflow = NULL;
+}
+
+void
+grid_reflow_discard(struct grid *grid)
+{
+    reflow_discard(grid, false);
+}
+
+void
+grid_free_scrollback(struct grid *grid, int screen_rows)
+{
+    if (!reclaimer_can_take(grid)) {
+        grid_reflow_discard(grid);
+
+        for (int r = screen_rows; r < grid->num_rows; r++) {
+            const int idx = grid_row_absolute(grid, r);
+            grid_row_free(grid, grid->rows[idx]);
+            grid->rows[idx] = NULL;
+        }
+        return;
+    }
+
+    /* Spilled data is dropped by clearing the spill file, below */
+    reflow_discard(grid, true);
+
+    /*
+     * Copy the screen rows to a new row array, and arena, and let the
+     * reclaimer free the old ones, scrollback and all.
+     */
+    struct row **rows = xcalloc(grid->num_rows, sizeof(rows[0]));
+    struct row_arena *arena = row_arena_new(grid->num_cols);
+
+    for (int r = 0; r < screen_rows; r++) {
+        const int idx = grid_row_absolute(grid, r);
+        struct row *old = grid->rows[idx];
+
+        if (old == NULL)
+            continue;
+
+        struct row *row;
+
+        if (old->blank)
+            row = blank_row_dup(old);
+        else {
+            row = row_arena_alloc(arena, false);
+            row_copy(grid, row, old);
+
+            /* Move the URI ranges */
+            row->extra = old->extra;
+            old->extra = NULL;
+        }
+
+        if (old == grid->cur_row)
+            grid->cur_row = row;
+
+        rows[idx] = row;
+    }
+
+    reclaimer_take(grid->rows, grid->num_rows, grid->arena, NULL);
+    grid->rows = rows;
+    grid->arena = arena;
+
+    if (grid->spill != NULL)
+        spill_file_clear(grid->spill);
+}
+
 void
 grid_row_uri_range_put(struct row *row, int col, const char *uri, uint64_t id)
 {
@@ -1414,3 +3153,712 @@ UNITTEST
         grid_row_uri_range_destroy(&row_data.uri_ranges.v[i]);
     free(row_data.uri_ranges.v);
 }
+
+UNITTEST
+{
+    struct row row = {.dirty = false};
+
+    grid_row_dirty_cell(&row, 5);
+    xassert(row.dirty);
+    xassert(row.dirty_start == 5);
+    xassert(row.dirty_end == 5);
+
+    grid_row_dirty_range(&row, 2, 3);
+    xassert(row.dirty_start == 2);
+    xassert(row.dirty_end == 5);
+
+    grid_row_dirty_range(&row, 4, 8);
+    xassert(row.dirty_start == 2);
+    xassert(row.dirty_end == 8);
+
+    /* A clean row starts over, with a new span */
+    row.dirty = false;
+    grid_row_dirty_cell(&row, 7);
+    xassert(row.dirty_start == 7);
+    xassert(row.dirty_end == 7);
+
+    grid_row_dirty_all(&row);
+    xassert(row.dirty_start == 0);
+    xassert(row.dirty_end == INT_MAX);
+}
+
+UNITTEST
+{
+    /* Not a power of two */
+    struct grid grid = {.num_rows = 1030, .offset = 1020, .view = 5};
+
+    xassert(grid_row_wrap(&grid, 0) == 0);
+    xassert(grid_row_wrap(&grid, 1029) == 1029);
+    xassert(grid_row_wrap(&grid, 1030) == 0);
+    xassert(grid_row_wrap(&grid, 2059) == 1029);
+    xassert(grid_row_wrap(&grid, -1) == 1029);
+    xassert(grid_row_wrap(&grid, -1030) == 0);
+
+    /* More than one lap away */
+    xassert(grid_row_wrap(&grid, 2060) == 0);
+    xassert(grid_row_wrap(&grid, 5 * 1030 + 7) == 7);
+    xassert(grid_row_wrap(&grid, -1031) == 1029);
+    xassert(grid_row_wrap(&grid, -3 * 1030 + 7) == 7);
+
+    xassert(grid_row_absolute(&grid, 9) == 1029);
+    xassert(grid_row_absolute(&grid, 10) == 0);
+    xassert(grid_row_absolute(&grid, 23) == 13);
+    xassert(grid_row_absolute_in_view(&grid, 23) == 28);
+
+    xassert(grid_row_sb_to_abs(&grid, 24, 0) == 14);
+    xassert(grid_row_abs_to_sb(&grid, 24, 14) == 0);
+    xassert(grid_row_abs_to_sb(&grid, 24, 13) == 1029);
+}
+
+UNITTEST
+{
+    struct grid grid = {.num_cols = 3};
+
+    struct row *a = grid_row_alloc(&grid, true);
+    struct row *b = grid_row_alloc(&grid, false);
+    xassert(grid.arena != NULL);
+    xassert(grid.arena->live == 2);
+
+    /* Cells are co-allocated with the row */
+    xassert(a->cells == (struct cell *)(a + 1));
+    xassert((char *)b == (char *)a + grid.arena->row_size);
+
+    for (int c = 0; c < grid.num_cols; c++) {
+        xassert(a->cells[c].wc == 0);
+        xassert(a->cells[c].attrs.clean);
+    }
+
+    /* Free:d rows are recycled */
+    grid_row_free(&grid, b);
+    struct row *c = grid_row_alloc(&grid, false);
+    xassert(c == b);
+    xassert(!c->dirty);
+    xassert(c->extra == NULL);
+
+    grid_row_free(&grid, a);
+    grid_row_free(&grid, c);
+    xassert(grid.arena->live == 0);
+    xassert(grid.arena->slabs == NULL);
+
+    /* Rows beyond a single slab */
+    const size_t count = grid.arena->rows_per_slab + 1;
+    struct row **rows = xcalloc(count, sizeof(rows[0]));
+    for (size_t i = 0; i < count; i++)
+        rows[i] = grid_row_alloc(&grid, true);
+    xassert(grid.arena->slabs->next != NULL);
+
+    grid.rows = rows;
+    grid.num_rows = count;
+    grid_free(&grid);
+    xassert(grid.arena == NULL);
+}
+
+UNITTEST
+{
+    struct grid grid = {.num_rows = 2, .num_cols = 8};
+    grid.rows = xcalloc(grid.num_rows, sizeof(grid.rows[0]));
+
+    struct row *row = grid_row_alloc(&grid, true);
+    grid.rows[0] = row;
+    grid.rows[1] = grid_row_alloc(&grid, true);
+    grid.cur_row = grid.rows[1];
+
+    const char32_t text[] = {
+        U'a', U'b', U'ö', CELL_COMB_CHARS_LO + 42, U'木', CELL_SPACER + 1};
+    for (size_t c = 0; c < ALEN(text); c++)
+        row->cells[c].wc = text[c];
+
+    row->cells[1].attrs.bold = true;
+    row->cells[1].attrs.fg = 0x123456;
+    row->cells[2].attrs.bold = true;
+    row->cells[2].attrs.fg = 0x123456;
+    row->cells[7].attrs.bg = 0xabcdef;
+    row->cells[7].attrs.clean = 0;
+    row->linebreak = true;
+    row->prompt_marker = true;
+
+    struct cell expected[8];
+    memcpy(expected, row->cells, sizeof(expected));
+
+    grid_row_compress(&grid, 0);
+    xassert(grid.rows[0]->compressed);
+    xassert(grid.rows[0]->cells == NULL);
+    xassert(grid.arena->live == 1);
+
+    /* Text count, text (1+1+2+4+3+5 bytes), and four attribute runs */
+    const struct compressed_row *compressed =
+        (const struct compressed_row *)grid.rows[0];
+    xassert(compressed->size == 1 + 16 + 4 * (1 + sizeof(struct attributes)));
+
+    row = grid_row_abs(&grid, 0);
+    xassert(!row->compressed);
+    xassert(row->linebreak);
+    xassert(row->prompt_marker);
+    xassert(grid.decompressed);
+    xassert(memcmp(row->cells, expected, sizeof(expected)) == 0);
+
+    /* Compressed rows are free:d along with the grid */
+    grid_row_compress(&grid, 0);
+    grid_free(&grid);
+
+    /* Same thing, but with the encoded cells in a spill file */
+    grid.rows = xcalloc(grid.num_rows, sizeof(grid.rows[0]));
+    grid.rows[0] = grid_row_alloc(&grid, true);
+    grid.rows[1] = grid_row_alloc(&grid, true);
+    grid.spill = spill_file_new("/tmp");
+    xassert(grid.spill != NULL);
+
+    memcpy(grid.rows[0]->cells, expected, sizeof(expected));
+    grid_row_compress(&grid, 0);
+    xassert(((const struct compressed_row *)grid.rows[0])->spilled);
+
+    struct cell scratch_cells[8];
+    struct row scratch = {.cells = scratch_cells};
+    const struct row *peeked = grid_row_peek(&grid, 0, &scratch);
+    xassert(peeked == &scratch);
+    xassert(grid.rows[0]->compressed);
+    xassert(memcmp(scratch_cells, expected, sizeof(expected)) == 0);
+
+    row = grid_row_abs(&grid, 0);
+    xassert(memcmp(row->cells, expected, sizeof(expected)) == 0);
+
+    grid_row_compress(&grid, 0);
+    grid_free(&grid);
+    xassert(grid.spill == NULL);
+}
+
+UNITTEST
+{
+    struct grid grid = {.num_rows = 3, .num_cols = 8, .cursor = {.point = {.row = 2}}};
+    grid.rows = xcalloc(grid.num_rows, sizeof(grid.rows[0]));
+    grid.rows[1] = grid_row_alloc(&grid, true);
+    grid.rows[2] = grid_row_alloc(&grid, true);
+    grid.cur_row = grid.rows[2];
+
+    const struct attributes attrs = {.bg_src = COLOR_RGB, .bg = 0x102030};
+
+    /* Unallocated rows, and rows with text, are replaced */
+    struct row *row = grid_row_blank(&grid, 0, attrs);
+    xassert(row == grid.rows[0]);
+    xassert(row->blank);
+    xassert(row->cells == NULL);
+    xassert(row->dirty);
+    xassert(grid_row_blank_attrs(row)->bg == 0x102030);
+
+    grid.rows[1]->cells[3].wc = U'x';
+    grid.rows[1]->linebreak = true;
+    row = grid_row_blank(&grid, 1, attrs);
+    xassert(row->linebreak);
+    xassert(grid.arena->live == 1);
+
+    /* Blank rows are left alone by the *_or_blank() accessors... */
+    xassert(grid_row_abs_or_blank(&grid, 1) == row);
+
+    /* ...decoded when peeked at... */
+    struct cell scratch_cells[8];
+    struct row scratch = {.cells = scratch_cells};
+    const struct row *peeked = grid_row_peek(&grid, 1, &scratch);
+    xassert(peeked == &scratch);
+    xassert(!peeked->blank);
+    xassert(peeked->linebreak);
+    for (int c = 0; c < grid.num_cols; c++) {
+        xassert(scratch_cells[c].wc == 0);
+        xassert(scratch_cells[c].attrs.bg == 0x102030);
+    }
+
+    /* ...and materialized by all other accessors */
+    row = grid_row_abs(&grid, 1);
+    xassert(!row->blank);
+    xassert(!row->compressed);
+    xassert(row->linebreak);
+    xassert(!grid.decompressed);
+    xassert(memcmp(row->cells, scratch_cells, sizeof(scratch_cells)) == 0);
+
+    /* Rows without text, and with the same attributes, can be blanked */
+    row->cells[2].attrs.clean = 1;
+    xassert(grid_row_blank_if_empty(&grid, 1));
+    xassert(grid.rows[1]->blank);
+    xassert(grid.rows[1]->linebreak);
+    xassert(!grid_row_blank_if_empty(&grid, 1));
+
+    grid.cur_row = grid.rows[0];
+    grid.rows[2]->cells[7].attrs.bold = true;
+    xassert(!grid_row_blank_if_empty(&grid, 2));
+    grid.rows[2]->cells[7].attrs.bold = false;
+    grid.rows[2]->cells[7].wc = U'x';
+    xassert(!grid_row_blank_if_empty(&grid, 2));
+    grid.cur_row = grid.rows[2];
+
+    /* Shared blank rows are copied as blank rows */
+    struct grid *snapshot = grid_snapshot(&grid, 3);
+    struct row *shared = grid.rows[1];
+    row = grid_row_abs_or_blank(&grid, 1);
+    xassert(row != shared);
+    xassert(row->blank);
+    xassert(shared->shared == 0);
+    grid_free(snapshot);
+    free(snapshot);
+
+    grid_free(&grid);
+
+    /* Empty lines stay blank when reflowed */
+    grid = (struct grid){
+        .num_rows = 4,
+        .num_cols = 10,
+        .cursor = {.point = {.row = 3}},
+        .saved_cursor = {.point = {.row = 3}},
+    };
+    grid.rows = xcalloc(grid.num_rows, sizeof(grid.rows[0]));
+
+    for (int r = 0; r < grid.num_rows; r++) {
+        if (r == 1 || r == 2)
+            grid_row_blank(&grid, r, attrs);
+        else {
+            grid.rows[r] = grid_row_alloc(&grid, true);
+            grid.rows[r]->cells[0].wc = U'a' + r;
+        }
+        grid.rows[r]->linebreak = true;
+    }
+    grid.cur_row = grid.rows[3];
+
+    struct coord *const tracking_points[1] = {NULL};
+    grid_resize_and_reflow(&grid, NULL, 8, 5, 4, 4, 0, tracking_points);
+
+    xassert(grid.offset == 0);
+    xassert(grid.rows[0]->cells[0].wc == U'a');
+    xassert(grid.rows[1]->blank);
+    xassert(grid.rows[1]->linebreak);
+    xassert(grid.rows[2]->blank);
+    xassert(grid.cur_row == grid.rows[3]);
+    xassert(grid.rows[3]->cells[0].wc == U'd');
+
+    grid_free(&grid);
+}
+
+UNITTEST
+{
+    struct grid grid = {.num_rows = 4, .num_cols = 4};
+    grid.rows = xcalloc(grid.num_rows, sizeof(grid.rows[0]));
+    grid.spill = spill_file_new("/tmp");
+    xassert(grid.spill != NULL);
+
+    for (int r = 0; r < 3; r++) {
+        grid.rows[r] = grid_row_alloc(&grid, true);
+        grid.rows[r]->cells[0].wc = U'a' + r;
+    }
+
+    grid_row_uri_range_put(grid.rows[0], 1, "http://foot", 1);
+    grid_row_compress(&grid, 2);
+    grid.cursor.point.row = 1;
+    grid.cur_row = grid.rows[1];
+
+    struct row *const row0 = grid.rows[0];
+    struct row *const row2 = grid.rows[2];
+
+    struct grid *snapshot = grid_snapshot(&grid, 3);
+    xassert(snapshot->arena == grid.arena);
+    xassert(snapshot->rows[0] == row0);
+    xassert(snapshot->rows[2] == row2);
+    xassert(snapshot->rows[3] == NULL);
+    xassert(row0->shared == 1);
+    xassert(row2->shared == 1);
+
+    /* The current row is copied right away */
+    xassert(grid.cur_row == grid.rows[1]);
+    xassert(grid.cur_row != snapshot->rows[1]);
+    xassert(snapshot->rows[1]->shared == 0);
+
+    /* Rows are copied when accessed */
+    struct row *row = grid_row_abs(&grid, 0);
+    xassert(row != row0);
+    xassert(row->shared == 0);
+    xassert(row0->shared == 0);
+    xassert(row->extra != row0->extra);
+    xassert(strcmp(row->extra->uri_ranges.v[0].uri, "http://foot") == 0);
+
+    row->cells[0].wc = U'x';
+    xassert(snapshot->rows[0]->cells[0].wc == U'a');
+
+    /* Re-used rows are simply dropped... */
+    grid_row_free(&grid, grid.rows[2]);
+    grid.rows[2] = NULL;
+    xassert(row2->shared == 0);
+
+    /* ...but are still there in the snapshot */
+    row = grid_row_abs(snapshot, 2);
+    xassert(!row->compressed);
+    xassert(row->cells[0].wc == U'c');
+
+    /* Free:ing the snapshot returns its rows to the shared arena */
+    grid_free(snapshot);
+    free(snapshot);
+    xassert(grid.arena->ref_count == 1);
+    xassert(grid.arena->live == 2);
+
+    /* Rows with too many references are copied right away */
+    row = grid.rows[0];
+    row->shared = UINT8_MAX;
+    snapshot = grid_snapshot(&grid, 3);
+    xassert(snapshot->rows[0] != row);
+    xassert(snapshot->rows[0]->shared == 0);
+    xassert(snapshot->rows[0]->cells[0].wc == U'x');
+    xassert(snapshot->rows[0]->extra != row->extra);
+    xassert(row->shared == UINT8_MAX);
+
+    row->shared = 0;
+    grid_free(snapshot);
+    free(snapshot);
+
+    /* Only the view, and the cursor row, are shared */
+    grid.rows[2] = grid_row_alloc(&grid, true);
+    grid.rows[3] = grid_row_alloc(&grid, true);
+    grid.view = 2;
+
+    snapshot = grid_snapshot(&grid, 2);
+    xassert(snapshot->rows[0] == NULL);
+    xassert(snapshot->rows[1] != NULL);
+    xassert(snapshot->rows[2] == grid.rows[2]);
+    xassert(snapshot->rows[3] == grid.rows[3]);
+    xassert(grid.rows[0]->shared == 0);
+    xassert(grid.rows[3]->shared == 1);
+    xassert(grid_sb_start_ignore_uninitialized(snapshot, 2) == 2);
+
+    grid_free(snapshot);
+    free(snapshot);
+    xassert(grid.rows[3]->shared == 0);
+    xassert(grid.arena->live == 4);
+
+    grid_free(&grid);
+}
+
+UNITTEST
+{
+    struct grid_reclaimer *rc = grid_reclaimer_ref();
+    xassert(rc != NULL);
+    xassert(grid_reclaimer_ref() == rc);
+    grid_reclaimer_unref(rc);
+
+    /* 8 rows; a two row screen at offset 6, and 6 scrollback rows */
+    struct grid grid = {.num_rows = 8, .num_cols = 4, .offset = 6};
+    grid.rows = xcalloc(grid.num_rows, sizeof(grid.rows[0]));
+    grid.spill = spill_file_new("/tmp");
+    xassert(grid.spill != NULL);
+
+    for (int r = 0; r < grid.num_rows; r++) {
+        grid.rows[r] = grid_row_alloc(&grid, true);
+        grid.rows[r]->cells[0].wc = U'a' + r;
+        grid_row_uri_range_put(grid.rows[r], 1, "http://foot", r);
+    }
+
+    grid_row_compress(&grid, 0);
+    grid_row_compress(&grid, 7);
+    grid.cursor.point.row = 0;
+    grid.cur_row = grid.rows[6];
+
+    struct row_arena *const arena = grid.arena;
+
+    /* Scrollback rows, and the arena, are free:d in the background */
+    grid_free_scrollback(&grid, 2);
+    xassert(grid.arena != arena);
+    xassert(grid.arena->live == 2);
+    xassert(grid.cur_row == grid.rows[6]);
+
+    for (int r = 0; r < grid.num_rows; r++) {
+        const struct row *row = grid.rows[r];
+
+        if (r < 6) {
+            xassert(row == NULL);
+            continue;
+        }
+
+        xassert(!row->compressed);
+        xassert(row->cells[0].wc == U'a' + r);
+        xassert(row->extra->uri_ranges.v[0].id == r);
+    }
+
+    grid_free(&grid);
+    xassert(grid.arena == NULL);
+    xassert(grid.spill == NULL);
+
+    /* Waits for the rows to be free:d */
+    grid_reclaimer_unref(rc);
+}
+
+UNITTEST
+{
+    /*
+     * Lazy reflow: 4000 lines ("L000000" - "L003999"), reflowed from
+     * 10 to 5 columns. I.e. each line ends up on two rows.
+     */
+    const int lines = 4000;
+    const int screen_rows = 5;
+
+    for (int pass = 0; pass < 2; pass++) {
+        /* First pass: the new grid cannot hold all lines */
+        const int new_rows = pass == 0 ? 4100 : 9000;
+
+        struct grid grid = {
+            .num_rows = 4100,
+            .num_cols = 10,
+            .offset = lines - screen_rows,
+            .view = lines - screen_rows,
+            .cursor = {.point = {.row = screen_rows - 1}},
+            .saved_cursor = {.point = {.row = screen_rows - 1}},
+        };
+        grid.rows = xcalloc(grid.num_rows, sizeof(grid.rows[0]));
+
+        for (int r = 0; r < lines; r++) {
+            struct row *row = grid_row_alloc(&grid, true);
+            row->linebreak = true;
+            row->cells[0].wc = U'L';
+            for (int c = 6, n = r; c >= 1; c--, n /= 10)
+                row->cells[c].wc = U'0' + n % 10;
+            grid.rows[r] = row;
+        }
+        grid.cur_row = grid.rows[lines - 1];
+
+        struct coord *const tracking_points[1] = {NULL};
+        grid_resize_and_reflow(
+            &grid, NULL, new_rows, 5, screen_rows, screen_rows, 0,
+            tracking_points);
+
+        /* Only the end of the scrollback has been reflowed */
+        xassert(grid.reflow != NULL);
+        xassert(grid_row_abs_to_sb_precalc_sb_start(
+                    &grid,
+                    grid_sb_start_ignore_uninitialized(&grid, screen_rows),
+                    grid.offset) < 100);
+
+        while (grid_reflow_scrollback(&grid, NULL, screen_rows, 1000))
+            ;
+        xassert(grid.reflow == NULL);
+
+        /* The newest lines, in order, without any gaps */
+        const int expected_lines = min(lines, new_rows / 2);
+        const int sb_start = grid_sb_start_ignore_uninitialized(&grid, screen_rows);
+        xassert(grid_row_abs_to_sb_precalc_sb_start(&grid, sb_start, grid.offset) ==
+                2 * expected_lines - screen_rows);
+
+        int line = lines - expected_lines;
+        for (int r = 0; r < 2 * expected_lines; r += 2, line++) {
+            const struct row *head = grid.rows[grid_row_wrap(&grid, sb_start + r)];
+            const struct row *tail = grid.rows[grid_row_wrap(&grid, sb_start + r + 1)];
+
+            xassert(!head->linebreak);
+            xassert(tail->linebreak);
+            xassert(head->cells[0].wc == U'L');
+
+            int n = 0;
+            for (int c = 1; c < 5; c++)
+                n = n * 10 + (head->cells[c].wc - U'0');
+            for (int c = 0; c < 2; c++)
+                n = n * 10 + (tail->cells[c].wc - U'0');
+            xassert(n == line);
+        }
+
+        xassert(line == lines);
+        grid_free(&grid);
+    }
+}
+
+/*
+ * Test helper: reflows all rows of 'old' into 'to', either in one go,
+ * or split up into (at most) 'segments' segments. 'tp' is tracked.
+ */
+static struct reflow
+reflow_test_run(struct grid *old, struct grid *to, struct coord *tp,
+                size_t segments)
+{
+    struct coord terminator = {-1, -1};
+    struct coord *tracking_points[] = {tp, &terminator};
+
+    struct reflow rf = {
+        .from = old,
+        .to = to,
+        .new_row = grid_row_alloc(to, false),
+        .next_tp = tracking_points,
+    };
+    to->rows[0] = rf.new_row;
+
+    if (segments <= 1) {
+        for (int r = 0; r < old->num_rows; r++)
+            reflow_row(&rf, r, r + 1 == old->num_rows);
+    } else
+        reflow_rows_parallel(&rf, 0, 0, old->num_rows, segments, NULL);
+
+    xassert(*rf.next_tp == &terminator);
+    rf.next_tp = NULL;
+
+    for (int r = 0; r < old->num_rows; r++)
+        xassert(old->rows[r] == NULL);
+
+    memset(&rf.new_row->cells[rf.new_col_idx], 0,
+           (to->num_cols - rf.new_col_idx) * sizeof(struct cell));
+    return rf;
+}
+
+/* Test helper: asserts two reflowed grids are identical */
+static void
+reflow_test_compare(const struct grid *a, const struct grid *b)
+{
+    xassert(a->num_rows == b->num_rows);
+    xassert(a->num_cols == b->num_cols);
+
+    for (int r = 0; r < a->num_rows; r++) {
+        const struct row *x = a->rows[r];
+        const struct row *y = b->rows[r];
+
+        xassert((x == NULL) == (y == NULL));
+        if (x == NULL)
+            continue;
+
+        xassert(x->linebreak == y->linebreak);
+        xassert(memcmp(x->cells, y->cells, a->num_cols * sizeof(x->cells[0])) == 0);
+
+        const uint32_t count = x->extra != NULL ? x->extra->uri_ranges.count : 0;
+        xassert(count == (y->extra != NULL ? y->extra->uri_ranges.count : 0));
+
+        for (uint32_t i = 0; i < count; i++) {
+            const struct row_uri_range *u = &x->extra->uri_ranges.v[i];
+            const struct row_uri_range *v = &y->extra->uri_ranges.v[i];
+
+            xassert(u->start == v->start);
+            xassert(u->end == v->end);
+            xassert(u->id == v->id);
+            xassert(strcmp(u->uri, v->uri) == 0);
+        }
+    }
+}
+
+UNITTEST
+{
+    /* Reflowing in segments is the same as reflowing in one go */
+    const int old_rows = 4096;
+    const int new_rows_variants[] = {8192, 1500, 600};
+
+    for (size_t v = 0; v < ALEN(new_rows_variants); v++) {
+        const int new_rows = new_rows_variants[v];
+
+        struct grid old[2];
+        struct grid to[2];
+        struct coord tp[2];
+        struct reflow rf[2];
+
+        for (int i = 0; i < 2; i++) {
+            old[i] = (struct grid){
+                .num_rows = old_rows,
+                .num_cols = 8,
+                .rows = xcalloc(old_rows, sizeof(old[i].rows[0])),
+            };
+
+            for (int r = 0; r < old_rows; r++) {
+                struct row *row = grid_row_alloc(&old[i], true);
+                const int len = r % 3 != 0 ? 8 : r % 7;
+
+                for (int c = 0; c < len; c++) {
+                    if (r % 5 == 0 && c == 3 && len > 4) {
+                        row->cells[c++].wc = 0x4e00;
+                        row->cells[c].wc = CELL_SPACER + 1;
+                    } else
+                        row->cells[c].wc = U'a' + (r + c) % 26;
+                }
+
+                row->linebreak = r % 3 == 0 || r + 1 == old_rows;
+                old[i].rows[r] = row;
+            }
+
+            to[i] = (struct grid){
+                .num_rows = new_rows,
+                .num_cols = 5,
+                .rows = xcalloc(new_rows, sizeof(to[i].rows[0])),
+            };
+
+            tp[i] = (struct coord){.col = 2, .row = 3000};
+            rf[i] = reflow_test_run(&old[i], &to[i], &tp[i], i == 0 ? 1 : 7);
+        }
+
+        xassert(rf[0].new_row_idx == rf[1].new_row_idx);
+        xassert(rf[0].new_col_idx == rf[1].new_col_idx);
+        xassert(tp[0].row == tp[1].row);
+        xassert(tp[0].col == tp[1].col);
+        reflow_test_compare(&to[0], &to[1]);
+
+        for (int i = 0; i < 2; i++) {
+            grid_free(&old[i]);
+            grid_free(&to[i]);
+        }
+    }
+}
+
+UNITTEST
+{
+    /*
+     * A logical line (rows 2800-4039) longer than a segment (4096 / 7
+     * rows), with a URI, and a tracking point, in it. The segments
+     * must not split the line, and must leave the old rows' URIs
+     * alone.
+     */
+    const int old_rows = 4096;
+    const int new_rows_variants[] = {8192, 3000};
+
+    for (size_t v = 0; v < ALEN(new_rows_variants); v++) {
+        const int new_rows = new_rows_variants[v];
+
+        struct grid old[2];
+        struct grid to[2];
+        struct coord tp[2];
+        struct reflow rf[2];
+
+        for (int i = 0; i < 2; i++) {
+            old[i] = (struct grid){
+                .num_rows = old_rows,
+                .num_cols = 8,
+                .rows = xcalloc(old_rows, sizeof(old[i].rows[0])),
+            };
+
+            for (int r = 0; r < old_rows; r++) {
+                struct row *row = grid_row_alloc(&old[i], true);
+                for (int c = 0; c < 8; c++)
+                    row->cells[c].wc = U'a' + (r + c) % 26;
+
+                row->linebreak =
+                    (r % 40 == 39 && (r < 2800 || r >= 4000)) ||
+                    r + 1 == old_rows;
+                old[i].rows[r] = row;
+
+                ensure_row_has_extra_data(row);
+                if (r >= 2800 && r < 4040) {
+                    uri_range_append(
+                        row->extra, r == 2800 ? 2 : 0, r == 4039 ? 3 : 7,
+                        1, "http://long");
+                } else if (r % 40 == 10)
+                    uri_range_append(row->extra, 3, 5, r, "http://short");
+            }
+
+            to[i] = (struct grid){
+                .num_rows = new_rows,
+                .num_cols = 5,
+                .rows = xcalloc(new_rows, sizeof(to[i].rows[0])),
+            };
+
+            tp[i] = (struct coord){.col = 4, .row = 3500};
+            rf[i] = reflow_test_run(&old[i], &to[i], &tp[i], i == 0 ? 1 : 7);
+        }
+
+        xassert(rf[0].new_row_idx == rf[1].new_row_idx);
+        xassert(rf[0].new_col_idx == rf[1].new_col_idx);
+        xassert(tp[0].row == tp[1].row);
+        xassert(tp[0].col == tp[1].col);
+        reflow_test_compare(&to[0], &to[1]);
+
+        /* The tracked cell moved along */
+        const struct row *row = to[1].rows[tp[1].row];
+        xassert(row != NULL);
+        xassert(row->cells[tp[1].col].wc == U'a' + 3504 % 26);
+
+        for (int i = 0; i < 2; i++) {
+            grid_free(&old[i]);
+            grid_free(&to[i]);
+        }
+    }
+}
@@ -1,26 +1,128 @@
 #pragma once
 
+#include <limits.h>
 #include <stddef.h>
 #include "debug.h"
 #include "terminal.h"
 
-struct grid *grid_snapshot(const struct grid *grid);
+/*
+ * Takes a copy-on-write snapshot of the 'view_rows' rows of the view,
+ * and the cursor row. All other rows are NULL in the snapshot. The
+ * snapshot shares its rows (and the row arena, and spill file) with
+ * 'grid'; a row is copied when either of them accesses it with
+ * grid_row_abs(). The snapshot must be free:d before 'grid' is
+ * resized.
+ *
+ * A pending lazy reflow (see grid_reflow_scrollback()) is left with
+ * 'grid'; the view has always been reflowed.
+ */
+struct grid *grid_snapshot(struct grid *grid, int view_rows);
 void grid_free(struct grid *grid);
 
+/*
+ * Frees all scrollback rows, i.e. all rows except the 'screen_rows'
+ * rows starting at grid->offset, and the scrollback not yet reflowed.
+ * grid->cur_row is updated, but any other pointers to the screen rows
+ * are invalidated.
+ */
+void grid_free_scrollback(struct grid *grid, int screen_rows);
+
+/*
+ * grid_free() and grid_free_scrollback() hand the rows over to a
+ * background thread, shared by all terminals in the process, as long as
+ * it has been started with grid_reclaimer_ref(). The last
+ * grid_reclaimer_unref() waits for it to finish.
+ *
+ * Returns NULL if the thread could not be started; rows are then
+ * free:d right away.
+ */
+struct grid_reclaimer;
+struct grid_reclaimer *grid_reclaimer_ref(void);
+void grid_reclaimer_unref(struct grid_reclaimer *reclaimer);
+
 void grid_swap_row(struct grid *grid, int row_a, int row_b);
-struct row *grid_row_alloc(int cols, bool initialize);
-void grid_row_free(struct row *row);
+struct row *grid_row_alloc(struct grid *grid, bool initialize);
+void grid_row_free(struct grid *grid, struct row *row);
+
+/*
+ * Compresses, or decompresses, the row at the absolute row number
+ * 'abs_row'. Both replace the row in grid->rows; any pointers to the
+ * old row are invalidated.
+ */
+void grid_row_compress(struct grid *grid, int abs_row);
+struct row *grid_row_decompress(struct grid *grid, int abs_row);
+
+/*
+ * Blank rows have no text, and the same attributes in all cells
+ * (e.g. an erased line). They have no cells at all, until they are
+ * accessed with grid_row_abs(), or any of the other grid_row*()
+ * accessors, which materialize them. Code that can handle them as
+ * they are uses the *_or_blank() accessors instead, and reads the
+ * shared attributes with grid_row_blank_attrs().
+ *
+ * grid_row_blank() replaces the row at 'abs_row' (which may be NULL)
+ * with a blank row, and marks it dirty. Its line break, and prompt
+ * marker, are kept. Any pointers to the old row are invalidated.
+ *
+ * grid_row_blank_if_empty() does the same, but only if the row has no
+ * text, and no per-cell attributes. Returns true if it was replaced.
+ */
+struct row *grid_row_blank(
+    struct grid *grid, int abs_row, struct attributes attrs);
+bool grid_row_blank_if_empty(struct grid *grid, int abs_row);
+struct attributes *grid_row_blank_attrs(const struct row *row);
+
+/*
+ * Replaces the shared row at 'abs_row' (see grid_snapshot()) with a
+ * private, decompressed, copy. Blank rows are copied as blank rows.
+ */
+struct row *grid_row_unshare(struct grid *grid, int abs_row);
+
+/*
+ * Returns the row at 'abs_row', without decompressing it in the
+ * grid. Instead, compressed (and blank) rows are decoded into
+ * 'scratch', whose 'cells' must have room for grid->num_cols cells.
+ */
+const struct row *grid_row_peek(
+    const struct grid *grid, int abs_row, struct row *scratch);
 
 void grid_resize_without_reflow(
     struct grid *grid, int new_rows, int new_cols,
     int old_screen_rows, int new_screen_rows);
 
+/*
+ * Large reflows are split up at hard line breaks, and the pieces are
+ * reflowed in parallel, by the render worker threads in 'workers'
+ * (which may be NULL).
+ */
+struct render_worker_pool;
+
 void grid_resize_and_reflow(
-    struct grid *grid, int new_rows, int new_cols,
+    struct grid *grid, struct render_worker_pool *workers,
+    int new_rows, int new_cols,
     int old_screen_rows, int new_screen_rows,
     size_t tracking_points_count,
     struct coord *const _tracking_points[static tracking_points_count]);
 
+/*
+ * grid_resize_and_reflow() only reflows the screen, the tracking
+ * points, and the last screen of scrollback, right away. The rest of
+ * the scrollback is left in grid->reflow, and reflowed, in chunks, by
+ * grid_reflow_scrollback(). Until then, the grid looks as if the
+ * scrollback hadn't been filled yet.
+ *
+ * grid_reflow_scrollback() reflows (at least) the 'count' newest
+ * rows left, or all of them if 'count' is negative. Returns true if
+ * there are rows left to reflow.
+ *
+ * Note that reflowed rows may come with sixels; these are *not*
+ * inserted in sorted order.
+ */
+bool grid_reflow_scrollback(
+    struct grid *grid, struct render_worker_pool *workers,
+    int screen_rows, int count);
+void grid_reflow_discard(struct grid *grid);
+
 /* Convert row numbers between scrollback-relative and absolute coordinates */
 int grid_row_abs_to_sb(const struct grid *grid, int screen_rows, int abs_row);
 int grid_row_sb_to_abs(const struct grid *grid, int screen_rows, int sb_rel_row);
@@ -31,16 +133,93 @@ int grid_row_abs_to_sb_precalc_sb_start(
 int grid_row_sb_to_abs_precalc_sb_start(
     const struct grid *grid, int sb_start, int sb_rel_row);
 
+/*
+ * The grid is a ring buffer of 'num_rows' rows (screen rows plus
+ * scrollback lines), which is *not* necessarily a power of two. Thus,
+ * row numbers cannot be masked; instead, wrap them with this.
+ *
+ * Virtually all row numbers are less than one lap outside the ring,
+ * and are wrapped with a single compare-and-adjust. Only rows further
+ * away than that need a division.
+ */
+static inline int
+_grid_row_wrap(int row, int num_rows)
+{
+    if (likely(row >= 0)) {
+        if (likely(row < num_rows))
+            return row;
+        if (likely(row - num_rows < num_rows))
+            return row - num_rows;
+    } else if (likely(row >= -num_rows))
+        return row + num_rows;
+
+    if (unlikely(num_rows == 0))
+        return row;
+
+    const int wrapped = row % num_rows;
+    return wrapped < 0 ? wrapped + num_rows : wrapped;
+}
+
+static inline int
+grid_row_wrap(const struct grid *grid, int row)
+{
+    return _grid_row_wrap(row, grid->num_rows);
+}
+
 static inline int
 grid_row_absolute(const struct grid *grid, int row_no)
 {
-    return (grid->offset + row_no) & (grid->num_rows - 1);
+    return grid_row_wrap(grid, grid->offset + row_no);
 }
 
 static inline int
 grid_row_absolute_in_view(const struct grid *grid, int row_no)
 {
-    return (grid->view + row_no) & (grid->num_rows - 1);
+    return grid_row_wrap(grid, grid->view + row_no);
+}
+
+/* Whether 'row' can be used as is; i.e. it is neither shared, nor compressed */
+static inline bool
+grid_row_is_plain(const struct row *row)
+{
+    return row == NULL || (row->shared == 0 && !row->compressed);
+}
+
+/*
+ * Returns the row at the absolute row number 'abs_row', or NULL if
+ * it hasn't been allocated. Shared rows are copied, and compressed
+ * rows, except blank rows, are decompressed.
+ */
+static inline struct row *
+grid_row_abs_or_blank(struct grid *grid, int abs_row)
+{
+    struct row *row = grid->rows[abs_row];
+
+    if (likely(grid_row_is_plain(row)))
+        return row;
+
+    if (row->shared > 0)
+        row = grid_row_unshare(grid, abs_row);
+    if (row->compressed && !row->blank)
+        row = grid_row_decompress(grid, abs_row);
+
+    return row;
+}
+
+/* Like grid_row_abs_or_blank(), but blank rows are materialized too */
+static inline struct row *
+grid_row_abs(struct grid *grid, int abs_row)
+{
+    struct row *row = grid->rows[abs_row];
+
+    if (likely(grid_row_is_plain(row)))
+        return row;
+
+    row = grid_row_abs_or_blank(grid, abs_row);
+    if (row->blank)
+        row = grid_row_decompress(grid, abs_row);
+
+    return row;
 }
 
 static inline struct row *
@@ -49,10 +228,10 @@ _grid_row_maybe_alloc(struct grid *grid, int row_no, bool alloc_if_null)
     xassert(grid->offset >= 0);
 
     int real_row = grid_row_absolute(grid, row_no);
-    struct row *row = grid->rows[real_row];
+    struct row *row = grid_row_abs(grid, real_row);
 
     if (row == NULL && alloc_if_null) {
-        row = grid_row_alloc(grid->num_cols, false);
+        row = grid_row_alloc(grid, false);
         grid->rows[real_row] = row;
     }
 
@@ -72,18 +251,75 @@ grid_row_and_alloc(struct grid *grid, int row_no)
     return _grid_row_maybe_alloc(grid, row_no, true);
 }
 
+static inline struct row *
+grid_row_or_blank(struct grid *grid, int row_no)
+{
+    struct row *row = grid_row_abs_or_blank(
+        grid, grid_row_absolute(grid, row_no));
+
+    xassert(row != NULL);
+    return row;
+}
+
 static inline struct row *
 grid_row_in_view(struct grid *grid, int row_no)
 {
     xassert(grid->view >= 0);
 
     int real_row = grid_row_absolute_in_view(grid, row_no);
-    struct row *row = grid->rows[real_row];
+    struct row *row = grid_row_abs(grid, real_row);
 
     xassert(row != NULL);
     return row;
 }
 
+static inline struct row *
+grid_row_in_view_or_blank(struct grid *grid, int row_no)
+{
+    xassert(grid->view >= 0);
+
+    struct row *row = grid_row_abs_or_blank(
+        grid, grid_row_absolute_in_view(grid, row_no));
+
+    xassert(row != NULL);
+    return row;
+}
+
+/*
+ * Marks the row as dirty, and extends its dirty column span to
+ * include [start, end]. The cells' 'clean' bits must be cleared by
+ * the caller; the renderer only looks at cells inside the span.
+ */
+static inline void
+grid_row_dirty_range(struct row *row, int start, int end)
+{
+    xassert(start <= end);
+
+    if (!row->dirty) {
+        row->dirty = true;
+        row->dirty_start = start;
+        row->dirty_end = end;
+        return;
+    }
+
+    if (start < row->dirty_start)
+        row->dirty_start = start;
+    if (end > row->dirty_end)
+        row->dirty_end = end;
+}
+
+static inline void
+grid_row_dirty_cell(struct row *row, int col)
+{
+    grid_row_dirty_range(row, col, col);
+}
+
+static inline void
+grid_row_dirty_all(struct row *row)
+{
+    grid_row_dirty_range(row, 0, INT_MAX);
+}
+
 void grid_row_uri_range_put(
     struct row *row, int col, const char *uri, uint64_t id);
 void grid_row_uri_range_add(struct row *row, struct row_uri_range range);
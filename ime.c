@@ -10,6 +10,7 @@
 #define LOG_ENABLE_DBG 0
 #include "log.h"
 #include "char32.h"
+#include "grid.h"
 #include "render.h"
 #include "search.h"
 #include "terminal.h"
@@ -472,7 +473,7 @@ ime_update_cursor_rect(struct seat *seat)
     int row = term->grid->cursor.point.row;
     row += term->grid->offset;
     row -= term->grid->view;
-    row &= term->grid->num_rows - 1;
+    row = grid_row_wrap(term->grid, row);
     x = term->margins.left + col * term->cell_width;
     y = term->margins.top + row * term->cell_height;
 
@@ -260,6 +260,7 @@ execute_binding(struct seat *seat, struct terminal *term,
         bool success;
         switch (action) {
         case BIND_ACTION_PIPE_SCROLLBACK:
+            term_reflow_scrollback(term, -1);
             success = term_scrollback_to_text(term, &text, &len);
             break;
 
@@ -406,9 +407,9 @@ execute_binding(struct seat *seat, struct terminal *term,
         }
 
         /* Check each row from view+1, to the bottom of the scrollback */
-        for (int r_abs = (grid->view + 1) & (num_rows - 1);
+        for (int r_abs = _grid_row_wrap(grid->view + 1, num_rows);
              ;
-             r_abs = (r_abs + 1) & (num_rows - 1))
+             r_abs = _grid_row_wrap(r_abs + 1, num_rows))
         {
             const struct row *row = grid->rows[r_abs];
             xassert(row != NULL);
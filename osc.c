@@ -652,7 +652,7 @@ osc_dispatch(struct terminal *term)
 
                         if (dirty) {
                             cell->attrs.clean = 0;
-                            row->dirty = true;
+                            grid_row_dirty_cell(row, c);
                         }
                     }
                 }
@@ -0,0 +1,457 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "terminal.h"
+#include "util.h"
+
+/*
+ * Cell layout benchmark: compares foot's cell layout (struct cell; a
+ * code point, and the full 8-byte attributes) with a compact, 8-byte,
+ * layout, where each cell stores the code point, the per-cell state
+ * bits (clean, selected etc), and an index into an interned
+ * attribute table.
+ *
+ * Both layouts are filled with the same content, and then scanned
+ * the way search/extraction (code points only) and the renderer
+ * (code points and colors) do.
+ *
+ * Workloads:
+ *   - sparse: regular text, with a handful of attribute changes per
+ *     row (e.g. compiler output, colored logs)
+ *   - dense: every cell has a different foreground color (e.g.
+ *     lolcat, true color gradients)
+ */
+
+struct compact_cell {
+    char32_t wc;
+    uint32_t clean:1;
+    uint32_t confined:1;
+    uint32_t selected:1;
+    uint32_t url:1;
+    uint32_t attrs_idx:28;
+};
+static_assert(sizeof(struct compact_cell) == 8, "bad size");
+
+struct attr_table {
+    struct attributes *attrs;   /* Index -> attributes */
+    uint32_t count;
+    uint32_t capacity;
+
+    uint32_t *buckets;          /* Index + 1, or 0 if empty */
+    uint32_t bucket_mask;
+};
+
+struct workload {
+    const char *name;
+    void (*generate)(int row, int col, char32_t *wc, struct attributes *attrs);
+};
+
+struct result {
+    size_t bytes;
+    double fill;
+    double scan_text;
+    double scan_colors;
+};
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool
+parse_int(const char *opt_name, const char *value, int min, int *res)
+{
+    char *end;
+    errno = 0;
+    long v = strtol(value, &end, 10);
+
+    if (errno != 0 || *end != '\0' || v < min || v > INT32_MAX / 2) {
+        fprintf(stderr, "error: --%s=%s: invalid value\n", opt_name, value);
+        return false;
+    }
+
+    *res = v;
+    return true;
+}
+
+static void
+usage(const char *prog_name)
+{
+    printf(
+        "Usage: %s [OPTIONS...]\n"
+        "\n"
+        "Options:\n"
+        "  -r,--repetitions=N   number of timed runs (5)\n"
+        "  -R,--rows=N          number of rows (65536)\n"
+        "  -C,--cols=N          number of columns (200)\n"
+        "  -h,--help            show this help and exit\n",
+        prog_name);
+}
+
+/* Interned attributes don't include the per-cell state bits */
+static uint64_t
+attrs_key(struct attributes attrs)
+{
+    attrs.clean = 0;
+    attrs.confined = 0;
+    attrs.selected = 0;
+    attrs.url = 0;
+
+    uint64_t key;
+    memcpy(&key, &attrs, sizeof(key));
+    return key;
+}
+
+static uint32_t
+attrs_hash(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    return (uint32_t)key;
+}
+
+static void
+attr_table_init(struct attr_table *table)
+{
+    *table = (struct attr_table){
+        .capacity = 64,
+        .attrs = malloc(64 * sizeof(table->attrs[0])),
+        .bucket_mask = 127,
+        .buckets = calloc(128, sizeof(table->buckets[0])),
+    };
+}
+
+static void
+attr_table_destroy(struct attr_table *table)
+{
+    free(table->attrs);
+    free(table->buckets);
+}
+
+static size_t
+attr_table_size(const struct attr_table *table)
+{
+    return table->capacity * sizeof(table->attrs[0]) +
+        (table->bucket_mask + 1) * sizeof(table->buckets[0]);
+}
+
+static void
+attr_table_rehash(struct attr_table *table)
+{
+    const uint32_t bucket_count = (table->bucket_mask + 1) * 2;
+
+    free(table->buckets);
+    table->buckets = calloc(bucket_count, sizeof(table->buckets[0]));
+    table->bucket_mask = bucket_count - 1;
+
+    for (uint32_t i = 0; i < table->count; i++) {
+        uint32_t b = attrs_hash(attrs_key(table->attrs[i])) & table->bucket_mask;
+        while (table->buckets[b] != 0)
+            b = (b + 1) & table->bucket_mask;
+        table->buckets[b] = i + 1;
+    }
+}
+
+static uint32_t
+attr_table_intern(struct attr_table *table, struct attributes attrs)
+{
+    const uint64_t key = attrs_key(attrs);
+    uint32_t b = attrs_hash(key) & table->bucket_mask;
+
+    for (; table->buckets[b] != 0; b = (b + 1) & table->bucket_mask) {
+        const uint32_t idx = table->buckets[b] - 1;
+        if (attrs_key(table->attrs[idx]) == key)
+            return idx;
+    }
+
+    if (table->count == table->capacity) {
+        table->capacity *= 2;
+        table->attrs = realloc(
+            table->attrs, table->capacity * sizeof(table->attrs[0]));
+    }
+
+    const uint32_t idx = table->count++;
+    table->attrs[idx] = attrs;
+    table->buckets[b] = idx + 1;
+
+    /* Keep the load factor below 50% */
+    if (table->count * 2 > table->bucket_mask + 1)
+        attr_table_rehash(table);
+
+    return idx;
+}
+
+static void
+generate_sparse(int row, int col, char32_t *wc, struct attributes *attrs)
+{
+    static const struct attributes palette[] = {
+        {.clean = 1},
+        {.clean = 1, .bold = true},
+        {.clean = 1, .fg_src = COLOR_BASE16, .fg = 1},
+        {.clean = 1, .fg_src = COLOR_BASE16, .fg = 2, .bold = true},
+        {.clean = 1, .fg_src = COLOR_BASE16, .fg = 3},
+        {.clean = 1, .fg_src = COLOR_BASE256, .fg = 244},
+        {.clean = 1, .underline = true},
+        {.clean = 1, .fg_src = COLOR_BASE16, .fg = 4, .bg_src = COLOR_BASE16, .bg = 0},
+    };
+
+    /* Lines of varying length, with a new attribute every 24 cells */
+    const int len = 40 + (row * 37) % 120;
+
+    *wc = col < len ? U'a' + (row + col) % 26 : 0;
+    *attrs = palette[((row + col / 24) * 5) % ALEN(palette)];
+}
+
+static void
+generate_dense(int row, int col, char32_t *wc, struct attributes *attrs)
+{
+    /* Diagonal RGB gradient; every cell differs from its neighbors */
+    const uint32_t r = (row * 3 + col * 5) & 0xff;
+    const uint32_t g = (row * 7 + col * 2) & 0xff;
+    const uint32_t b = 0x80;
+
+    *wc = U'a' + (row + col) % 26;
+    *attrs = (struct attributes){
+        .clean = 1,
+        .fg_src = COLOR_RGB,
+        .fg = r << 16 | g << 8 | b,
+    };
+}
+
+/*
+ * The fill loops mimic term_print(); attributes are only (re-)interned
+ * when they change, like they would on an SGR sequence.
+ */
+
+static void
+fill_cells(struct cell *cells, int rows, int cols, const struct workload *w)
+{
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < cols; c++) {
+            struct cell *cell = &cells[(size_t)r * cols + c];
+            w->generate(r, c, &cell->wc, &cell->attrs);
+        }
+    }
+}
+
+static void
+fill_compact(struct compact_cell *cells, struct attr_table *table,
+             int rows, int cols, const struct workload *w)
+{
+    uint64_t last_key = UINT64_MAX;
+    uint32_t idx = 0;
+
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < cols; c++) {
+            char32_t wc;
+            struct attributes attrs;
+            w->generate(r, c, &wc, &attrs);
+
+            const uint64_t key = attrs_key(attrs);
+            if (key != last_key) {
+                idx = attr_table_intern(table, attrs);
+                last_key = key;
+            }
+
+            cells[(size_t)r * cols + c] = (struct compact_cell){
+                .wc = wc,
+                .clean = attrs.clean,
+                .attrs_idx = idx,
+            };
+        }
+    }
+}
+
+/* Search/extraction: code points only */
+
+static size_t
+scan_text_cells(const struct cell *cells, size_t count)
+{
+    size_t hits = 0;
+    for (size_t i = 0; i < count; i++)
+        hits += cells[i].wc == U'e';
+    return hits;
+}
+
+static size_t
+scan_text_compact(const struct compact_cell *cells, size_t count)
+{
+    size_t hits = 0;
+    for (size_t i = 0; i < count; i++)
+        hits += cells[i].wc == U'e';
+    return hits;
+}
+
+/* Renderer: code points, and colors */
+
+static uint64_t
+scan_colors_cells(const struct cell *cells, size_t count)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        const struct attributes *a = &cells[i].attrs;
+        sum += cells[i].wc + a->fg + a->bg + a->bold + a->reverse;
+    }
+    return sum;
+}
+
+static uint64_t
+scan_colors_compact(const struct compact_cell *cells,
+                    const struct attr_table *table, size_t count)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        const struct attributes *a = &table->attrs[cells[i].attrs_idx];
+        sum += cells[i].wc + a->fg + a->bg + a->bold + a->reverse;
+    }
+    return sum;
+}
+
+static void
+keep(uint64_t value)
+{
+    /* Prevent the compiler from optimizing away the scans */
+    static volatile uint64_t sink;
+    sink += value;
+}
+
+static void
+min_time(double *best, double elapsed)
+{
+    if (*best < 0. || elapsed < *best)
+        *best = elapsed;
+}
+
+static void
+print_result(const char *workload, const char *layout,
+             const struct result *res, size_t cell_count)
+{
+    printf("%-6s %-7s: %7.1f MB (%5.2f bytes/cell), fill: %7.3fms, "
+           "text scan: %7.3fms, color scan: %7.3fms\n",
+           workload, layout,
+           res->bytes / 1024. / 1024., (double)res->bytes / cell_count,
+           res->fill * 1000., res->scan_text * 1000.,
+           res->scan_colors * 1000.);
+}
+
+int
+main(int argc, char *const *argv)
+{
+    static const struct option longopts[] = {
+        {"repetitions", required_argument, NULL, 'r'},
+        {"rows",        required_argument, NULL, 'R'},
+        {"cols",        required_argument, NULL, 'C'},
+        {"help",        no_argument,       NULL, 'h'},
+        {NULL,          no_argument,       NULL, 0},
+    };
+
+    int repetitions = 5;
+    int rows = 65536;
+    int cols = 200;
+
+    while (true) {
+        int c = getopt_long(argc, argv, "+r:R:C:h", longopts, NULL);
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'r':
+            if (!parse_int("repetitions", optarg, 1, &repetitions))
+                return EXIT_FAILURE;
+            break;
+
+        case 'R':
+            if (!parse_int("rows", optarg, 1, &rows))
+                return EXIT_FAILURE;
+            break;
+
+        case 'C':
+            if (!parse_int("cols", optarg, 1, &cols))
+                return EXIT_FAILURE;
+            break;
+
+        case 'h':
+            usage(argv[0]);
+            return EXIT_SUCCESS;
+
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    static const struct workload workloads[] = {
+        {"sparse", &generate_sparse},
+        {"dense", &generate_dense},
+    };
+
+    const size_t count = (size_t)rows * cols;
+    struct cell *cells = malloc(count * sizeof(cells[0]));
+    struct compact_cell *compact = malloc(count * sizeof(compact[0]));
+
+    if (cells == NULL || compact == NULL) {
+        fprintf(stderr, "error: failed to allocate %zu cells\n", count);
+        free(cells);
+        free(compact);
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < ALEN(workloads); i++) {
+        const struct workload *w = &workloads[i];
+
+        struct result res_cells = {.fill = -1., .scan_text = -1., .scan_colors = -1.};
+        struct result res_compact = res_cells;
+        size_t interned = 0;
+
+        for (int j = 0; j < repetitions; j++) {
+            double start = now();
+            fill_cells(cells, rows, cols, w);
+            min_time(&res_cells.fill, now() - start);
+
+            start = now();
+            keep(scan_text_cells(cells, count));
+            min_time(&res_cells.scan_text, now() - start);
+
+            start = now();
+            keep(scan_colors_cells(cells, count));
+            min_time(&res_cells.scan_colors, now() - start);
+
+            struct attr_table table;
+            attr_table_init(&table);
+
+            start = now();
+            fill_compact(compact, &table, rows, cols, w);
+            min_time(&res_compact.fill, now() - start);
+
+            start = now();
+            keep(scan_text_compact(compact, count));
+            min_time(&res_compact.scan_text, now() - start);
+
+            start = now();
+            keep(scan_colors_compact(compact, &table, count));
+            min_time(&res_compact.scan_colors, now() - start);
+
+            res_compact.bytes = count * sizeof(compact[0]) + attr_table_size(&table);
+            interned = table.count;
+            attr_table_destroy(&table);
+        }
+
+        res_cells.bytes = count * sizeof(cells[0]);
+
+        print_result(w->name, "cell", &res_cells, count);
+        print_result(w->name, "compact", &res_compact, count);
+        printf("%-6s %-7s: %zu interned attributes\n", w->name, "", interned);
+    }
+
+    free(cells);
+    free(compact);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,496 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#include "headless.h"
+#include "vt.h"
+
+/*
+ * Headless VT benchmark: feeds stimuli files to a terminal instance
+ * without a Wayland connection, and reports the throughput of the
+ * VT parser and the grid.
+ *
+ * By default, data is fed directly to vt_from_slave(). With --ptmx,
+ * it is instead read by fdm_ptmx(), from a memory FD, just like the
+ * PGO helper does.
+ *
+ * With --render, a frame is rendered to an offscreen buffer every N
+ * bytes, using the regular renderer (and render worker threads).
+ */
+
+extern bool fdm_ptmx(struct fdm *fdm, int fd, int events, void *data);
+
+/* Same chunk size as fdm_ptmx() reads with */
+#define CHUNK_SIZE (24 * 1024)
+
+struct result {
+    const char *path;
+    size_t bytes;
+    size_t cells;
+    size_t frames;
+    double best;
+    double mean;
+};
+
+static void
+usage(const char *prog_name)
+{
+    printf(
+        "Usage: %s [OPTIONS...] stimuli-file1 stimuli-file2 ... stimuli-fileN\n"
+        "\n"
+        "Options:\n"
+        "  -w,--warmup=N        number of untimed runs (1)\n"
+        "  -r,--repetitions=N   number of timed runs (5)\n"
+        "  -R,--rows=N          number of rows in the grid (67)\n"
+        "  -C,--cols=N          number of columns in the grid (135)\n"
+        "  -s,--scrollback=N    number of scrollback lines (16317)\n"
+        "  -p,--ptmx            feed data through fdm_ptmx(), rather than\n"
+        "                       directly to vt_from_slave()\n"
+        "  -f,--render=N        render a frame every N bytes (0, i.e. never)\n"
+        "  -F,--font=PATTERN    font to render with (monospace:pixelsize=15)\n"
+        "  -W,--workers=N       number of render worker threads (0)\n"
+        "  -G,--glyph-cache=N   glyph cache size, in cells, per render thread\n"
+        "                       (0, i.e. disabled)\n"
+        "  -j,--json            output results as JSON\n"
+        "  -h,--help            show this help and exit\n",
+        prog_name);
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool
+parse_int(const char *opt_name, const char *value, int min, int *res)
+{
+    char *end;
+    errno = 0;
+    long v = strtol(value, &end, 10);
+
+    if (errno != 0 || *end != '\0' || v < min || v > INT32_MAX / 2) {
+        fprintf(stderr, "error: --%s=%s: invalid value\n", opt_name, value);
+        return false;
+    }
+
+    *res = v;
+    return true;
+}
+
+/*
+ * Approximates the number of cells written by the stimuli: printable
+ * characters, outside of escape sequences and control strings. Wide
+ * and combining characters count as a single cell.
+ */
+static size_t
+count_cells(const uint8_t *data, size_t len)
+{
+    size_t cells = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        const uint8_t c = data[i];
+
+        if (c == '\x1b' && i + 1 < len) {
+            const uint8_t intro = data[++i];
+
+            if (intro == '[') {
+                /* CSI: parameters and intermediates, then a final byte */
+                while (i + 1 < len && (data[i + 1] < 0x40 || data[i + 1] > 0x7e))
+                    i++;
+                i++;
+            }
+
+            else if (intro == ']' || intro == 'P' || intro == '_' ||
+                     intro == '^' || intro == 'X')
+            {
+                /* OSC, DCS, APC, PM and SOS: terminated by BEL, or ST */
+                while (i + 1 < len) {
+                    i++;
+                    if (data[i] == '\a')
+                        break;
+                    if (data[i] == '\x1b' && i + 1 < len && data[i + 1] == '\\') {
+                        i++;
+                        break;
+                    }
+                }
+            }
+
+            else {
+                /* Intermediates, then a final byte */
+                while (i < len && data[i] >= 0x20 && data[i] <= 0x2f)
+                    i++;
+            }
+
+            continue;
+        }
+
+        if (c < 0x20 || c == 0x7f)
+            continue;
+
+        /* UTF-8 continuation bytes are part of an already counted character */
+        if ((c & 0xc0) == 0x80)
+            continue;
+
+        cells++;
+    }
+
+    return cells;
+}
+
+static size_t
+feed(struct headless *headless, const uint8_t *data, size_t len,
+     size_t render_interval)
+{
+    struct terminal *term = &headless->term;
+    const size_t chunk_size = render_interval > 0 && render_interval < CHUNK_SIZE
+        ? render_interval : CHUNK_SIZE;
+
+    size_t frames = 0;
+    size_t since_last_frame = 0;
+
+    for (size_t ofs = 0; ofs < len; ofs += chunk_size) {
+        size_t count = len - ofs < chunk_size ? len - ofs : chunk_size;
+        vt_from_slave(term, &data[ofs], count);
+
+        since_last_frame += count;
+        if (render_interval > 0 && since_last_frame >= render_interval) {
+            headless_render(headless);
+            since_last_frame = 0;
+            frames++;
+        }
+    }
+
+    return frames;
+}
+
+static bool
+feed_ptmx(struct headless *headless, int mem_fd, size_t len,
+          size_t render_interval, size_t *frames)
+{
+    struct terminal *term = &headless->term;
+    term->ptmx = mem_fd;
+    lseek(mem_fd, 0, SEEK_SET);
+
+    off_t last_frame = 0;
+    off_t ofs;
+    *frames = 0;
+
+    while ((ofs = lseek(mem_fd, 0, SEEK_CUR)) < (off_t)len) {
+        if (!fdm_ptmx(NULL, -1, EPOLLIN, term)) {
+            fprintf(stderr, "error: fdm_ptmx() failed\n");
+            return false;
+        }
+
+        ofs = lseek(mem_fd, 0, SEEK_CUR);
+        if (render_interval > 0 && ofs - last_frame >= (off_t)render_interval) {
+            headless_render(headless);
+            last_frame = ofs;
+            (*frames)++;
+        }
+    }
+
+    return true;
+}
+
+static int
+create_mem_fd(const uint8_t *data, size_t len)
+{
+#if defined(MEMFD_CREATE)
+    int mem_fd = memfd_create("foot-bench-vt-ptmx", MFD_CLOEXEC);
+#elif defined(__FreeBSD__)
+    // memfd_create on FreeBSD 13 is SHM_ANON without sealing support
+    int mem_fd = shm_open(SHM_ANON, O_RDWR | O_CLOEXEC, 0600);
+#else
+    char name[] = "/tmp/foot-bench-vt-ptmx-XXXXXX";
+    int mem_fd = mkostemp(name, O_CLOEXEC);
+    unlink(name);
+#endif
+    if (mem_fd < 0) {
+        fprintf(stderr, "error: failed to create memory FD\n");
+        return -1;
+    }
+
+    if (write(mem_fd, data, len) < 0) {
+        fprintf(stderr, "error: failed to write memory FD\n");
+        close(mem_fd);
+        return -1;
+    }
+
+    return mem_fd;
+}
+
+static void
+print_json_string(const char *s)
+{
+    putchar('"');
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\')
+            printf("\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            printf("\\u%04x", *s);
+        else
+            putchar(*s);
+    }
+    putchar('"');
+}
+
+static void
+print_result(const struct result *res)
+{
+    const size_t bytes = res->bytes > 0 ? res->bytes : 1;
+
+    printf("%s: %zu bytes, %zu cells, %zu frames, best: %.3fms, mean: %.3fms, "
+           "%.2f ns/byte, %.1f MB/s, %.1f Mcells/s\n",
+           res->path, res->bytes, res->cells, res->frames,
+           res->best * 1e3, res->mean * 1e3,
+           res->best * 1e9 / bytes,
+           res->bytes / res->best / (1024. * 1024.),
+           res->cells / res->best / 1e6);
+}
+
+static void
+print_json(const struct result *results, size_t count, int rows, int cols,
+           int scrollback, int warmup, int repetitions, bool ptmx,
+           int render_interval, int workers, int glyph_cache_size)
+{
+    printf("{\n");
+    printf("  \"rows\": %d,\n", rows);
+    printf("  \"cols\": %d,\n", cols);
+    printf("  \"scrollback\": %d,\n", scrollback);
+    printf("  \"warmup\": %d,\n", warmup);
+    printf("  \"repetitions\": %d,\n", repetitions);
+    printf("  \"input\": \"%s\",\n", ptmx ? "ptmx" : "vt");
+    printf("  \"render_interval\": %d,\n", render_interval);
+    printf("  \"render_workers\": %d,\n", workers);
+    printf("  \"glyph_cache_size\": %d,\n", glyph_cache_size);
+    printf("  \"results\": [\n");
+
+    for (size_t i = 0; i < count; i++) {
+        const struct result *res = &results[i];
+        const size_t bytes = res->bytes > 0 ? res->bytes : 1;
+
+        printf("    {\n");
+        printf("      \"file\": ");
+        print_json_string(res->path);
+        printf(",\n");
+        printf("      \"bytes\": %zu,\n", res->bytes);
+        printf("      \"cells\": %zu,\n", res->cells);
+        printf("      \"frames\": %zu,\n", res->frames);
+        printf("      \"best_ns\": %.0f,\n", res->best * 1e9);
+        printf("      \"mean_ns\": %.0f,\n", res->mean * 1e9);
+        printf("      \"ns_per_byte\": %.3f,\n", res->best * 1e9 / bytes);
+        printf("      \"mb_per_s\": %.3f,\n",
+               res->bytes / res->best / (1024. * 1024.));
+        printf("      \"cells_per_s\": %.0f\n", res->cells / res->best);
+        printf("    }%s\n", i + 1 < count ? "," : "");
+    }
+
+    printf("  ]\n");
+    printf("}\n");
+}
+
+int
+main(int argc, char *const *argv)
+{
+    static const struct option longopts[] = {
+        {"warmup",      required_argument, NULL, 'w'},
+        {"repetitions", required_argument, NULL, 'r'},
+        {"rows",        required_argument, NULL, 'R'},
+        {"cols",        required_argument, NULL, 'C'},
+        {"scrollback",  required_argument, NULL, 's'},
+        {"ptmx",        no_argument,       NULL, 'p'},
+        {"render",      required_argument, NULL, 'f'},
+        {"font",        required_argument, NULL, 'F'},
+        {"workers",     required_argument, NULL, 'W'},
+        {"glyph-cache", required_argument, NULL, 'G'},
+        {"json",        no_argument,       NULL, 'j'},
+        {"help",        no_argument,       NULL, 'h'},
+        {NULL,          no_argument,       NULL, 0},
+    };
+
+    int warmup = 1;
+    int repetitions = 5;
+    int rows = 67;
+    int cols = 135;
+    int scrollback = 16384 - 67;
+    bool ptmx = false;
+    int render_interval = 0;
+    const char *font = "monospace:pixelsize=15";
+    int workers = 0;
+    int glyph_cache_size = 0;
+    bool json = false;
+
+    while (true) {
+        int c = getopt_long(argc, argv, "w:r:R:C:s:pf:F:W:G:jh", longopts, NULL);
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'w':
+            if (!parse_int("warmup", optarg, 0, &warmup))
+                return EXIT_FAILURE;
+            break;
+
+        case 'r':
+            if (!parse_int("repetitions", optarg, 1, &repetitions))
+                return EXIT_FAILURE;
+            break;
+
+        case 'R':
+            if (!parse_int("rows", optarg, 1, &rows))
+                return EXIT_FAILURE;
+            break;
+
+        case 'C':
+            if (!parse_int("cols", optarg, 1, &cols))
+                return EXIT_FAILURE;
+            break;
+
+        case 's':
+            if (!parse_int("scrollback", optarg, 0, &scrollback))
+                return EXIT_FAILURE;
+            break;
+
+        case 'p':
+            ptmx = true;
+            break;
+
+        case 'f':
+            if (!parse_int("render", optarg, 0, &render_interval))
+                return EXIT_FAILURE;
+            break;
+
+        case 'F':
+            font = optarg;
+            break;
+
+        case 'W':
+            if (!parse_int("workers", optarg, 0, &workers))
+                return EXIT_FAILURE;
+            break;
+
+        case 'G':
+            if (!parse_int("glyph-cache", optarg, 0, &glyph_cache_size))
+                return EXIT_FAILURE;
+            break;
+
+        case 'j':
+            json = true;
+            break;
+
+        case 'h':
+            usage(argv[0]);
+            return EXIT_SUCCESS;
+
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* Same as render_resize() */
+    const int grid_rows = rows + scrollback;
+
+    struct headless *headless = headless_new(rows, cols, grid_rows);
+    if (headless == NULL)
+        return EXIT_FAILURE;
+
+    int ret = EXIT_FAILURE;
+
+    if (render_interval > 0 &&
+        !headless_render_init(headless, font, workers, glyph_cache_size))
+    {
+        goto out;
+    }
+
+    const size_t file_count = argc - optind;
+    struct result *results = calloc(file_count, sizeof(results[0]));
+    if (results == NULL)
+        goto out;
+
+    for (size_t i = 0; i < file_count; i++) {
+        const char *path = argv[optind + i];
+
+        uint8_t *data;
+        size_t len;
+        if (!headless_load_file(path, &data, &len))
+            goto out;
+
+        int mem_fd = -1;
+        if (ptmx && (mem_fd = create_mem_fd(data, len)) < 0) {
+            free(data);
+            goto out;
+        }
+
+        double best = -1.;
+        double total = 0.;
+        size_t frames = 0;
+        bool ok = true;
+
+        for (int j = 0; j < warmup + repetitions && ok; j++) {
+            const double start = now();
+
+            if (ptmx)
+                ok = feed_ptmx(headless, mem_fd, len, render_interval, &frames);
+            else
+                frames = feed(headless, data, len, render_interval);
+
+            const double elapsed = now() - start;
+
+            if (j < warmup)
+                continue;
+
+            total += elapsed;
+            if (best < 0. || elapsed < best)
+                best = elapsed;
+        }
+
+        results[i] = (struct result){
+            .path = path,
+            .bytes = len,
+            .cells = count_cells(data, len),
+            .frames = frames,
+            .best = best,
+            .mean = total / repetitions,
+        };
+
+        if (mem_fd >= 0)
+            close(mem_fd);
+        free(data);
+
+        if (!ok)
+            goto out;
+
+        if (!json)
+            print_result(&results[i]);
+    }
+
+    if (json) {
+        print_json(
+            results, file_count, rows, cols, scrollback, warmup, repetitions,
+            ptmx, render_interval, workers, glyph_cache_size);
+    }
+
+    ret = EXIT_SUCCESS;
+
+out:
+    free(results);
+    headless_destroy(headless);
+    return ret;
+}
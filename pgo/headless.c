@@ -0,0 +1,563 @@
+#include "headless.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <fcntl.h>
+
+#include "async.h"
+#include "debug.h"
+#include "extract.h"
+#include "fdm.h"
+#include "glyph-cache.h"
+#include "grid.h"
+#include "ime.h"
+#include "key-binding.h"
+#include "quirks.h"
+#include "reaper.h"
+#include "render.h"
+#include "search.h"
+#include "shm.h"
+#include "sixel.h"
+#include "slave.h"
+#include "spawn.h"
+#include "user-notification.h"
+
+enum async_write_status
+async_write(int fd, const void *data, size_t len, size_t *idx)
+{
+    return ASYNC_WRITE_DONE;
+}
+
+bool
+fdm_add(struct fdm *fdm, int fd, int events, fdm_fd_handler_t handler, void *data)
+{
+    return true;
+}
+
+bool
+fdm_del(struct fdm *fdm, int fd)
+{
+    return true;
+}
+
+bool
+fdm_event_add(struct fdm *fdm, int fd, int events)
+{
+    return true;
+}
+
+bool
+fdm_event_del(struct fdm *fdm, int fd, int events)
+{
+    return true;
+}
+
+
+bool
+fdm_hook_add(struct fdm *fdm, fdm_hook_t hook, void *data,
+             enum fdm_hook_priority priority)
+{
+    return true;
+}
+
+bool
+fdm_hook_del(struct fdm *fdm, fdm_hook_t hook, enum fdm_hook_priority priority)
+{
+    return true;
+}
+
+enum cursor_shape
+xcursor_for_csd_border(struct terminal *term, int x, int y)
+{
+    return CURSOR_SHAPE_LEFT_PTR;
+}
+
+struct wl_window *
+wayl_win_init(struct terminal *term, const char *token)
+{
+    return NULL;
+}
+
+void wayl_win_destroy(struct wl_window *win) {}
+void wayl_win_alpha_changed(struct wl_window *win) {}
+bool wayl_win_set_urgent(struct wl_window *win) { return true; }
+bool wayl_fractional_scaling(const struct wayland *wayl) { return true; }
+bool wayl_win_csd_titlebar_visible(const struct wl_window *win) { return false; }
+bool wayl_win_csd_borders_visible(const struct wl_window *win) { return false; }
+void wayl_win_scale(struct wl_window *win, const struct buffer *buf) {}
+
+void
+wayl_surface_scale(const struct wl_window *win, const struct wayl_surface *surf,
+                   const struct buffer *buf, float scale)
+{
+}
+
+void
+wayl_surface_scale_explicit_width_height(
+    const struct wl_window *win, const struct wayl_surface *surf,
+    int width, int height, float scale)
+{
+}
+
+bool
+wayl_win_subsurface_new(struct wl_window *win, struct wayl_sub_surface *surf,
+                        bool allow_pointer_input)
+{
+    return false;
+}
+
+void wayl_win_subsurface_destroy(struct wayl_sub_surface *surf) {}
+
+void quirk_weston_subsurface_desync_on(struct wl_subsurface *sub) {}
+void quirk_weston_subsurface_desync_off(struct wl_subsurface *sub) {}
+void quirk_weston_csd_on(struct terminal *term) {}
+void quirk_weston_csd_off(struct terminal *term) {}
+void quirk_sway_subsurface_unmap(struct terminal *term) {}
+
+bool
+spawn(struct reaper *reaper, const char *cwd, char *const argv[],
+      int stdin_fd, int stdout_fd, int stderr_fd,
+      const char *xdg_activation_token)
+{
+    return true;
+}
+
+pid_t
+slave_spawn(
+    int ptmx, int argc, const char *cwd, char *const *argv, char *const *envp,
+    const env_var_list_t *extra_env_vars, const char *term_env,
+    const char *conf_shell, bool login_shell,
+    const user_notifications_t *notifications)
+{
+    return 0;
+}
+
+struct extraction_context *
+extract_begin(enum selection_kind kind, bool strip_trailing_empty)
+{
+    return NULL;
+}
+
+bool
+extract_one(
+    const struct terminal *term, const struct row *row, const struct cell *cell,
+    int col, void *context)
+{
+    return true;
+}
+
+bool
+extract_finish(struct extraction_context *context, char **text, size_t *len)
+{
+    return true;
+}
+
+void cmd_scrollback_up(struct terminal *term, int rows) {}
+void cmd_scrollback_down(struct terminal *term, int rows) {}
+
+void ime_enable(struct seat *seat) {}
+void ime_disable(struct seat *seat) {}
+void ime_reset_preedit(struct seat *seat) {}
+void ime_update_cursor_rect(struct seat *seat) {}
+
+void
+notify_notify(const struct terminal *term, const char *title, const char *body)
+{
+}
+
+void reaper_add(struct reaper *reaper, pid_t pid, reaper_cb cb, void *cb_data) {}
+void reaper_del(struct reaper *reaper, pid_t pid) {}
+
+void urls_reset(struct terminal *term) {}
+
+void search_selection_cancelled(struct terminal *term) {}
+
+struct search_match_iterator
+search_matches_new_iter(struct terminal *term)
+{
+    return (struct search_match_iterator){.term = term};
+}
+
+struct range
+search_matches_next(struct search_match_iterator *iter)
+{
+    return (struct range){{-1, -1}, {-1, -1}};
+}
+
+void get_current_modifiers(const struct seat *seat,
+                           xkb_mod_mask_t *effective,
+                           xkb_mod_mask_t *consumed, uint32_t key) {}
+
+static struct key_binding_set kbd;
+static bool kbd_initialized = false;
+
+struct key_binding_set *
+key_binding_for(
+    struct key_binding_manager *mgr, const struct config *conf,
+    const struct seat *seat)
+{
+    return &kbd;
+}
+
+void
+key_binding_new_for_conf(
+    struct key_binding_manager *mgr, const struct wayland *wayl,
+    const struct config *conf)
+{
+    if (!kbd_initialized) {
+        kbd_initialized = true;
+        kbd = (struct key_binding_set){
+            .key = tll_init(),
+            .search = tll_init(),
+            .url = tll_init(),
+            .mouse = tll_init(),
+            .selection_overrides = 0,
+        };
+    }
+}
+
+void
+key_binding_unref(struct key_binding_manager *mgr, const struct config *conf)
+{
+}
+
+struct headless *
+headless_new(int rows, int cols, int grid_rows)
+{
+    int lower_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (lower_fd < 0)
+        return NULL;
+
+    int upper_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (upper_fd < 0) {
+        close(lower_fd);
+        return NULL;
+    }
+
+    struct headless *h = calloc(1, sizeof(*h));
+    struct row **normal_rows = calloc(grid_rows, sizeof(normal_rows[0]));
+    struct row **alt_rows = calloc(grid_rows, sizeof(alt_rows[0]));
+
+    if (h == NULL || normal_rows == NULL || alt_rows == NULL) {
+        free(h);
+        free(normal_rows);
+        free(alt_rows);
+        close(lower_fd);
+        close(upper_fd);
+        return NULL;
+    }
+
+    /* Same as the defaults in config.c, for the options used when rendering */
+    h->conf = (struct config){
+        .title = (char *)"foot",
+        .app_id = (char *)"foot",
+        .line_height = {.pt = 0, .px = -1},
+        .underline_thickness = {.pt = 0., .px = -1},
+        .colors = {
+            .fg = 0xffffff,
+            .bg = 0x242424,
+            .alpha = 0xffff,
+            .selection_fg = 0x80000000,
+            .selection_bg = 0x80000000,
+        },
+        .cursor = {
+            .style = CURSOR_BLOCK,
+            .beam_thickness = {.pt = 1.5},
+            .underline_thickness = {.pt = 0., .px = -1},
+        },
+        .tweak = {
+            .fcft_filter = FCFT_SCALING_FILTER_LANCZOS3,
+            .overflowing_glyphs = true,
+            .delayed_render_lower_ns = 500000,         /* 0.5ms */
+            .delayed_render_upper_ns = 16666666 / 2,   /* half a frame period (60Hz) */
+            .box_drawing_base_thickness = 0.04,
+            .box_drawing_solid_shades = true,
+        },
+    };
+
+    /* 16 base colors, followed by the 6x6x6 color cube, and a gray ramp */
+    static const uint32_t base16[16] = {
+        0x242424, 0xf62b5a, 0x47b413, 0xe3c401,
+        0x24acd4, 0xf2affd, 0x13c299, 0xe6e6e6,
+        0x616161, 0xff4d51, 0x35d450, 0xe9e836,
+        0x5dc5f8, 0xfeabf2, 0x24dfc4, 0xffffff,
+    };
+
+    memcpy(h->conf.colors.table, base16, sizeof(base16));
+    for (size_t i = 0; i < 216; i++) {
+        static const uint8_t levels[6] = {0x00, 0x5f, 0x87, 0xaf, 0xd7, 0xff};
+        h->conf.colors.table[16 + i] =
+            levels[i / 36] << 16 | levels[i / 6 % 6] << 8 | levels[i % 6];
+    }
+    for (size_t i = 0; i < 24; i++) {
+        const uint8_t level = 8 + i * 10;
+        h->conf.colors.table[232 + i] = level << 16 | level << 8 | level;
+    }
+
+    h->wayl = (struct wayland){
+        .seats = tll_init(),
+        .monitors = tll_init(),
+        .terms = tll_init(),
+    };
+
+    struct terminal *term = &h->term;
+    *term = (struct terminal){
+        .conf = &h->conf,
+        .wl = &h->wayl,
+        .grid = &term->normal,
+        .normal = {
+            .num_rows = grid_rows,
+            .num_cols = cols,
+            .rows = normal_rows,
+        },
+        .alt = {
+            .num_rows = grid_rows,
+            .num_cols = cols,
+            .rows = alt_rows,
+        },
+        .scale = 1,
+        .width = cols * 8,
+        .height = rows * 15,
+        .cols = cols,
+        .rows = rows,
+        .cell_width = 8,
+        .cell_height = 15,
+        .colors = {
+            .fg = h->conf.colors.fg,
+            .bg = h->conf.colors.bg,
+            .alpha = h->conf.colors.alpha,
+            .selection_fg = h->conf.colors.selection_fg,
+            .selection_bg = h->conf.colors.selection_bg,
+        },
+        .scroll_region = {
+            .start = 0,
+            .end = rows,
+        },
+        .selection = {
+            .coords = {
+                .start = {-1, -1},
+                .end = {-1, -1},
+            },
+        },
+        .delayed_render_timer = {
+            .lower_fd = lower_fd,
+            .upper_fd = upper_fd
+        },
+        .sixel = {
+            .palette_size = SIXEL_MAX_COLORS,
+            .max_width = SIXEL_MAX_WIDTH,
+            .max_height = SIXEL_MAX_HEIGHT,
+        },
+    };
+
+    memcpy(term->colors.table, h->conf.colors.table, sizeof(term->colors.table));
+
+    for (int i = 0; i < grid_rows; i++) {
+        normal_rows[i] = grid_row_alloc(&term->normal, true);
+        alt_rows[i] = grid_row_alloc(&term->alt, true);
+    }
+
+    term->normal.cur_row = normal_rows[0];
+    term->alt.cur_row = alt_rows[0];
+
+    /*
+     * The window has no surfaces. Arming the title timer prevents
+     * title updates from being rendered.
+     */
+    h->win = (struct wl_window){.term = term};
+    term->window = &h->win;
+    term->render.title.is_armed = true;
+
+    term_update_ascii_printer(term);
+    tll_push_back(h->wayl.terms, term);
+    return h;
+}
+
+static void
+free_custom_glyphs(struct fcft_glyph **glyphs, size_t count)
+{
+    if (glyphs == NULL)
+        return;
+
+    for (size_t i = 0; i < count; i++) {
+        if (glyphs[i] == NULL)
+            continue;
+
+        free(pixman_image_get_data(glyphs[i]->pix));
+        pixman_image_unref(glyphs[i]->pix);
+        free(glyphs[i]);
+    }
+
+    free(glyphs);
+}
+
+static void
+render_fini(struct headless *h)
+{
+    struct terminal *term = &h->term;
+
+    if (term->render.workers.pool != NULL) {
+        render_worker_pool_unref(term->render.workers.pool);
+        mtx_destroy(&term->render.workers.lock);
+    }
+
+    free(term->render.workers.frame.rows);
+
+    if (term->render.glyph_caches != NULL) {
+        for (size_t i = 0; i < 1 + term->render.workers.count; i++)
+            glyph_cache_destroy(term->render.glyph_caches[i]);
+        free(term->render.glyph_caches);
+    }
+
+    if (term->render.last_buf != NULL)
+        shm_unref(term->render.last_buf);
+    shm_chain_free(term->render.chains.grid);
+
+    free_custom_glyphs(
+        term->custom_glyphs.box_drawing, GLYPH_BOX_DRAWING_COUNT);
+    free_custom_glyphs(
+        term->custom_glyphs.braille, GLYPH_BRAILLE_COUNT);
+    free_custom_glyphs(
+        term->custom_glyphs.legacy, GLYPH_LEGACY_COUNT);
+
+    for (size_t i = 0; i < 4; i++)
+        fcft_destroy(term->fonts[i]);
+
+    fcft_fini();
+}
+
+bool
+headless_render_init(struct headless *h, const char *font, int workers,
+                     int glyph_cache_size)
+{
+    struct terminal *term = &h->term;
+    xassert(!h->can_render);
+
+    fcft_init(FCFT_LOG_COLORIZE_NEVER, false, FCFT_LOG_CLASS_ERROR);
+
+    static const char *const attrs[4] = {
+        "dpi=96",
+        "dpi=96:weight=bold",
+        "dpi=96:slant=italic",
+        "dpi=96:weight=bold:slant=italic",
+    };
+
+    struct fcft_font *fonts[4] = {NULL};
+    for (size_t i = 0; i < 4; i++) {
+        fonts[i] = fcft_from_name(1, (const char *[]){font}, attrs[i]);
+        if (fonts[i] == NULL) {
+            fprintf(stderr, "error: %s: failed to load font\n", font);
+            for (size_t j = 0; j < i; j++)
+                fcft_destroy(fonts[j]);
+            fcft_fini();
+            return false;
+        }
+    }
+
+    term_set_fonts(term, fonts, false);
+
+    term->width = term->cols * term->cell_width;
+    term->height = term->rows * term->cell_height;
+    h->can_render = true;
+
+    bool ok = true;
+    struct render_worker_pool *pool = NULL;
+    if (workers > 0) {
+        pool = render_worker_pool_ref(term->fdm, workers);
+        if (pool == NULL ||
+            mtx_init(&term->render.workers.lock, mtx_plain) != thrd_success)
+        {
+            fprintf(stderr, "error: failed to initialize render workers\n");
+            render_worker_pool_unref(pool);
+            workers = 0;
+            pool = NULL;
+            ok = false;
+        }
+    }
+
+    term->render.chains.grid = shm_chain_new(NULL, true, 1 + workers);
+    term->render.workers.pool = pool;
+    term->render.workers.count = workers;
+
+    if (glyph_cache_size > 0) {
+        h->conf.tweak.glyph_cache_size = glyph_cache_size;
+        term->render.glyph_caches = calloc(
+            1 + workers, sizeof(term->render.glyph_caches[0]));
+    }
+
+    return ok;
+}
+
+void
+headless_render(struct headless *h)
+{
+    xassert(h->can_render);
+    render_grid_offscreen(&h->term);
+}
+
+void
+headless_destroy(struct headless *h)
+{
+    if (h == NULL)
+        return;
+
+    struct terminal *term = &h->term;
+
+    if (h->can_render)
+        render_fini(h);
+
+    tll_free(h->wayl.terms);
+
+    grid_free(&term->normal);
+    grid_free(&term->alt);
+    close(term->delayed_render_timer.lower_fd);
+    close(term->delayed_render_timer.upper_fd);
+    free(h);
+}
+
+bool
+headless_load_file(const char *path, uint8_t **data, size_t *len)
+{
+    struct stat st;
+    if (stat(path, &st) < 0) {
+        fprintf(stderr, "error: %s: failed to stat: %s\n",
+                path, strerror(errno));
+        return false;
+    }
+
+    uint8_t *buf = malloc(st.st_size > 0 ? st.st_size : 1);
+    if (buf == NULL) {
+        fprintf(stderr, "error: %s: failed to allocate buffer: %s\n",
+                path, strerror(errno));
+        return false;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "error: %s: failed to open: %s\n",
+                path, strerror(errno));
+        free(buf);
+        return false;
+    }
+
+    ssize_t amount = read(fd, buf, st.st_size);
+    close(fd);
+
+    if (amount != st.st_size) {
+        fprintf(stderr, "error: %s: failed to read: %s\n",
+                path, strerror(errno));
+        free(buf);
+        return false;
+    }
+
+    *data = buf;
+    *len = st.st_size;
+    return true;
+}
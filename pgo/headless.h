@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "config.h"
+#include "terminal.h"
+#include "wayland.h"
+
+/*
+ * A terminal instance without a Wayland connection, FDM etc. Used by
+ * the PGO helper and the benchmarks to exercise the VT parser, the
+ * grid and, optionally, the renderer.
+ *
+ * Everything outside of 'pgolib' and 'rendlib' is stubbed out in
+ * headless.c.
+ */
+struct headless {
+    struct config conf;
+    struct wayland wayl;
+    struct wl_window win;   /* Has no surfaces */
+    struct terminal term;
+    bool can_render;
+};
+
+struct headless *headless_new(int rows, int cols, int grid_rows);
+void headless_destroy(struct headless *headless);
+
+/*
+ * Loads fonts ('font' is a fontconfig pattern), and sets up an
+ * offscreen buffer chain and 'workers' render worker threads, each
+ * with a 'glyph_cache_size' cells large glyph cache (0 disables
+ * it). The terminal is resized (in pixels) to fit its rows and
+ * columns.
+ *
+ * Must be called before headless_render().
+ */
+bool headless_render_init(struct headless *headless, const char *font,
+                          int workers, int glyph_cache_size);
+
+/* Renders a frame, of all dirty cells, to an offscreen buffer */
+void headless_render(struct headless *headless);
+
+/* Reads the entire file into a newly allocated buffer */
+bool headless_load_file(const char *path, uint8_t **data, size_t *len);
@@ -1,5 +1,6 @@
 #include "render.h"
 
+#include <errno.h>
 #include <string.h>
 #include <wctype.h>
 #include <unistd.h>
@@ -32,6 +33,7 @@
 #include "char32.h"
 #include "config.h"
 #include "cursor-shape.h"
+#include "glyph-cache.h"
 #include "grid.h"
 #include "hsl.h"
 #include "ime.h"
@@ -458,22 +460,10 @@ draw_cursor(const struct terminal *term, const struct cell *cell,
     }
 }
 
-static int
-render_cell(struct terminal *term, pixman_image_t *pix, pixman_region32_t *damage,
-            struct row *row, int row_no, int col, bool has_cursor)
+static void
+cell_colors(const struct terminal *term, const struct cell *cell,
+            uint32_t *fg, uint32_t *bg, uint16_t *bg_alpha)
 {
-    struct cell *cell = &row->cells[col];
-    if (cell->attrs.clean)
-        return 0;
-
-    cell->attrs.clean = 1;
-    cell->attrs.confined = true;
-
-    int width = term->cell_width;
-    int height = term->cell_height;
-    const int x = term->margins.left + col * width;
-    const int y = term->margins.top + row_no * height;
-
     bool is_selected = cell->attrs.selected;
 
     uint32_t _fg = 0;
@@ -579,18 +569,32 @@ render_cell(struct terminal *term, pixman_image_t *pix, pixman_region32_t *damag
     if (cell->attrs.blink && term->blink.state == BLINK_OFF)
         _fg = color_decrease_luminance(_fg);
 
-    pixman_color_t fg = color_hex_to_pixman(_fg);
-    pixman_color_t bg = color_hex_to_pixman_with_alpha(_bg, alpha);
+    *fg = _fg;
+    *bg = _bg;
+    *bg_alpha = alpha;
+}
+
+struct cell_glyphs {
+    struct fcft_font *font;
+    const struct composed *composed;
+    const struct fcft_glyph *single;
+    const struct fcft_glyph **glyphs;
+    unsigned count;
+    int cols;
+};
 
-    struct fcft_font *font = attrs_to_font(term, &cell->attrs);
-    const struct composed *composed = NULL;
+static void
+cell_glyphs_lookup(struct terminal *term, const struct cell *cell, int col,
+                   struct cell_glyphs *g)
+{
     const struct fcft_grapheme *grapheme = NULL;
-    const struct fcft_glyph *single = NULL;
-    const struct fcft_glyph **glyphs = NULL;
-    unsigned glyph_count = 0;
+
+    *g = (struct cell_glyphs){
+        .font = attrs_to_font(term, &cell->attrs),
+        .cols = 1,
+    };
 
     char32_t base = cell->wc;
-    int cell_cols = 1;
 
     if (base != 0) {
         if (unlikely(
@@ -635,133 +639,152 @@ render_cell(struct terminal *term, pixman_image_t *pix, pixman_region32_t *damag
                 *arr = xcalloc(count, sizeof((*arr)[0]));
 
             if (likely((*arr)[idx] != NULL))
-                single = (*arr)[idx];
+                g->single = (*arr)[idx];
             else {
                 mtx_lock(&term->render.workers.lock);
 
                 /* Other thread may have instantiated it while we
                  * acquired the lock */
-                single = (*arr)[idx];
-                if (likely(single == NULL))
-                    single = (*arr)[idx] = box_drawing(term, base);
+                g->single = (*arr)[idx];
+                if (likely(g->single == NULL))
+                    g->single = (*arr)[idx] = box_drawing(term, base);
                 mtx_unlock(&term->render.workers.lock);
             }
 
-            if (single != NULL) {
-                glyph_count = 1;
-                glyphs = &single;
-                cell_cols = single->cols;
+            if (g->single != NULL) {
+                g->count = 1;
+                g->glyphs = &g->single;
+                g->cols = g->single->cols;
             }
         }
 
         else if (base >= CELL_COMB_CHARS_LO && base <= CELL_COMB_CHARS_HI)
         {
-            composed = composed_lookup(term->composed, base - CELL_COMB_CHARS_LO);
-            base = composed->chars[0];
+            g->composed = composed_lookup(term->composed, base - CELL_COMB_CHARS_LO);
+            base = g->composed->chars[0];
 
             if (term->conf->can_shape_grapheme && term->conf->tweak.grapheme_shaping) {
                 grapheme = fcft_rasterize_grapheme_utf32(
-                    font, composed->count, composed->chars, term->font_subpixel);
+                    g->font, g->composed->count, g->composed->chars, term->font_subpixel);
             }
 
             if (grapheme != NULL) {
-                cell_cols = composed->width;
+                g->cols = g->composed->width;
 
-                composed = NULL;
-                glyphs = grapheme->glyphs;
-                glyph_count = grapheme->count;
+                g->composed = NULL;
+                g->glyphs = grapheme->glyphs;
+                g->count = grapheme->count;
             }
         }
 
-        if (single == NULL && grapheme == NULL) {
+        if (g->single == NULL && grapheme == NULL) {
             if (unlikely(base >= CELL_SPACER)) {
-                glyph_count = 0;
-                cell_cols = 1;
+                g->count = 0;
+                g->cols = 1;
             } else {
                 xassert(base != 0);
-                single = fcft_rasterize_char_utf32(font, base, term->font_subpixel);
-                if (single == NULL) {
-                    glyph_count = 0;
-                    cell_cols = 1;
+                g->single = fcft_rasterize_char_utf32(g->font, base, term->font_subpixel);
+                if (g->single == NULL) {
+                    g->count = 0;
+                    g->cols = 1;
                 } else {
-                    glyph_count = 1;
-                    glyphs = &single;
-                    cell_cols = single->cols;
+                    g->count = 1;
+                    g->glyphs = &g->single;
+                    g->cols = g->single->cols;
                 }
             }
         }
     }
 
-    assert(glyph_count == 0 || glyphs != NULL);
+
+    assert(g->count == 0 || g->glyphs != NULL);
 
     const int cols_left = term->cols - col;
-    cell_cols = max(1, min(cell_cols, cols_left));
+    g->cols = max(1, min(g->cols, cols_left));
+}
+
+/*
+ * Returns the width, in pixels, the cell's glyphs may draw into.
+ *
+ * Determines cells that will bleed into their right neighbor and
+ * remembers them for cleanup in the next frame.
+ */
+static int
+cell_render_width(const struct terminal *term, struct row *row, int col,
+                  const struct cell_glyphs *g)
+{
+    const int cols_left = term->cols - col;
+    int render_width = g->cols * term->cell_width;
 
-    /*
-     * Determine cells that will bleed into their right neighbor and remember
-     * them for cleanup in the next frame.
-     */
-    int render_width = cell_cols * width;
     if (term->conf->tweak.overflowing_glyphs &&
-        glyph_count > 0 &&
-        cols_left > cell_cols)
+        g->count > 0 &&
+        cols_left > g->cols)
     {
         int glyph_width = 0, advance = 0;
-        for (size_t i = 0; i < glyph_count; i++) {
+        for (size_t i = 0; i < g->count; i++) {
             glyph_width = max(glyph_width,
-                              advance + glyphs[i]->x + glyphs[i]->width);
-            advance += glyphs[i]->advance.x;
+                              advance + g->glyphs[i]->x + g->glyphs[i]->width);
+            advance += g->glyphs[i]->advance.x;
         }
 
         if (glyph_width > render_width) {
-            render_width = min(glyph_width, render_width + width);
+            render_width = min(glyph_width, render_width + term->cell_width);
 
-            for (int i = 0; i < cell_cols; i++)
+            for (int i = 0; i < g->cols; i++)
                 row->cells[col + i].attrs.confined = false;
         }
     }
 
-    pixman_region32_t clip;
-    pixman_region32_init_rect(
-        &clip, x, y,
-        render_width, term->cell_height);
-    pixman_image_set_clip_region32(pix, &clip);
+    return render_width;
+}
 
-    if (damage != NULL) {
-        pixman_region32_union_rect(
-            damage, damage, x, y, render_width, term->cell_height);
+/*
+ * Returns true if all of the cell's glyphs are horizontally inside
+ * [x, x + render_width), i.e. if they can be drawn without a clip
+ * region of their own.
+ */
+static bool
+cell_glyphs_are_inside(const struct terminal *term, const struct cell_glyphs *g,
+                       int x, int render_width)
+{
+    if (g->composed != NULL) {
+        /* Combining characters are positioned relative to the
+         * cell, and are not known until rasterized */
+        return false;
     }
 
-    pixman_region32_fini(&clip);
+    int pen_x = x;
+    for (unsigned i = 0; i < g->count; i++) {
+        const int letter_x_ofs = i == 0 ? term->font_x_ofs : 0;
 
-    /* Background */
-    pixman_image_fill_rectangles(
-        PIXMAN_OP_SRC, pix, &bg, 1,
-        &(pixman_rectangle16_t){x, y, cell_cols * width, height});
+        const struct fcft_glyph *glyph = g->glyphs[i];
+        if (glyph == NULL)
+            continue;
 
-    if (cell->attrs.blink && term->blink.fd < 0) {
-        /* TODO: use a custom lock for this? */
-        mtx_lock(&term->render.workers.lock);
-        term_arm_blink_timer(term);
-        mtx_unlock(&term->render.workers.lock);
-    }
+        int g_x = glyph->x;
+        if (i > 0 && glyph->x >= 0)
+            g_x -= term->cell_width;
 
-    if (unlikely(has_cursor && term->cursor_style == CURSOR_BLOCK && term->kbd_focus))
-        draw_cursor(term, cell, font, pix, &fg, &bg, x, y, cell_cols);
+        const int left = pen_x + letter_x_ofs + g_x;
+        if (left < x || left + glyph->width > x + render_width)
+            return false;
 
-    if (cell->wc == 0 || cell->wc >= CELL_SPACER || cell->wc == U'\t' ||
-        (unlikely(cell->attrs.conceal) && !is_selected))
-    {
-        goto draw_cursor;
+        pen_x += glyph->advance.x;
     }
 
-    pixman_image_t *clr_pix = pixman_image_create_solid_fill(&fg);
+    return true;
+}
 
+static void
+draw_cell_glyphs(struct terminal *term, pixman_image_t *pix,
+                 const struct cell *cell, const struct cell_glyphs *g,
+                 pixman_image_t *clr_pix, int x, int y)
+{
     int pen_x = x;
-    for (unsigned i = 0; i < glyph_count; i++) {
+    for (unsigned i = 0; i < g->count; i++) {
         const int letter_x_ofs = i == 0 ? term->font_x_ofs : 0;
 
-        const struct fcft_glyph *glyph = glyphs[i];
+        const struct fcft_glyph *glyph = g->glyphs[i];
         if (glyph == NULL)
             continue;
 
@@ -786,14 +809,14 @@ render_cell(struct terminal *term, pixman_image_t *pix, pixman_region32_t *damag
                 glyph->width, glyph->height);
 
             /* Combining characters */
-            if (composed != NULL) {
-                assert(glyph_count == 1);
+            if (g->composed != NULL) {
+                assert(g->count == 1);
 
-                for (size_t i = 1; i < composed->count; i++) {
-                    const struct fcft_glyph *g = fcft_rasterize_char_utf32(
-                        font, composed->chars[i], term->font_subpixel);
+                for (size_t i = 1; i < g->composed->count; i++) {
+                    const struct fcft_glyph *comb = fcft_rasterize_char_utf32(
+                        g->font, g->composed->chars[i], term->font_subpixel);
 
-                    if (g == NULL)
+                    if (comb == NULL)
                         continue;
 
                     /*
@@ -813,32 +836,109 @@ render_cell(struct terminal *term, pixman_image_t *pix, pixman_region32_t *damag
                      * somewhat deal with double-width glyphs we use
                      * an offset of *one* cell.
                      */
-                    int x_ofs = g->x < 0
-                        ? cell_cols * term->cell_width
-                        : (cell_cols - 1) * term->cell_width;
+                    int x_ofs = comb->x < 0
+                        ? g->cols * term->cell_width
+                        : (g->cols - 1) * term->cell_width;
 
                     pixman_image_composite32(
-                        PIXMAN_OP_OVER, clr_pix, g->pix, pix, 0, 0, 0, 0,
+                        PIXMAN_OP_OVER, clr_pix, comb->pix, pix, 0, 0, 0, 0,
                         /* Some fonts use a negative offset, while others use a
                          * "normal" offset */
-                        pen_x + x_ofs + g->x,
-                        y + term->font_baseline - g->y,
-                        g->width, g->height);
+                        pen_x + x_ofs + comb->x,
+                        y + term->font_baseline - comb->y,
+                        comb->width, comb->height);
                 }
             }
         }
 
         pen_x += glyph->advance.x;
     }
+}
+
+static void
+arm_blink_timer(struct terminal *term)
+{
+    if (term->blink.fd >= 0)
+        return;
+
+    /* TODO: use a custom lock for this? */
+    mtx_lock(&term->render.workers.lock);
+    term_arm_blink_timer(term);
+    mtx_unlock(&term->render.workers.lock);
+}
 
+static bool
+cell_has_glyphs(const struct cell *cell)
+{
+    return !(cell->wc == 0 || cell->wc >= CELL_SPACER || cell->wc == U'\t' ||
+             (unlikely(cell->attrs.conceal) && !cell->attrs.selected));
+}
+
+static int
+render_cell(struct terminal *term, pixman_image_t *pix, pixman_region32_t *damage,
+            struct row *row, int row_no, int col, bool has_cursor)
+{
+    struct cell *cell = &row->cells[col];
+    if (cell->attrs.clean)
+        return 0;
+
+    cell->attrs.clean = 1;
+    cell->attrs.confined = true;
+
+    int width = term->cell_width;
+    int height = term->cell_height;
+    const int x = term->margins.left + col * width;
+    const int y = term->margins.top + row_no * height;
+
+    uint32_t _fg, _bg;
+    uint16_t alpha;
+    cell_colors(term, cell, &_fg, &_bg, &alpha);
+
+    pixman_color_t fg = color_hex_to_pixman(_fg);
+    pixman_color_t bg = color_hex_to_pixman_with_alpha(_bg, alpha);
+
+    struct cell_glyphs g;
+    cell_glyphs_lookup(term, cell, col, &g);
+
+    const int render_width = cell_render_width(term, row, col, &g);
+
+    pixman_region32_t clip;
+    pixman_region32_init_rect(
+        &clip, x, y,
+        render_width, term->cell_height);
+    pixman_image_set_clip_region32(pix, &clip);
+
+    if (damage != NULL) {
+        pixman_region32_union_rect(
+            damage, damage, x, y, render_width, term->cell_height);
+    }
+
+    pixman_region32_fini(&clip);
+
+    /* Background */
+    pixman_image_fill_rectangles(
+        PIXMAN_OP_SRC, pix, &bg, 1,
+        &(pixman_rectangle16_t){x, y, g.cols * width, height});
+
+    if (cell->attrs.blink)
+        arm_blink_timer(term);
+
+    if (unlikely(has_cursor && term->cursor_style == CURSOR_BLOCK && term->kbd_focus))
+        draw_cursor(term, cell, g.font, pix, &fg, &bg, x, y, g.cols);
+
+    if (!cell_has_glyphs(cell))
+        goto draw_cursor;
+
+    pixman_image_t *clr_pix = pixman_image_create_solid_fill(&fg);
+    draw_cell_glyphs(term, pix, cell, &g, clr_pix, x, y);
     pixman_image_unref(clr_pix);
 
     /* Underline */
     if (cell->attrs.underline)
-        draw_underline(term, pix, font, &fg, x, y, cell_cols);
+        draw_underline(term, pix, g.font, &fg, x, y, g.cols);
 
     if (cell->attrs.strikethrough)
-        draw_strikeout(term, pix, font, &fg, x, y, cell_cols);
+        draw_strikeout(term, pix, g.font, &fg, x, y, g.cols);
 
     if (unlikely(cell->attrs.url)) {
         pixman_color_t url_color = color_hex_to_pixman(
@@ -846,23 +946,421 @@ render_cell(struct terminal *term, pixman_image_t *pix, pixman_region32_t *damag
             ? term->conf->colors.url
             : term->colors.table[3]
             );
-        draw_underline(term, pix, font, &url_color, x, y, cell_cols);
+        draw_underline(term, pix, g.font, &url_color, x, y, g.cols);
     }
 
 draw_cursor:
     if (has_cursor && (term->cursor_style != CURSOR_BLOCK || !term->kbd_focus))
-        draw_cursor(term, cell, font, pix, &fg, &bg, x, y, cell_cols);
+        draw_cursor(term, cell, g.font, pix, &fg, &bg, x, y, g.cols);
 
     pixman_image_set_clip_region32(pix, NULL);
-    return cell_cols;
+    return g.cols;
+}
+
+/*
+ * A horizontal line (underline, strikeout) spanning one or more
+ * adjacent cells, drawn with a single fill.
+ */
+struct line_span {
+    void (*draw)(const struct terminal *term, pixman_image_t *pix,
+                 const struct fcft_font *font, const pixman_color_t *color,
+                 int x, int y, int cols);
+    const pixman_color_t *color;
+    const struct fcft_font *font;  /* NULL if span is empty */
+    int start;                     /* First column */
+    int end;                       /* Last column + 1 */
+};
+
+static void
+line_span_flush(const struct terminal *term, pixman_image_t *pix,
+                struct line_span *span, int y)
+{
+    if (span->font == NULL)
+        return;
+
+    span->draw(term, pix, span->font, span->color,
+               term->margins.left + span->start * term->cell_width, y,
+               span->end - span->start);
+    span->font = NULL;
 }
 
+static void
+line_span_add(const struct terminal *term, pixman_image_t *pix,
+              struct line_span *span, const struct fcft_font *font,
+              int col, int cols, int y)
+{
+    /* Cells are added right-to-left */
+    if (span->font == font && col + cols >= span->start) {
+        span->start = col;
+        span->end = max(span->end, col + cols);
+        return;
+    }
+
+    line_span_flush(term, pix, span, y);
+    span->font = font;
+    span->start = col;
+    span->end = col + cols;
+}
+
+/*
+ * Draws a cell's background and glyph with a single blit from the
+ * glyph cache, rendering it into the cache first, on a miss.
+ *
+ * Returns false if the cell cannot be cached: multi-glyph cells,
+ * combining characters, blinking text, and glyphs that aren't
+ * entirely inside the cell.
+ */
+static bool
+draw_cached_cell(const struct terminal *term, pixman_image_t *pix,
+                 struct glyph_cache *cache, const struct cell *cell,
+                 const struct cell_glyphs *g, pixman_image_t *clr_pix,
+                 uint32_t fg, uint32_t bg, uint16_t alpha,
+                 const pixman_color_t *bg_color, int x, int y)
+{
+    if (g->count != 1 || g->composed != NULL || g->cols > 2 ||
+        cell->attrs.blink)
+    {
+        return false;
+    }
+
+    const struct fcft_glyph *glyph = g->glyphs[0];
+    if (glyph == NULL)
+        return false;
+
+    const int width = g->cols * term->cell_width;
+    const int height = term->cell_height;
+    const int g_x = term->font_x_ofs + glyph->x;
+    const int g_y = term->font_baseline - glyph->y;
+
+    if (g_x < 0 || g_x + glyph->width > width ||
+        g_y < 0 || g_y + glyph->height > height)
+    {
+        return false;
+    }
+
+    const struct glyph_cache_key key = {
+        .glyph = glyph,
+        .fg = fg,
+        .bg = bg,
+        .alpha = alpha,
+        .subpixel = term->font_subpixel,
+        .cols = g->cols,
+    };
+
+    int slot_x, slot_y;
+    if (!glyph_cache_get(cache, &key, &slot_x, &slot_y)) {
+        /* The atlas may be taller than a 16-bit rectangle can address */
+        pixman_image_fill_boxes(
+            PIXMAN_OP_SRC, cache->atlas, bg_color, 1,
+            &(pixman_box32_t){slot_x, slot_y, slot_x + width, slot_y + height});
+
+        if (unlikely(pixman_image_get_format(glyph->pix) == PIXMAN_a8r8g8b8)) {
+            pixman_image_composite32(
+                PIXMAN_OP_OVER, glyph->pix, NULL, cache->atlas, 0, 0, 0, 0,
+                slot_x + g_x, slot_y + g_y, glyph->width, glyph->height);
+        } else {
+            pixman_image_composite32(
+                PIXMAN_OP_OVER, clr_pix, glyph->pix, cache->atlas, 0, 0, 0, 0,
+                slot_x + g_x, slot_y + g_y, glyph->width, glyph->height);
+        }
+    }
+
+    pixman_image_composite32(
+        PIXMAN_OP_SRC, cache->atlas, NULL, pix, slot_x, slot_y, 0, 0,
+        x, y, width, height);
+    return true;
+}
+
+/*
+ * Renders the dirty cells [first_col, last_col], all of which have
+ * the same foreground and background colors.
+ *
+ * The background is filled, and the damage recorded, once for the
+ * whole run. All glyphs share a single solid-fill source, and
+ * underlines and strikeouts are drawn across adjacent cells. Only
+ * glyphs that reach outside their own cell(s) are given a clip
+ * region of their own.
+ *
+ * With a glyph cache, cells are drawn from the cache whenever
+ * possible (see draw_cached_cell()).
+ *
+ * Like render_row(), cells are rendered right-to-left, so that
+ * overflowing glyphs are drawn on top of their right neighbor.
+ */
+static void
+render_run(struct terminal *term, pixman_image_t *pix, pixman_region32_t *damage,
+           struct glyph_cache *glyph_cache, struct row *row, int row_no,
+           int first_col, int last_col, uint32_t _fg, uint32_t _bg,
+           uint16_t alpha)
+{
+    const int width = term->cell_width;
+    const int height = term->cell_height;
+    const int y = term->margins.top + row_no * height;
+    const int run_x = term->margins.left + first_col * width;
+    const int run_cols = last_col - first_col + 1;
+    const int row_end = term->margins.left + term->cols * width;
+
+    pixman_color_t fg = color_hex_to_pixman(_fg);
+    pixman_color_t bg = color_hex_to_pixman_with_alpha(_bg, alpha);
+    pixman_color_t url_color;
+
+    pixman_region32_t clip;
+    pixman_region32_init_rect(&clip, run_x, y, row_end - run_x, height);
+    pixman_image_set_clip_region32(pix, &clip);
+
+    /* Background */
+    pixman_image_fill_rectangles(
+        PIXMAN_OP_SRC, pix, &bg, 1,
+        &(pixman_rectangle16_t){run_x, y, run_cols * width, height});
+
+    pixman_image_t *clr_pix = NULL;
+    int damage_end = run_x + run_cols * width;
+
+    struct line_span underline = {.draw = &draw_underline, .color = &fg};
+    struct line_span strikeout = {.draw = &draw_strikeout, .color = &fg};
+    struct line_span url = {.draw = &draw_underline, .color = &url_color};
+
+    for (int col = last_col; col >= first_col; col--) {
+        struct cell *cell = &row->cells[col];
+        xassert(!cell->attrs.clean);
+
+        cell->attrs.clean = 1;
+        cell->attrs.confined = true;
+
+        const int x = term->margins.left + col * width;
+
+        struct cell_glyphs g;
+        cell_glyphs_lookup(term, cell, col, &g);
+
+        const int render_width = cell_render_width(term, row, col, &g);
+        damage_end = max(damage_end, x + render_width);
+
+        if (unlikely(col + g.cols - 1 > last_col)) {
+            /* Wide glyph, whose spacer(s) are outside the run */
+            const int extra_cols = col + g.cols - 1 - last_col;
+            pixman_image_fill_rectangles(
+                PIXMAN_OP_SRC, pix, &bg, 1,
+                &(pixman_rectangle16_t){
+                    run_x + run_cols * width, y, extra_cols * width, height});
+        }
+
+        if (cell->attrs.blink)
+            arm_blink_timer(term);
+
+        if (!cell_has_glyphs(cell))
+            continue;
+
+        if (g.count > 0) {
+            if (clr_pix == NULL)
+                clr_pix = pixman_image_create_solid_fill(&fg);
+
+            if (glyph_cache != NULL &&
+                draw_cached_cell(term, pix, glyph_cache, cell, &g, clr_pix,
+                                 _fg, _bg, alpha, &bg, x, y))
+            {
+                /* Drawn from the glyph cache */
+            }
+
+            else if (likely(cell_glyphs_are_inside(term, &g, x, render_width)))
+                draw_cell_glyphs(term, pix, cell, &g, clr_pix, x, y);
+            else {
+                pixman_region32_t cell_clip;
+                pixman_region32_init_rect(&cell_clip, x, y, render_width, height);
+                pixman_image_set_clip_region32(pix, &cell_clip);
+                pixman_region32_fini(&cell_clip);
+
+                draw_cell_glyphs(term, pix, cell, &g, clr_pix, x, y);
+                pixman_image_set_clip_region32(pix, &clip);
+            }
+        }
+
+        if (cell->attrs.underline)
+            line_span_add(term, pix, &underline, g.font, col, g.cols, y);
+
+        if (cell->attrs.strikethrough)
+            line_span_add(term, pix, &strikeout, g.font, col, g.cols, y);
+
+        if (unlikely(cell->attrs.url)) {
+            if (url.font == NULL) {
+                url_color = color_hex_to_pixman(
+                    term->conf->colors.use_custom.url
+                    ? term->conf->colors.url
+                    : term->colors.table[3]);
+            }
+            line_span_add(term, pix, &url, g.font, col, g.cols, y);
+        }
+    }
+
+    line_span_flush(term, pix, &underline, y);
+    line_span_flush(term, pix, &strikeout, y);
+    line_span_flush(term, pix, &url, y);
+
+    if (clr_pix != NULL)
+        pixman_image_unref(clr_pix);
+
+    if (damage != NULL) {
+        pixman_region32_union_rect(
+            damage, damage, run_x, y, damage_end - run_x, height);
+    }
+
+    pixman_image_set_clip_region32(pix, NULL);
+    pixman_region32_fini(&clip);
+}
+
+/*
+ * Renders a blank row (see grid_row_blank()). There is no text; only
+ * the background needs to be filled.
+ */
+static void
+render_blank_row(struct terminal *term, pixman_image_t *pix,
+                 pixman_region32_t *damage, struct row *row, int row_no)
+{
+    struct attributes *attrs = grid_row_blank_attrs(row);
+    if (attrs->clean)
+        return;
+
+    attrs->clean = 1;
+
+    uint32_t fg, bg;
+    uint16_t alpha;
+    cell_colors(term, &(struct cell){.attrs = *attrs}, &fg, &bg, &alpha);
+
+    const int x = term->margins.left;
+    const int y = term->margins.top + row_no * term->cell_height;
+    const int width = term->cols * term->cell_width;
+
+    pixman_color_t color = color_hex_to_pixman_with_alpha(bg, alpha);
+    pixman_image_fill_rectangles(
+        PIXMAN_OP_SRC, pix, &color, 1,
+        &(pixman_rectangle16_t){x, y, width, term->cell_height});
+
+    if (damage != NULL)
+        pixman_region32_union_rect(damage, damage, x, y, width, term->cell_height);
+}
+
+/*
+ * Renders all dirty cells in a row. Adjacent dirty cells with the
+ * same colors are batched together, and rendered as a run (see
+ * render_run()). The cursor cell is always rendered on its own.
+ */
 static void
 render_row(struct terminal *term, pixman_image_t *pix, pixman_region32_t *damage,
-           struct row *row, int row_no, int cursor_col)
+           struct glyph_cache *glyph_cache, struct row *row, int row_no,
+           int cursor_col)
+{
+    if (row->blank) {
+        /* The cursor's row is never blank (see grid_render_buffer()) */
+        xassert(cursor_col < 0);
+        render_blank_row(term, pix, damage, row, row_no);
+        return;
+    }
+
+    /* Cells outside the row's dirty span are known to be clean */
+    const int first_dirty = max(row->dirty_start, 0);
+    int col = min(row->dirty_end, term->cols - 1);
+
+    /* Colors of the cell at ‘col’, if already known */
+    bool have_colors = false;
+    uint32_t fg, bg;
+    uint16_t alpha;
+
+    while (col >= first_dirty) {
+        const struct cell *cell = &row->cells[col];
+
+        if (cell->attrs.clean) {
+            col--;
+            continue;
+        }
+
+        if (col == cursor_col) {
+            render_cell(term, pix, damage, row, row_no, col, true);
+            have_colors = false;
+            col--;
+            continue;
+        }
+
+        if (!have_colors)
+            cell_colors(term, cell, &fg, &bg, &alpha);
+
+        have_colors = false;
+
+        int first_col = col;
+        uint32_t next_fg = 0, next_bg = 0;
+        uint16_t next_alpha = 0;
+
+        while (first_col > first_dirty) {
+            const struct cell *next = &row->cells[first_col - 1];
+
+            if (next->attrs.clean || first_col - 1 == cursor_col)
+                break;
+
+            cell_colors(term, next, &next_fg, &next_bg, &next_alpha);
+            if (next_fg != fg || next_bg != bg || next_alpha != alpha) {
+                have_colors = true;
+                break;
+            }
+
+            first_col--;
+        }
+
+        render_run(term, pix, damage, glyph_cache, row, row_no,
+                   first_col, col, fg, bg, alpha);
+
+        col = first_col - 1;
+        fg = next_fg;
+        bg = next_bg;
+        alpha = next_alpha;
+    }
+}
+
+/*
+ * Returns the glyph cache for the specified render thread (0 is the
+ * main thread), or NULL if the glyph cache has been disabled.
+ *
+ * The cache is (re-)created if it doesn't exist yet, or if the cell
+ * size, or the buffer format, has changed. A cache that failed to
+ * allocate its atlas is kept, but not used, until then.
+ */
+static struct glyph_cache *
+glyph_cache_for_thread(struct terminal *term, int thread_idx,
+                       pixman_image_t *pix)
 {
-    for (int col = term->cols - 1; col >= 0; col--)
-        render_cell(term, pix, damage, row, row_no, col, cursor_col == col);
+    if (term->render.glyph_caches == NULL)
+        return NULL;
+
+    struct glyph_cache **cache = &term->render.glyph_caches[thread_idx];
+    const pixman_format_code_t format = pixman_image_get_format(pix);
+
+    if (*cache != NULL &&
+        !glyph_cache_is_compatible(
+            *cache, format, term->cell_width, term->cell_height))
+    {
+        glyph_cache_destroy(*cache);
+        *cache = NULL;
+    }
+
+    if (*cache == NULL) {
+        *cache = glyph_cache_new(
+            term->conf->tweak.glyph_cache_size, format,
+            term->cell_width, term->cell_height);
+    }
+
+    return (*cache)->atlas != NULL ? *cache : NULL;
+}
+
+/*
+ * Damages the terminal's main surface. Offscreen frames (see
+ * render_grid_offscreen()) have no surface; their damage is only
+ * tracked in the buffer.
+ */
+static void
+surface_damage_buffer(const struct terminal *term,
+                      int32_t x, int32_t y, int32_t width, int32_t height)
+{
+    struct wl_surface *surf = term->window->surface.surf;
+
+    if (likely(surf != NULL))
+        wl_surface_damage_buffer(surf, x, y, width, height);
 }
 
 static void
@@ -945,22 +1443,22 @@ render_margin(struct terminal *term, struct buffer *buf,
 
     if (apply_damage) {
         /* Top */
-        wl_surface_damage_buffer(
-            term->window->surface.surf, 0, 0, term->width, term->margins.top);
+        surface_damage_buffer(
+            term, 0, 0, term->width, term->margins.top);
 
         /* Bottom */
-        wl_surface_damage_buffer(
-            term->window->surface.surf, 0, bmargin, term->width, term->margins.bottom);
+        surface_damage_buffer(
+            term, 0, bmargin, term->width, term->margins.bottom);
 
         /* Left */
-        wl_surface_damage_buffer(
-            term->window->surface.surf,
+        surface_damage_buffer(
+            term,
             0, term->margins.top + start_line * term->cell_height,
             term->margins.left, line_count * term->cell_height);
 
         /* Right */
-        wl_surface_damage_buffer(
-            term->window->surface.surf,
+        surface_damage_buffer(
+            term,
             rmargin, term->margins.top + start_line * term->cell_height,
             term->margins.right, line_count * term->cell_height);
     }
@@ -1067,8 +1565,8 @@ grid_render_scroll(struct terminal *term, struct buffer *buf,
              (long)memmove_time.tv_sec, memmove_time.tv_nsec);
 #endif
 
-    wl_surface_damage_buffer(
-        term->window->surface.surf, term->margins.left, dst_y,
+    surface_damage_buffer(
+        term, term->margins.left, dst_y,
         term->width - term->margins.left - term->margins.right, height);
 
     /*
@@ -1144,8 +1642,8 @@ grid_render_scroll_reverse(struct terminal *term, struct buffer *buf,
              (long)memmove_time.tv_sec, memmove_time.tv_nsec);
 #endif
 
-    wl_surface_damage_buffer(
-        term->window->surface.surf, term->margins.left, dst_y,
+    surface_damage_buffer(
+        term, term->margins.left, dst_y,
         term->width - term->margins.left - term->margins.right, height);
 
     /*
@@ -1194,7 +1692,7 @@ render_sixel_chunk(struct terminal *term, pixman_image_t *pix, const struct sixe
         x, y,
         width, height);
 
-    wl_surface_damage_buffer(term->window->surface.surf, x, y, width, height);
+    surface_damage_buffer(term, x, y, width, height);
 }
 
 static void
@@ -1206,7 +1704,7 @@ render_sixel(struct terminal *term, pixman_image_t *pix,
     xassert(sixel->width >= 0);
     xassert(sixel->height >= 0);
 
-    const int view_end = (term->grid->view + term->rows - 1) & (term->grid->num_rows - 1);
+    const int view_end = grid_row_wrap(term->grid, term->grid->view + term->rows - 1);
     const bool last_row_needs_erase = sixel->height % term->cell_height != 0;
     const bool last_col_needs_erase = sixel->width % term->cell_width != 0;
 
@@ -1245,10 +1743,9 @@ render_sixel(struct terminal *term, pixman_image_t *pix,
          _abs_row_no < sixel->pos.row + sixel->rows;
          _abs_row_no++)
     {
-        const int abs_row_no = _abs_row_no & (term->grid->num_rows - 1);
+        const int abs_row_no = grid_row_wrap(term->grid, _abs_row_no);
         const int term_row_no =
-            (abs_row_no - term->grid->view + term->grid->num_rows) &
-            (term->grid->num_rows - 1);
+            grid_row_wrap(term->grid, abs_row_no - term->grid->view);
 
         /* Check if row is in the visible viewport */
         if (view_end >= term->grid->view) {
@@ -1268,7 +1765,7 @@ render_sixel(struct terminal *term, pixman_image_t *pix,
         }
 
         /* Is the row dirty? */
-        struct row *row = term->grid->rows[abs_row_no];
+        struct row *row = grid_row_abs(term->grid, abs_row_no);
         xassert(row != NULL);  /* Should be visible */
 
         if (!row->dirty) {
@@ -1294,7 +1791,7 @@ render_sixel(struct terminal *term, pixman_image_t *pix,
          */
         if (!sixel->opaque) {
             /* TODO: multithreading */
-            render_row(term, pix, damage, row, term_row_no, cursor_col);
+            render_row(term, pix, damage, NULL, row, term_row_no, cursor_col);
         } else {
             for (int col = sixel->pos.col;
                  col < min(sixel->pos.col + sixel->cols, term->cols);
@@ -1340,12 +1837,10 @@ render_sixel_images(struct terminal *term, pixman_image_t *pix,
         return;
 
     const int scrollback_end
-        = (term->grid->offset + term->rows) & (term->grid->num_rows - 1);
+        = grid_row_wrap(term->grid, term->grid->offset + term->rows);
 
     const int view_start
-        = (term->grid->view
-           - scrollback_end
-           + term->grid->num_rows) & (term->grid->num_rows - 1);
+        = grid_row_wrap(term->grid, term->grid->view - scrollback_end);
 
     const int view_end = view_start + term->rows - 1;
 
@@ -1355,9 +1850,7 @@ render_sixel_images(struct terminal *term, pixman_image_t *pix,
     tll_foreach(term->grid->sixel_images, it) {
         const struct sixel *six = &it->item;
         const int start
-            = (six->pos.row
-               - scrollback_end
-               + term->grid->num_rows) & (term->grid->num_rows - 1);
+            = grid_row_wrap(term->grid, six->pos.row - scrollback_end);
         const int end = start + six->rows - 1;
 
         //LOG_DBG("  sixel: %d-%d", start, end);
@@ -1391,7 +1884,7 @@ render_ime_preedit_for_seat(struct terminal *term, struct seat *seat,
     cursor = term->grid->cursor.point;
     cursor.row += term->grid->offset;
     cursor.row -= term->grid->view;
-    cursor.row &= term->grid->num_rows - 1;
+    cursor.row = grid_row_wrap(term->grid, cursor.row);
 
     if (cursor.row < 0 || cursor.row >= term->rows)
         return;
@@ -1466,7 +1959,7 @@ render_ime_preedit_for_seat(struct terminal *term, struct seat *seat,
         real_cells[i] = row->cells[col_idx + i];
         real_cells[i].attrs.clean = 0;
     }
-    row->dirty = true;
+    grid_row_dirty_range(row, col_idx, col_idx + cells_used - 1);
 
     /* Render pre-edit text */
     xassert(seat->ime.preedit.cells[ime_ofs].wc < CELL_SPACER);
@@ -1735,35 +2228,166 @@ render_overlay(struct terminal *term)
         damage_bounds = (pixman_box32_t){0, 0, buf->width, buf->height};
     }
 
-    pixman_image_fill_rectangles(
-        PIXMAN_OP_SRC, buf->pix[0], &color, 1,
-        &(pixman_rectangle16_t){0, 0, term->width, term->height});
+    pixman_image_fill_rectangles(
+        PIXMAN_OP_SRC, buf->pix[0], &color, 1,
+        &(pixman_rectangle16_t){0, 0, term->width, term->height});
+
+    quirk_weston_subsurface_desync_on(overlay->sub);
+    wayl_surface_scale(
+        term->window, &overlay->surface, buf, term->scale);
+    wl_subsurface_set_position(overlay->sub, 0, 0);
+    wl_surface_attach(overlay->surface.surf, buf->wl_buf, 0, 0);
+
+    wl_surface_damage_buffer(
+        overlay->surface.surf,
+        damage_bounds.x1, damage_bounds.y1,
+        damage_bounds.x2 - damage_bounds.x1,
+        damage_bounds.y2 - damage_bounds.y1);
+
+    wl_surface_commit(overlay->surface.surf);
+    quirk_weston_subsurface_desync_off(overlay->sub);
+
+    buf->age = 0;
+    term->render.last_overlay_buf = buf;
+    term->render.last_overlay_style = style;
+}
+
+/*
+ * Render workers are only woken when the frame is large enough to be
+ * worth it; waking a worker, and waiting for it, typically costs more
+ * than rendering a row or two.
+ *
+ * Each thread (including the main thread) is given at least
+ * RENDER_THREAD_MIN_WORK_NS worth of (estimated) work. The estimate
+ * starts out at RENDER_DEFAULT_ROW_COST_NS.
+ */
+#define RENDER_THREAD_MIN_WORK_NS 50000
+#define RENDER_DEFAULT_ROW_COST_NS 10000
+
+static size_t
+render_workers_to_wake(const struct terminal *term, size_t row_count)
+{
+    const uint64_t row_cost = term->render.workers.row_cost_ns > 0
+        ? term->render.workers.row_cost_ns
+        : RENDER_DEFAULT_ROW_COST_NS;
+
+    const uint64_t frame_cost = row_count * row_cost;
+    const uint64_t threads = frame_cost / RENDER_THREAD_MIN_WORK_NS;
+
+    /* Main thread renders too */
+    return threads > 1 ? min(threads - 1, term->render.workers.count) : 0;
+}
+
+/*
+ * Updates the estimated per-row render cost (an exponential moving
+ * average), from the rows the main thread rendered itself. This is
+ * done for every frame, whether workers were woken or not.
+ *
+ * Samples are capped at RENDER_THREAD_MIN_WORK_NS; a single slow row
+ * (e.g. one with glyphs rasterized for the first time) is not enough
+ * to have single row frames wake a worker.
+ */
+static void
+render_update_row_cost(struct terminal *term, const struct timespec *elapsed,
+                       size_t row_count)
+{
+    const uint64_t ns =
+        (uint64_t)elapsed->tv_sec * 1000000000 + elapsed->tv_nsec;
+    const uint64_t sample = min(ns / row_count, RENDER_THREAD_MIN_WORK_NS);
+
+    uint64_t *cost = &term->render.workers.row_cost_ns;
+    const uint64_t old = *cost > 0 ? *cost : RENDER_DEFAULT_ROW_COST_NS;
+    *cost = (old * 7 + sample) / 8;
+}
+
+/*
+ * Renders rows from the current frame's row array, until there are
+ * no more rows to claim. Called by the render workers, and by the
+ * main thread, concurrently. Returns the number of rows rendered.
+ */
+static size_t
+render_frame_rows(struct terminal *term, pixman_image_t *pix,
+                  pixman_region32_t *damage, struct glyph_cache *glyph_cache,
+                  struct coord cursor)
+{
+    const int *rows = term->render.workers.frame.rows;
+    const size_t row_count = term->render.workers.frame.count;
+    size_t rendered = 0;
+
+    while (true) {
+        /*
+         * Claim the next row. The start/done semaphores order
+         * everything else, so a relaxed increment is enough.
+         */
+        const size_t idx = atomic_fetch_add_explicit(
+            &term->render.workers.frame.next, 1, memory_order_relaxed);
+
+        if (idx >= row_count)
+            break;
+
+        const int row_no = rows[idx];
+        struct row *row = grid_row_in_view_or_blank(term->grid, row_no);
+        int cursor_col = cursor.row == row_no ? cursor.col : -1;
+
+        render_row(term, pix, damage, glyph_cache, row, row_no, cursor_col);
+        rendered++;
+    }
+
+    return rendered;
+}
 
-    quirk_weston_subsurface_desync_on(overlay->sub);
-    wayl_surface_scale(
-        term->window, &overlay->surface, buf, term->scale);
-    wl_subsurface_set_position(overlay->sub, 0, 0);
-    wl_surface_attach(overlay->surface.surf, buf->wl_buf, 0, 0);
+/*
+ * Render worker threads are shared by all terminals in the process
+ * (i.e. all windows of a 'foot --server' instance).
+ *
+ * Frames are rendered one at a time, by the main thread (see
+ * grid_render_buffer()), which points 'term' to the terminal whose
+ * frame is being rendered before waking the workers.
+ *
+ * The pool grows to the largest workers value of all
+ * terminals. Terminals configured with fewer threads wake fewer
+ * workers. Since any worker may pick up a frame, each woken worker
+ * claims a per-frame slot (1..woken), which indexes the terminal's
+ * per-thread buffers and glyph caches.
+ */
+struct render_worker_background_job {
+    bool (*step)(void *data);
+    void *data;
+};
 
-    wl_surface_damage_buffer(
-        overlay->surface.surf,
-        damage_bounds.x1, damage_bounds.y1,
-        damage_bounds.x2 - damage_bounds.x1,
-        damage_bounds.y2 - damage_bounds.y1);
+struct render_worker_pool {
+    size_t ref_count;
+    uint16_t count;
+    sem_t start;
+    sem_t done;
+    thrd_t *threads;
+    bool quit;
 
-    wl_surface_commit(overlay->surface.surf);
-    quirk_weston_subsurface_desync_off(overlay->sub);
+    struct terminal *term;
+    atomic_int slot;  /* Last claimed per-frame slot */
 
-    buf->age = 0;
-    term->render.last_overlay_buf = buf;
-    term->render.last_overlay_style = style;
-}
+    /* Work other than rendering, see render_worker_pool_run() */
+    void (*job)(void *data);
+    void *job_data;
+
+    /* See render_worker_pool_queue() */
+    struct fdm *fdm;
+    int background_timer_fd;
+    tll(struct render_worker_background_job) background;
+};
+
+static struct render_worker_pool *worker_pool = NULL;
+
+struct render_worker_context {
+    struct render_worker_pool *pool;
+    int my_id;
+};
 
-int
+static int
 render_worker_thread(void *_ctx)
 {
     struct render_worker_context *ctx = _ctx;
-    struct terminal *term = ctx->term;
+    struct render_worker_pool *pool = ctx->pool;
     const int my_id = ctx->my_id;
     free(ctx);
 
@@ -1777,15 +2401,30 @@ render_worker_thread(void *_ctx)
     if (pthread_setname_np(pthread_self(), proc_title) < 0)
         LOG_ERRNO("render worker %d: failed to set process title", my_id);
 
-    sem_t *start = &term->render.workers.start;
-    sem_t *done = &term->render.workers.done;
-    mtx_t *lock = &term->render.workers.lock;
-
     while (true) {
-        sem_wait(start);
+        sem_wait(&pool->start);
+
+        if (pool->quit)
+            return 0;
+
+        if (pool->job != NULL) {
+            pool->job(pool->job_data);
+            sem_post(&pool->done);
+            continue;
+        }
+
+        struct terminal *term = pool->term;
+        xassert(term != NULL);
 
         struct buffer *buf = term->render.workers.buf;
-        bool frame_done = false;
+        xassert(buf != NULL);
+
+        const int slot = 1 + atomic_fetch_add_explicit(
+            &pool->slot, 1, memory_order_relaxed);
+        xassert(slot <= term->render.workers.count);
+
+        struct glyph_cache *glyph_cache =
+            glyph_cache_for_thread(term, slot, buf->pix[slot]);
 
         /* Translate offset-relative cursor row to view-relative */
         struct coord cursor = {-1, -1};
@@ -1793,40 +2432,269 @@ render_worker_thread(void *_ctx)
             cursor = term->grid->cursor.point;
             cursor.row += term->grid->offset;
             cursor.row -= term->grid->view;
-            cursor.row &= term->grid->num_rows - 1;
+            cursor.row = grid_row_wrap(term->grid, cursor.row);
         }
 
-        while (!frame_done) {
-            mtx_lock(lock);
-            xassert(tll_length(term->render.workers.queue) > 0);
+        render_frame_rows(
+            term, buf->pix[slot], &buf->dirty[slot], glyph_cache, cursor);
+        sem_post(&pool->done);
+    };
+
+    return -1;
+}
+
+static void
+render_worker_pool_destroy(struct render_worker_pool *pool)
+{
+    /* Note: only started threads are counted */
+    pool->quit = true;
+    for (size_t i = 0; i < pool->count; i++)
+        sem_post(&pool->start);
+    for (size_t i = 0; i < pool->count; i++)
+        thrd_join(pool->threads[i], NULL);
+
+    if (pool->background_timer_fd >= 0)
+        fdm_del(pool->fdm, pool->background_timer_fd);
+    tll_free(pool->background);
+
+    free(pool->threads);
+    sem_destroy(&pool->start);
+    sem_destroy(&pool->done);
+    free(pool);
+}
 
-            int row_no = tll_pop_front(term->render.workers.queue);
-            mtx_unlock(lock);
+/* Starts more threads, until there are 'count' of them */
+static bool
+render_worker_pool_grow(struct render_worker_pool *pool, uint16_t count)
+{
+    if (count <= pool->count)
+        return true;
 
-            switch (row_no) {
-            default: {
-                xassert(buf != NULL);
+    pool->threads = xrealloc(pool->threads, count * sizeof(pool->threads[0]));
 
-                struct row *row = grid_row_in_view(term->grid, row_no);
-                int cursor_col = cursor.row == row_no ? cursor.col : -1;
+    for (size_t i = pool->count; i < count; i++) {
+        struct render_worker_context *ctx = xmalloc(sizeof(*ctx));
+        *ctx = (struct render_worker_context) {
+            .pool = pool,
+            .my_id = 1 + i,
+        };
 
-                render_row(term, buf->pix[my_id], &buf->dirty[my_id],
-                           row, row_no, cursor_col);
-                break;
-            }
+        int ret = thrd_create(&pool->threads[i], &render_worker_thread, ctx);
+        if (ret != thrd_success) {
+            LOG_ERR("failed to create render worker thread: %s (%d)",
+                    thrd_err_as_string(ret), ret);
+            free(ctx);
+            return false;
+        }
 
-            case -1:
-                frame_done = true;
-                sem_post(done);
-                break;
+        pool->count++;
+    }
 
-            case -2:
-                return 0;
-            }
+    return true;
+}
+
+static bool fdm_background(struct fdm *fdm, int fd, int events, void *data);
+
+struct render_worker_pool *
+render_worker_pool_ref(struct fdm *fdm, uint16_t count)
+{
+    if (worker_pool != NULL) {
+        if (count > worker_pool->count) {
+            LOG_INFO("workers=%hu: growing from %hu to %hu "
+                     "rendering threads", count, worker_pool->count, count);
+
+            /* Not fatal; we'll use the threads we've got */
+            render_worker_pool_grow(worker_pool, count);
         }
+
+        worker_pool->ref_count++;
+        return worker_pool;
+    }
+
+    LOG_INFO("using %hu rendering threads", count);
+
+    struct render_worker_pool *pool = xmalloc(sizeof(*pool));
+    *pool = (struct render_worker_pool){
+        .ref_count = 1,
+        .fdm = fdm,
+        .background_timer_fd = -1,
+        .background = tll_init(),
     };
 
-    return -1;
+    if (sem_init(&pool->start, 0, 0) < 0 ||
+        sem_init(&pool->done, 0, 0) < 0)
+    {
+        LOG_ERRNO("failed to instantiate render worker semaphores");
+        free(pool);
+        return NULL;
+    }
+
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (timer_fd < 0) {
+        LOG_ERRNO("failed to create render worker background job timer");
+        render_worker_pool_destroy(pool);
+        return NULL;
+    }
+
+    if (!fdm_add(fdm, timer_fd, EPOLLIN, &fdm_background, pool)) {
+        close(timer_fd);
+        render_worker_pool_destroy(pool);
+        return NULL;
+    }
+
+    pool->background_timer_fd = timer_fd;
+
+    if (!render_worker_pool_grow(pool, count)) {
+        render_worker_pool_destroy(pool);
+        return NULL;
+    }
+
+    worker_pool = pool;
+    return pool;
+}
+
+void
+render_worker_pool_unref(struct render_worker_pool *pool)
+{
+    if (pool == NULL)
+        return;
+
+    xassert(pool == worker_pool);
+    xassert(pool->ref_count > 0);
+
+    if (--pool->ref_count > 0)
+        return;
+
+    render_worker_pool_destroy(pool);
+    worker_pool = NULL;
+}
+
+uint16_t
+render_worker_pool_size(const struct render_worker_pool *pool)
+{
+    return pool->count;
+}
+
+void
+render_worker_pool_run(struct render_worker_pool *pool, size_t workers,
+                       void (*job)(void *data), void *data)
+{
+    if (pool == NULL)
+        workers = 0;
+    else
+        workers = min(workers, (size_t)pool->count);
+
+    if (workers > 0) {
+        xassert(pool->term == NULL);
+        xassert(pool->job == NULL);
+
+        pool->job = job;
+        pool->job_data = data;
+
+        for (size_t i = 0; i < workers; i++)
+            sem_post(&pool->start);
+    }
+
+    job(data);
+
+    if (workers > 0) {
+        for (size_t i = 0; i < workers; i++)
+            sem_wait(&pool->done);
+
+        pool->job = NULL;
+        pool->job_data = NULL;
+    }
+}
+
+static bool
+background_timer_schedule(struct render_worker_pool *pool)
+{
+    const struct itimerspec alarm = {
+        .it_value = {.tv_sec = 0, .tv_nsec = 1000000},
+    };
+
+    if (timerfd_settime(pool->background_timer_fd, 0, &alarm, NULL) < 0) {
+        LOG_ERRNO("failed to arm render worker background job timer");
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Runs one step of the job at the head of the queue, and moves it to
+ * the back of the queue if it isn't done yet. The timer is a one-shot
+ * timer, re-armed for as long as there are queued jobs.
+ */
+static bool
+fdm_background(struct fdm *fdm, int fd, int events, void *data)
+{
+    if (events & EPOLLHUP)
+        return false;
+
+    struct render_worker_pool *pool = data;
+    uint64_t expiration_count;
+    ssize_t ret = read(fd, &expiration_count, sizeof(expiration_count));
+
+    if (ret < 0) {
+        if (errno == EAGAIN)
+            return true;
+
+        LOG_ERRNO("failed to read render worker background job timer");
+        return false;
+    }
+
+    if (tll_length(pool->background) == 0)
+        return true;
+
+    struct render_worker_background_job job = tll_pop_front(pool->background);
+
+    if (job.step(job.data))
+        tll_push_back(pool->background, job);
+
+    if (tll_length(pool->background) > 0 && !background_timer_schedule(pool)) {
+        /* Run everything that's left right away */
+        while (tll_length(pool->background) > 0) {
+            job = tll_pop_front(pool->background);
+            while (job.step(job.data))
+                ;
+        }
+    }
+
+    return true;
+}
+
+bool
+render_worker_pool_queue(struct render_worker_pool *pool,
+                         bool (*step)(void *data), void *data)
+{
+    if (pool == NULL || pool->background_timer_fd < 0)
+        return false;
+
+    tll_foreach(pool->background, it) {
+        if (it->item.step == step && it->item.data == data)
+            return true;
+    }
+
+    if (tll_length(pool->background) == 0 && !background_timer_schedule(pool))
+        return false;
+
+    tll_push_back(
+        pool->background,
+        ((struct render_worker_background_job){.step = step, .data = data}));
+    return true;
+}
+
+void
+render_worker_pool_dequeue(struct render_worker_pool *pool, void *data)
+{
+    if (pool == NULL)
+        return;
+
+    tll_foreach(pool->background, it) {
+        if (it->item.data == data)
+            tll_remove(pool->background, it);
+    }
 }
 
 struct csd_data
@@ -2495,17 +3363,15 @@ render_scrollback_position(struct terminal *term)
     xassert(win->scrollback_indicator.sub != NULL);
 
     /* Find absolute row number of the scrollback start */
-    int scrollback_start = term->grid->offset + term->rows;
-    int empty_rows = 0;
-    while (term->grid->rows[scrollback_start & (term->grid->num_rows - 1)] == NULL) {
-        scrollback_start++;
-        empty_rows++;
-    }
+    const int scrollback_start =
+        grid_sb_start_ignore_uninitialized(term->grid, term->rows);
+    const int empty_rows = grid_row_wrap(
+        term->grid, scrollback_start - term->grid->offset - term->rows);
 
     /* Rebase viewport against scrollback start (so that 0 is at
      * the beginning of the scrollback) */
     int rebased_view = term->grid->view - scrollback_start + term->grid->num_rows;
-    rebased_view &= term->grid->num_rows - 1;
+    rebased_view = grid_row_wrap(term->grid, rebased_view);
 
     /* How much of the scrollback is actually used? */
     int populated_rows = term->grid->num_rows - empty_rows;
@@ -2712,18 +3578,32 @@ reapply_old_damage(struct terminal *term, struct buffer *new, struct buffer *old
     bool full_repaint_needed = true;
 
     for (int r = 0; r < term->rows; r++) {
-        const struct row *row = grid_row_in_view(term->grid, r);
+        const struct row *row = grid_row_in_view_or_blank(term->grid, r);
+
+        if (!row->dirty ||
+            row->dirty_start > 0 || row->dirty_end < term->cols - 1)
+        {
+            /* Cells outside the dirty span are clean */
+            full_repaint_needed = false;
+            continue;
+        }
 
         bool row_all_dirty = true;
-        for (int c = 0; c < term->cols; c++) {
-            if (row->cells[c].attrs.clean) {
-                row_all_dirty = false;
-                full_repaint_needed = false;
-                break;
+
+        if (row->blank)
+            row_all_dirty = !grid_row_blank_attrs(row)->clean;
+        else {
+            for (int c = 0; c < term->cols; c++) {
+                if (row->cells[c].attrs.clean) {
+                    row_all_dirty = false;
+                    break;
+                }
             }
         }
 
-        if (row_all_dirty) {
+        if (!row_all_dirty)
+            full_repaint_needed = false;
+        else {
             pixman_region32_union_rect(
                 &dirty, &dirty,
                 term->margins.left,
@@ -2779,7 +3659,7 @@ dirty_old_cursor(struct terminal *term)
         struct row *row = term->render.last_cursor.row;
         struct cell *cell = &row->cells[term->render.last_cursor.col];
         cell->attrs.clean = 0;
-        row->dirty = true;
+        grid_row_dirty_cell(row, term->render.last_cursor.col);
     }
 
     /* Remember current cursor position, for the next frame */
@@ -2799,26 +3679,20 @@ dirty_cursor(struct terminal *term)
     struct row *row = grid_row(term->grid, cursor->row);
     struct cell *cell = &row->cells[cursor->col];
     cell->attrs.clean = 0;
-    row->dirty = true;
+    grid_row_dirty_cell(row, cursor->col);
 }
 
+/*
+ * Renders all dirty rows (and scroll damage, sixels etc) of the grid
+ * to 'buf', and adds the damaged areas to 'damage'. This is the part
+ * of a frame that doesn't involve the Wayland surface.
+ */
 static void
-grid_render(struct terminal *term)
+grid_render_buffer(struct terminal *term, struct buffer *buf,
+                   pixman_region32_t *damage,
+                   struct timespec *start_double_buffering,
+                   struct timespec *stop_double_buffering)
 {
-    if (term->shutdown.in_progress)
-        return;
-
-    struct timespec start_time, start_double_buffering = {0}, stop_double_buffering = {0};
-
-    if (term->conf->tweak.render_timer != RENDER_TIMER_NONE)
-        clock_gettime(CLOCK_MONOTONIC, &start_time);
-
-    xassert(term->width > 0);
-    xassert(term->height > 0);
-
-    struct buffer_chain *chain = term->render.chains.grid;
-    struct buffer *buf = shm_get_buffer(chain, term->width, term->height);
-
     /* Dirty old and current cursor cell, to ensure they’re repainted */
     dirty_old_cursor(term);
     dirty_cursor(term);
@@ -2839,9 +3713,9 @@ grid_render(struct terminal *term)
         xassert(term->render.last_buf->width == buf->width);
         xassert(term->render.last_buf->height == buf->height);
 
-        clock_gettime(CLOCK_MONOTONIC, &start_double_buffering);
+        clock_gettime(CLOCK_MONOTONIC, start_double_buffering);
         reapply_old_damage(term, buf, term->render.last_buf);
-        clock_gettime(CLOCK_MONOTONIC, &stop_double_buffering);
+        clock_gettime(CLOCK_MONOTONIC, stop_double_buffering);
     }
 
     if (term->render.last_buf != NULL) {
@@ -2904,7 +3778,33 @@ grid_render(struct terminal *term)
         cursor = term->grid->cursor.point;
         cursor.row += term->grid->offset;
         cursor.row -= term->grid->view;
-        cursor.row &= term->grid->num_rows - 1;
+        cursor.row = grid_row_wrap(term->grid, cursor.row);
+    }
+
+    /*
+     * Collect this frame's dirty rows. Everything below only looks at
+     * these rows, and only at the dirty column span of each row.
+     */
+    if (term->render.workers.frame.size < (size_t)term->rows) {
+        term->render.workers.frame.size = term->rows;
+        term->render.workers.frame.rows = xrealloc(
+            term->render.workers.frame.rows,
+            term->rows * sizeof(term->render.workers.frame.rows[0]));
+    }
+
+    int *const dirty_rows = term->render.workers.frame.rows;
+    size_t row_count = 0;
+
+    for (int r = 0; r < term->rows; r++) {
+        struct row *row = grid_row_in_view_or_blank(term->grid, r);
+
+        if (unlikely(row->blank && r == cursor.row)) {
+            /* Only the main thread may materialize rows */
+            row = grid_row_in_view(term->grid, r);
+        }
+
+        if (row->dirty)
+            dirty_rows[row_count++] = r;
     }
 
     if (term->conf->tweak.overflowing_glyphs) {
@@ -2919,18 +3819,20 @@ grid_render(struct terminal *term)
          * dirty cell in the middle, we need to re-render the entire
          * string.
          */
-        for (int r = 0; r < term->rows; r++) {
-            struct row *row = grid_row_in_view(term->grid, r);
+        for (size_t i = 0; i < row_count; i++) {
+            struct row *row =
+                grid_row_in_view_or_blank(term->grid, dirty_rows[i]);
 
-            if (!row->dirty)
+            /* Blank rows are rendered in full, and have no glyphs */
+            if (row->blank)
                 continue;
 
-            /* Loop row from left to right, looking for dirty cells */
-            for (struct cell *cell = &row->cells[0];
-                 cell < &row->cells[term->cols];
-                 cell++)
-            {
-                if (cell->attrs.clean)
+            int span_start = max(row->dirty_start, 0);
+            int span_end = min(row->dirty_end, term->cols - 1);
+
+            /* Loop dirty span from left to right, looking for dirty cells */
+            for (int col = span_start; col <= span_end; col++) {
+                if (row->cells[col].attrs.clean)
                     continue;
 
                 /*
@@ -2945,12 +3847,14 @@ grid_render(struct terminal *term)
                  * that means we’ve already handled it (remember the
                  * outer loop goes from left to right).
                  */
-                for (struct cell *c = cell - 1; c >= &row->cells[0]; c--) {
-                    if (c->attrs.confined)
+                for (int c = col - 1; c >= 0; c--) {
+                    struct cell *cell = &row->cells[c];
+                    if (cell->attrs.confined)
                         break;
-                    if (!c->attrs.clean)
+                    if (!cell->attrs.clean)
                         break;
-                    c->attrs.clean = false;
+                    cell->attrs.clean = false;
+                    span_start = min(span_start, c);
                 }
 
                 /*
@@ -2963,65 +3867,106 @@ grid_render(struct terminal *term)
                  * we’re dealing with right now.
                  *
                  * For performance, this iterates the *outer* loop’s
-                 * cell pointer - no point in re-checking all these
-                 * glyphs again, in the outer loop.
+                 * column - no point in re-checking all these glyphs
+                 * again, in the outer loop. Note that this may take
+                 * us past the end of the dirty span.
                  */
-                for (; cell < &row->cells[term->cols]; cell++) {
+                for (; col < term->cols; col++) {
+                    struct cell *cell = &row->cells[col];
                     cell->attrs.clean = false;
                     if (cell->attrs.confined)
                         break;
                 }
+
+                span_end = max(span_end, min(col, term->cols - 1));
             }
+
+            row->dirty_start = span_start;
+            row->dirty_end = span_end;
         }
     }
 
-    pixman_region32_t damage;
-    pixman_region32_init(&damage);
+    render_sixel_images(term, buf->pix[0], damage, &cursor);
+
+    /* Note: the rows' dirty spans are still used by render_row() */
+    for (size_t i = 0; i < row_count; i++)
+        grid_row_in_view_or_blank(term->grid, dirty_rows[i])->dirty = false;
+
+    struct glyph_cache *glyph_cache =
+        glyph_cache_for_thread(term, 0, buf->pix[0]);
+
+    term->render.workers.frame.count = row_count;
+    atomic_store_explicit(
+        &term->render.workers.frame.next, 0, memory_order_relaxed);
+
+    if (term->render.workers.count == 0)
+        render_frame_rows(term, buf->pix[0], damage, glyph_cache, cursor);
 
-    render_sixel_images(term, buf->pix[0], &damage, &cursor);
+    /*
+     * Wake as many workers as the frame is worth, and render
+     * alongside them. Small frames are rendered by the main thread
+     * alone.
+     */
+    else if (row_count > 0) {
+        struct render_worker_pool *pool = term->render.workers.pool;
+        const size_t wake = render_workers_to_wake(term, row_count);
 
-    if (term->render.workers.count > 0) {
-        mtx_lock(&term->render.workers.lock);
+        xassert(pool->term == NULL);
+        pool->term = term;
+        atomic_store_explicit(&pool->slot, 0, memory_order_relaxed);
         term->render.workers.buf = buf;
-        for (size_t i = 0; i < term->render.workers.count; i++)
-            sem_post(&term->render.workers.start);
 
-        xassert(tll_length(term->render.workers.queue) == 0);
-    }
+        for (size_t i = 0; i < wake; i++)
+            sem_post(&pool->start);
 
-    for (int r = 0; r < term->rows; r++) {
-        struct row *row = grid_row_in_view(term->grid, r);
+        struct timespec start_time, end_time, elapsed;
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
 
-        if (!row->dirty)
-            continue;
+        const size_t rendered = render_frame_rows(
+            term, buf->pix[0], damage, glyph_cache, cursor);
 
-        row->dirty = false;
+        clock_gettime(CLOCK_MONOTONIC, &end_time);
 
-        if (term->render.workers.count > 0)
-            tll_push_back(term->render.workers.queue, r);
+        for (size_t i = 0; i < wake; i++)
+            sem_wait(&pool->done);
 
-        else {
-            /* TODO: damage region */
-            int cursor_col = cursor.row == r ? cursor.col : -1;
-            render_row(term, buf->pix[0], &damage, row, r, cursor_col);
+        if (rendered > 0) {
+            timespec_sub(&end_time, &start_time, &elapsed);
+            render_update_row_cost(term, &elapsed, rendered);
         }
-    }
-
-    /* Signal workers the frame is done */
-    if (term->render.workers.count > 0) {
-        for (size_t i = 0; i < term->render.workers.count; i++)
-            tll_push_back(term->render.workers.queue, -1);
-        mtx_unlock(&term->render.workers.lock);
 
-        for (size_t i = 0; i < term->render.workers.count; i++)
-            sem_wait(&term->render.workers.done);
         term->render.workers.buf = NULL;
+        pool->term = NULL;
     }
 
     for (size_t i = 0; i < term->render.workers.count; i++)
-        pixman_region32_union(&damage, &damage, &buf->dirty[i + 1]);
+        pixman_region32_union(damage, damage, &buf->dirty[i + 1]);
+
+    pixman_region32_union(&buf->dirty[0], &buf->dirty[0], damage);
+}
+
+static void
+grid_render(struct terminal *term)
+{
+    if (term->shutdown.in_progress)
+        return;
+
+    struct timespec start_time, start_double_buffering = {0}, stop_double_buffering = {0};
+
+    if (term->conf->tweak.render_timer != RENDER_TIMER_NONE)
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    xassert(term->width > 0);
+    xassert(term->height > 0);
+
+    struct buffer_chain *chain = term->render.chains.grid;
+    struct buffer *buf = shm_get_buffer(chain, term->width, term->height);
+
+    pixman_region32_t damage;
+    pixman_region32_init(&damage);
 
-    pixman_region32_union(&buf->dirty[0], &buf->dirty[0], &damage);
+    grid_render_buffer(
+        term, buf, &damage, &start_double_buffering, &stop_double_buffering);
 
     {
         int box_count = 0;
@@ -3130,6 +4075,29 @@ grid_render(struct terminal *term)
     wl_surface_commit(term->window->surface.surf);
 }
 
+struct buffer *
+render_grid_offscreen(struct terminal *term)
+{
+    xassert(term->width > 0);
+    xassert(term->height > 0);
+
+    struct buffer_chain *chain = term->render.chains.grid;
+    struct buffer *buf = shm_get_buffer(chain, term->width, term->height);
+
+    struct timespec start_double_buffering, stop_double_buffering;
+    pixman_region32_t damage;
+    pixman_region32_init(&damage);
+
+    grid_render_buffer(
+        term, buf, &damage, &start_double_buffering, &stop_double_buffering);
+
+    pixman_region32_fini(&damage);
+
+    /* There's no compositor; the buffer is released immediately */
+    shm_did_not_use_buf(buf);
+    return buf;
+}
+
 static void
 render_search_box(struct terminal *term)
 {
@@ -3485,11 +4453,9 @@ render_urls(struct terminal *term)
 
     /* Calculate view start, counted from the *current* scrollback start */
     const int scrollback_end
-        = (term->grid->offset + term->rows) & (term->grid->num_rows - 1);
+        = grid_row_wrap(term->grid, term->grid->offset + term->rows);
     const int view_start
-        = (term->grid->view
-           - scrollback_end
-           + term->grid->num_rows) & (term->grid->num_rows - 1);
+        = grid_row_wrap(term->grid, term->grid->view - scrollback_end);
     const int view_end = view_start + term->rows - 1;
 
     const bool show_url = term->urls_show_uri_on_jump_label;
@@ -3553,9 +4519,7 @@ render_urls(struct terminal *term)
         bool hide = false;
         const struct coord *pos = &url->range.start;
         const int _row
-            = (pos->row
-               - scrollback_end
-               + term->grid->num_rows) & (term->grid->num_rows - 1);
+            = grid_row_wrap(term->grid, pos->row - scrollback_end);
 
         if (_row < view_start || _row > view_end)
             hide = true;
@@ -3574,7 +4538,7 @@ render_urls(struct terminal *term)
         int row = pos->row - term->grid->view;
         while (row < 0)
             row += term->grid->num_rows;
-        row &= (term->grid->num_rows - 1);
+        row = grid_row_wrap(term->grid, row);
 
         /* Position label slightly above and to the left */
         int x = col * term->cell_width - 15 * term->cell_width / 10;
@@ -3799,7 +4763,7 @@ delayed_reflow_of_normal_grid(struct terminal *term)
     /* Reflow the original (since before the resize was started) grid,
      * to the *current* dimensions */
     grid_resize_and_reflow(
-        term->interactive_resizing.grid,
+        term->interactive_resizing.grid, term->render.workers.pool,
         term->interactive_resizing.new_rows, term->normal.num_cols,
         term->interactive_resizing.old_screen_rows, term->rows,
         term->selection.coords.end.row >= 0 ? ALEN(tracking_points) : 0,
@@ -3826,6 +4790,7 @@ delayed_reflow_of_normal_grid(struct terminal *term)
 
     tll_free(term->normal.scroll_damage);
     sixel_reflow_grid(term, &term->normal);
+    term_queue_reflow(term);
 
     if (term->grid == &term->normal) {
         term_damage_view(term);
@@ -4014,8 +4979,8 @@ maybe_resize(struct terminal *term, int width, int height, bool force)
     const int new_rows = (term->height - 2 * pad_y) / term->cell_height;
 
     /* Grid rows/cols after resize */
-    const int new_normal_grid_rows = 1 << (32 - __builtin_clz(new_rows + scrollback_lines - 1));
-    const int new_alt_grid_rows = 1 << (32  - __builtin_clz(new_rows));
+    const int new_normal_grid_rows = new_rows + scrollback_lines;
+    const int new_alt_grid_rows = new_rows;
 
     xassert(new_cols >= 1);
     xassert(new_rows >= 1);
@@ -4095,7 +5060,7 @@ maybe_resize(struct terminal *term, int width, int height, bool force)
          *  - sixels?
          */
         struct grid g = {
-            .num_rows = 1 << (32 - __builtin_clz(term->interactive_resizing.old_screen_rows)),
+            .num_rows = term->interactive_resizing.old_screen_rows,
             .num_cols = term->interactive_resizing.old_cols,
             .offset = 0,
             .view = 0,
@@ -4113,11 +5078,11 @@ maybe_resize(struct terminal *term, int width, int height, bool force)
 
         for (size_t i = 0, j = orig->view;
              i < term->interactive_resizing.old_screen_rows;
-             i++, j = (j + 1) & (orig->num_rows - 1))
+             i++, j = grid_row_wrap(orig, j + 1))
         {
-            g.rows[i] = grid_row_alloc(g.num_cols, false);
+            g.rows[i] = grid_row_alloc(&g, false);
             memcpy(g.rows[i]->cells,
-                   orig->rows[j]->cells,
+                   grid_row_abs(orig, j)->cells,
                    g.num_cols * sizeof(g.rows[i]->cells[0]));
         }
 
@@ -4187,9 +5152,12 @@ maybe_resize(struct terminal *term, int width, int height, bool force)
         };
 
         grid_resize_and_reflow(
-            &term->normal, new_normal_grid_rows, new_cols, old_normal_rows, new_rows,
+            &term->normal, term->render.workers.pool,
+            new_normal_grid_rows, new_cols, old_normal_rows, new_rows,
             term->selection.coords.end.row >= 0 ? ALEN(tracking_points) : 0,
             tracking_points);
+
+        term_queue_reflow(term);
     }
 
     grid_resize_without_reflow(
@@ -22,11 +22,48 @@ bool render_xcursor_set(
     struct seat *seat, struct terminal *term, enum cursor_shape shape);
 bool render_xcursor_is_valid(const struct seat *seat, const char *cursor);
 
-struct render_worker_context {
-    int my_id;
-    struct terminal *term;
-};
-int render_worker_thread(void *_ctx);
+/*
+ * Renders the grid to a buffer from the terminal's grid buffer chain,
+ * without committing it to a surface. Meant for offscreen chains
+ * (i.e. created with a NULL wl_shm), by benchmarks and the PGO helper.
+ */
+struct buffer *render_grid_offscreen(struct terminal *term);
+
+/*
+ * Render worker threads are shared by all terminals in the process.
+ * The pool is started by the first reference, with 'count' threads,
+ * and stopped when the last reference is dropped. Later references
+ * grow the pool to 'count' threads, if it's smaller than that.
+ */
+struct render_worker_pool;
+struct render_worker_pool *render_worker_pool_ref(
+    struct fdm *fdm, uint16_t count);
+void render_worker_pool_unref(struct render_worker_pool *pool);
+uint16_t render_worker_pool_size(const struct render_worker_pool *pool);
+
+/*
+ * Runs 'job' on the calling thread, and on (at most) 'workers' of the
+ * pool's threads, and returns when all of them have returned. Used
+ * for work other than rendering (e.g. reflow). Must be called from
+ * the main thread, and not while a frame is being rendered. 'pool'
+ * may be NULL, in which case 'job' runs on the calling thread only.
+ */
+void render_worker_pool_run(
+    struct render_worker_pool *pool, size_t workers,
+    void (*job)(void *data), void *data);
+
+/*
+ * Queues a background job (e.g. a lazy scrollback reflow). 'step' is
+ * called from the main loop, until it returns false. The queued jobs
+ * take turns, one step at a time, so that a single terminal cannot
+ * keep the pool to itself. Queuing an already queued job is a
+ * no-op. Returns false if the job could not be queued.
+ */
+bool render_worker_pool_queue(
+    struct render_worker_pool *pool, bool (*step)(void *data), void *data);
+
+/* Removes all queued background jobs with 'data' */
+void render_worker_pool_dequeue(struct render_worker_pool *pool, void *data);
 
 struct csd_data {
     int x;
@@ -0,0 +1,259 @@
+#!/usr/bin/env python3
+
+"""
+Generates foot's code point width table, unicode-width.c.
+
+The output is checked in; the table is *not* generated at build
+time. This way, widths are the same on every machine, regardless of
+which Python (and thus which Unicode data) the build host has. Re-run
+this script, and commit the result, when updating UNICODE_VERSION.
+
+The widths follow the same rules as glibc's wcwidth(), but are
+derived from a single, pinned, Unicode version, rather than whatever
+the current locale provides:
+
+  * C0 and C1 control characters, line and paragraph separators and
+    surrogates: -1
+  * NUL, non-spacing and enclosing marks (Mn, Me), format characters
+    (Cf, except SOFT HYPHEN and prepended concatenation marks), ZERO
+    WIDTH SPACE and conjoining Hangul medial vowels and final
+    consonants: 0
+  * East Asian Wide and Fullwidth, emoji with default emoji
+    presentation, circled numbers on black squares (U+3248..U+324F)
+    and Yijing hexagram symbols (U+4DC0..U+4DFF): 2
+  * Everything else: 1
+
+Unlike glibc, unassigned code points are *not* -1. They get the
+width of their (default) East Asian Width; i.e. 2 in the CJK
+ideograph blocks and planes, and 1 elsewhere. Otherwise, characters
+newer than UNICODE_VERSION (e.g. new emoji) would not be printed at
+all.
+
+The data is read from UnicodeData.txt, EastAsianWidth.txt and
+emoji-data.txt in --ucd-dir. Their version must be UNICODE_VERSION.
+Without --ucd-dir, Python's bundled unicodedata module is used, but
+only if its version is UNICODE_VERSION. It lacks the emoji
+properties, so the Emoji_Presentation code points that are not East
+Asian Wide are listed below.
+
+The table is a two-level lookup: the high bits of the code point
+index a block table, and the low bits index into the (de-duplicated)
+block.
+"""
+
+import argparse
+import os
+import re
+import sys
+import unicodedata
+
+from typing import Dict, List, Set, Tuple
+
+
+UNICODE_VERSION = '15.1.0'
+
+CODE_POINT_COUNT = 0x110000
+BLOCK_SHIFT = 8
+BLOCK_SIZE = 1 << BLOCK_SHIFT
+
+# Prepended_Concatenation_Mark, from PropList.txt
+PREPENDED_CONCATENATION_MARKS = set(
+    list(range(0x0600, 0x0605 + 1)) +
+    [0x06dd, 0x070f, 0x0890, 0x0891, 0x08e2, 0x110bd, 0x110cd])
+
+# Emoji_Presentation code points, from emoji-data.txt, that are *not*
+# East Asian Wide (UNICODE_VERSION): the regional indicators
+EMOJI_PRESENTATION_NOT_WIDE = set(range(0x1f1e6, 0x1f1ff + 1))
+
+
+def check_version(path: str, pattern: str, expected: str) -> None:
+    """Verifies the version in the header of a UCD file"""
+    with open(path, encoding='utf-8') as f:
+        header = ''.join(f.readline() for _ in range(16))
+
+    m = re.search(pattern, header)
+    if m is None or m.group(1) != expected:
+        sys.exit(f'{path}: expected version {expected}, '
+                 f'found {m.group(1) if m is not None else "none"}')
+
+
+def parse_ranges(path: str) -> List[Tuple[int, int, str]]:
+    """
+    Parses a UCD file with 'XXXX[..YYYY] ; value' lines. Default
+    values ('# @missing: XXXX..YYYY; value' lines) come first in the
+    returned list, so that explicit values override them.
+    """
+    missing = []
+    ranges = []
+    with open(path, encoding='utf-8') as f:
+        for line in f:
+            if line.startswith('# @missing:'):
+                cps, value = (x.strip() for x in line[len('# @missing:'):].split(';')[:2])
+                lo, hi = cps.split('..')
+                missing.append((int(lo, 16), int(hi, 16), value))
+                continue
+
+            line = line.split('#', 1)[0].strip()
+            if not line:
+                continue
+
+            cps, value = (x.strip() for x in line.split(';')[:2])
+            if '..' in cps:
+                lo, hi = cps.split('..')
+            else:
+                lo = hi = cps
+            ranges.append((int(lo, 16), int(hi, 16), value))
+    return missing + ranges
+
+
+def load_ucd(ucd_dir: str) -> Tuple[Dict[int, str], Dict[int, str], Set[int]]:
+    eaw_path = os.path.join(ucd_dir, 'EastAsianWidth.txt')
+    emoji_path = os.path.join(ucd_dir, 'emoji-data.txt')
+    if not os.path.exists(emoji_path):
+        emoji_path = os.path.join(ucd_dir, 'emoji', 'emoji-data.txt')
+
+    check_version(eaw_path, r'EastAsianWidth-(\d+\.\d+\.\d+)\.txt',
+                  UNICODE_VERSION)
+    check_version(emoji_path, r'Emoji Version (\d+\.\d+)',
+                  '.'.join(UNICODE_VERSION.split('.')[:2]))
+
+    categories: Dict[int, str] = {}
+    with open(os.path.join(ucd_dir, 'UnicodeData.txt'), encoding='utf-8') as f:
+        first = None
+        for line in f:
+            fields = line.split(';')
+            cp = int(fields[0], 16)
+            name = fields[1]
+            category = fields[2]
+
+            if name.endswith(', First>'):
+                first = cp
+                continue
+            if name.endswith(', Last>'):
+                assert first is not None
+                for c in range(first, cp + 1):
+                    categories[c] = category
+                first = None
+                continue
+
+            categories[cp] = category
+
+    east_asian_widths: Dict[int, str] = {}
+    for lo, hi, value in parse_ranges(eaw_path):
+        for cp in range(lo, hi + 1):
+            east_asian_widths[cp] = value
+
+    emoji_presentation: Set[int] = set()
+    for lo, hi, value in parse_ranges(emoji_path):
+        if value == 'Emoji_Presentation':
+            emoji_presentation.update(range(lo, hi + 1))
+
+    return categories, east_asian_widths, emoji_presentation
+
+
+def load_unicodedata() -> Tuple[Dict[int, str], Dict[int, str], Set[int]]:
+    if unicodedata.unidata_version != UNICODE_VERSION:
+        sys.exit(f'Python\'s Unicode data is version '
+                 f'{unicodedata.unidata_version}, but the table is pinned '
+                 f'to {UNICODE_VERSION}; use --ucd-dir')
+
+    categories: Dict[int, str] = {}
+    east_asian_widths: Dict[int, str] = {}
+
+    for cp in range(CODE_POINT_COUNT):
+        c = chr(cp)
+        categories[cp] = unicodedata.category(c)
+        east_asian_widths[cp] = unicodedata.east_asian_width(c)
+
+    return categories, east_asian_widths, EMOJI_PRESENTATION_NOT_WIDE
+
+
+def width(cp: int, categories: Dict[int, str],
+          east_asian_widths: Dict[int, str],
+          emoji_presentation: Set[int]) -> int:
+    if cp == 0:
+        return 0
+    if cp < 0x20 or 0x7f <= cp < 0xa0:
+        return -1
+
+    category = categories.get(cp, 'Cn')
+    if category in ('Cs', 'Zl', 'Zp'):
+        return -1
+    if category == 'Cn':
+        return 2 if east_asian_widths.get(cp, 'N') in ('W', 'F') else 1
+
+    if cp == 0x00ad or cp in PREPENDED_CONCATENATION_MARKS:
+        return 1
+    if category in ('Mn', 'Me', 'Cf'):
+        return 0
+    if 0x1160 <= cp <= 0x11ff or 0xd7b0 <= cp <= 0xd7ff or cp == 0x200b:
+        return 0
+
+    if east_asian_widths.get(cp, 'N') in ('W', 'F'):
+        return 2
+    if cp in emoji_presentation:
+        return 2
+    if 0x3248 <= cp <= 0x324f or 0x4dc0 <= cp <= 0x4dff:
+        return 2
+
+    return 1
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--ucd-dir', default='',
+                        help=f'directory with UnicodeData.txt, EastAsianWidth.txt and emoji-data.txt, '
+                             f'version {UNICODE_VERSION} (default: use Python\'s unicodedata)')
+    parser.add_argument('target', type=argparse.FileType('w'))
+
+    opts = parser.parse_args()
+    target = opts.target
+
+    if opts.ucd_dir:
+        categories, east_asian_widths, emoji_presentation = load_ucd(opts.ucd_dir)
+    else:
+        categories, east_asian_widths, emoji_presentation = load_unicodedata()
+
+    blocks: List[Tuple[int, ...]] = []
+    block_index: Dict[Tuple[int, ...], int] = {}
+    stage1: List[int] = []
+
+    for block_start in range(0, CODE_POINT_COUNT, BLOCK_SIZE):
+        block = tuple(
+            width(cp, categories, east_asian_widths, emoji_presentation)
+            for cp in range(block_start, block_start + BLOCK_SIZE))
+
+        idx = block_index.get(block)
+        if idx is None:
+            idx = len(blocks)
+            blocks.append(block)
+            block_index[block] = idx
+        stage1.append(idx)
+
+    assert len(blocks) <= 256
+
+    target.write('/* Generated by generate-unicode-width.py - do not edit */\n')
+    target.write(f'/* Unicode {UNICODE_VERSION} */\n')
+    target.write('\n')
+    target.write('#include <stdint.h>\n')
+    target.write('\n')
+    target.write('#include "char32.h"\n')
+    target.write('\n')
+
+    target.write(f'const uint8_t c32width_blocks[{len(stage1)}] = {{\n')
+    for i in range(0, len(stage1), 16):
+        target.write('    ' + ' '.join(f'{x},' for x in stage1[i:i + 16]) + '\n')
+    target.write('};\n')
+    target.write('\n')
+
+    target.write(f'const int8_t c32width_table[{len(blocks)}][{BLOCK_SIZE}] = {{\n')
+    for block in blocks:
+        target.write('    {\n')
+        for i in range(0, BLOCK_SIZE, 32):
+            target.write('        ' + ''.join(f'{x},' for x in block[i:i + 32]) + '\n')
+        target.write('    },\n')
+    target.write('};\n')
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,284 @@
+#!/usr/bin/env python3
+
+"""
+Generates the VT parser's state transition table.
+
+The state machine is based on https://vt100.net/emu/dec_ansi_parser,
+with foot's modifications (UTF-8 decoding states, DEL handling etc).
+
+Each (state, byte) pair maps to an action, and a new state. The
+action is the concatenation of the exit action of the current state,
+the transition action, and the entry action of the new state. The
+resulting table is dense; each byte costs a single lookup.
+"""
+
+import argparse
+import sys
+
+from typing import Dict, List, Tuple
+
+
+STATES = [
+    'ground',
+    'escape',
+    'escape_intermediate',
+
+    'csi_entry',
+    'csi_param',
+    'csi_intermediate',
+    'csi_ignore',
+
+    'osc_string',
+
+    'dcs_entry',
+    'dcs_param',
+    'dcs_intermediate',
+    'dcs_ignore',
+    'dcs_passthrough',
+
+    'sos_pm_apc_string',
+
+    'utf8_21',
+    'utf8_31',
+    'utf8_32',
+    'utf8_41',
+    'utf8_42',
+    'utf8_43',
+]
+
+Transition = Tuple[Tuple[str, ...], str]
+
+
+class State:
+    def __init__(self, name: str, default: Transition):
+        self.name = name
+        self.transitions: List[Transition] = [default] * 256
+
+    def on(self, lo: int, hi: int, actions: Tuple[str, ...], new_state: str):
+        assert new_state in STATES, new_state
+        actions = tuple(a for a in actions if a != 'ignore')
+        for b in range(lo, hi + 1):
+            self.transitions[b] = (actions, new_state)
+
+    def execute(self, actions: Tuple[str, ...], new_state: str):
+        """C0 control characters, except CAN, SUB and ESC"""
+        self.on(0x00, 0x17, actions, new_state)
+        self.on(0x19, 0x19, actions, new_state)
+        self.on(0x1c, 0x1f, actions, new_state)
+
+    def anywhere(self):
+        self.on(0x18, 0x18, ('execute',), 'ground')
+        self.on(0x1a, 0x1a, ('execute',), 'ground')
+        self.on(0x1b, 0x1b, ('clear',), 'escape')
+
+        # 8-bit C1 control characters (not supported)
+        self.on(0x80, 0x9f, (), 'ground')
+
+
+def build() -> Dict[str, State]:
+    states = {}
+
+    def state(name: str, anywhere: bool = True,
+              default: Transition = None) -> State:
+        s = State(name, default if default is not None else ((), name))
+        if anywhere:
+            s.anywhere()
+        states[name] = s
+        return s
+
+    s = state('ground')
+    s.execute(('execute',), 'ground')
+    # 0x20..0x7e, since 0x7f is DEL, which is a zero-width character
+    s.on(0x20, 0x7e, ('print',), 'ground')
+    s.on(0xc2, 0xdf, ('utf8_21',), 'utf8_21')
+    s.on(0xe0, 0xef, ('utf8_31',), 'utf8_31')
+    s.on(0xf0, 0xf4, ('utf8_41',), 'utf8_41')
+
+    s = state('escape')
+    s.execute(('execute',), 'escape')
+    s.on(0x20, 0x2f, ('collect',), 'escape_intermediate')
+    s.on(0x30, 0x4f, ('esc_dispatch',), 'ground')
+    s.on(0x50, 0x50, ('clear',), 'dcs_entry')
+    s.on(0x51, 0x57, ('esc_dispatch',), 'ground')
+    s.on(0x58, 0x58, (), 'sos_pm_apc_string')
+    s.on(0x59, 0x5a, ('esc_dispatch',), 'ground')
+    s.on(0x5b, 0x5b, ('clear',), 'csi_entry')
+    s.on(0x5c, 0x5c, ('esc_dispatch',), 'ground')
+    s.on(0x5d, 0x5d, ('osc_start',), 'osc_string')
+    s.on(0x5e, 0x5f, (), 'sos_pm_apc_string')
+    s.on(0x60, 0x7e, ('esc_dispatch',), 'ground')
+    s.on(0x7f, 0x7f, ('ignore',), 'escape')
+
+    s = state('escape_intermediate')
+    s.execute(('execute',), 'escape_intermediate')
+    s.on(0x20, 0x2f, ('collect',), 'escape_intermediate')
+    s.on(0x30, 0x7e, ('esc_dispatch',), 'ground')
+    s.on(0x7f, 0x7f, ('ignore',), 'escape_intermediate')
+
+    s = state('csi_entry')
+    s.execute(('execute',), 'csi_entry')
+    s.on(0x20, 0x2f, ('collect',), 'csi_intermediate')
+    s.on(0x30, 0x39, ('param',), 'csi_param')
+    s.on(0x3a, 0x3a, ('param_new_subparam',), 'csi_param')
+    s.on(0x3b, 0x3b, ('param_new',), 'csi_param')
+    s.on(0x3c, 0x3f, ('collect',), 'csi_param')
+    s.on(0x40, 0x7e, ('csi_dispatch',), 'ground')
+    s.on(0x7f, 0x7f, ('ignore',), 'csi_entry')
+
+    s = state('csi_param')
+    s.execute(('execute',), 'csi_param')
+    s.on(0x20, 0x2f, ('collect',), 'csi_intermediate')
+    s.on(0x30, 0x39, ('param',), 'csi_param')
+    s.on(0x3a, 0x3a, ('param_new_subparam',), 'csi_param')
+    s.on(0x3b, 0x3b, ('param_new',), 'csi_param')
+    s.on(0x3c, 0x3f, (), 'csi_ignore')
+    s.on(0x40, 0x7e, ('csi_dispatch',), 'ground')
+    s.on(0x7f, 0x7f, ('ignore',), 'csi_param')
+
+    s = state('csi_intermediate')
+    s.execute(('execute',), 'csi_intermediate')
+    s.on(0x20, 0x2f, ('collect',), 'csi_intermediate')
+    s.on(0x30, 0x3f, (), 'csi_ignore')
+    s.on(0x40, 0x7e, ('csi_dispatch',), 'ground')
+    s.on(0x7f, 0x7f, ('ignore',), 'csi_intermediate')
+
+    s = state('csi_ignore')
+    s.execute(('execute',), 'csi_ignore')
+    s.on(0x20, 0x3f, ('ignore',), 'csi_ignore')
+    s.on(0x40, 0x7e, (), 'ground')
+    s.on(0x7f, 0x7f, ('ignore',), 'csi_ignore')
+
+    # Note: original was 20-7f, but we use 20-ff to include
+    # UTF-8. Don't forget to add EXECUTE to 8-bit C1 if we implement
+    # that.
+    s = state('osc_string', anywhere=False,
+              default=(('osc_put',), 'osc_string'))
+    s.on(0x07, 0x07, ('osc_end',), 'ground')
+    s.on(0x00, 0x06, ('ignore',), 'osc_string')
+    s.on(0x08, 0x17, ('ignore',), 'osc_string')
+    s.on(0x19, 0x19, ('ignore',), 'osc_string')
+    s.on(0x1c, 0x1f, ('ignore',), 'osc_string')
+    s.on(0x18, 0x18, ('osc_end', 'execute'), 'ground')
+    s.on(0x1a, 0x1a, ('osc_end', 'execute'), 'ground')
+    s.on(0x1b, 0x1b, ('osc_end', 'clear'), 'escape')
+
+    s = state('dcs_entry')
+    s.execute(('ignore',), 'dcs_entry')
+    s.on(0x20, 0x2f, ('collect',), 'dcs_intermediate')
+    s.on(0x30, 0x39, ('param',), 'dcs_param')
+    s.on(0x3a, 0x3a, (), 'dcs_ignore')
+    s.on(0x3b, 0x3b, ('param_new',), 'dcs_param')
+    s.on(0x3c, 0x3f, ('collect',), 'dcs_param')
+    s.on(0x40, 0x7e, ('hook',), 'dcs_passthrough')
+    s.on(0x7f, 0x7f, ('ignore',), 'dcs_entry')
+
+    s = state('dcs_param')
+    s.execute(('ignore',), 'dcs_param')
+    s.on(0x20, 0x2f, ('collect',), 'dcs_intermediate')
+    s.on(0x30, 0x39, ('param',), 'dcs_param')
+    s.on(0x3a, 0x3a, (), 'dcs_ignore')
+    s.on(0x3b, 0x3b, ('param_new',), 'dcs_param')
+    s.on(0x3c, 0x3f, (), 'dcs_ignore')
+    s.on(0x40, 0x7e, ('hook',), 'dcs_passthrough')
+    s.on(0x7f, 0x7f, ('ignore',), 'dcs_param')
+
+    s = state('dcs_intermediate')
+    s.execute(('ignore',), 'dcs_intermediate')
+    s.on(0x20, 0x2f, ('collect',), 'dcs_intermediate')
+    s.on(0x30, 0x3f, (), 'dcs_ignore')
+    s.on(0x40, 0x7e, ('hook',), 'dcs_passthrough')
+    s.on(0x7f, 0x7f, ('ignore',), 'dcs_intermediate')
+
+    s = state('dcs_ignore')
+    s.execute(('ignore',), 'dcs_ignore')
+    s.on(0x20, 0x7f, ('ignore',), 'dcs_ignore')
+
+    s = state('dcs_passthrough', anywhere=False)
+    s.execute(('put',), 'dcs_passthrough')
+    s.on(0x20, 0x7e, ('put',), 'dcs_passthrough')
+    s.on(0x7f, 0x7f, ('ignore',), 'dcs_passthrough')
+    s.on(0x18, 0x18, ('unhook', 'execute'), 'ground')
+    s.on(0x1a, 0x1a, ('unhook', 'execute'), 'ground')
+    s.on(0x1b, 0x1b, ('unhook', 'clear'), 'escape')
+    s.on(0x80, 0x9f, ('unhook',), 'ground')
+
+    s = state('sos_pm_apc_string')
+    s.execute(('ignore',), 'sos_pm_apc_string')
+    s.on(0x20, 0x7f, ('ignore',), 'sos_pm_apc_string')
+
+    # UTF-8 continuation bytes; anything else aborts the sequence
+    for name, action, new_state in (
+            ('utf8_21', 'utf8_22', 'ground'),
+            ('utf8_31', 'utf8_32', 'utf8_32'),
+            ('utf8_32', 'utf8_33', 'ground'),
+            ('utf8_41', 'utf8_42', 'utf8_42'),
+            ('utf8_42', 'utf8_43', 'utf8_43'),
+            ('utf8_43', 'utf8_44', 'ground')):
+        s = state(name, anywhere=False, default=((), 'ground'))
+        s.on(0x80, 0xbf, (action,), new_state)
+
+    assert list(states.keys()) == STATES
+    return states
+
+
+def action_enum_name(actions: Tuple[str, ...]) -> str:
+    if len(actions) == 0:
+        return 'ACTION_NONE'
+    return 'ACTION_' + '_'.join(a.upper() for a in actions)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('target', type=argparse.FileType('w'))
+
+    opts = parser.parse_args()
+    target = opts.target
+
+    states = build()
+
+    # Collect all (possibly combined) actions actually used
+    actions = [()]
+    for s in states.values():
+        for acts, _ in s.transitions:
+            if acts not in actions:
+                actions.append(acts)
+
+    target.write('/* Generated by generate-vt-tables.py - do not edit */\n')
+    target.write('#pragma once\n')
+    target.write('\n')
+    target.write('#include <stdint.h>\n')
+    target.write('\n')
+
+    target.write('enum state {\n')
+    for name in STATES:
+        target.write(f'    STATE_{name.upper()},\n')
+    target.write('    STATE_COUNT,\n')
+    target.write('};\n')
+    target.write('\n')
+
+    target.write('enum action {\n')
+    for acts in actions:
+        target.write(f'    {action_enum_name(acts)},\n')
+    target.write('};\n')
+    target.write('\n')
+
+    target.write('struct transition {\n')
+    target.write('    uint8_t action;  /* enum action */\n')
+    target.write('    uint8_t state;   /* enum state */\n')
+    target.write('};\n')
+    target.write('\n')
+
+    target.write('static const struct transition transitions[STATE_COUNT][256] = {\n')
+    for name in STATES:
+        s = states[name]
+        target.write(f'    [STATE_{name.upper()}] = {{\n')
+        for b, (acts, new_state) in enumerate(s.transitions):
+            target.write(
+                f'        [0x{b:02x}] = {{{action_enum_name(acts)}, '
+                f'STATE_{new_state.upper()}}},\n')
+        target.write('    },\n')
+    target.write('};\n')
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -39,11 +39,11 @@ static int
 ensure_view_is_allocated(struct terminal *term, int new_view)
 {
     struct grid *grid = term->grid;
-    int view_end = (new_view + term->rows - 1) & (grid->num_rows - 1);
+    int view_end = grid_row_wrap(grid, new_view + term->rows - 1);
 
     if (grid->rows[new_view] == NULL) {
         while (grid->rows[new_view] == NULL)
-            new_view = (new_view + 1) & (grid->num_rows - 1);
+            new_view = grid_row_wrap(grid, new_view + 1);
     }
 
     else if (grid->rows[view_end] == NULL) {
@@ -51,13 +51,13 @@ ensure_view_is_allocated(struct terminal *term, int new_view)
             new_view--;
             if (new_view < 0)
                 new_view += grid->num_rows;
-            view_end = (new_view + term->rows - 1) & (grid->num_rows - 1);
+            view_end = grid_row_wrap(grid, new_view + term->rows - 1);
         }
     }
 
 #if defined(_DEBUG)
     for (size_t r = 0; r < term->rows; r++)
-        xassert(grid->rows[(new_view + r) & (grid->num_rows - 1)] != NULL);
+        xassert(grid->rows[grid_row_wrap(grid, new_view + r)] != NULL);
 #endif
 
     return new_view;
@@ -136,6 +136,9 @@ search_begin(struct terminal *term)
     search_cancel_keep_selection(term);
     selection_cancel(term);
 
+    /* Search the entire scrollback, not just the reflowed part */
+    term_reflow_scrollback(term, -1);
+
     /* Reset IME state */
     if (term_ime_is_enabled(term)) {
         term_ime_disable(term);
@@ -193,7 +196,7 @@ search_update_selection(struct terminal *term, const struct range *match)
 
     bool move_viewport = true;
 
-    int view_end = (grid->view + term->rows - 1) & (grid->num_rows - 1);
+    int view_end = grid_row_wrap(grid, grid->view + term->rows - 1);
     if (view_end >= grid->view) {
         /* Viewport does *not* wrap around */
         if (start_row >= grid->view && end_row <= view_end)
@@ -215,16 +218,13 @@ search_update_selection(struct terminal *term, const struct range *match)
         int new_view = grid_row_sb_to_abs(grid, term->rows, rebased_new_view);
 
         /* Scrollback may not be completely filled yet */
-        {
-            const int mask = grid->num_rows - 1;
-            while (grid->rows[new_view] == NULL)
-                new_view = (new_view + 1) & mask;
-        }
+        while (grid->rows[new_view] == NULL)
+            new_view = grid_row_wrap(grid, new_view + 1);
 
 #if defined(_DEBUG)
         /* Verify all to-be-visible rows have been allocated */
         for (int r = 0; r < term->rows; r++)
-            xassert(grid->rows[(new_view + r) & (grid->num_rows - 1)] != NULL);
+            xassert(grid->rows[grid_row_wrap(grid, new_view + r)] != NULL);
 #endif
 
 #if defined(_DEBUG)
@@ -249,7 +249,7 @@ search_update_selection(struct terminal *term, const struct range *match)
         !term->selection.ongoing)
     {
         int selection_row = start_row - grid->view + grid->num_rows;
-        selection_row &= grid->num_rows - 1;
+        selection_row = grid_row_wrap(grid, selection_row);
 
         selection_start(
             term, start_col, selection_row, SELECTION_CHAR_WISE, false);
@@ -261,7 +261,7 @@ search_update_selection(struct terminal *term, const struct range *match)
     /* Update selection endpoint */
     {
         int selection_row = end_row - grid->view + grid->num_rows;
-        selection_row &= grid->num_rows - 1;
+        selection_row = grid_row_wrap(grid, selection_row);
         selection_update(term, end_col, selection_row);
     }
 }
@@ -303,8 +303,8 @@ static bool
 find_next(struct terminal *term, enum search_direction direction,
           struct coord abs_start, struct coord abs_end, struct range *match)
 {
-#define ROW_DEC(_r) ((_r) = ((_r) - 1 + grid->num_rows) & (grid->num_rows - 1))
-#define ROW_INC(_r) ((_r) = ((_r) + 1) & (grid->num_rows - 1))
+#define ROW_DEC(_r) ((_r) = grid_row_wrap(grid, (_r) - 1))
+#define ROW_INC(_r) ((_r) = grid_row_wrap(grid, (_r) + 1))
 
     struct grid *grid = term->grid;
     const bool backward = direction != SEARCH_FORWARD;
@@ -322,11 +322,17 @@ find_next(struct terminal *term, enum search_direction direction,
     xassert(abs_end.col >= 0);
     xassert(abs_end.col < term->cols);
 
+    /* Blank rows (see grid_row_blank()) are searched as empty cells */
+    struct cell *empty = xcalloc(term->cols, sizeof(empty[0]));
+    bool found = false;
+
+#define ROW_CELLS(_row) (unlikely((_row)->blank) ? empty : (_row)->cells)
+
     for (int match_start_row = abs_start.row, match_start_col = abs_start.col;
          ;
          backward ? ROW_DEC(match_start_row) : ROW_INC(match_start_row)) {
 
-        const struct row *row = grid->rows[match_start_row];
+        const struct row *row = grid_row_abs_or_blank(grid, match_start_row);
         if (row == NULL) {
             if (match_start_row == abs_end.row)
                 break;
@@ -337,7 +343,7 @@ find_next(struct terminal *term, enum search_direction direction,
              backward ? match_start_col >= 0 : match_start_col < term->cols;
              backward ? match_start_col-- : match_start_col++)
         {
-            if (matches_cell(term, &row->cells[match_start_col], 0) < 0) {
+            if (matches_cell(term, &ROW_CELLS(row)[match_start_col], 0) < 0) {
                 if (match_start_row == abs_end.row &&
                     match_start_col == abs_end.col)
                 {
@@ -364,18 +370,20 @@ find_next(struct terminal *term, enum search_direction direction,
                     ROW_INC(match_end_row);
                     match_end_col = 0;
 
-                    match_row = grid->rows[match_end_row];
+                    match_row = grid_row_abs_or_blank(grid, match_end_row);
                     if (match_row == NULL)
                         break;
                 }
 
-                if (match_row->cells[match_end_col].wc >= CELL_SPACER) {
+                const struct cell *cells = ROW_CELLS(match_row);
+
+                if (cells[match_end_col].wc >= CELL_SPACER) {
                     match_end_col++;
                     continue;
                 }
 
                 ssize_t additional_chars = matches_cell(
-                    term, &match_row->cells[match_end_col], i);
+                    term, &cells[match_end_col], i);
                 if (additional_chars < 0)
                     break;
 
@@ -384,7 +392,7 @@ find_next(struct terminal *term, enum search_direction direction,
                 match_end_col++;
 
                 while (match_end_col < term->cols &&
-                       match_row->cells[match_end_col].wc > CELL_SPACER)
+                       cells[match_end_col].wc > CELL_SPACER)
                 {
                     match_end_col++;
                 }
@@ -407,7 +415,8 @@ find_next(struct terminal *term, enum search_direction direction,
                 .end = {match_end_col - 1, match_end_row},
             };
 
-            return true;
+            found = true;
+            goto out;
         }
 
         if (match_start_row == abs_end.row && match_start_col == abs_end.col)
@@ -416,7 +425,11 @@ find_next(struct terminal *term, enum search_direction direction,
         match_start_col = backward ? term->cols - 1 : 0;
     }
 
-    return false;
+out:
+    free(empty);
+    return found;
+
+#undef ROW_CELLS
 }
 
 static void
@@ -464,7 +477,7 @@ search_find_next(struct terminal *term, enum search_direction direction)
             if (--start.col < 0) {
                 start.col = term->cols - 1;
                 start.row += grid->num_rows - 1;
-                start.row &= grid->num_rows - 1;
+                start.row = grid_row_wrap(grid, start.row);
             }
             break;
 
@@ -472,7 +485,7 @@ search_find_next(struct terminal *term, enum search_direction direction)
             if (++start.col >= term->cols) {
                 start.col = 0;
                 start.row++;
-                start.row &= grid->num_rows - 1;
+                start.row = grid_row_wrap(grid, start.row);
             }
             break;
         }
@@ -497,7 +510,7 @@ search_find_next(struct terminal *term, enum search_direction direction)
         if (--end.col < 0) {
             end.col = term->cols - 1;
             end.row += grid->num_rows - 1;
-            end.row &= grid->num_rows - 1;
+            end.row = grid_row_wrap(grid, end.row);
         }
         break;
 
@@ -507,7 +520,7 @@ search_find_next(struct terminal *term, enum search_direction direction)
         if (++end.col >= term->cols) {
             end.col = 0;
             end.row++;
-            end.row &= grid->num_rows - 1;
+            end.row = grid_row_wrap(grid, end.row);
         }
         break;
     }
@@ -575,9 +588,9 @@ search_matches_next(struct search_match_iterator *iter)
 
     /* Convert absolute row numbers back to view relative */
     match.start.row = match.start.row - grid->view + grid->num_rows;
-    match.start.row &= grid->num_rows - 1;
+    match.start.row = grid_row_wrap(grid, match.start.row);
     match.end.row = match.end.row - grid->view + grid->num_rows;
-    match.end.row &= grid->num_rows - 1;
+    match.end.row = grid_row_wrap(grid, match.end.row);
 
     LOG_DBG("match at (view-local coordinates) %dx%d-%dx%d, view=%d",
             match.start.row, match.start.col,
@@ -665,14 +678,14 @@ coord_advance_left(const struct terminal *term, struct coord *pos,
     struct coord new_pos = *pos;
 
     if (--new_pos.col < 0) {
-        new_pos.row = (new_pos.row - 1 + grid->num_rows) & (grid->num_rows - 1);
+        new_pos.row = grid_row_wrap(grid, new_pos.row - 1);
         new_pos.col = term->cols - 1;
 
         if (has_wrapped_around_left(term, new_pos.row))
             return false;
 
         if (row != NULL)
-            *row = grid->rows[new_pos.row];
+            *row = grid_row_abs(term->grid, new_pos.row);
     }
 
     *pos = new_pos;
@@ -687,14 +700,14 @@ coord_advance_right(const struct terminal *term, struct coord *pos,
     struct coord new_pos = *pos;
 
     if (++new_pos.col >= term->cols) {
-        new_pos.row = (new_pos.row + 1) & (grid->num_rows - 1);
+        new_pos.row = grid_row_wrap(grid, new_pos.row + 1);
         new_pos.col = 0;
 
         if (has_wrapped_around_right(term, new_pos.row))
             return false;
 
         if (row != NULL)
-            *row = grid->rows[new_pos.row];
+            *row = grid_row_abs(term->grid, new_pos.row);
     }
 
     *pos = new_pos;
@@ -715,7 +728,7 @@ search_extend_find_char(const struct terminal *term, struct coord *target,
 
     *target = pos;
 
-    const struct row *row = term->grid->rows[pos.row];
+    const struct row *row = grid_row_abs(term->grid, pos.row);
 
     while (true) {
         switch (direction) {
@@ -834,13 +847,13 @@ search_extend_find_line(const struct terminal *term, struct coord *target,
 
     switch (direction) {
     case SEARCH_EXTEND_LEFT:
-        pos.row = (pos.row - 1 + grid->num_rows) & (grid->num_rows - 1);
+        pos.row = grid_row_wrap(grid, pos.row - 1);
         if (has_wrapped_around_left(term, pos.row))
             return false;
         break;
 
     case SEARCH_EXTEND_RIGHT:
-        pos.row = (pos.row + 1) & (grid->num_rows - 1);
+        pos.row = grid_row_wrap(grid, pos.row + 1);
         if (has_wrapped_around_right(term, pos.row))
             return false;
         break;
@@ -870,7 +883,7 @@ search_extend_left(struct terminal *term, const struct coord *target)
 
     const struct coord last_coord = selection_get_start(term);
     struct coord pos = *target;
-    const struct row *row = term->grid->rows[pos.row];
+    const struct row *row = grid_row_abs(term->grid, pos.row);
 
     const bool move_cursor = term->search.cursor != 0;
 
@@ -934,7 +947,7 @@ search_extend_right(struct terminal *term, const struct coord *target)
         return;
 
     struct coord pos = selection_get_end(term);
-    const struct row *row = term->grid->rows[pos.row];
+    const struct row *row = grid_row_abs(term->grid, pos.row);
 
     const bool move_cursor = term->search.cursor == term->search.len;
 
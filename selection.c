@@ -43,7 +43,7 @@ static const char *const mime_type_map[] = {
 static inline struct coord
 bounded(const struct grid *grid, struct coord coord)
 {
-    coord.row &= grid->num_rows - 1;
+    coord.row = grid_row_wrap(grid, coord.row);
     return coord;
 }
 
@@ -173,9 +173,32 @@ selection_view_down(struct terminal *term, int new_view)
     if (likely(new_view > term->grid->view))
         return;
 
-    term->selection.coords.start.row &= term->grid->num_rows - 1;
-    if (term->selection.coords.end.row >= 0)
-        term->selection.coords.end.row &= term->grid->num_rows - 1;
+    term->selection.coords.start.row =
+        grid_row_wrap(term->grid, term->selection.coords.start.row);
+    if (term->selection.coords.end.row >= 0) {
+        term->selection.coords.end.row =
+            grid_row_wrap(term->grid, term->selection.coords.end.row);
+    }
+}
+
+/*
+ * Returns the cells of 'row'. Blank rows (see grid_row_blank()) have
+ * none; they are passed to the foreach_selected() callbacks as empty
+ * cells, allocated on demand in '*empty'. Writes to them are
+ * discarded. This is fine, since they are never selected.
+ */
+static struct cell *
+row_cells(const struct terminal *term, struct row *row, struct cell **empty)
+{
+    if (likely(!row->blank))
+        return row->cells;
+
+    if (*empty == NULL)
+        *empty = xcalloc(term->cols, sizeof((*empty)[0]));
+    else
+        memset(*empty, 0, term->cols * sizeof((*empty)[0]));
+
+    return *empty;
 }
 
 static void
@@ -216,29 +239,38 @@ foreach_selected_normal(
         end_col = max(start->col, end->col);
     }
 
-    start_row &= (grid_rows - 1);
-    end_row &= (grid_rows - 1);
+    start_row = _grid_row_wrap(start_row, grid_rows);
+    end_row = _grid_row_wrap(end_row, grid_rows);
 
-    for (int r = start_row; r != end_row; r = (r + 1) & (grid_rows - 1)) {
-        struct row *row = term->grid->rows[r];
+    struct cell *empty = NULL;
+
+    for (int r = start_row; r != end_row; r = _grid_row_wrap(r + 1, grid_rows)) {
+        struct row *row = grid_row_abs_or_blank(term->grid, r);
         xassert(row != NULL);
 
+        struct cell *cells = row_cells(term, row, &empty);
+
         for (int c = start_col; c <= term->cols - 1; c++) {
-            if (!cb(term, row, &row->cells[c], r, c, data))
-                return;
+            if (!cb(term, row, &cells[c], r, c, data))
+                goto out;
         }
 
         start_col = 0;
     }
 
     /* Last, partial row */
-    struct row *row = term->grid->rows[end_row];
+    struct row *row = grid_row_abs_or_blank(term->grid, end_row);
     xassert(row != NULL);
 
+    struct cell *cells = row_cells(term, row, &empty);
+
     for (int c = start_col; c <= end_col; c++) {
-        if (!cb(term, row, &row->cells[c], end_row, c, data))
-            return;
+        if (!cb(term, row, &cells[c], end_row, c, data))
+            goto out;
     }
+
+out:
+    free(empty);
 }
 
 static void
@@ -260,33 +292,40 @@ foreach_selected_block(
         grid_row_abs_to_sb(term->grid, term->rows, end->row);
 
     struct coord top_left = {
-        .row = (rel_start_row < rel_end_row
-                ? start->row : end->row) & (grid_rows - 1),
+        .row = _grid_row_wrap(
+            rel_start_row < rel_end_row ? start->row : end->row, grid_rows),
         .col = min(start->col, end->col),
     };
 
     struct coord bottom_right = {
-        .row = (rel_start_row > rel_end_row
-                ? start->row : end->row) & (grid_rows - 1),
+        .row = _grid_row_wrap(
+            rel_start_row > rel_end_row ? start->row : end->row, grid_rows),
         .col = max(start->col, end->col),
     };
 
+    struct cell *empty = NULL;
+
     int r = top_left.row;
     while (true) {
-        struct row *row = term->grid->rows[r];
+        struct row *row = grid_row_abs_or_blank(term->grid, r);
         xassert(row != NULL);
 
+        struct cell *cells = row_cells(term, row, &empty);
+
         for (int c = top_left.col; c <= bottom_right.col; c++) {
-            if (!cb(term, row, &row->cells[c], r, c, data))
-                return;
+            if (!cb(term, row, &cells[c], r, c, data))
+                goto out;
         }
 
         if (r == bottom_right.row)
             break;
 
         r++;
-        r &= grid_rows - 1;
+        r = _grid_row_wrap(r, grid_rows);
     }
+
+out:
+    free(empty);
 }
 
 static void
@@ -350,9 +389,9 @@ selection_find_word_boundary_left(const struct terminal *term, struct coord *pos
     xassert(pos->col >= 0);
     xassert(pos->col < term->cols);
     xassert(pos->row >= 0);
-    pos->row &= grid->num_rows - 1;
+    pos->row = grid_row_wrap(grid, pos->row);
 
-    const struct row *r = grid->rows[pos->row];
+    const struct row *r = grid_row_abs(term->grid, pos->row);
     char32_t c = r->cells[pos->col].wc;
 
     while (c >= CELL_SPACER) {
@@ -376,13 +415,13 @@ selection_find_word_boundary_left(const struct terminal *term, struct coord *pos
         int next_col = pos->col - 1;
         int next_row = pos->row;
 
-        const struct row *row = grid->rows[next_row];
+        const struct row *row = grid_row_abs(term->grid, next_row);
 
         /* Linewrap */
         if (next_col < 0) {
             next_col = term->cols - 1;
 
-            next_row = (next_row - 1 + grid->num_rows) & (grid->num_rows - 1);
+            next_row = grid_row_wrap(grid, next_row - 1);
 
             if (grid_row_abs_to_sb(grid, term->rows, next_row) == term->grid->num_rows - 1 ||
                 grid->rows[next_row] == NULL)
@@ -391,7 +430,7 @@ selection_find_word_boundary_left(const struct terminal *term, struct coord *pos
                 break;
             }
 
-            row = grid->rows[next_row];
+            row = grid_row_abs(term->grid, next_row);
 
             if (row->linebreak) {
                 /* Hard linebreak, treat as space. I.e. break selection */
@@ -439,9 +478,9 @@ selection_find_word_boundary_right(const struct terminal *term, struct coord *po
     xassert(pos->col >= 0);
     xassert(pos->col < term->cols);
     xassert(pos->row >= 0);
-    pos->row &= grid->num_rows - 1;
+    pos->row = grid_row_wrap(grid, pos->row);
 
-    const struct row *r = grid->rows[pos->row];
+    const struct row *r = grid_row_abs(term->grid, pos->row);
     char32_t c = r->cells[pos->col].wc;
 
     while (c >= CELL_SPACER) {
@@ -466,7 +505,7 @@ selection_find_word_boundary_right(const struct terminal *term, struct coord *po
         int next_col = pos->col + 1;
         int next_row = pos->row;
 
-        const struct row *row = term->grid->rows[next_row];
+        const struct row *row = grid_row_abs(term->grid, next_row);
 
         /* Linewrap */
         if (next_col >= term->cols) {
@@ -476,14 +515,14 @@ selection_find_word_boundary_right(const struct terminal *term, struct coord *po
             }
 
             next_col = 0;
-            next_row = (next_row + 1) & (grid->num_rows - 1);
+            next_row = grid_row_wrap(grid, next_row + 1);
 
             if (grid_row_abs_to_sb(grid, term->rows, next_row) == 0) {
                 /* Scrollback wrap-around */
                 break;
             }
 
-            row = grid->rows[next_row];
+            row = grid_row_abs(term->grid, next_row);
         }
 
         c = row->cells[next_col].wc;
@@ -904,13 +943,20 @@ mark_selected_region(struct terminal *term, pixman_box32_t *boxes,
 
         for (int r = abs_row_start, rel_r = box->y1;
              rel_r < box->y2;
-             r = (r + 1) & (term->grid->num_rows - 1), rel_r++)
+             r = grid_row_wrap(term->grid, r + 1), rel_r++)
         {
-            struct row *row = term->grid->rows[r];
+            struct row *row = grid_row_abs_or_blank(term->grid, r);
             xassert(row != NULL);
 
+            if (row->blank) {
+                /* Empty cells are never highlighted; nothing to mark */
+                if (!highlight_empty)
+                    continue;
+                row = grid_row_abs(term->grid, r);
+            }
+
             if (dirty_cells)
-                row->dirty = true;
+                grid_row_dirty_range(row, box->x1, box->x2 - 1);
 
             for (int c = box->x1, empty_count = 0; c < box->x2; c++) {
                 struct cell *cell = &row->cells[c];
@@ -965,6 +1011,8 @@ mark_selected_region(struct terminal *term, pixman_box32_t *boxes,
                      */
                     cell->attrs.clean = false;
                     cell->attrs.selected = false;
+                    if (row->dirty)
+                        grid_row_dirty_cell(row, c);
                     continue;
                 }
 
@@ -1045,7 +1093,7 @@ set_pivot_point_for_block_and_char_wise(struct terminal *term,
     /* First, make sure ‘start’ isn’t in the middle of a
      * multi-column character */
     while (true) {
-        const struct row *row = term->grid->rows[pivot_start->row & (term->grid->num_rows - 1)];
+        const struct row *row = grid_row_abs(term->grid, grid_row_wrap(term->grid, pivot_start->row));
         const struct cell *cell = &row->cells[pivot_start->col];
 
         if (cell->wc < CELL_SPACER)
@@ -1070,7 +1118,7 @@ set_pivot_point_for_block_and_char_wise(struct terminal *term,
     if (new_direction == SELECTION_RIGHT) {
         bool keep_going = true;
         while (keep_going) {
-            const struct row *row = term->grid->rows[pivot_end->row & (term->grid->num_rows - 1)];
+            const struct row *row = grid_row_abs(term->grid, grid_row_wrap(term->grid, pivot_end->row));
             const char32_t wc = row->cells[pivot_end->col].wc;
 
             keep_going = wc >= CELL_SPACER;
@@ -1086,7 +1134,7 @@ set_pivot_point_for_block_and_char_wise(struct terminal *term,
     } else {
         bool keep_going = true;
         while (keep_going) {
-            const struct row *row = term->grid->rows[pivot_start->row & (term->grid->num_rows - 1)];
+            const struct row *row = grid_row_abs(term->grid, grid_row_wrap(term->grid, pivot_start->row));
             const char32_t wc = pivot_start->col < term->cols - 1
                 ? row->cells[pivot_start->col + 1].wc : 0;
 
@@ -1102,9 +1150,9 @@ set_pivot_point_for_block_and_char_wise(struct terminal *term,
         }
     }
 
-    xassert(term->grid->rows[pivot_start->row & (term->grid->num_rows - 1)]->
+    xassert(term->grid->rows[grid_row_wrap(term->grid, pivot_start->row)]->
            cells[pivot_start->col].wc <= CELL_SPACER);
-    xassert(term->grid->rows[pivot_end->row & (term->grid->num_rows - 1)]->
+    xassert(term->grid->rows[grid_row_wrap(term->grid, pivot_end->row)]->
            cells[pivot_end->col].wc <= CELL_SPACER + 1);
 }
 
@@ -1233,11 +1281,11 @@ selection_update(struct terminal *term, int col, int row)
         break;
     }
 
-    size_t start_row_idx = new_start.row & (term->grid->num_rows - 1);
-    size_t end_row_idx = new_end.row & (term->grid->num_rows - 1);
+    size_t start_row_idx = grid_row_wrap(term->grid, new_start.row);
+    size_t end_row_idx = grid_row_wrap(term->grid, new_end.row);
 
-    const struct row *row_start = term->grid->rows[start_row_idx];
-    const struct row *row_end = term->grid->rows[end_row_idx];
+    const struct row *row_start = grid_row_abs(term->grid, start_row_idx);
+    const struct row *row_end = grid_row_abs(term->grid, end_row_idx);
 
     /* If an end point is in the middle of a multi-column character,
      * expand the selection to cover the entire character */
@@ -1548,8 +1596,10 @@ selection_finalize(struct seat *seat, struct terminal *term, uint32_t serial)
     xassert(term->selection.coords.start.row != -1);
     xassert(term->selection.coords.end.row != -1);
 
-    term->selection.coords.start.row &= (term->grid->num_rows - 1);
-    term->selection.coords.end.row &= (term->grid->num_rows - 1);
+    term->selection.coords.start.row =
+        grid_row_wrap(term->grid, term->selection.coords.start.row);
+    term->selection.coords.end.row =
+        grid_row_wrap(term->grid, term->selection.coords.end.row);
 
     switch (term->conf->selection_target) {
     case SELECTION_TARGET_NONE:
@@ -1576,7 +1626,7 @@ unmark_selected(struct terminal *term, struct row *row, struct cell *cell,
     if (!cell->attrs.selected)
         return true;
 
-    row->dirty = true;
+    grid_row_dirty_cell(row, col);
     cell->attrs.selected = false;
     cell->attrs.clean = false;
     return true;
@@ -258,14 +258,17 @@ instantiate_offset(struct buffer_private *buf, off_t new_offset)
 
     mmapped = (uint8_t *)pool->real_mmapped + new_offset;
 
-    wl_buf = wl_shm_pool_create_buffer(
-        pool->wl_pool, new_offset,
-        buf->public.width, buf->public.height, buf->public.stride,
-        WL_SHM_FORMAT_ARGB8888);
-
-    if (wl_buf == NULL) {
-        LOG_ERR("failed to create SHM buffer");
-        goto err;
+    /* Offscreen buffers (see shm_chain_new()) have no wl_buffer */
+    if (pool->wl_pool != NULL) {
+        wl_buf = wl_shm_pool_create_buffer(
+            pool->wl_pool, new_offset,
+            buf->public.width, buf->public.height, buf->public.stride,
+            WL_SHM_FORMAT_ARGB8888);
+
+        if (wl_buf == NULL) {
+            LOG_ERR("failed to create SHM buffer");
+            goto err;
+        }
     }
 
     /* One pixman image for each worker thread (do we really need multiple?) */
@@ -284,7 +287,8 @@ instantiate_offset(struct buffer_private *buf, off_t new_offset)
     buf->public.pix = pix;
     buf->offset = new_offset;
 
-    wl_buffer_add_listener(wl_buf, &buffer_listener, buf);
+    if (wl_buf != NULL)
+        wl_buffer_add_listener(wl_buf, &buffer_listener, buf);
     return true;
 
 err:
@@ -434,10 +438,12 @@ get_new_buffers(struct buffer_chain *chain, size_t count,
     }
 #endif
 
-    wl_pool = wl_shm_create_pool(chain->shm, pool_fd, memfd_size);
-    if (wl_pool == NULL) {
-        LOG_ERR("failed to create SHM pool");
-        goto err;
+    if (chain->shm != NULL) {
+        wl_pool = wl_shm_create_pool(chain->shm, pool_fd, memfd_size);
+        if (wl_pool == NULL) {
+            LOG_ERR("failed to create SHM pool");
+            goto err;
+        }
     }
 
     pool = xmalloc(sizeof(*pool));
@@ -678,7 +684,7 @@ shm_scroll_forward(struct buffer_private *buf, int rows,
     xassert(can_punch_hole);
     xassert(buf->busy);
     xassert(buf->public.pix != NULL);
-    xassert(buf->public.wl_buf != NULL);
+    xassert(buf->public.wl_buf != NULL || buf->chain->shm == NULL);
     xassert(pool != NULL);
     xassert(pool->ref_count == 1);
     xassert(pool->fd >= 0);
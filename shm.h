@@ -42,6 +42,13 @@ void shm_fini(void);
 void shm_set_max_pool_size(off_t max_pool_size);
 
 struct buffer_chain;
+
+/*
+ * With a NULL 'shm', the chain is an offscreen chain: buffers are
+ * backed by memory only, and have no wl_buffer. Such buffers are never
+ * released by a compositor; call shm_did_not_use_buf() when done with
+ * them.
+ */
 struct buffer_chain *shm_chain_new(
     struct wl_shm *shm, bool scrollable, size_t pix_instances);
 void shm_chain_free(struct buffer_chain *chain);
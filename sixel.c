@@ -170,17 +170,19 @@ static void
 sixel_erase(struct terminal *term, struct sixel *sixel)
 {
     for (int i = 0; i < sixel->rows; i++) {
-        int r = (sixel->pos.row + i) & (term->grid->num_rows - 1);
+        int r = grid_row_wrap(term->grid, sixel->pos.row + i);
 
-        struct row *row = term->grid->rows[r];
+        struct row *row = grid_row_abs(term->grid, r);
         if (row == NULL) {
             /* A resize/reflow may cause row to now be unallocated */
             continue;
         }
 
-        row->dirty = true;
+        const int end = min(sixel->pos.col + sixel->cols, term->cols);
+        if (sixel->pos.col < end)
+            grid_row_dirty_range(row, sixel->pos.col, end - 1);
 
-        for (int c = sixel->pos.col; c < min(sixel->pos.col + sixel->cols, term->cols); c++)
+        for (int c = sixel->pos.col; c < end; c++)
             row->cells[c].attrs.clean = 0;
     }
 
@@ -243,7 +245,7 @@ verify_no_wraparound_crossover(const struct terminal *term)
         xassert(six->pos.row >= 0);
         xassert(six->pos.row < term->grid->num_rows);
 
-        int end = (six->pos.row + six->rows - 1) & (term->grid->num_rows - 1);
+        int end = grid_row_wrap(term->grid, six->pos.row + six->rows - 1);
         xassert(end >= six->pos.row);
     }
 #endif
@@ -798,8 +800,8 @@ sixel_overwrite_by_rectangle(
     if (likely(tll_length(term->grid->sixel_images) == 0))
         return;
 
-    const int start = (term->grid->offset + row) & (term->grid->num_rows - 1);
-    const int end = (start + height - 1) & (term->grid->num_rows - 1);
+    const int start = grid_row_wrap(term->grid, term->grid->offset + row);
+    const int end = grid_row_wrap(term->grid, start + height - 1);
     const bool wraps = end < start;
 
     if (wraps) {
@@ -830,13 +832,13 @@ sixel_overwrite_by_row(struct terminal *term, int _row, int col, int width)
     if (col + width > term->grid->num_cols)
         width = term->grid->num_cols - col;
 
-    const int row = (term->grid->offset + _row) & (term->grid->num_rows - 1);
+    const int row = grid_row_wrap(term->grid, term->grid->offset + _row);
     const int scrollback_rel_row = grid_row_abs_to_sb(term->grid, term->rows, row);
 
     tll_foreach(term->grid->sixel_images, it) {
         struct sixel *six = &it->item;
         const int six_start = six->pos.row;
-        const int six_end = (six_start + six->rows - 1) & (term->grid->num_rows - 1);
+        const int six_end = grid_row_wrap(term->grid, six_start + six->rows - 1);
 
         /* We should never generate scrollback wrapping sixels */
         xassert(six_end >= six_start);
@@ -988,7 +990,7 @@ sixel_reflow_grid(struct terminal *term, struct grid *grid)
     tll_rforeach(copy, it) {
         struct sixel *six = &it->item;
         int start = six->pos.row;
-        int end = (start + six->rows - 1) & (grid->num_rows - 1);
+        int end = grid_row_wrap(grid, start + six->rows - 1);
 
         if (end < start) {
             /* Crosses scrollback wrap-around */
@@ -1109,7 +1111,7 @@ sixel_unhook(struct terminal *term)
            rows_avail > 0 &&
            rows_needed <= term->grid->num_rows)
     {
-        const int cur_row = (term->grid->offset + start_row) & (term->grid->num_rows - 1);
+        const int cur_row = grid_row_wrap(term->grid, term->grid->offset + start_row);
         const int rows_left_until_wrap_around = term->grid->num_rows - cur_row;
         const int usable_rows = min(rows_avail, rows_left_until_wrap_around);
 
@@ -1226,16 +1228,14 @@ sixel_unhook(struct terminal *term)
 
         /* Dirty touched cells, and scroll terminal content if necessary */
         for (size_t i = 0; i < image.rows; i++) {
-            struct row *row = term->grid->rows[cur_row + i];
-            row->dirty = true;
+            struct row *row = grid_row_abs(term->grid, cur_row + i);
+            const int end = min(image.pos.col + image.cols, term->cols);
 
-            for (int col = image.pos.col;
-                 col < min(image.pos.col + image.cols, term->cols);
-                 col++)
-            {
-                row->cells[col].attrs.clean = 0;
-            }
+            if (image.pos.col < end)
+                grid_row_dirty_range(row, image.pos.col, end - 1);
 
+            for (int col = image.pos.col; col < end; col++)
+                row->cells[col].attrs.clean = 0;
         }
 
         _sixel_overwrite_by_rectangle(
@@ -0,0 +1,278 @@
+#include "spill.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#define LOG_MODULE "spill"
+#define LOG_ENABLE_DBG 0
+#include "log.h"
+#include "debug.h"
+#include "macros.h"
+#include "util.h"
+#include "xmalloc.h"
+
+/* The file is grown, and shrunk, in multiples of this */
+#define SPILL_FILE_CHUNK (1024 * 1024)
+
+struct spill_file {
+    int ref_count;
+    int fd;
+    uint8_t *data;      /* The mmap:ed file, or NULL if empty */
+    size_t size;        /* Of the file, and the mapping */
+    size_t used;        /* Appended bytes */
+    size_t live;        /* Appended, and not yet released, bytes */
+};
+
+static size_t
+chunk_align(size_t size)
+{
+    return (size + SPILL_FILE_CHUNK - 1) & ~((size_t)SPILL_FILE_CHUNK - 1);
+}
+
+struct spill_file *
+spill_file_new(const char *dir)
+{
+    if (dir == NULL)
+        dir = getenv("XDG_RUNTIME_DIR");
+    if (dir == NULL)
+        dir = "/tmp";
+
+    int fd = -1;
+
+#if defined(O_TMPFILE)
+    fd = open(dir, O_RDWR | O_TMPFILE | O_CLOEXEC, 0600);
+#endif
+
+    if (fd < 0) {
+        /* O_TMPFILE not supported, by either the OS, or the FS */
+        char *path = xasprintf("%s/foot-scrollback-XXXXXX", dir);
+        fd = mkostemp(path, O_CLOEXEC);
+        if (fd >= 0)
+            unlink(path);
+        free(path);
+    }
+
+    if (fd < 0) {
+        LOG_ERRNO("%s: failed to create scrollback spill file", dir);
+        return NULL;
+    }
+
+    struct spill_file *file = xmalloc(sizeof(*file));
+    *file = (struct spill_file){.ref_count = 1, .fd = fd};
+    return file;
+}
+
+struct spill_file *
+spill_file_ref(struct spill_file *file)
+{
+    file->ref_count++;
+    return file;
+}
+
+void
+spill_file_destroy(struct spill_file *file)
+{
+    if (file == NULL)
+        return;
+
+    xassert(file->ref_count > 0);
+    if (--file->ref_count > 0)
+        return;
+
+    if (file->data != NULL)
+        munmap(file->data, file->size);
+    close(file->fd);
+    free(file);
+}
+
+static bool
+grow(struct spill_file *file, size_t new_size)
+{
+    xassert(new_size > file->size);
+
+    /*
+     * Allocate the backing storage up front; writing to a sparse
+     * mapping, on a full file system, raises SIGBUS.
+     */
+    int err = posix_fallocate(file->fd, file->size, new_size - file->size);
+    if (err != 0) {
+        errno = err;
+        LOG_ERRNO("failed to grow scrollback spill file to %zu bytes",
+                  new_size);
+        goto err;
+    }
+
+    void *data = mmap(
+        NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+    if (data == MAP_FAILED) {
+        LOG_ERRNO("failed to mmap scrollback spill file");
+        goto err;
+    }
+
+    if (file->data != NULL)
+        munmap(file->data, file->size);
+
+    file->data = data;
+    file->size = new_size;
+    return true;
+
+err:
+    if (ftruncate(file->fd, file->size) < 0)
+        LOG_ERRNO("failed to truncate scrollback spill file");
+    return false;
+}
+
+static void
+shrink(struct spill_file *file, size_t new_size)
+{
+    xassert(new_size < file->size);
+    xassert(new_size >= file->used);
+    xassert(new_size % SPILL_FILE_CHUNK == 0);
+
+    /* Drop the tail of the mapping; the head is still valid */
+    munmap(file->data + new_size, file->size - new_size);
+
+    if (new_size == 0)
+        file->data = NULL;
+
+    if (ftruncate(file->fd, new_size) < 0)
+        LOG_ERRNO("failed to shrink scrollback spill file");
+
+    file->size = new_size;
+}
+
+uint8_t *
+spill_file_append(struct spill_file *file, size_t size, uint64_t *offset)
+{
+    if (file->used + size > file->size) {
+        if (!grow(file, chunk_align(file->used + size)))
+            return NULL;
+    }
+
+    *offset = file->used;
+    file->used += size;
+    file->live += size;
+    return &file->data[*offset];
+}
+
+const uint8_t *
+spill_file_data(const struct spill_file *file, uint64_t offset)
+{
+    xassert(offset < file->used);
+    return &file->data[offset];
+}
+
+void
+spill_file_release(struct spill_file *file, size_t size)
+{
+    xassert(file->live >= size);
+    file->live -= size;
+
+    if (file->live > 0)
+        return;
+
+    /* Everything has been released (e.g. the scrollback was erased) */
+    spill_file_clear(file);
+}
+
+void
+spill_file_clear(struct spill_file *file)
+{
+    file->used = 0;
+    file->live = 0;
+
+    if (file->size > SPILL_FILE_CHUNK)
+        shrink(file, SPILL_FILE_CHUNK);
+}
+
+bool
+spill_file_needs_compaction(const struct spill_file *file)
+{
+    return file->ref_count == 1 &&
+           file->used > SPILL_FILE_CHUNK && file->used - file->live > file->live;
+}
+
+void
+spill_file_move(struct spill_file *file, uint64_t to, uint64_t from, size_t size)
+{
+    xassert(to + size <= file->used);
+    xassert(from + size <= file->used);
+
+    if (to != from)
+        memmove(&file->data[to], &file->data[from], size);
+}
+
+void
+spill_file_truncate(struct spill_file *file, uint64_t size)
+{
+    xassert(size <= file->used);
+    xassert(size >= file->live);
+
+    file->used = size;
+
+    const size_t new_size = max(chunk_align(size), (size_t)SPILL_FILE_CHUNK);
+    if (new_size < file->size)
+        shrink(file, new_size);
+}
+
+UNITTEST
+{
+    struct spill_file *file = spill_file_new("/tmp");
+    xassert(file != NULL);
+
+    uint64_t a_ofs, b_ofs;
+    uint8_t *a = spill_file_append(file, 3, &a_ofs);
+    xassert(a != NULL);
+    memcpy(a, "abc", 3);
+
+    uint8_t *b = spill_file_append(file, 2, &b_ofs);
+    xassert(b != NULL);
+    memcpy(b, "de", 2);
+
+    xassert(a_ofs == 0);
+    xassert(b_ofs == 3);
+    xassert(file->size == SPILL_FILE_CHUNK);
+    xassert(memcmp(spill_file_data(file, b_ofs), "de", 2) == 0);
+
+    /* Data larger than a chunk */
+    uint64_t c_ofs;
+    xassert(spill_file_append(file, SPILL_FILE_CHUNK, &c_ofs) != NULL);
+    xassert(file->size == 2 * SPILL_FILE_CHUNK);
+    xassert(memcmp(spill_file_data(file, a_ofs), "abc", 3) == 0);
+
+    spill_file_release(file, SPILL_FILE_CHUNK);
+    spill_file_release(file, 3);
+    xassert(spill_file_needs_compaction(file));
+
+    /* Shared files are not compacted */
+    xassert(spill_file_ref(file) == file);
+    xassert(!spill_file_needs_compaction(file));
+    spill_file_destroy(file);
+    xassert(spill_file_needs_compaction(file));
+
+    /* Compact; move 'b' to the beginning of the file */
+    spill_file_move(file, 0, b_ofs, 2);
+    spill_file_truncate(file, 2);
+    xassert(!spill_file_needs_compaction(file));
+    xassert(file->size == SPILL_FILE_CHUNK);
+    xassert(memcmp(spill_file_data(file, 0), "de", 2) == 0);
+
+    /* Releasing everything starts over */
+    spill_file_release(file, 2);
+    xassert(file->used == 0);
+    xassert(file->live == 0);
+
+    /* As does clearing the file */
+    xassert(spill_file_append(file, 2 * SPILL_FILE_CHUNK, &c_ofs) != NULL);
+    spill_file_clear(file);
+    xassert(file->used == 0);
+    xassert(file->live == 0);
+    xassert(file->size == SPILL_FILE_CHUNK);
+
+    spill_file_destroy(file);
+}
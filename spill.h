@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Append-only, memory mapped, file holding compressed scrollback
+ * rows (see grid.c).
+ *
+ * The file is unlinked as soon as it has been created. I.e. it is
+ * never visible in the file system, and its storage is released when
+ * the spill file is destroyed, or when foot exits.
+ *
+ * Data is addressed by its offset into the file; pointers returned
+ * by spill_file_append() and spill_file_data() are invalidated by
+ * the next call to spill_file_append(), spill_file_release() or
+ * spill_file_truncate().
+ */
+
+struct spill_file;
+
+/* Creates a new spill file in 'dir' ($XDG_RUNTIME_DIR if NULL) */
+struct spill_file *spill_file_new(const char *dir);
+
+/*
+ * Spill files are reference counted, since grid snapshots share
+ * compressed rows with the grid. spill_file_destroy() drops a
+ * reference.
+ */
+struct spill_file *spill_file_ref(struct spill_file *file);
+void spill_file_destroy(struct spill_file *file);
+
+/*
+ * Reserves 'size' bytes at the end of the file, and returns a pointer
+ * to them. Returns NULL if the file could not be grown (e.g. the file
+ * system is full).
+ */
+uint8_t *spill_file_append(
+    struct spill_file *file, size_t size, uint64_t *offset);
+
+const uint8_t *spill_file_data(const struct spill_file *file, uint64_t offset);
+
+/* Marks 'size' previously appended bytes as unused */
+void spill_file_release(struct spill_file *file, size_t size);
+
+/* Marks *all* data as unused, without having to release it piece by piece */
+void spill_file_clear(struct spill_file *file);
+
+/*
+ * Returns true when most of the file is unused. The owner should then
+ * move all used data to the beginning of the file, with
+ * spill_file_move(), and call spill_file_truncate().
+ *
+ * Shared files are never compacted; no single owner knows about all
+ * the data in them.
+ */
+bool spill_file_needs_compaction(const struct spill_file *file);
+void spill_file_move(
+    struct spill_file *file, uint64_t to, uint64_t from, size_t size);
+void spill_file_truncate(struct spill_file *file, uint64_t size);
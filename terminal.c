@@ -8,6 +8,8 @@
 #include <unistd.h>
 #include <errno.h>
 #include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 
 #include <sys/stat.h>
 #include <sys/wait.h>
@@ -28,6 +30,7 @@
 #include "config.h"
 #include "debug.h"
 #include "extract.h"
+#include "glyph-cache.h"
 #include "grid.h"
 #include "ime.h"
 #include "input.h"
@@ -39,6 +42,7 @@
 #include "shm.h"
 #include "sixel.h"
 #include "slave.h"
+#include "spill.h"
 #include "spawn.h"
 #include "url-mode.h"
 #include "util.h"
@@ -236,6 +240,92 @@ static struct timespec last = {0};
 
 static bool cursor_blink_rearm_timer(struct terminal *term);
 
+static void
+cursor_blink_restart(struct terminal *term)
+{
+    /* Prevent blinking while typing */
+    if (term->cursor_blink.fd >= 0) {
+        term->cursor_blink.state = CURSOR_BLINK_ON;
+        cursor_blink_rearm_timer(term);
+    }
+}
+
+static void
+schedule_render(struct terminal *term)
+{
+    if (term->render.app_sync_updates.enabled)
+        return;
+
+    /*
+     * We likely need to re-render. But, we don't want to do it
+     * immediately. Often, a single client update is done through
+     * multiple writes. This could lead to us rendering one frame with
+     * "intermediate" state.
+     *
+     * For example, we might end up rendering a frame
+     * where the client just erased a line, while in the
+     * next frame, the client wrote to the same line. This
+     * causes screen "flickering".
+     *
+     * Mitigate by always incuring a small delay before
+     * rendering the next frame. This gives the client
+     * some time to finish the operation (and thus gives
+     * us time to receive the last writes before doing any
+     * actual rendering).
+     *
+     * We incur this delay *every* time we receive
+     * input. To ensure we don't delay rendering
+     * indefinitely, we start a second timer that is only
+     * reset when we render.
+     *
+     * Note that when the client is producing data at a
+     * very high pace, we're rate limited by the wayland
+     * compositor anyway. The delay we introduce here only
+     * has any effect when the renderer is idle.
+     */
+    uint64_t lower_ns = term->conf->tweak.delayed_render_lower_ns;
+    uint64_t upper_ns = term->conf->tweak.delayed_render_upper_ns;
+
+    if (lower_ns > 0 && upper_ns > 0) {
+#if PTMX_TIMING
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (last.tv_sec > 0 || last.tv_nsec > 0) {
+            struct timespec diff;
+
+            timespec_sub(&now, &last, &diff);
+            LOG_INFO("waited %lds %ldns for more input",
+                     (long)diff.tv_sec, diff.tv_nsec);
+        }
+        last = now;
+#endif
+
+        xassert(lower_ns < 1000000000);
+        xassert(upper_ns < 1000000000);
+        xassert(upper_ns > lower_ns);
+
+        timerfd_settime(
+            term->delayed_render_timer.lower_fd, 0,
+            &(struct itimerspec){.it_value = {.tv_nsec = lower_ns}},
+            NULL);
+
+        /* Second timeout - only reset when we render. Set to one
+         * frame (assuming 60Hz) */
+        if (!term->delayed_render_timer.is_armed) {
+            timerfd_settime(
+                term->delayed_render_timer.upper_fd, 0,
+                &(struct itimerspec){.it_value = {.tv_nsec = upper_ns}},
+                NULL);
+            term->delayed_render_timer.is_armed = true;
+        }
+    } else
+        render_refresh(term);
+}
+
+static void ptmx_thread_drain(struct terminal *term);
+static void ptmx_thread_stop(struct terminal *term);
+
 /* Externally visible, but not declared in terminal.h, to enable pgo
  * to call this function directly */
 bool
@@ -252,11 +342,7 @@ fdm_ptmx(struct fdm *fdm, int fd, int events, void *data)
             return false;
     }
 
-    /* Prevent blinking while typing */
-    if (term->cursor_blink.fd >= 0) {
-        term->cursor_blink.state = CURSOR_BLINK_ON;
-        cursor_blink_rearm_timer(term);
-    }
+    cursor_blink_restart(term);
 
     if (unlikely(term->interactive_resizing.grid != NULL)) {
         /*
@@ -295,92 +381,319 @@ fdm_ptmx(struct fdm *fdm, int fd, int events, void *data)
         vt_from_slave(term, buf, count);
     }
 
-    if (!term->render.app_sync_updates.enabled) {
-        /*
-         * We likely need to re-render. But, we don't want to do it
-         * immediately. Often, a single client update is done through
-         * multiple writes. This could lead to us rendering one frame with
-         * "intermediate" state.
-         *
-         * For example, we might end up rendering a frame
-         * where the client just erased a line, while in the
-         * next frame, the client wrote to the same line. This
-         * causes screen "flickering".
-         *
-         * Mitigate by always incuring a small delay before
-         * rendering the next frame. This gives the client
-         * some time to finish the operation (and thus gives
-         * us time to receive the last writes before doing any
-         * actual rendering).
-         *
-         * We incur this delay *every* time we receive
-         * input. To ensure we don't delay rendering
-         * indefinitely, we start a second timer that is only
-         * reset when we render.
-         *
-         * Note that when the client is producing data at a
-         * very high pace, we're rate limited by the wayland
-         * compositor anyway. The delay we introduce here only
-         * has any effect when the renderer is idle.
-         */
-        uint64_t lower_ns = term->conf->tweak.delayed_render_lower_ns;
-        uint64_t upper_ns = term->conf->tweak.delayed_render_upper_ns;
+    /*
+     * With tweak.threaded-parser, EPOLLIN is never set; PTY data is
+     * read, and tokenized, by ptmx_thread(). Apply everything up to
+     * the hangup before we close the PTY.
+     */
+    if (hup && term->ptmx_thread.running)
+        ptmx_thread_drain(term);
 
-        if (lower_ns > 0 && upper_ns > 0) {
-#if PTMX_TIMING
-            struct timespec now;
+    schedule_render(term);
+
+    if (hup) {
+        del_utmp_record(term->conf, term->reaper, term->ptmx);
+        fdm_del(fdm, fd);
+        term->ptmx = -1;
+    }
+
+    return true;
+}
+
+static void
+eventfd_signal(int fd)
+{
+    if (write(fd, &(uint64_t){1}, sizeof(uint64_t)) != sizeof(uint64_t))
+        LOG_ERRNO("failed to signal event FD");
+}
+
+static void
+eventfd_drain(int fd)
+{
+    uint64_t value;
+    if (read(fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+        LOG_ERRNO("failed to read event FD");
+}
+
+/*
+ * Reads from the PTY, and runs the VT state machine, without blocking
+ * the main thread. The result is a chunk of tokens (see
+ * vt_tokenize()), that is queued for the main thread, which applies it
+ * to the terminal (see ptmx_thread_apply()).
+ *
+ * The thread never touches the terminal itself; the only state shared
+ * with the main thread is the chunk queue, protected by
+ * term->ptmx_thread.lock. When all chunks are queued (i.e. the main
+ * thread is busy, or paused), we stop reading the PTY.
+ */
+static int
+ptmx_thread(void *data)
+{
+    struct terminal *term = data;
+    struct ptmx_thread *pt = &term->ptmx_thread;
+
+    sigset_t mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_SETMASK, &mask, NULL);
+
+    if (pthread_setname_np(pthread_self(), "foot:ptmx") < 0)
+        LOG_ERRNO("ptmx thread: failed to set process title");
+
+    uint8_t buf[24 * 1024];
+    size_t ofs = 0;    /* buf[ofs..count) is read, but not yet tokenized */
+    size_t count = 0;
+
+    while (true) {
+        /* Wait for a free chunk */
+        mtx_lock(&pt->lock);
+        while (!pt->stop && pt->count == ALEN(pt->chunks))
+            cnd_wait(&pt->cond, &pt->lock);
 
-            clock_gettime(CLOCK_MONOTONIC, &now);
-            if (last.tv_sec > 0 || last.tv_nsec > 0) {
-                struct timespec diff;
+        const bool stop = pt->stop;
+        struct vt_tokens *chunk =
+            &pt->chunks[(pt->head + pt->count) % ALEN(pt->chunks)];
+        mtx_unlock(&pt->lock);
 
-                timespec_sub(&now, &last, &diff);
-                LOG_INFO("waited %lds %ldns for more input",
-                         (long)diff.tv_sec, diff.tv_nsec);
+        if (stop)
+            break;
+
+        if (ofs == count) {
+            struct pollfd fds[] = {
+                {.fd = pt->wake_fd, .events = POLLIN},
+                {.fd = term->ptmx, .events = POLLIN},
+            };
+
+            if (poll(fds, ALEN(fds), -1) < 0) {
+                if (errno == EINTR)
+                    continue;
+                LOG_ERRNO("failed to poll pseudo terminal");
+                break;
             }
-            last = now;
-#endif
 
-            xassert(lower_ns < 1000000000);
-            xassert(upper_ns < 1000000000);
-            xassert(upper_ns > lower_ns);
+            if (fds[0].revents & POLLIN) {
+                /* Check 'stop' again */
+                eventfd_drain(pt->wake_fd);
+                continue;
+            }
 
-            timerfd_settime(
-                term->delayed_render_timer.lower_fd, 0,
-                &(struct itimerspec){.it_value = {.tv_nsec = lower_ns}},
-                NULL);
+            ssize_t ret = read(term->ptmx, buf, sizeof(buf));
 
-            /* Second timeout - only reset when we render. Set to one
-             * frame (assuming 60Hz) */
-            if (!term->delayed_render_timer.is_armed) {
-                timerfd_settime(
-                    term->delayed_render_timer.upper_fd, 0,
-                    &(struct itimerspec){.it_value = {.tv_nsec = upper_ns}},
-                    NULL);
-                term->delayed_render_timer.is_armed = true;
+            if (ret < 0) {
+                if (errno == EAGAIN || errno == EINTR)
+                    continue;
+                if (errno != EIO)
+                    LOG_ERRNO("failed to read from pseudo terminal");
+                break;
+            } else if (ret == 0) {
+                /* Reached end-of-file */
+                break;
             }
-        } else
-            render_refresh(term);
+
+            ofs = 0;
+            count = ret;
+        }
+
+        chunk->len = 0;
+        ofs += vt_tokenize(&pt->tokenizer, &buf[ofs], count - ofs, chunk);
+
+        mtx_lock(&pt->lock);
+        pt->count++;
+        cnd_broadcast(&pt->cond);
+        mtx_unlock(&pt->lock);
+
+        eventfd_signal(pt->notify_fd);
     }
 
-    if (hup) {
-        del_utmp_record(term->conf, term->reaper, term->ptmx);
-        fdm_del(fdm, fd);
-        term->ptmx = -1;
+    /* PTY was closed; the main thread gets a EPOLLHUP */
+    mtx_lock(&pt->lock);
+    pt->done = true;
+    cnd_broadcast(&pt->cond);
+    mtx_unlock(&pt->lock);
+    return 0;
+}
+
+/* Applies all queued chunks. The thread keeps reading meanwhile */
+static void
+ptmx_thread_apply(struct terminal *term)
+{
+    struct ptmx_thread *pt = &term->ptmx_thread;
+
+    mtx_lock(&pt->lock);
+    const size_t head = pt->head;
+    const size_t count = pt->count;
+    mtx_unlock(&pt->lock);
+
+    if (count == 0)
+        return;
+
+    for (size_t i = 0; i < count; i++)
+        vt_from_tokens(term, &pt->chunks[(head + i) % ALEN(pt->chunks)]);
+
+    mtx_lock(&pt->lock);
+    pt->head = (head + count) % ALEN(pt->chunks);
+    pt->count -= count;
+    cnd_broadcast(&pt->cond);
+    mtx_unlock(&pt->lock);
+
+    cursor_blink_restart(term);
+    schedule_render(term);
+}
+
+/* Applies everything up to the hangup, and reaps the thread */
+static void
+ptmx_thread_drain(struct terminal *term)
+{
+    struct ptmx_thread *pt = &term->ptmx_thread;
+
+    while (true) {
+        mtx_lock(&pt->lock);
+        while (pt->count == 0 && !pt->done)
+            cnd_wait(&pt->cond, &pt->lock);
+        const bool done = pt->count == 0 && pt->done;
+        mtx_unlock(&pt->lock);
+
+        if (done)
+            break;
+
+        ptmx_thread_apply(term);
     }
 
+    thrd_join(pt->id, NULL);
+    pt->running = false;
+}
+
+static bool
+fdm_ptmx_thread_notify(struct fdm *fdm, int fd, int events, void *data)
+{
+    struct terminal *term = data;
+
+    if (events & EPOLLHUP)
+        return false;
+
+    eventfd_drain(fd);
+
+    /* term_ptmx_resume() signals us again */
+    if (term->ptmx_thread.paused)
+        return true;
+
+    ptmx_thread_apply(term);
     return true;
 }
 
+static bool
+ptmx_thread_start(struct terminal *term)
+{
+    struct ptmx_thread *pt = &term->ptmx_thread;
+
+    int wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    int notify_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if (wake_fd < 0 || notify_fd < 0) {
+        LOG_ERRNO("failed to create ptmx thread event FDs");
+        goto err;
+    }
+
+    if (mtx_init(&pt->lock, mtx_plain) != thrd_success) {
+        LOG_ERR("failed to instantiate ptmx thread mutex");
+        goto err;
+    }
+
+    if (cnd_init(&pt->cond) != thrd_success) {
+        LOG_ERR("failed to instantiate ptmx thread condition variable");
+        mtx_destroy(&pt->lock);
+        goto err;
+    }
+
+    if (!fdm_add(term->fdm, notify_fd, EPOLLIN, &fdm_ptmx_thread_notify, term)) {
+        cnd_destroy(&pt->cond);
+        mtx_destroy(&pt->lock);
+        goto err;
+    }
+
+    pt->wake_fd = wake_fd;
+    pt->notify_fd = notify_fd;
+    pt->head = pt->count = 0;
+    pt->stop = pt->done = false;
+    vt_tokenizer_init(&pt->tokenizer);
+
+    for (size_t i = 0; i < ALEN(pt->chunks); i++) {
+        const size_t size = 64 * 1024;
+        pt->chunks[i] = (struct vt_tokens){.data = xmalloc(size), .size = size};
+    }
+
+    int ret = thrd_create(&pt->id, &ptmx_thread, term);
+    if (ret != thrd_success) {
+        LOG_ERR("failed to create ptmx thread: %s (%d)",
+                thrd_err_as_string(ret), ret);
+        ptmx_thread_stop(term);
+        return false;
+    }
+
+    pt->running = true;
+    return true;
+
+err:
+    if (wake_fd >= 0)
+        close(wake_fd);
+    if (notify_fd >= 0)
+        close(notify_fd);
+    return false;
+}
+
+static void
+ptmx_thread_stop(struct terminal *term)
+{
+    struct ptmx_thread *pt = &term->ptmx_thread;
+
+    if (pt->notify_fd < 0)
+        return;
+
+    if (pt->running) {
+        mtx_lock(&pt->lock);
+        pt->stop = true;
+        cnd_broadcast(&pt->cond);
+        mtx_unlock(&pt->lock);
+
+        eventfd_signal(pt->wake_fd);
+        thrd_join(pt->id, NULL);
+        pt->running = false;
+    }
+
+    /* Chunks not yet applied are discarded, like unread PTY data */
+    for (size_t i = 0; i < ALEN(pt->chunks); i++) {
+        free(pt->chunks[i].data);
+        pt->chunks[i] = (struct vt_tokens){0};
+    }
+
+    fdm_del(term->fdm, pt->notify_fd);
+    close(pt->wake_fd);
+    cnd_destroy(&pt->cond);
+    mtx_destroy(&pt->lock);
+
+    pt->wake_fd = -1;
+    pt->notify_fd = -1;
+}
+
 bool
 term_ptmx_pause(struct terminal *term)
 {
+    if (term->ptmx_thread.running) {
+        term->ptmx_thread.paused = true;
+        return true;
+    }
+
     return fdm_event_del(term->fdm, term->ptmx, EPOLLIN);
 }
 
 bool
 term_ptmx_resume(struct terminal *term)
 {
+    if (term->ptmx_thread.running) {
+        term->ptmx_thread.paused = false;
+        eventfd_signal(term->ptmx_thread.notify_fd);
+        return true;
+    }
+
     return fdm_event_add(term->fdm, term->ptmx, EPOLLIN);
 }
 
@@ -440,13 +753,18 @@ fdm_blink(struct fdm *fdm, int fd, int events, void *data)
     /* Scan all visible cells and mark rows with blinking cells dirty */
     bool no_blinking_cells = true;
     for (int r = 0; r < term->rows; r++) {
-        struct row *row = grid_row_in_view(term->grid, r);
+        struct row *row = grid_row_in_view_or_blank(term->grid, r);
+
+        /* Blank rows have no text to blink */
+        if (row->blank)
+            continue;
+
         for (int col = 0; col < term->cols; col++) {
             struct cell *cell = &row->cells[col];
 
             if (cell->attrs.blink) {
                 cell->attrs.clean = 0;
-                row->dirty = true;
+                grid_row_dirty_cell(row, col);
                 no_blinking_cells = false;
             }
         }
@@ -495,11 +813,106 @@ term_arm_blink_timer(struct terminal *term)
     term->blink.fd = fd;
 }
 
+/*
+ * Number of scrollback rows reflowed in each step of the background
+ * reflow, per thread (see grid_resize_and_reflow())
+ */
+#define REFLOW_CHUNK_ROWS 1024
+
+static void
+reflow_dequeue(struct terminal *term)
+{
+    render_worker_pool_dequeue(term->render.workers.pool, term);
+}
+
+/* A render worker pool background job; see term_queue_reflow() */
+static bool
+reflow_step(void *data)
+{
+    struct terminal *term = data;
+    struct grid *grid = &term->normal;
+
+    if (grid->reflow == NULL) {
+        /* Erased, or stashed by an interactive resize */
+        return false;
+    }
+
+    bool more = grid_reflow_scrollback(
+        grid, term->render.workers.pool, term->rows,
+        REFLOW_CHUNK_ROWS * (1 + term->render.workers.count));
+
+    if (tll_length(grid->sixel_images) > 0)
+        sixel_reflow_grid(term, grid);
+
+    /* Scrollbar, and possibly the view, needs to be updated */
+    if (term->grid == grid)
+        render_refresh(term);
+
+    return more;
+}
+
+/*
+ * Reflows what's left of the scrollback (see grid_reflow_scrollback()),
+ * chunk by chunk, from the main loop. The chunks are scheduled by the
+ * render worker pool, taking turns with other terminals' reflows.
+ */
+void
+term_queue_reflow(struct terminal *term)
+{
+    if (term->normal.reflow == NULL)
+        return;
+
+    if (!render_worker_pool_queue(term->render.workers.pool, &reflow_step, term)) {
+        /* Fallback; reflow everything right away */
+        term_reflow_scrollback(term, -1);
+    }
+}
+
+/*
+ * Reflows, right away, enough of the scrollback to have at least
+ * 'rows' scrollback rows above the view, or all of it if 'rows' is
+ * negative.
+ */
+void
+term_reflow_scrollback(struct terminal *term, int rows)
+{
+    struct grid *grid = &term->normal;
+
+    if (grid->reflow == NULL)
+        return;
+
+    bool more = true;
+
+    if (rows < 0)
+        more = grid_reflow_scrollback(
+            grid, term->render.workers.pool, term->rows, -1);
+    else {
+        while (more) {
+            int sb_start = grid_sb_start_ignore_uninitialized(grid, term->rows);
+            int view_sb_rel =
+                grid_row_abs_to_sb_precalc_sb_start(grid, sb_start, grid->view);
+
+            if (view_sb_rel >= rows)
+                break;
+
+            more = grid_reflow_scrollback(
+                grid, term->render.workers.pool, term->rows,
+                max(rows - view_sb_rel, REFLOW_CHUNK_ROWS));
+        }
+    }
+
+    if (tll_length(grid->sixel_images) > 0)
+        sixel_reflow_grid(term, grid);
+
+    if (!more)
+        reflow_dequeue(term);
+}
+
 static void
 cursor_refresh(struct terminal *term)
 {
     term->grid->cur_row->cells[term->grid->cursor.point.col].attrs.clean = 0;
-    term->grid->cur_row->dirty = true;
+    grid_row_dirty_cell(term->grid->cur_row, term->grid->cursor.point.col);
     render_refresh(term);
 }
 
@@ -631,49 +1044,21 @@ fdm_title_update_timeout(struct fdm *fdm, int fd, int events, void *data)
 static bool
 initialize_render_workers(struct terminal *term)
 {
-    LOG_INFO("using %hu rendering threads", term->render.workers.count);
-
-    if (sem_init(&term->render.workers.start, 0, 0) < 0 ||
-        sem_init(&term->render.workers.done, 0, 0) < 0)
-    {
-        LOG_ERRNO("failed to instantiate render worker semaphores");
-        return false;
-    }
-
     int err;
     if ((err = mtx_init(&term->render.workers.lock, mtx_plain)) != thrd_success) {
         LOG_ERR("failed to instantiate render worker mutex: %s (%d)",
                 thrd_err_as_string(err), err);
-        goto err_sem_destroy;
+        return false;
     }
 
-    term->render.workers.threads = xcalloc(
-        term->render.workers.count, sizeof(term->render.workers.threads[0]));
-
-    for (size_t i = 0; i < term->render.workers.count; i++) {
-        struct render_worker_context *ctx = xmalloc(sizeof(*ctx));
-        *ctx = (struct render_worker_context) {
-            .term = term,
-            .my_id = 1 + i,
-        };
-
-        int ret = thrd_create(
-            &term->render.workers.threads[i], &render_worker_thread, ctx);
-        if (ret != thrd_success) {
-
-            LOG_ERR("failed to create render worker thread: %s (%d)",
-                    thrd_err_as_string(ret), ret);
-            term->render.workers.threads[i] = 0;
-            return false;
-        }
+    if (term->conf->tweak.glyph_cache_size > 0) {
+        /* Caches are instantiated lazily, by the render threads */
+        term->render.glyph_caches = xcalloc(
+            1 + term->render.workers.count,
+            sizeof(term->render.glyph_caches[0]));
     }
 
     return true;
-
-err_sem_destroy:
-    sem_destroy(&term->render.workers.start);
-    sem_destroy(&term->render.workers.done);
-    return false;
 }
 
 static void
@@ -732,7 +1117,7 @@ term_line_height_update(struct terminal *term)
     term->font_line_height.pt = fmaxf(line_original_pt_size * change, 0.);
 }
 
-static bool
+bool
 term_set_fonts(struct terminal *term, struct fcft_font *fonts[static 4],
                bool resize_grid)
 {
@@ -750,6 +1135,14 @@ term_set_fonts(struct terminal *term, struct fcft_font *fonts[static 4],
     free_custom_glyphs(
         &term->custom_glyphs.legacy, GLYPH_LEGACY_COUNT);
 
+    /* Cached cells refer to glyphs from the old fonts */
+    if (term->render.glyph_caches != NULL) {
+        for (size_t i = 0; i < 1 + term->render.workers.count; i++) {
+            if (term->render.glyph_caches[i] != NULL)
+                glyph_cache_clear(term->render.glyph_caches[i]);
+        }
+    }
+
     const struct config *conf = term->conf;
 
     const struct fcft_glyph *M = fcft_rasterize_char_utf32(
@@ -1139,12 +1532,28 @@ term_init(const struct config *conf, struct fdm *fdm, struct reaper *reaper,
         goto err;
     }
 
+    /* Render worker threads are shared with all other terminals */
+    struct render_worker_pool *render_workers =
+        render_worker_pool_ref(fdm, conf->render_worker_count);
+    if (render_workers == NULL)
+        goto err;
+
+    /* As is the grid reclaimer; failure is not fatal */
+    struct grid_reclaimer *grid_reclaimer = grid_reclaimer_ref();
+
+    /* The pool may be larger (another terminal asked for more), or
+     * smaller (failed to grow), than what we asked for */
+    const uint16_t render_worker_count =
+        min(conf->render_worker_count, render_worker_pool_size(render_workers));
+
     /* Initialize configure-based terminal attributes */
     *term = (struct terminal) {
         .fdm = fdm,
         .reaper = reaper,
+        .grid_reclaimer = grid_reclaimer,
         .conf = conf,
         .ptmx = ptmx,
+        .ptmx_thread = {.wake_fd = -1, .notify_fd = -1},
         .ptmx_buffers = tll_init(),
         .ptmx_paste_buffers = tll_init(),
         .font_sizes = {
@@ -1217,7 +1626,7 @@ term_init(const struct config *conf, struct fdm *fdm, struct reaper *reaper,
         .wl = wayl,
         .render = {
             .chains = {
-                .grid = shm_chain_new(wayl->shm, true, 1 + conf->render_worker_count),
+                .grid = shm_chain_new(wayl->shm, true, 1 + render_worker_count),
                 .search = shm_chain_new(wayl->shm, false, 1),
                 .scrollback_indicator = shm_chain_new(wayl->shm, false, 1),
                 .render_timer = shm_chain_new(wayl->shm, false, 1),
@@ -1232,8 +1641,8 @@ term_init(const struct config *conf, struct fdm *fdm, struct reaper *reaper,
                 .timer_fd = title_update_fd,
             },
             .workers = {
-                .count = conf->render_worker_count,
-                .queue = tll_init(),
+                .pool = render_workers,
+                .count = render_worker_count,
             },
         },
         .delayed_render_timer = {
@@ -1294,6 +1703,13 @@ term_init(const struct config *conf, struct fdm *fdm, struct reaper *reaper,
 
     memcpy(term->colors.table, term->conf->colors.table, sizeof(term->colors.table));
 
+    if (conf->tweak.scrollback_spill &&
+        conf->tweak.scrollback_compress_distance > 0)
+    {
+        /* Failure is not fatal; compressed rows are kept in memory */
+        term->normal.spill = spill_file_new(conf->tweak.scrollback_spill_dir);
+    }
+
     /* Initialize the Wayland window backend */
     if ((term->window = wayl_win_init(term, token)) == NULL)
         goto err;
@@ -1350,7 +1766,10 @@ term_window_configured(struct terminal *term)
     /* Enable ptmx FDM callback */
     if (!term->shutdown.in_progress) {
         xassert(term->window->is_configured);
-        fdm_add(term->fdm, term->ptmx, EPOLLIN, &fdm_ptmx, term);
+
+        const bool threaded =
+            term->conf->tweak.threaded_parser && ptmx_thread_start(term);
+        fdm_add(term->fdm, term->ptmx, threaded ? 0 : EPOLLIN, &fdm_ptmx, term);
     }
 }
 
@@ -1535,8 +1954,10 @@ term_shutdown(struct terminal *term)
     fdm_del(term->fdm, term->delayed_render_timer.lower_fd);
     fdm_del(term->fdm, term->delayed_render_timer.upper_fd);
     fdm_del(term->fdm, term->blink.fd);
+    reflow_dequeue(term);
     fdm_del(term->fdm, term->flash.fd);
 
+    ptmx_thread_stop(term);
     del_utmp_record(term->conf, term->reaper, term->ptmx);
 
     if (term->window != NULL && term->window->is_configured)
@@ -1618,6 +2039,7 @@ term_destroy(struct terminal *term)
         }
     }
 
+    ptmx_thread_stop(term);
     del_utmp_record(term->conf, term->reaper, term->ptmx);
 
     fdm_del(term->fdm, term->selection.auto_scroll.fd);
@@ -1627,6 +2049,7 @@ term_destroy(struct terminal *term)
     fdm_del(term->fdm, term->delayed_render_timer.upper_fd);
     fdm_del(term->fdm, term->cursor_blink.fd);
     fdm_del(term->fdm, term->blink.fd);
+    reflow_dequeue(term);
     fdm_del(term->fdm, term->flash.fd);
     fdm_del(term->fdm, term->ptmx);
     if (term->shutdown.terminate_timeout_fd >= 0)
@@ -1637,25 +2060,6 @@ term_destroy(struct terminal *term)
         term->window = NULL;
     }
 
-    mtx_lock(&term->render.workers.lock);
-    xassert(tll_length(term->render.workers.queue) == 0);
-
-    /* Count livinig threads - we may get here when only some of the
-     * threads have been successfully started */
-    size_t worker_count = 0;
-    if (term->render.workers.threads != NULL) {
-        for (size_t i = 0; i < term->render.workers.count; i++, worker_count++) {
-            if (term->render.workers.threads[i] == 0)
-                break;
-        }
-
-        for (size_t i = 0; i < worker_count; i++) {
-            sem_post(&term->render.workers.start);
-            tll_push_back(term->render.workers.queue, -2);
-        }
-    }
-    mtx_unlock(&term->render.workers.lock);
-
     key_binding_unref(term->wl->key_binding_manager, term->conf);
 
     urls_reset(term);
@@ -1684,18 +2088,15 @@ term_destroy(struct terminal *term)
     free(term->search.buf);
     free(term->search.last.buf);
 
-    if (term->render.workers.threads != NULL) {
-        for (size_t i = 0; i < term->render.workers.count; i++) {
-            if (term->render.workers.threads[i] != 0)
-                thrd_join(term->render.workers.threads[i], NULL);
-        }
-    }
-    free(term->render.workers.threads);
+    render_worker_pool_unref(term->render.workers.pool);
     mtx_destroy(&term->render.workers.lock);
-    sem_destroy(&term->render.workers.start);
-    sem_destroy(&term->render.workers.done);
-    xassert(tll_length(term->render.workers.queue) == 0);
-    tll_free(term->render.workers.queue);
+    free(term->render.workers.frame.rows);
+
+    if (term->render.glyph_caches != NULL) {
+        for (size_t i = 0; i < 1 + term->render.workers.count; i++)
+            glyph_cache_destroy(term->render.glyph_caches[i]);
+        free(term->render.glyph_caches);
+    }
 
     shm_unref(term->render.last_buf);
     shm_chain_free(term->render.chains.grid);
@@ -1726,6 +2127,7 @@ term_destroy(struct terminal *term)
     grid_free(&term->alt);
     grid_free(term->interactive_resizing.grid);
     free(term->interactive_resizing.grid);
+    grid_reclaimer_unref(term->grid_reclaimer);
 
     free(term->foot_exe);
     free(term->cwd);
@@ -1822,7 +2224,7 @@ erase_cell_range(struct terminal *term, struct row *row, int start, int end)
     xassert(start < term->cols);
     xassert(end < term->cols);
 
-    row->dirty = true;
+    grid_row_dirty_range(row, start, end);
 
     const enum color_source bg_src = term->vt.attrs.bg_src;
 
@@ -1839,10 +2241,40 @@ erase_cell_range(struct terminal *term, struct row *row, int start, int end)
         grid_row_uri_range_erase(row, start, end);
 }
 
+/*
+ * Erases the cells [start, end] of the row 'row_no' in 'grid'. Entire
+ * rows, other than the cursor's, are replaced with a blank row (see
+ * grid_row_blank()), instead of having their cells written to.
+ */
+static struct row *
+erase_row(struct terminal *term, struct grid *grid, int row_no,
+          int start, int end)
+{
+    if (start > 0 || end < term->cols - 1 || row_no == grid->cursor.point.row) {
+        struct row *row = grid_row_and_alloc(grid, row_no);
+        erase_cell_range(term, row, start, end);
+        return row;
+    }
+
+    const int abs_row = grid_row_absolute(grid, row_no);
+    const struct row *old = grid->rows[abs_row];
+
+    if (old != NULL && term->render.last_cursor.row == old)
+        term->render.last_cursor.row = NULL;
+
+    const enum color_source bg_src = term->vt.attrs.bg_src;
+
+    return grid_row_blank(
+        grid, abs_row,
+        (struct attributes){
+            .bg_src = bg_src,
+            .bg = bg_src != COLOR_DEFAULT ? term->vt.attrs.bg : 0});
+}
+
 static inline void
-erase_line(struct terminal *term, struct row *row)
+erase_line(struct terminal *term, struct grid *grid, int row_no)
 {
-    erase_cell_range(term, row, 0, term->cols - 1);
+    struct row *row = erase_row(term, grid, row_no, 0, term->cols - 1);
     row->linebreak = false;
     row->prompt_marker = false;
 }
@@ -1946,24 +2378,19 @@ term_reset(struct terminal *term, bool hard)
     selection_cancel(term);
     term->normal.offset = term->normal.view = 0;
     term->alt.offset = term->alt.view = 0;
-    for (size_t i = 0; i < term->rows; i++) {
-        struct row *r = grid_row_and_alloc(&term->normal, i);
-        erase_line(term, r);
-    }
-    for (size_t i = 0; i < term->rows; i++) {
-        struct row *r = grid_row_and_alloc(&term->alt, i);
-        erase_line(term, r);
-    }
-    for (size_t i = term->rows; i < term->normal.num_rows; i++) {
-        grid_row_free(term->normal.rows[i]);
-        term->normal.rows[i] = NULL;
-    }
+    for (size_t i = 0; i < term->rows; i++)
+        erase_line(term, &term->normal, i);
+    for (size_t i = 0; i < term->rows; i++)
+        erase_line(term, &term->alt, i);
+    /* Also drops the not yet reflowed scrollback, and spilled rows */
+    grid_free_scrollback(&term->normal, term->rows);
+    reflow_dequeue(term);
     for (size_t i = term->rows; i < term->alt.num_rows; i++) {
-        grid_row_free(term->alt.rows[i]);
+        grid_row_free(&term->alt, term->alt.rows[i]);
         term->alt.rows[i] = NULL;
     }
-    term->normal.cur_row = term->normal.rows[0];
-    term->alt.cur_row = term->alt.rows[0];
+    term->normal.cur_row = grid_row(&term->normal, 0);
+    term->alt.cur_row = grid_row(&term->alt, 0);
     tll_free(term->normal.scroll_damage);
     tll_free(term->alt.scroll_damage);
     term->render.last_cursor.row = NULL;
@@ -2205,16 +2632,26 @@ term_font_baseline(const struct terminal *term)
     return term->font_y_ofs + line_height - glyph_top_y - font->descent;
 }
 
+static void
+damage_row(struct row *row, int cols)
+{
+    grid_row_dirty_all(row);
+
+    if (unlikely(row->blank)) {
+        grid_row_blank_attrs(row)->clean = 0;
+        return;
+    }
+
+    for (int c = 0; c < cols; c++)
+        row->cells[c].attrs.clean = 0;
+}
+
 void
 term_damage_rows(struct terminal *term, int start, int end)
 {
     xassert(start <= end);
-    for (int r = start; r <= end; r++) {
-        struct row *row = grid_row(term->grid, r);
-        row->dirty = true;
-        for (int c = 0; c < term->grid->num_cols; c++)
-            row->cells[c].attrs.clean = 0;
-    }
+    for (int r = start; r <= end; r++)
+        damage_row(grid_row_or_blank(term->grid, r), term->grid->num_cols);
 }
 
 void
@@ -2222,10 +2659,8 @@ term_damage_rows_in_view(struct terminal *term, int start, int end)
 {
     xassert(start <= end);
     for (int r = start; r <= end; r++) {
-        struct row *row = grid_row_in_view(term->grid, r);
-        row->dirty = true;
-        for (int c = 0; c < term->grid->num_cols; c++)
-            row->cells[c].attrs.clean = 0;
+        damage_row(
+            grid_row_in_view_or_blank(term->grid, r), term->grid->num_cols);
     }
 }
 
@@ -2245,7 +2680,7 @@ void
 term_damage_cursor(struct terminal *term)
 {
     term->grid->cur_row->cells[term->grid->cursor.point.col].attrs.clean = 0;
-    term->grid->cur_row->dirty = true;
+    grid_row_dirty_cell(term->grid->cur_row, term->grid->cursor.point.col);
 }
 
 void
@@ -2290,24 +2725,22 @@ term_erase(struct terminal *term, int start_row, int start_col,
     xassert(start_col <= end_col || start_row < end_row);
 
     if (start_row == end_row) {
-        struct row *row = grid_row(term->grid, start_row);
-        erase_cell_range(term, row, start_col, end_col);
+        erase_row(term, term->grid, start_row, start_col, end_col);
         sixel_overwrite_by_row(term, start_row, start_col, end_col - start_col + 1);
         return;
     }
 
     xassert(end_row > start_row);
 
-    erase_cell_range(
-        term, grid_row(term->grid, start_row), start_col, term->cols - 1);
+    erase_row(term, term->grid, start_row, start_col, term->cols - 1);
     sixel_overwrite_by_row(term, start_row, start_col, term->cols - start_col);
 
     for (int r = start_row + 1; r < end_row; r++)
-        erase_line(term, grid_row(term->grid, r));
+        erase_line(term, term->grid, r);
     sixel_overwrite_by_rectangle(
         term, start_row + 1, 0, end_row - start_row, term->cols);
 
-    erase_cell_range(term, grid_row(term->grid, end_row), 0, end_col);
+    erase_row(term, term->grid, end_row, 0, end_col);
     sixel_overwrite_by_row(term, end_row, 0, end_col + 1);
 }
 
@@ -2315,11 +2748,9 @@ void
 term_erase_scrollback(struct terminal *term)
 {
     const struct grid *grid = term->grid;
-    const int num_rows = grid->num_rows;
-    const int mask = num_rows - 1;
 
-    const int start = (grid->offset + term->rows) & mask;
-    const int end = (grid->offset - 1) & mask;
+    const int start = grid_row_wrap(grid, grid->offset + term->rows);
+    const int end = grid_row_wrap(grid, grid->offset - 1);
 
     const int rel_start = grid_row_abs_to_sb(grid, term->rows, start);
     const int rel_end = grid_row_abs_to_sb(grid, term->rows, end);
@@ -2369,19 +2800,9 @@ term_erase_scrollback(struct terminal *term)
         }
     }
 
-    for (int i = start;; i = (i + 1) & mask) {
-        struct row *row = term->grid->rows[i];
-        if (row != NULL) {
-            if (term->render.last_cursor.row == row)
-                term->render.last_cursor.row = NULL;
-
-            grid_row_free(row);
-            term->grid->rows[i] = NULL;
-        }
-
-        if (i == end)
-            break;
-    }
+    /* Screen rows may be re-allocated too; the view is damaged below */
+    term->render.last_cursor.row = NULL;
+    grid_free_scrollback(term->grid, term->rows);
 
     term->grid->view = term->grid->offset;
     term_damage_view(term);
@@ -2422,11 +2843,8 @@ UNITTEST
 
 #define populate_scrollback() do {                                      \
         for (int i = 0; i < scrollback_rows; i++) {                     \
-            if (term.normal.rows[i] == NULL) {                          \
-                struct row *r = xcalloc(1, sizeof(*term.normal.rows[i])); \
-                r->cells = xcalloc(cols, sizeof(r->cells[0]));          \
-                term.normal.rows[i] = r;                                \
-            }                                                           \
+            if (term.normal.rows[i] == NULL)                            \
+                term.normal.rows[i] = grid_row_alloc(&term.normal, true); \
         }                                                               \
     } while (0)
 
@@ -2510,9 +2928,7 @@ UNITTEST
     /* Cleanup */
     tll_free(term.normal.sixel_images);
     close(term.selection.auto_scroll.fd);
-    for (int i = 0; i < scrollback_rows; i++)
-        grid_row_free(term.normal.rows[i]);
-    free(term.normal.rows);
+    grid_free(&term.normal);
     fdm_destroy(fdm);
 }
 
@@ -2673,6 +3089,89 @@ selection_on_bottom_region(const struct terminal *term,
         selection_on_rows(term, region.end, term->rows - 1);
 }
 
+/*
+ * Compresses the 'count' scrollback rows that just crossed
+ * tweak.scrollback-compress-distance. If rows have been decompressed
+ * (by the view, search, selection etc) since the last call, the
+ * entire scrollback is swept instead. Rows in the view are left
+ * alone.
+ */
+static void
+compress_scrollback(struct terminal *term, int count)
+{
+    struct grid *grid = term->grid;
+
+    const uint32_t distance = term->conf->tweak.scrollback_compress_distance;
+
+    if (distance >= (uint32_t)(grid->num_rows - term->rows))
+        return;
+
+    const int cold_rows = grid->num_rows - term->rows - (int)distance;
+
+    if (unlikely(grid->decompressed)) {
+        count = cold_rows;
+        grid->decompressed = false;
+    } else
+        count = min(count, cold_rows);
+
+    for (int i = 0; i < count; i++) {
+        const int abs_r = grid_row_wrap(grid, grid->offset - (int)distance - 1 - i);
+        struct row *row = grid->rows[abs_r];
+
+        if (row == NULL) {
+            /* Reached the scrollback start */
+            break;
+        }
+
+        if (row->compressed)
+            continue;
+
+        if (grid_row_wrap(grid, abs_r - grid->view) < term->rows) {
+            /* Visible */
+            continue;
+        }
+
+        if (term->render.last_cursor.row == row)
+            term->render.last_cursor.row = NULL;
+
+        grid_row_compress(grid, abs_r);
+    }
+}
+
+/*
+ * Replaces the 'count' rows just scrolled out of the screen with
+ * blank rows, if they are empty (see grid_row_blank_if_empty()).
+ * Erased rows are blank already; this catches the ones the cursor
+ * has been on (e.g. the empty lines of a log).
+ */
+static void
+blank_empty_rows(struct terminal *term, int count)
+{
+    struct grid *grid = term->grid;
+
+    count = min(count, grid->num_rows - term->rows);
+
+    for (int i = 0; i < count; i++) {
+        const int abs_r = grid_row_wrap(grid, grid->offset - 1 - i);
+        const struct row *row = grid->rows[abs_r];
+
+        if (row == NULL) {
+            /* Reached the scrollback start */
+            break;
+        }
+
+        if (grid_row_wrap(grid, abs_r - grid->view) < term->rows) {
+            /* Visible */
+            continue;
+        }
+
+        const bool last_cursor = term->render.last_cursor.row == row;
+
+        if (grid_row_blank_if_empty(grid, abs_r) && last_cursor)
+            term->render.last_cursor.row = NULL;
+    }
+}
+
 void
 term_scroll_partial(struct terminal *term, struct scroll_region region, int rows)
 {
@@ -2705,7 +3204,7 @@ term_scroll_partial(struct terminal *term, struct scroll_region region, int rows
 
     bool view_follows = term->grid->view == term->grid->offset;
     term->grid->offset += rows;
-    term->grid->offset &= term->grid->num_rows - 1;
+    term->grid->offset = grid_row_wrap(term->grid, term->grid->offset);
 
     if (likely(view_follows)) {
         term_damage_scroll(term, DAMAGE_SCROLL, region, rows);
@@ -2728,12 +3227,29 @@ term_scroll_partial(struct terminal *term, struct scroll_region region, int rows
 
     /* Erase scrolled in lines */
     for (int r = region.end - rows; r < region.end; r++) {
-        struct row *row = grid_row_and_alloc(term->grid, r);
-        erase_line(term, row);
+        const int abs_r = grid_row_absolute(term->grid, r);
+        struct row *row = term->grid->rows[abs_r];
+
+        if (unlikely(row != NULL &&
+                     ((row->compressed && !row->blank) || row->shared > 0)))
+        {
+            /* Re-used scrollback row; no need to decompress, or copy, it */
+            grid_row_free(term->grid, row);
+            term->grid->rows[abs_r] = NULL;
+        }
+
+        erase_line(term, term->grid, r);
     }
 
     term->grid->cur_row = grid_row(term->grid, term->grid->cursor.point.row);
 
+    if (term->grid == &term->normal) {
+        blank_empty_rows(term, rows);
+
+        if (term->conf->tweak.scrollback_compress_distance > 0)
+            compress_scrollback(term, rows);
+    }
+
 #if defined(_DEBUG)
     for (int r = 0; r < term->rows; r++)
         xassert(grid_row(term->grid, r) != NULL);
@@ -2776,7 +3292,7 @@ term_scroll_reverse_partial(struct terminal *term,
         const int abs_r = grid_row_absolute(term->grid, r);
         struct row *row = term->grid->rows[abs_r];
 
-        grid_row_free(row);
+        grid_row_free(term->grid, row);
         term->grid->rows[abs_r] = NULL;
 
         if (term->render.last_cursor.row == row)
@@ -2788,7 +3304,7 @@ term_scroll_reverse_partial(struct terminal *term,
     bool view_follows = term->grid->view == term->grid->offset;
     term->grid->offset -= rows;
     term->grid->offset += term->grid->num_rows;
-    term->grid->offset &= term->grid->num_rows - 1;
+    term->grid->offset = grid_row_wrap(term->grid, term->grid->offset);
 
     xassert(term->grid->offset >= 0);
     xassert(term->grid->offset < term->grid->num_rows);
@@ -2808,10 +3324,8 @@ term_scroll_reverse_partial(struct terminal *term,
         grid_swap_row(term->grid, i, i - rows);
 
     /* Erase scrolled in lines */
-    for (int r = region.start; r < region.start + rows; r++) {
-        struct row *row = grid_row_and_alloc(term->grid, r);
-        erase_line(term, row);
-    }
+    for (int r = region.start; r < region.start + rows; r++)
+        erase_line(term, term->grid, r);
 
     term->grid->cur_row = grid_row(term->grid, term->grid->cursor.point.row);
 
@@ -3416,6 +3930,64 @@ print_insert(struct terminal *term, int width)
     /* Mark moved cells as dirty */
     for (size_t i = term->grid->cursor.point.col + width; i < term->cols; i++)
         row->cells[i].attrs.clean = 0;
+    if (move_count > 0)
+        grid_row_dirty_range(row, term->grid->cursor.point.col + width, term->cols - 1);
+}
+
+/*
+ * Returns true if writing 'wc', with the attributes 'attrs', to
+ * 'cell' would not change what is rendered. This lets full screen
+ * applications redraw unchanged content without dirtying it.
+ *
+ * Cells that are already dirty are never considered unchanged. Nor
+ * are selected cells; a write replaces the 'selected' bit too, and
+ * whether the cell is still highlighted is up to the next frame's
+ * selection pass (see selection_dirty_cells()).
+ */
+static inline bool
+cell_is_unchanged(const struct cell *cell, char32_t wc,
+                  struct attributes attrs)
+{
+    /* Bits maintained by the renderer */
+    static const struct attributes ignored = {
+        .clean = true, .confined = true};
+
+    uint64_t old, new, mask;
+    memcpy(&old, &cell->attrs, sizeof(old));
+    memcpy(&new, &attrs, sizeof(new));
+    memcpy(&mask, &ignored, sizeof(mask));
+
+    return cell->attrs.clean && cell->wc == wc && ((old ^ new) & ~mask) == 0;
+}
+
+UNITTEST
+{
+    const struct attributes attrs = {.bold = true, .fg = 0x123456};
+
+    struct cell cell = {.wc = U'a', .attrs = attrs};
+    xassert(!cell_is_unchanged(&cell, U'a', attrs));  /* Already dirty */
+
+    cell.attrs.clean = true;
+    cell.attrs.confined = true;
+    xassert(cell_is_unchanged(&cell, U'a', attrs));
+    xassert(!cell_is_unchanged(&cell, U'b', attrs));
+
+    /* Selected cells are always written */
+    cell.attrs.selected = true;
+    xassert(!cell_is_unchanged(&cell, U'a', attrs));
+    cell.attrs.selected = false;
+
+    struct attributes other = attrs;
+    other.underline = true;
+    xassert(!cell_is_unchanged(&cell, U'a', other));
+
+    other = attrs;
+    other.bg_src = COLOR_RGB;
+    xassert(!cell_is_unchanged(&cell, U'a', other));
+
+    other = attrs;
+    other.url = true;
+    xassert(!cell_is_unchanged(&cell, U'a', other));
 }
 
 static void
@@ -3427,6 +3999,7 @@ print_spacer(struct terminal *term, int col, int remaining)
 
     cell->wc = CELL_SPACER + remaining;
     cell->attrs = term->vt.attrs;
+    grid_row_dirty_cell(row, col);
 }
 
 void
@@ -3474,12 +4047,18 @@ term_print(struct terminal *term, char32_t wc, int width)
 
     /* *Must* get current cell *after* linewrap+insert */
     struct row *row = grid->cur_row;
-    row->dirty = true;
     row->linebreak = true;
 
     struct cell *cell = &row->cells[col];
-    cell->wc = term->vt.last_printed = wc;
-    cell->attrs = term->vt.attrs;
+    term->vt.last_printed = wc;
+
+    if (width > 1 || term->vt.osc8.uri != NULL ||
+        !cell_is_unchanged(cell, wc, term->vt.attrs))
+    {
+        grid_row_dirty_cell(row, col);
+        cell->wc = wc;
+        cell->attrs = term->vt.attrs;
+    }
 
     if (term->vt.osc8.uri != NULL) {
         grid_row_uri_range_put(
@@ -3534,12 +4113,16 @@ ascii_printer_fast(struct terminal *term, char32_t wc)
     const int uri_start = col;
 
     struct row *row = grid->cur_row;
-    row->dirty = true;
     row->linebreak = true;
 
     struct cell *cell = &row->cells[col];
-    cell->wc = term->vt.last_printed = wc;
-    cell->attrs = term->vt.attrs;
+    term->vt.last_printed = wc;
+
+    if (!cell_is_unchanged(cell, wc, term->vt.attrs)) {
+        grid_row_dirty_cell(row, col);
+        cell->wc = wc;
+        cell->attrs = term->vt.attrs;
+    }
 
     /* Advance cursor */
     if (unlikely(++col >= term->cols)) {
@@ -3562,6 +4145,90 @@ ascii_printer_single_shift(struct terminal *term, char32_t wc)
     term_update_ascii_printer(term);
 }
 
+static void
+ascii_run_printer_generic(struct terminal *term, const uint8_t *s, size_t len)
+{
+    /*
+     * Note: the printer may change while we're printing (single
+     * shifts), hence we need to re-load it for each character
+     */
+    for (size_t i = 0; i < len; i++)
+        term->ascii_printer(term, s[i]);
+}
+
+static void
+ascii_run_printer_fast(struct terminal *term, const uint8_t *s, size_t len)
+{
+    struct grid *grid = term->grid;
+
+    xassert(len > 0);
+    xassert(term->charsets.set[term->charsets.selected] == CHARSET_ASCII);
+    xassert(!term->insert_mode);
+    xassert(tll_length(grid->sixel_images) == 0);
+
+    const struct attributes attrs = term->vt.attrs;
+    term->vt.last_printed = s[len - 1];
+
+    while (len > 0) {
+        print_linewrap(term);
+
+        if (unlikely(grid->cursor.lcf)) {
+            /*
+             * Auto-wrap is disabled, and we're at the right margin;
+             * all remaining characters will overwrite the last
+             * column, so only the last one will actually be
+             * visible.
+             */
+            xassert(!term->auto_margin);
+            s += len - 1;
+            len = 1;
+        }
+
+        /* *Must* get current cell *after* linewrap */
+        int col = grid->cursor.point.col;
+        const size_t count = min(len, (size_t)(term->cols - col));
+        xassert(count > 0);
+
+        struct row *row = grid->cur_row;
+        row->linebreak = true;
+
+        /* Only cells whose content actually changes are dirtied */
+        int first_changed = -1, last_changed = -1;
+
+        struct cell *cell = &row->cells[col];
+        for (size_t i = 0; i < count; i++, cell++) {
+            if (cell_is_unchanged(cell, s[i], attrs))
+                continue;
+
+            cell->wc = s[i];
+            cell->attrs = attrs;
+
+            if (first_changed < 0)
+                first_changed = i;
+            last_changed = i;
+        }
+
+        if (first_changed >= 0)
+            grid_row_dirty_range(row, col + first_changed, col + last_changed);
+
+        if (unlikely(row->extra != NULL))
+            grid_row_uri_range_erase(row, col, col + count - 1);
+
+        s += count;
+        len -= count;
+
+        /* Advance cursor */
+        col += count;
+        if (unlikely(col >= term->cols)) {
+            grid->cursor.lcf = true;
+            col = term->cols - 1;
+        } else
+            xassert(!grid->cursor.lcf);
+
+        grid->cursor.point.col = col;
+    }
+}
+
 void
 term_update_ascii_printer(struct terminal *term)
 {
@@ -3582,6 +4249,9 @@ term_update_ascii_printer(struct terminal *term)
 #endif
 
     term->ascii_printer = new_printer;
+    term->ascii_run_printer = new_printer == &ascii_printer_fast
+        ? &ascii_run_printer_fast
+        : &ascii_run_printer_generic;
 }
 
 void
@@ -3590,6 +4260,7 @@ term_single_shift(struct terminal *term, enum charset_designator idx)
     term->charsets.saved = term->charsets.selected;
     term->charsets.selected = idx;
     term->ascii_printer = &ascii_printer_single_shift;
+    term->ascii_run_printer = &ascii_run_printer_generic;
 }
 
 enum term_surface
@@ -3628,8 +4299,19 @@ rows_to_text(const struct terminal *term, int start, int end,
     const int grid_rows = term->grid->num_rows;
     int r = start;
 
-    while (true) {
-        const struct row *row = term->grid->rows[r];
+    /*
+     * Compressed (and blank) rows are decoded here, rather than
+     * decompressed. Consecutive rows are decoded into different
+     * scratch rows; extract_one() tells rows apart by their address.
+     */
+    const size_t cells_size = term->grid->num_cols * sizeof(struct cell);
+    struct row scratch[2] = {
+        {.cells = xmalloc(cells_size)},
+        {.cells = xmalloc(cells_size)},
+    };
+
+    for (size_t i = 0; ; i ^= 1) {
+        const struct row *row = grid_row_peek(term->grid, r, &scratch[i]);
         xassert(row != NULL);
 
         for (int c = 0; c < term->cols; c++)
@@ -3640,10 +4322,12 @@ rows_to_text(const struct terminal *term, int start, int end,
             break;
 
         r++;
-        r &= grid_rows - 1;
+        r = _grid_row_wrap(r, grid_rows);
     }
 
 out:
+    for (size_t i = 0; i < ALEN(scratch); i++)
+        free(scratch[i].cells);
     return extract_finish(ctx, text, len);
 }
 
@@ -3651,8 +4335,8 @@ bool
 term_scrollback_to_text(const struct terminal *term, char **text, size_t *len)
 {
     const int grid_rows = term->grid->num_rows;
-    int start = (term->grid->offset + term->rows) & (grid_rows - 1);
-    int end = (term->grid->offset + term->rows - 1) & (grid_rows - 1);
+    int start = _grid_row_wrap(term->grid->offset + term->rows, grid_rows);
+    int end = _grid_row_wrap(term->grid->offset + term->rows - 1, grid_rows);
 
     xassert(start >= 0);
     xassert(start < grid_rows);
@@ -3663,7 +4347,7 @@ term_scrollback_to_text(const struct terminal *term, char **text, size_t *len)
      * until we find the first non-NULL row */
     while (term->grid->rows[start] == NULL) {
         start++;
-        start &= grid_rows - 1;
+        start = _grid_row_wrap(start, grid_rows);
     }
 
     while (term->grid->rows[end] == NULL) {
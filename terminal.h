@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 
@@ -123,6 +124,24 @@ struct row {
 
     /* Shell integration */
     bool prompt_marker;
+
+    /* Cells are encoded, and 'cells' is NULL. See grid_row_abs() */
+    bool compressed;
+
+    /* No text, and a single set of attributes; implies 'compressed'.
+     * See grid_row_blank() */
+    bool blank;
+
+    /* Number of *other* grids referencing the row. See grid_snapshot() */
+    uint8_t shared;
+
+    /*
+     * Columns (inclusive) that may contain dirty cells. Only valid
+     * when 'dirty' is set. May extend past the last column. Use
+     * grid_row_dirty_range() and friends to update.
+     */
+    int dirty_start;
+    int dirty_end;
 };
 
 struct sixel {
@@ -203,6 +222,27 @@ struct grid {
     struct row **rows;
     struct row *cur_row;
 
+    /* Rows are allocated from here (see grid.c) */
+    struct row_arena *arena;
+
+    /* Set when a compressed row has been decompressed */
+    bool decompressed;
+
+    /* Compressed rows are stored here, if non-NULL (see spill.h) */
+    struct spill_file *spill;
+
+    /* Scrollback not yet reflowed after a resize, or NULL (see grid.h) */
+    struct grid_reflow *reflow;
+
+    /*
+     * Set in grid snapshots only (see grid_snapshot()); the number of
+     * view rows held, and the scrollback start of the original grid.
+     */
+    struct {
+        int view_rows;
+        int sb_start;
+    } snapshot;
+
     tll(struct damage) scroll_damage;
     tll(struct sixel) sixel_images;
 
@@ -225,6 +265,25 @@ struct vt_param {
     struct vt_subparams sub;
 };
 
+struct vt_params {
+    uint8_t idx;
+    struct vt_param *cur;
+    struct vt_param v[16];
+    struct vt_param dummy;
+};
+
+/*
+ * Maps the parameter string of a recently seen SGR sequence, to the
+ * attribute bits it changes (mask), and their new values (value). See
+ * csi_sgr_fast().
+ */
+struct sgr_cache_entry {
+    uint64_t mask;
+    uint64_t value;
+    uint8_t len;
+    uint8_t params[31];
+};
+
 struct vt {
     int state;  /* enum state */
     char32_t last_printed;
@@ -232,18 +291,15 @@ struct vt {
     utf8proc_int32_t grapheme_state;
 #endif
     char32_t utf8;
-    struct {
-        uint8_t idx;
-        struct vt_param *cur;
-        struct vt_param v[16];
-        struct vt_param dummy;
-    } params;
+    struct vt_params params;
 
     uint32_t private; /* LSB=priv0, MSB=priv3 */
 
     struct attributes attrs;
     struct attributes saved_attrs;
 
+    struct sgr_cache_entry sgr_cache[16];
+
     struct {
         uint8_t *data;
         size_t size;
@@ -266,6 +322,48 @@ struct vt {
     } dcs;
 };
 
+/*
+ * Parser state of the tweak.threaded-parser thread. The thread runs
+ * the state machine, and hands the resulting actions over to the main
+ * thread in chunks of tokens; see vt_tokenize() and vt_from_tokens().
+ */
+struct vt_tokenizer {
+    int state;  /* enum state */
+    char32_t utf8;
+    struct vt_params params;
+    uint32_t private;
+};
+
+struct vt_tokens {
+    uint8_t *data;
+    size_t size;
+    size_t len;
+};
+
+/*
+ * tweak.threaded-parser: PTY is read, and tokenized, by this thread.
+ * The tokens are applied to the terminal by the main thread.
+ */
+struct ptmx_thread {
+    thrd_t id;
+    bool running;
+    bool paused;   /* term_ptmx_pause() */
+    int wake_fd;   /* Wakes the thread up when 'stop' is set */
+    int notify_fd; /* Wakes the main thread up when chunks are queued */
+
+    /* Owned by the thread */
+    struct vt_tokenizer tokenizer;
+
+    /* Hand-off queue, protected by 'lock' */
+    mtx_t lock;
+    cnd_t cond;
+    struct vt_tokens chunks[4];
+    size_t head;   /* First queued chunk */
+    size_t count;  /* Number of queued chunks */
+    bool stop;     /* Exit, without reading any more */
+    bool done;     /* Thread has exited (EOF, or error) */
+};
+
 enum cursor_origin { ORIGIN_ABSOLUTE, ORIGIN_RELATIVE };
 enum cursor_keys { CURSOR_KEYS_DONTCARE, CURSOR_KEYS_NORMAL, CURSOR_KEYS_APPLICATION };
 enum keypad_keys { KEYPAD_DONTCARE, KEYPAD_NUMERICAL, KEYPAD_APPLICATION };
@@ -355,15 +453,21 @@ struct terminal {
     const struct config *conf;
 
     void (*ascii_printer)(struct terminal *term, char32_t c);
+    void (*ascii_run_printer)(struct terminal *term, const uint8_t *s, size_t len);
 
     pid_t slave;
     int ptmx;
 
+    struct ptmx_thread ptmx_thread;
+
     struct vt vt;
     struct grid *grid;
     struct grid normal;
     struct grid alt;
 
+    /* Frees grid rows in the background; shared with all other terminals */
+    struct grid_reclaimer *grid_reclaimer;
+
     int cols;   /* number of columns */
     int rows;   /* number of rows */
     struct scroll_region scroll_region;
@@ -613,15 +717,31 @@ struct terminal {
 
         /* Render threads + synchronization primitives */
         struct {
+            struct render_worker_pool *pool;  /* Shared by all terminals */
             uint16_t count;
-            sem_t start;
-            sem_t done;
             mtx_t lock;
-            tll(int) queue;
-            thrd_t *threads;
             struct buffer *buf;
+
+            /* Estimated time to render a single row (see render.c) */
+            uint64_t row_cost_ns;
+
+            /*
+             * Dirty rows in the current frame. Filled in by the main
+             * thread before the workers are started (also used when
+             * there are no workers); threads then claim rows by
+             * incrementing 'next'.
+             */
+            struct {
+                int *rows;
+                size_t count;
+                size_t size;
+                atomic_size_t next;
+            } frame;
         } workers;
 
+        /* Per render thread (main thread first), NULL if disabled */
+        struct glyph_cache **glyph_caches;
+
         /* Last rendered cursor position */
         struct {
             struct row *row;
@@ -744,6 +864,8 @@ bool term_paste_data_to_slave(
 
 bool term_fractional_scaling(const struct terminal *term);
 bool term_update_scale(struct terminal *term);
+bool term_set_fonts(
+    struct terminal *term, struct fcft_font *fonts[static 4], bool resize_grid);
 bool term_font_size_increase(struct terminal *term);
 bool term_font_size_decrease(struct terminal *term);
 bool term_font_size_reset(struct terminal *term);
@@ -803,6 +925,8 @@ void term_linefeed(struct terminal *term);
 void term_reverse_index(struct terminal *term);
 
 void term_arm_blink_timer(struct terminal *term);
+void term_queue_reflow(struct terminal *term);
+void term_reflow_scrollback(struct terminal *term, int rows);
 
 void term_save_cursor(struct terminal *term);
 void term_restore_cursor(struct terminal *term, const struct cursor *cursor);
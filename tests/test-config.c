@@ -1348,6 +1348,28 @@ test_section_tweak(void)
     test_boolean(&ctx, &parse_section_tweak, "font-monospace-warn",
                  &conf.tweak.font_monospace_warn);
 
+    test_boolean(&ctx, &parse_section_tweak, "threaded-parser",
+                 &conf.tweak.threaded_parser);
+
+    /* Must not exceed 65536 */
+    ctx.key = "glyph-cache-size";
+    ctx.value = "65536";
+    if (!parse_section_tweak(&ctx) || conf.tweak.glyph_cache_size != 65536)
+        BUG("[%s].%s=%s: failed to parse", ctx.section, ctx.key, ctx.value);
+    ctx.value = "65537";
+    if (parse_section_tweak(&ctx))
+        BUG("[%s].%s=%s: did not fail to parse as expected",
+            ctx.section, ctx.key, ctx.value);
+
+    test_uint32(&ctx, &parse_section_tweak, "scrollback-compress-distance",
+                &conf.tweak.scrollback_compress_distance);
+
+    test_boolean(&ctx, &parse_section_tweak, "scrollback-spill",
+                 &conf.tweak.scrollback_spill);
+
+    test_string(&ctx, &parse_section_tweak, "scrollback-spill-dir",
+                &conf.tweak.scrollback_spill_dir);
+
     test_float(&ctx, &parse_section_tweak, "bold-text-in-bright-amount",
                &conf.bold_in_bright.amount);
 
@@ -745,33 +745,32 @@ tag_cells_for_url(struct terminal *term, const struct url *url, bool value)
     const struct coord *start = &url->range.start;
     const struct coord *end = &url->range.end;
 
-    size_t end_r = end->row & (grid->num_rows - 1);
+    size_t end_r = grid_row_wrap(grid, end->row);
 
-    size_t r = start->row & (grid->num_rows - 1);
+    size_t r = grid_row_wrap(grid, start->row);
     size_t c = start->col;
 
-    struct row *row = grid->rows[r];
-    row->dirty = true;
+    struct row *row = grid_row_abs(grid, r);
 
     while (true) {
         struct cell *cell = &row->cells[c];
         cell->attrs.url = value;
         cell->attrs.clean = 0;
+        grid_row_dirty_cell(row, c);
 
         if (r == end_r && c == end->col)
             break;
 
         if (++c >= term->cols) {
-            r = (r + 1) & (grid->num_rows - 1);
+            r = grid_row_wrap(grid, r + 1);
             c = 0;
 
-            row = grid->rows[r];
+            row = grid_row_abs(grid, r);
             if (row == NULL) {
                 /* Un-allocated scrollback. This most likely means a
                  * runaway OSC-8 URL. */
                 break;
             }
-            row->dirty = true;
         }
     }
 }
@@ -790,7 +789,7 @@ urls_render(struct terminal *term)
         if (cursor_row != NULL) {
             struct cell *cell = &cursor_row->cells[term->render.last_cursor.col];
             cell->attrs.clean = 0;
-            cursor_row->dirty = true;
+            grid_row_dirty_cell(cursor_row, term->render.last_cursor.col);
         }
     }
     term->render.last_cursor.row = NULL;
@@ -804,7 +803,7 @@ urls_render(struct terminal *term)
     term_damage_view(term);
 
     /* Snapshot the current grid */
-    term->url_grid_snapshot = grid_snapshot(term->grid);
+    term->url_grid_snapshot = grid_snapshot(term->grid, term->rows);
 
     xassert(tll_length(win->urls) == 0);
     tll_foreach(win->term->urls, it) {
@@ -1,5 +1,6 @@
 #include "vt.h"
 
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -8,6 +9,12 @@
  #include <utf8proc.h>
 #endif
 
+#if defined(__SSE2__)
+ #include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+ #include <arm_neon.h>
+#endif
+
 #define LOG_MODULE "vt"
 #define LOG_ENABLE_DBG 0
 #include "log.h"
@@ -19,68 +26,13 @@
 #include "grid.h"
 #include "osc.h"
 #include "util.h"
+#include "vt-tables.h"
 #include "xmalloc.h"
 
 #define UNHANDLED() LOG_DBG("unhandled: %s", esc_as_string(term, final))
 
 /* https://vt100.net/emu/dec_ansi_parser */
 
-enum state {
-    STATE_GROUND,
-    STATE_ESCAPE,
-    STATE_ESCAPE_INTERMEDIATE,
-
-    STATE_CSI_ENTRY,
-    STATE_CSI_PARAM,
-    STATE_CSI_INTERMEDIATE,
-    STATE_CSI_IGNORE,
-
-    STATE_OSC_STRING,
-
-    STATE_DCS_ENTRY,
-    STATE_DCS_PARAM,
-    STATE_DCS_INTERMEDIATE,
-    STATE_DCS_IGNORE,
-    STATE_DCS_PASSTHROUGH,
-
-    STATE_SOS_PM_APC_STRING,
-
-    STATE_UTF8_21,
-    STATE_UTF8_31,
-    STATE_UTF8_32,
-    STATE_UTF8_41,
-    STATE_UTF8_42,
-    STATE_UTF8_43,
-};
-
-#if defined(_DEBUG) && defined(LOG_ENABLE_DBG) && LOG_ENABLE_DBG && 0
-static const char *const state_names[] = {
-    [STATE_GROUND] = "ground",
-
-    [STATE_ESCAPE] = "escape",
-    [STATE_ESCAPE_INTERMEDIATE] = "escape intermediate",
-
-    [STATE_CSI_ENTRY] = "CSI entry",
-    [STATE_CSI_PARAM] = "CSI param",
-    [STATE_CSI_INTERMEDIATE] = "CSI intermediate",
-    [STATE_CSI_IGNORE] = "CSI ignore",
-
-    [STATE_OSC_STRING] = "OSC string",
-
-    [STATE_DCS_ENTRY] = "DCS entry",
-    [STATE_DCS_PARAM] = "DCS param",
-    [STATE_DCS_INTERMEDIATE] = "DCS intermediate",
-    [STATE_DCS_IGNORE] = "DCS ignore",
-    [STATE_DCS_PASSTHROUGH] = "DCS passthrough",
-
-    [STATE_SOS_PM_APC_STRING] = "sos/pm/apc string",
-
-    [STATE_UTF8_21] = "UTF8 2-byte 1/2",
-    [STATE_UTF8_31] = "UTF8 3-byte 1/3",
-    [STATE_UTF8_32] = "UTF8 3-byte 2/3",
-};
-#endif
-
 #if defined(LOG_ENABLE_DBG) && LOG_ENABLE_DBG
 static const char *
 esc_as_string(struct terminal *term, uint8_t final)
@@ -103,11 +55,6 @@ esc_as_string(struct terminal *term, uint8_t final)
 }
 #endif
 
-static void
-action_ignore(struct terminal *term)
-{
-}
-
 static void
 action_clear(struct terminal *term)
 {
@@ -201,7 +148,7 @@ action_execute(struct terminal *term, uint8_t c)
          * subsequent cells, all the way until the next tab stop.
          */
         if (emit_tab_char) {
-            row->dirty = true;
+            grid_row_dirty_range(row, start_col, max(start_col, new_col - 1));
 
             row->cells[start_col].wc = U'\t';
             row->cells[start_col].attrs.clean = 0;
@@ -294,69 +241,148 @@ action_print(struct terminal *term, uint8_t c)
 }
 
 static void
-action_param_lazy_init(struct terminal *term)
+action_print_run(struct terminal *term, const uint8_t *s, size_t len)
+{
+    term_reset_grapheme_state(term);
+    term->ascii_run_printer(term, s, len);
+}
+
+/*
+ * Returns the length of the parameter string of the SGR sequence at
+ * 'p' (i.e. the bytes following "CSI"), or SIZE_MAX if 'p' isn't a
+ * complete SGR sequence with digits and ';' only.
+ */
+static inline size_t
+sgr_params_length(const uint8_t *p, size_t len)
+{
+    /* Longer sequences are left to the regular parser */
+    const size_t max_len = min(len, 64);
+
+    for (size_t i = 0; i < max_len; i++) {
+        const uint8_t c = p[i];
+
+        if (c == 'm')
+            return i;
+        if (!((c >= '0' && c <= '9') || c == ';'))
+            return SIZE_MAX;
+    }
+
+    return SIZE_MAX;
+}
+
+/*
+ * Returns the number of consecutive printable ASCII characters
+ * (0x20-0x7e) at the beginning of 'p'
+ */
+static inline size_t
+printable_ascii_run_length(const uint8_t *p, size_t len)
+{
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i lower = _mm_set1_epi8(0x1f);
+    const __m128i upper = _mm_set1_epi8(0x7f);
+
+    for (; i + 16 <= len; i += 16) {
+        const __m128i chunk = _mm_loadu_si128((const __m128i *)&p[i]);
+
+        /* Signed compares; bytes >= 0x80 are negative, and thus < 0x1f */
+        const __m128i printable = _mm_and_si128(
+            _mm_cmpgt_epi8(chunk, lower), _mm_cmplt_epi8(chunk, upper));
+
+        const unsigned mask = ~_mm_movemask_epi8(printable) & 0xffff;
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const uint8x16_t lower = vdupq_n_u8(0x20);
+    const uint8x16_t upper = vdupq_n_u8(0x7f);
+
+    for (; i + 16 <= len; i += 16) {
+        const uint8x16_t chunk = vld1q_u8(&p[i]);
+        const uint8x16_t printable = vandq_u8(
+            vcgeq_u8(chunk, lower), vcltq_u8(chunk, upper));
+
+        /* Let the scalar loop below find the exact position */
+        if (vminvq_u8(printable) != 0xff)
+            break;
+    }
+#endif
+
+    for (; i < len; i++) {
+        if (p[i] < 0x20 || p[i] > 0x7e)
+            break;
+    }
+
+    return i;
+}
+
+/*
+ * The parameter and intermediate collecting actions operate on a
+ * struct vt_params, rather than on the terminal, since they are also
+ * used by the tweak.threaded-parser thread (see vt_tokenize()).
+ */
+static void
+action_param_lazy_init(struct vt_params *params)
 {
-    if (term->vt.params.idx == 0) {
-        struct vt_param *param = &term->vt.params.v[0];
+    if (params->idx == 0) {
+        struct vt_param *param = &params->v[0];
 
-        term->vt.params.cur = param;
+        params->cur = param;
         param->value = 0;
         param->sub.idx = 0;
         param->sub.cur = NULL;
-        term->vt.params.idx = 1;
+        params->idx = 1;
     }
 }
 
 static void
-action_param_new(struct terminal *term, uint8_t c)
+action_param_new(struct vt_params *params, uint8_t c)
 {
     xassert(c == ';');
-    action_param_lazy_init(term);
+    action_param_lazy_init(params);
 
-    const size_t max_params
-        = sizeof(term->vt.params.v) / sizeof(term->vt.params.v[0]);
+    const size_t max_params = sizeof(params->v) / sizeof(params->v[0]);
 
     struct vt_param *param;
 
-    if (unlikely(term->vt.params.idx >= max_params)) {
-        static bool have_warned = false;
-        if (!have_warned) {
-            have_warned = true;
+    if (unlikely(params->idx >= max_params)) {
+        static atomic_bool have_warned = false;
+        if (!atomic_exchange(&have_warned, true)) {
             LOG_WARN(
                 "unsupported: escape with more than %zu parameters "
                 "(will not warn again)",
-                sizeof(term->vt.params.v) / sizeof(term->vt.params.v[0]));
+                sizeof(params->v) / sizeof(params->v[0]));
         }
-        param = &term->vt.params.dummy;
+        param = &params->dummy;
     } else
-        param = &term->vt.params.v[term->vt.params.idx++];
+        param = &params->v[params->idx++];
 
-    term->vt.params.cur = param;
+    params->cur = param;
     param->value = 0;
     param->sub.idx = 0;
     param->sub.cur = NULL;
 }
 
 static void
-action_param_new_subparam(struct terminal *term, uint8_t c)
+action_param_new_subparam(struct vt_params *params, uint8_t c)
 {
     xassert(c == ':');
-    action_param_lazy_init(term);
+    action_param_lazy_init(params);
 
     const size_t max_sub_params
-        = sizeof(term->vt.params.v[0].sub.value) / sizeof(term->vt.params.v[0].sub.value[0]);
+        = sizeof(params->v[0].sub.value) / sizeof(params->v[0].sub.value[0]);
 
-    struct vt_param *param = term->vt.params.cur;
+    struct vt_param *param = params->cur;
     unsigned *sub_param_value;
 
     if (unlikely(param->sub.idx >= max_sub_params)) {
-        static bool have_warned = false;
-        if (!have_warned) {
-            have_warned = true;
+        static atomic_bool have_warned = false;
+        if (!atomic_exchange(&have_warned, true)) {
             LOG_WARN(
                 "unsupported: escape with more than %zu sub-parameters "
                 "(will not warn again)",
-                sizeof(term->vt.params.v[0].sub.value) / sizeof(term->vt.params.v[0].sub.value[0]));
+                sizeof(params->v[0].sub.value) / sizeof(params->v[0].sub.value[0]));
         }
 
         sub_param_value = &param->sub.dummy;
@@ -368,12 +394,12 @@ action_param_new_subparam(struct terminal *term, uint8_t c)
 }
 
 static void
-action_param(struct terminal *term, uint8_t c)
+action_param(struct vt_params *params, uint8_t c)
 {
-    action_param_lazy_init(term);
-    xassert(term->vt.params.cur != NULL);
+    action_param_lazy_init(params);
+    xassert(params->cur != NULL);
 
-    struct vt_param *param = term->vt.params.cur;
+    struct vt_param *param = params->cur;
     unsigned *value;
 
     if (unlikely(param->sub.cur != NULL))
@@ -388,7 +414,7 @@ action_param(struct terminal *term, uint8_t c)
 }
 
 static void
-action_collect(struct terminal *term, uint8_t c)
+action_collect(uint32_t *private, uint8_t c)
 {
     LOG_DBG("collect: %c", c);
 
@@ -401,39 +427,39 @@ action_collect(struct terminal *term, uint8_t c)
      * them (in action_clear()). Writing is ok if it’s a bit slow.
      */
 
-    if ((term->vt.private & 0xff) == 0)
-        term->vt.private = c;
-    else if (((term->vt.private >> 8) & 0xff) == 0)
-        term->vt.private |= c << 8;
-    else if (((term->vt.private >> 16) & 0xff) == 0)
-        term->vt.private |= c << 16;
-    else if (((term->vt.private >> 24) & 0xff) == 0)
-        term->vt.private |= c << 24;
+    if ((*private & 0xff) == 0)
+        *private = c;
+    else if (((*private >> 8) & 0xff) == 0)
+        *private |= c << 8;
+    else if (((*private >> 16) & 0xff) == 0)
+        *private |= c << 16;
+    else if (((*private >> 24) & 0xff) == 0)
+        *private |= c << 24;
     else
         LOG_WARN("only four private/intermediate characters supported");
 }
 
 UNITTEST
 {
-    struct terminal term = {.vt = {.private = 0}};
+    uint32_t private = 0;
     uint32_t expected = ' ';
-    action_collect(&term, ' ');
-    xassert(term.vt.private == expected);
+    action_collect(&private, ' ');
+    xassert(private == expected);
 
     expected |= '/' << 8;
-    action_collect(&term, '/');
-    xassert(term.vt.private == expected);
+    action_collect(&private, '/');
+    xassert(private == expected);
 
     expected |= '<' << 16;
-    action_collect(&term, '<');
-    xassert(term.vt.private == expected);
+    action_collect(&private, '<');
+    xassert(private == expected);
 
     expected |= '?' << 24;
-    action_collect(&term, '?');
-    xassert(term.vt.private == expected);
+    action_collect(&private, '?');
+    xassert(private == expected);
 
-    action_collect(&term, '?');
-    xassert(term.vt.private == expected);
+    action_collect(&private, '?');
+    xassert(private == expected);
 }
 
 static void
@@ -567,7 +593,7 @@ action_esc_dispatch(struct terminal *term, uint8_t final)
                     row->cells[c].wc = U'E';
                     row->cells[c].attrs = (struct attributes){0};
                 }
-                row->dirty = true;
+                grid_row_dirty_all(row);
             }
             break;
         }
@@ -615,6 +641,15 @@ action_osc_put(struct terminal *term, uint8_t c)
     term->vt.osc.data[term->vt.osc.idx++] = c;
 }
 
+static void
+action_osc_put_run(struct terminal *term, const uint8_t *s, size_t len)
+{
+    if (!osc_ensure_size(term, term->vt.osc.idx + len))
+        return;
+    memcpy(&term->vt.osc.data[term->vt.osc.idx], s, len);
+    term->vt.osc.idx += len;
+}
+
 static void
 action_hook(struct terminal *term, uint8_t c)
 {
@@ -633,6 +668,12 @@ action_put(struct terminal *term, uint8_t c)
     dcs_put(term, c);
 }
 
+static void
+action_put_run(struct terminal *term, const uint8_t *s, size_t len)
+{
+    dcs_put_many(term, s, len);
+}
+
 static inline uint32_t
 chain_key(uint32_t old_key, uint32_t new_wc)
 {
@@ -654,9 +695,8 @@ chain_key(uint32_t old_key, uint32_t new_wc)
 }
 
 static void
-action_utf8_print(struct terminal *term, char32_t wc)
+utf8_print(struct terminal *term, char32_t wc, int width)
 {
-    int width = c32width(wc);
     const bool grapheme_clustering = term->grapheme_shaping;
 
 #if !defined(FOOT_GRAPHEME_CLUSTERING)
@@ -879,6 +919,12 @@ out:
         term_print(term, wc, width);
 }
 
+static void
+action_utf8_print(struct terminal *term, char32_t wc)
+{
+    utf8_print(term, wc, c32width(wc));
+}
+
 static void
 action_utf8_21(struct terminal *term, uint8_t c)
 {
@@ -966,395 +1012,949 @@ action_utf8_44(struct terminal *term, uint8_t c)
     action_utf8_print(term, term->vt.utf8);
 }
 
-IGNORE_WARNING("-Wpedantic")
+static inline void
+dispatch_action(struct terminal *term, enum action action, uint8_t c)
+{
+    switch (action) {
+    case ACTION_NONE:                                                  break;
+    case ACTION_EXECUTE:            action_execute(term, c);           break;
+    case ACTION_CLEAR:              action_clear(term);                break;
+    case ACTION_PRINT:              action_print(term, c);             break;
+    case ACTION_COLLECT:            action_collect(&term->vt.private, c); break;
+    case ACTION_PARAM:              action_param(&term->vt.params, c); break;
+    case ACTION_PARAM_NEW:          action_param_new(&term->vt.params, c); break;
+    case ACTION_PARAM_NEW_SUBPARAM: action_param_new_subparam(&term->vt.params, c); break;
+    case ACTION_ESC_DISPATCH:       action_esc_dispatch(term, c);      break;
+    case ACTION_CSI_DISPATCH:       action_csi_dispatch(term, c);      break;
+
+    case ACTION_OSC_START:          action_osc_start(term, c);         break;
+    case ACTION_OSC_PUT:            action_osc_put(term, c);           break;
+    case ACTION_OSC_END:            action_osc_end(term, c);           break;
+    case ACTION_OSC_END_EXECUTE:    action_osc_end(term, c); action_execute(term, c); break;
+    case ACTION_OSC_END_CLEAR:      action_osc_end(term, c); action_clear(term); break;
+
+    case ACTION_HOOK:               action_hook(term, c);              break;
+    case ACTION_PUT:                action_put(term, c);               break;
+    case ACTION_UNHOOK:             action_unhook(term, c);            break;
+    case ACTION_UNHOOK_EXECUTE:     action_unhook(term, c); action_execute(term, c); break;
+    case ACTION_UNHOOK_CLEAR:       action_unhook(term, c); action_clear(term); break;
+
+    case ACTION_UTF8_21:            action_utf8_21(term, c);           break;
+    case ACTION_UTF8_22:            action_utf8_22(term, c);           break;
+    case ACTION_UTF8_31:            action_utf8_31(term, c);           break;
+    case ACTION_UTF8_32:            action_utf8_32(term, c);           break;
+    case ACTION_UTF8_33:            action_utf8_33(term, c);           break;
+    case ACTION_UTF8_41:            action_utf8_41(term, c);           break;
+    case ACTION_UTF8_42:            action_utf8_42(term, c);           break;
+    case ACTION_UTF8_43:            action_utf8_43(term, c);           break;
+    case ACTION_UTF8_44:            action_utf8_44(term, c);           break;
+    }
+}
 
-static enum state
-anywhere(struct terminal *term, uint8_t data)
+/*
+ * Returns the length of the longest prefix of 'p' (rounded down to a
+ * multiple of 16 bytes) that is structurally valid UTF-8, made up of
+ * multibyte sequences only. Note that the last sequence may extend
+ * past the returned length.
+ *
+ * "Structurally valid" means all continuation bytes are where the
+ * lead bytes say they should be, and that there are no ASCII, or
+ * invalid (C0, C1, F5-FF), lead bytes.
+ */
+static size_t
+utf8_validated_length(const uint8_t *p, size_t len)
 {
-    switch (data) {
-        /*              exit                             current                          enter                            new state */
-    case 0x18:                                           action_execute(term, data);                                       return STATE_GROUND;
-    case 0x1a:                                           action_execute(term, data);                                       return STATE_GROUND;
-    case 0x1b:                                                                            action_clear(term);              return STATE_ESCAPE;
-
-    /* 8-bit C1 control characters (not supported) */
-    case 0x80 ... 0x9f:                                                                                                    return STATE_GROUND;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    /* Unsigned greater-than-or-equal */
+#define ge(v, k) _mm_cmpeq_epi8(_mm_max_epu8((v), _mm_set1_epi8((char)(k))), (v))
+
+    __m128i prev = _mm_setzero_si128();
+
+    for (; i + 16 <= len; i += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i *)&p[i]);
+
+        /* The previous 1, 2 and 3 bytes, for each byte in 'x' */
+        const __m128i prev1 = _mm_or_si128(_mm_slli_si128(x, 1), _mm_srli_si128(prev, 15));
+        const __m128i prev2 = _mm_or_si128(_mm_slli_si128(x, 2), _mm_srli_si128(prev, 14));
+        const __m128i prev3 = _mm_or_si128(_mm_slli_si128(x, 3), _mm_srli_si128(prev, 13));
+
+        const __m128i is_cont = _mm_cmpeq_epi8(
+            _mm_and_si128(x, _mm_set1_epi8((char)0xc0)), _mm_set1_epi8((char)0x80));
+        const __m128i want_cont = _mm_or_si128(
+            ge(prev1, 0xc0), _mm_or_si128(ge(prev2, 0xe0), ge(prev3, 0xf0)));
+
+        const __m128i ascii = _mm_cmpgt_epi8(x, _mm_set1_epi8(-1));
+        const __m128i c0_c1 = _mm_cmpeq_epi8(
+            _mm_and_si128(x, _mm_set1_epi8((char)0xfe)), _mm_set1_epi8((char)0xc0));
+        const __m128i f5_ff = ge(x, 0xf5);
+
+        const __m128i error = _mm_or_si128(
+            _mm_xor_si128(is_cont, want_cont),
+            _mm_or_si128(ascii, _mm_or_si128(c0_c1, f5_ff)));
+
+        if (_mm_movemask_epi8(error) != 0)
+            break;
+
+        prev = x;
+    }
+#undef ge
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    uint8x16_t prev = vdupq_n_u8(0);
+
+    for (; i + 16 <= len; i += 16) {
+        const uint8x16_t x = vld1q_u8(&p[i]);
+
+        /* The previous 1, 2 and 3 bytes, for each byte in 'x' */
+        const uint8x16_t prev1 = vextq_u8(prev, x, 15);
+        const uint8x16_t prev2 = vextq_u8(prev, x, 14);
+        const uint8x16_t prev3 = vextq_u8(prev, x, 13);
+
+        const uint8x16_t is_cont = vceqq_u8(
+            vandq_u8(x, vdupq_n_u8(0xc0)), vdupq_n_u8(0x80));
+        const uint8x16_t want_cont = vorrq_u8(
+            vcgeq_u8(prev1, vdupq_n_u8(0xc0)),
+            vorrq_u8(vcgeq_u8(prev2, vdupq_n_u8(0xe0)),
+                     vcgeq_u8(prev3, vdupq_n_u8(0xf0))));
+
+        const uint8x16_t ascii = vcltq_u8(x, vdupq_n_u8(0x80));
+        const uint8x16_t c0_c1 = vceqq_u8(
+            vandq_u8(x, vdupq_n_u8(0xfe)), vdupq_n_u8(0xc0));
+        const uint8x16_t f5_ff = vcgeq_u8(x, vdupq_n_u8(0xf5));
+
+        const uint8x16_t error = vorrq_u8(
+            veorq_u8(is_cont, want_cont),
+            vorrq_u8(ascii, vorrq_u8(c0_c1, f5_ff)));
+
+        if (vmaxvq_u8(error) != 0)
+            break;
+
+        prev = x;
     }
+#endif
+
+    return i;
+}
 
-    return term->vt.state;
+static inline bool
+utf8_is_cont(uint8_t c)
+{
+    return c >= 0x80 && c <= 0xbf;
 }
 
-static enum state
-state_ground_switch(struct terminal *term, uint8_t data)
+/*
+ * Decodes a single multibyte sequence, without any validation. Used
+ * on input already validated by utf8_validated_length().
+ */
+static inline size_t
+utf8_decode_unchecked(const uint8_t *p, char32_t *wc)
 {
-    switch (data) {
-        /*              exit                             current                          enter                            new state */
-    case 0x00 ... 0x17:
-    case 0x19:
-    case 0x1c ... 0x1f:                                  action_execute(term, data);                                       return STATE_GROUND;
-
-    /* modified from 0x20..0x7f to 0x20..0x7e, since 0x7f is DEL, which is a zero-width character */
-    case 0x20 ... 0x7e:                                  action_print(term, data);                                         return STATE_GROUND;
-
-    case 0xc2 ... 0xdf:                                  action_utf8_21(term, data);                                       return STATE_UTF8_21;
-    case 0xe0 ... 0xef:                                  action_utf8_31(term, data);                                       return STATE_UTF8_31;
-    case 0xf0 ... 0xf4:                                  action_utf8_41(term, data);                                       return STATE_UTF8_41;
+    const uint8_t c0 = p[0];
+
+    if (c0 < 0xe0) {
+        *wc = ((c0 & 0x1f) << 6) | (p[1] & 0x3f);
+        return 2;
     }
 
-    return anywhere(term, data);
+    if (c0 < 0xf0) {
+        *wc = ((c0 & 0x0f) << 12) | ((p[1] & 0x3f) << 6) | (p[2] & 0x3f);
+        return 3;
+    }
+
+    *wc = ((c0 & 0x07) << 18) | ((p[1] & 0x3f) << 12) |
+          ((p[2] & 0x3f) << 6) | (p[3] & 0x3f);
+    return 4;
 }
 
-static enum state
-state_escape_switch(struct terminal *term, uint8_t data)
+/*
+ * Decodes a single multibyte sequence. Returns the number of bytes
+ * consumed, or 0 if the sequence is incomplete, or invalid.
+ */
+static inline size_t
+utf8_decode(const uint8_t *p, size_t len, char32_t *wc)
 {
-    switch (data) {
-        /*              exit                             current                          enter                            new state */
-    case 0x00 ... 0x17:
-    case 0x19:
-    case 0x1c ... 0x1f:                                  action_execute(term, data);                                       return STATE_ESCAPE;
-
-    case 0x20 ... 0x2f:                                  action_collect(term, data);                                       return STATE_ESCAPE_INTERMEDIATE;
-    case 0x30 ... 0x4f:                                  action_esc_dispatch(term, data);                                  return STATE_GROUND;
-    case 0x50:                                                                            action_clear(term);              return STATE_DCS_ENTRY;
-    case 0x51 ... 0x57:                                  action_esc_dispatch(term, data);                                  return STATE_GROUND;
-    case 0x58:                                                                                                             return STATE_SOS_PM_APC_STRING;
-    case 0x59:                                           action_esc_dispatch(term, data);                                  return STATE_GROUND;
-    case 0x5a:                                           action_esc_dispatch(term, data);                                  return STATE_GROUND;
-    case 0x5b:                                                                            action_clear(term);              return STATE_CSI_ENTRY;
-    case 0x5c:                                           action_esc_dispatch(term, data);                                  return STATE_GROUND;
-    case 0x5d:                                                                            action_osc_start(term, data);    return STATE_OSC_STRING;
-    case 0x5e ... 0x5f:                                                                                                    return STATE_SOS_PM_APC_STRING;
-    case 0x60 ... 0x7e:                                  action_esc_dispatch(term, data);                                  return STATE_GROUND;
-    case 0x7f:                                           action_ignore(term);                                              return STATE_ESCAPE;
+    const uint8_t c0 = p[0];
+
+    if (c0 >= 0xc2 && c0 <= 0xdf) {
+        if (len < 2 || !utf8_is_cont(p[1]))
+            return 0;
+    }
+
+    else if (c0 >= 0xe0 && c0 <= 0xef) {
+        if (len < 3 || !utf8_is_cont(p[1]) || !utf8_is_cont(p[2]))
+            return 0;
+    }
+
+    else if (c0 >= 0xf0 && c0 <= 0xf4) {
+        if (len < 4 || !utf8_is_cont(p[1]) || !utf8_is_cont(p[2]) ||
+            !utf8_is_cont(p[3]))
+            return 0;
     }
 
-    return anywhere(term, data);
+    else
+        return 0;
+
+    return utf8_decode_unchecked(p, wc);
 }
 
-static enum state
-state_escape_intermediate_switch(struct terminal *term, uint8_t data)
+/*
+ * Decodes up to 'max' code points from a run of well-formed multibyte
+ * UTF-8 sequences, 'validated' bytes of which have already been
+ * validated by utf8_validated_length().
+ *
+ * Returns the number of bytes consumed. Sets 'done' when the run
+ * ends; i.e. at an incomplete (at the end of the buffer), or
+ * malformed, sequence.
+ */
+static size_t
+utf8_decode_run(const uint8_t *p, size_t len, size_t validated,
+                char32_t *wcs, size_t max, size_t *count, bool *done)
 {
-    switch (data) {
-        /*              exit                             current                          enter                            new state */
-    case 0x00 ... 0x17:
-    case 0x19:
-    case 0x1c ... 0x1f:                                  action_execute(term, data);                                       return STATE_ESCAPE_INTERMEDIATE;
-
-    case 0x20 ... 0x2f:                                  action_collect(term, data);                                       return STATE_ESCAPE_INTERMEDIATE;
-    case 0x30 ... 0x7e:                                  action_esc_dispatch(term, data);                                  return STATE_GROUND;
-    case 0x7f:                                           action_ignore(term);                                              return STATE_ESCAPE_INTERMEDIATE;
+    size_t i = 0;
+    *count = 0;
+
+    while (*count < max) {
+        char32_t wc;
+        size_t seq_len;
+
+        if (likely(i + 4 <= validated))
+            seq_len = utf8_decode_unchecked(&p[i], &wc);
+        else if (i >= len ||
+                 (seq_len = utf8_decode(&p[i], len - i, &wc)) == 0)
+        {
+            *done = true;
+            break;
+        }
+
+        i += seq_len;
+
+        /* Surrogate halves, and anything above U+10FFFF, are
+         * consumed, but not printed */
+        if (unlikely((wc >= 0xd800 && wc <= 0xdfff) || wc > 0x10ffff))
+            continue;
+
+        wcs[(*count)++] = wc;
     }
 
-    return anywhere(term, data);
+    return i;
 }
 
-static enum state
-state_csi_entry_switch(struct terminal *term, uint8_t data)
+static void
+utf8_print_wcs(struct terminal *term, const char32_t *wcs,
+               const int8_t *widths, size_t count)
 {
-    switch (data) {
-        /*              exit                             current                          enter                            new state */
-    case 0x00 ... 0x17:
-    case 0x19:
-    case 0x1c ... 0x1f:                                  action_execute(term, data);                                       return STATE_CSI_ENTRY;
-
-    case 0x20 ... 0x2f:                                  action_collect(term, data);                                       return STATE_CSI_INTERMEDIATE;
-    case 0x30 ... 0x39:                                  action_param(term, data);                                         return STATE_CSI_PARAM;
-    case 0x3a:                                           action_param_new_subparam(term, data);                            return STATE_CSI_PARAM;
-    case 0x3b:                                           action_param_new(term, data);                                     return STATE_CSI_PARAM;
-
-    case 0x3c ... 0x3f:                                  action_collect(term, data);                                       return STATE_CSI_PARAM;
-    case 0x40 ... 0x7e:                                  action_csi_dispatch(term, data);                                  return STATE_GROUND;
-    case 0x7f:                                           action_ignore(term);                                              return STATE_CSI_ENTRY;
+    for (size_t i = 0; i < count; i++) {
+        const char32_t wc = wcs[i];
+        const int width = widths[i];
+
+        if (likely(!term->grapheme_shaping && (width != 0 || wc < 0x300))) {
+            /* Not a combining character; same as utf8_print() */
+            term_reset_grapheme_state(term);
+            if (likely(width > 0))
+                term_print(term, wc, width);
+        } else
+            utf8_print(term, wc, width);
     }
-
-    return anywhere(term, data);
 }
 
-static enum state
-state_csi_param_switch(struct terminal *term, uint8_t data)
+/*
+ * Decodes, and prints, a run of well-formed multibyte UTF-8
+ * sequences. This is equivalent to walking the UTF8_* states in the
+ * transition table, one byte at a time, but decodes (and calculates
+ * the width of) code points in batches.
+ *
+ * Returns the number of bytes consumed. Incomplete (at the end of
+ * the buffer), and malformed sequences are left to the state
+ * machine.
+ */
+static size_t
+utf8_print_run(struct terminal *term, const uint8_t *p, size_t len)
 {
-    switch (data) {
-        /*              exit                             current                          enter                            new state */
-    case 0x00 ... 0x17:
-    case 0x19:
-    case 0x1c ... 0x1f:                                  action_execute(term, data);                                       return STATE_CSI_PARAM;
+    const size_t validated = utf8_validated_length(p, len);
+
+    char32_t wcs[128];
+    int8_t widths[128];
+    size_t i = 0;
+    bool done = false;
 
-    case 0x20 ... 0x2f:                                  action_collect(term, data);                                       return STATE_CSI_INTERMEDIATE;
+    while (!done) {
+        size_t count;
+        i += utf8_decode_run(
+            &p[i], len - i, validated > i ? validated - i : 0,
+            wcs, ALEN(wcs), &count, &done);
 
-    case 0x30 ... 0x39:                                  action_param(term, data);                                         return STATE_CSI_PARAM;
-    case 0x3a:                                           action_param_new_subparam(term, data);                            return STATE_CSI_PARAM;
-    case 0x3b:                                           action_param_new(term, data);                                     return STATE_CSI_PARAM;
+        for (size_t j = 0; j < count; j++)
+            widths[j] = c32width(wcs[j]);
 
-    case 0x3c ... 0x3f:                                                                                                    return STATE_CSI_IGNORE;
-    case 0x40 ... 0x7e:                                  action_csi_dispatch(term, data);                                  return STATE_GROUND;
-    case 0x7f:                                           action_ignore(term);                                              return STATE_CSI_PARAM;
+        utf8_print_wcs(term, wcs, widths, count);
     }
 
-    return anywhere(term, data);
+    return i;
 }
 
-static enum state
-state_csi_intermediate_switch(struct terminal *term, uint8_t data)
+/*
+ * Returns the number of consecutive bytes, starting at 'p', that
+ * have the same transition as the first one.
+ */
+static inline size_t
+transition_run_length(const struct transition *row, const uint8_t *p,
+                      size_t len)
 {
-    switch (data) {
-        /*              exit                             current                          enter                            new state */
-    case 0x00 ... 0x17:
-    case 0x19:
-    case 0x1c ... 0x1f:                                  action_execute(term, data);                                       return STATE_CSI_INTERMEDIATE;
-
-    case 0x20 ... 0x2f:                                  action_collect(term, data);                                       return STATE_CSI_INTERMEDIATE;
-    case 0x30 ... 0x3f:                                                                                                    return STATE_CSI_IGNORE;
-    case 0x40 ... 0x7e:                                  action_csi_dispatch(term, data);                                  return STATE_GROUND;
-    case 0x7f:                                           action_ignore(term);                                              return STATE_CSI_INTERMEDIATE;
-    }
+    const struct transition t = row[p[0]];
+    size_t i = 1;
+
+    while (i < len && row[p[i]].action == t.action && row[p[i]].state == t.state)
+        i++;
 
-    return anywhere(term, data);
+    return i;
 }
 
-static enum state
-state_csi_ignore_switch(struct terminal *term, uint8_t data)
+UNITTEST
 {
-    switch (data) {
-        /*              exit                             current                          enter                            new state */
-    case 0x00 ... 0x17:
-    case 0x19:
-    case 0x1c ... 0x1f:                                  action_execute(term, data);                                       return STATE_CSI_IGNORE;
-
-    case 0x20 ... 0x3f:                                  action_ignore(term);                                              return STATE_CSI_IGNORE;
-    case 0x40 ... 0x7e:                                                                                                    return STATE_GROUND;
-    case 0x7f:                                           action_ignore(term);                                              return STATE_CSI_IGNORE;
-    }
-
-    return anywhere(term, data);
+    /* DEL is ignored, rather than put */
+    const uint8_t dcs[] = "#0;2;0;0;0!10~\x7f-";
+    xassert(transition_run_length(
+        transitions[STATE_DCS_PASSTHROUGH], dcs, sizeof(dcs) - 1) == 14);
+
+    /* OSC payloads include UTF-8, and are terminated by BEL */
+    const uint8_t osc[] = "0;f\xc3\xb6\xc3\xb6\x07";
+    xassert(transition_run_length(
+        transitions[STATE_OSC_STRING], osc, sizeof(osc) - 1) == 7);
 }
 
-static enum state
-state_osc_string_switch(struct terminal *term, uint8_t data)
+void
+vt_from_slave(struct terminal *term, const uint8_t *data, size_t len)
 {
-    switch (data) {
-        /*              exit                             current                          enter                            new state */
+    /*
+     * The state machine is table driven; see
+     * scripts/generate-vt-tables.py. Each byte is a single lookup in
+     * the (generated) transition table, which gives us the action to
+     * execute, and the new state.
+     *
+     * The most common sequences (printable ASCII, well-formed UTF-8
+     * and CSI introducers) are short-circuited while in the ground
+     * state.
+     */
+    enum state current_state = term->vt.state;
 
-    /* Note: original was 20-7f, but I changed to 20-ff to include utf-8. Don't forget to add EXECUTE to 8-bit C1 if we implement that. */
-    default:                                             action_osc_put(term, data);                                       return STATE_OSC_STRING;
+    const uint8_t *p = data;
+    const uint8_t *const end = data + len;
 
-    case 0x07:          action_osc_end(term, data);                                                                        return STATE_GROUND;
+    while (p < end) {
+        if (current_state == STATE_GROUND) {
+            if (likely(*p >= 0x20 && *p <= 0x7e)) {
+                /*
+                 * Fast path: print all consecutive printable ASCII
+                 * characters in one go. Note that this does not
+                 * change the parser state.
+                 */
+                const size_t count = printable_ascii_run_length(p, end - p);
+                xassert(count > 0);
 
-    case 0x00 ... 0x06:
-    case 0x08 ... 0x17:
-    case 0x19:
-    case 0x1c ... 0x1f:                                  action_ignore(term);                                              return STATE_OSC_STRING;
+                action_print_run(term, p, count);
+                p += count;
+                continue;
+            }
 
+            if (*p == '\x1b' && p + 1 < end && p[1] == '[') {
+                /*
+                 * SGR: if the entire sequence is in the buffer, try
+                 * the specialized (and cached) SGR handler, bypassing
+                 * the parameter collection and CSI dispatch.
+                 */
+                const size_t count = sgr_params_length(p + 2, end - p - 2);
+                if (count != SIZE_MAX && csi_sgr_fast(term, p + 2, count)) {
+                    p += 2 + count + 1;
+                    continue;
+                }
 
-    case 0x18:
-    case 0x1a:          action_osc_end(term, data);      action_execute(term, data);                                       return STATE_GROUND;
+                /* CSI: ESC and '[' both clear, so do it once */
+                action_clear(term);
+                current_state = STATE_CSI_ENTRY;
+                p += 2;
+                continue;
+            }
 
-    case 0x1b:          action_osc_end(term, data);      action_clear(term);                                               return STATE_ESCAPE;
-    }
-}
+            if (*p >= 0x80) {
+                const size_t count = utf8_print_run(term, p, end - p);
+                if (count > 0) {
+                    p += count;
+                    continue;
+                }
+            }
+        }
 
-static enum state
-state_dcs_entry_switch(struct terminal *term, uint8_t data)
-{
-    switch (data) {
-        /*              exit                             current                          enter                            new state */
-    case 0x00 ... 0x17:
-    case 0x19:
-    case 0x1c ... 0x1f:                                  action_ignore(term);                                              return STATE_DCS_ENTRY;
-
-    case 0x20 ... 0x2f:                                  action_collect(term, data);                                       return STATE_DCS_INTERMEDIATE;
-    case 0x30 ... 0x39:                                  action_param(term, data);                                         return STATE_DCS_PARAM;
-    case 0x3a:                                                                                                             return STATE_DCS_IGNORE;
-    case 0x3b:                                           action_param_new(term, data);                                     return STATE_DCS_PARAM;
-    case 0x3c ... 0x3f:                                  action_collect(term, data);                                       return STATE_DCS_PARAM;
-    case 0x40 ... 0x7e:                                                                   action_hook(term, data);         return STATE_DCS_PASSTHROUGH;
-    case 0x7f:                                           action_ignore(term);                                              return STATE_DCS_ENTRY;
+        /*
+         * Loop for as long as the state doesn't change. This keeps
+         * the current state in a register, rather than having each
+         * lookup depend on the result of the previous one (e.g. CSI
+         * parameters, OSC and DCS strings).
+         */
+        const struct transition *const row = transitions[current_state];
+        struct transition t;
+
+        do {
+            t = row[*p];
+
+            /* By far the most common action; avoid the jump table */
+            if (t.action == ACTION_PARAM)
+                action_param(&term->vt.params, *p);
+
+            else if ((t.action == ACTION_PUT || t.action == ACTION_OSC_PUT) &&
+                     t.state == current_state)
+            {
+                /*
+                 * DCS (e.g. sixel) and OSC payloads: hand the entire
+                 * run of payload bytes over in one go.
+                 */
+                const size_t count = transition_run_length(row, p, end - p);
+
+                if (t.action == ACTION_PUT)
+                    action_put_run(term, p, count);
+                else
+                    action_osc_put_run(term, p, count);
+
+                p += count;
+                continue;
+            }
+
+            else if (t.action != ACTION_NONE)
+                dispatch_action(term, t.action, *p);
+
+            p++;
+        } while (t.state == current_state &&
+                 current_state != STATE_GROUND &&
+                 p < end);
+
+        current_state = t.state;
     }
 
-    return anywhere(term, data);
+    term->vt.state = current_state;
 }
 
-static enum state
-state_dcs_param_switch(struct terminal *term, uint8_t data)
-{
-    switch (data) {
-        /*              exit                             current                          enter                            new state */
-    case 0x00 ... 0x17:
-    case 0x19:
-    case 0x1c ... 0x1f:                                  action_ignore(term);                                              return STATE_DCS_PARAM;
-
-    case 0x20 ... 0x2f:                                  action_collect(term, data);                                       return STATE_DCS_INTERMEDIATE;
-    case 0x30 ... 0x39:                                  action_param(term, data);                                         return STATE_DCS_PARAM;
-    case 0x3a:                                                                                                             return STATE_DCS_IGNORE;
-    case 0x3b:                                           action_param_new(term, data);                                     return STATE_DCS_PARAM;
-    case 0x3c ... 0x3f:                                                                                                    return STATE_DCS_IGNORE;
-    case 0x40 ... 0x7e:                                                                   action_hook(term, data);         return STATE_DCS_PASSTHROUGH;
-    case 0x7f:                                           action_ignore(term);                                              return STATE_DCS_PARAM;
-    }
+/*
+ * tweak.threaded-parser
+ *
+ * The parser thread runs the state machine (vt_tokenize()), and
+ * records the resulting actions as tokens. Parameters, intermediates,
+ * and decoded code points are all resolved by the thread. The main
+ * thread then executes the tokens (vt_from_tokens()); this is the
+ * only part that touches the terminal.
+ */
+
+enum token_type {
+    TOKEN_PRINT,         /* Payload: printable ASCII */
+    TOKEN_UTF8,          /* Payload: code points, followed by their widths */
+    TOKEN_EXECUTE,
+    TOKEN_ESC_DISPATCH,
+    TOKEN_CSI_DISPATCH,  /* Payload: parameters */
+    TOKEN_SGR,           /* Payload: SGR parameter string */
+    TOKEN_OSC_START,
+    TOKEN_OSC_PUT,       /* Payload: OSC string */
+    TOKEN_OSC_END,
+    TOKEN_HOOK,          /* Payload: parameters */
+    TOKEN_PUT,           /* Payload: DCS string */
+    TOKEN_UNHOOK,
+};
+
+struct token {
+    uint8_t type;      /* enum token_type */
+    uint8_t c;         /* Final, or executed, character */
+    uint16_t count;    /* Number of parameters, or code points */
+    uint32_t private;
+    uint32_t len;      /* Size of the payload, following the token */
+};
 
-    return anywhere(term, data);
+/*
+ * Tokenizing stops when there's less than this much room left; this
+ * fits the largest possible parameter list. Payload runs (strings,
+ * and code points) are cut to fit.
+ */
+#define TOKEN_MAX_SIZE 2048
+
+static_assert(
+    sizeof(struct token) +
+    ALEN(((struct vt_params *)0)->v) *
+    (2 + ALEN(((struct vt_param *)0)->sub.value)) * sizeof(unsigned)
+    <= TOKEN_MAX_SIZE,
+    "TOKEN_MAX_SIZE too small");
+
+static inline size_t
+token_room(const struct vt_tokens *out)
+{
+    return out->size - out->len;
 }
 
-static enum state
-state_dcs_intermediate_switch(struct terminal *term, uint8_t data)
+/* Maximum payload size of the next token */
+static inline size_t
+token_payload_room(const struct vt_tokens *out)
 {
-    switch (data) {
-        /*              exit                             current                          enter                            new state */
-    case 0x00 ... 0x17:
-    case 0x19:
-    case 0x1c ... 0x1f:                                  action_ignore(term);                                              return STATE_DCS_INTERMEDIATE;
-
-    case 0x20 ... 0x2f:                                  action_collect(term, data);                                       return STATE_DCS_INTERMEDIATE;
-    case 0x30 ... 0x3f:                                                                                                    return STATE_DCS_IGNORE;
-    case 0x40 ... 0x7e:                                                                   action_hook(term, data);         return STATE_DCS_PASSTHROUGH;
-    case 0x7f:                                           action_ignore(term);                                              return STATE_DCS_INTERMEDIATE;
-    }
+    return token_room(out) - sizeof(struct token);
+}
 
-    return anywhere(term, data);
+static void *
+token_push(struct vt_tokens *out, enum token_type type, uint8_t c,
+           uint32_t private, size_t count, size_t len)
+{
+    /* Keep tokens, and payloads, 4-byte aligned */
+    const size_t size = sizeof(struct token) + ((len + 3) & ~(size_t)3);
+    xassert(size <= token_room(out));
+
+    struct token *tok = (struct token *)&out->data[out->len];
+    *tok = (struct token){
+        .type = type,
+        .c = c,
+        .count = count,
+        .private = private,
+        .len = len,
+    };
+
+    out->len += size;
+    return tok + 1;
 }
 
-static enum state
-state_dcs_ignore_switch(struct terminal *term, uint8_t data)
+static void
+token_push_bytes(struct vt_tokens *out, enum token_type type,
+                 const uint8_t *s, size_t len)
 {
-    switch (data) {
-        /*              exit                             current                          enter                            new state */
-    case 0x00 ... 0x17:
-    case 0x19:
-    case 0x1c ... 0x1f:
-    case 0x20 ... 0x7f:                                  action_ignore(term);                                              return STATE_DCS_IGNORE;
-    }
+    memcpy(token_push(out, type, 0, 0, 0, len), s, len);
+}
 
-    return anywhere(term, data);
+static void
+token_push_wcs(struct vt_tokens *out, const char32_t *wcs, size_t count)
+{
+    char32_t *payload = token_push(
+        out, TOKEN_UTF8, 0, 0, count,
+        count * (sizeof(wcs[0]) + sizeof(int8_t)));
+    int8_t *widths = (int8_t *)&payload[count];
+
+    memcpy(payload, wcs, count * sizeof(wcs[0]));
+    for (size_t i = 0; i < count; i++)
+        widths[i] = c32width(wcs[i]);
 }
 
-static enum state
-state_dcs_passthrough_switch(struct terminal *term, uint8_t data)
+static void
+token_push_params(struct vt_tokens *out, enum token_type type, uint8_t c,
+                  const struct vt_tokenizer *tok)
 {
-    switch (data) {
-        /*              exit                             current                          enter                            new state */
-    case 0x00 ... 0x17:
-    case 0x19:
-    case 0x1c ... 0x7e:                                  action_put(term, data);                                           return STATE_DCS_PASSTHROUGH;
+    const struct vt_params *params = &tok->params;
 
-    case 0x7f:                                           action_ignore(term);                                              return STATE_DCS_PASSTHROUGH;
+    size_t len = 0;
+    for (size_t i = 0; i < params->idx; i++)
+        len += (2 + params->v[i].sub.idx) * sizeof(unsigned);
 
-    /* Anywhere */
-    case 0x18:          action_unhook(term, data);       action_execute(term, data);                                       return STATE_GROUND;
-    case 0x1a:          action_unhook(term, data);       action_execute(term, data);                                       return STATE_GROUND;
-    case 0x1b:          action_unhook(term, data);                                        action_clear(term);              return STATE_ESCAPE;
+    unsigned *v = token_push(out, type, c, tok->private, params->idx, len);
 
-    /* 8-bit C1 control characters (not supported) */
-    case 0x80 ... 0x9f: action_unhook(term, data);                                                                         return STATE_GROUND;
+    for (size_t i = 0; i < params->idx; i++) {
+        const struct vt_param *param = &params->v[i];
 
-    default:                                                                                                               return STATE_DCS_PASSTHROUGH;
+        *v++ = param->value;
+        *v++ = param->sub.idx;
+        memcpy(v, param->sub.value, param->sub.idx * sizeof(unsigned));
+        v += param->sub.idx;
     }
 }
 
-static enum state
-state_sos_pm_apc_string_switch(struct terminal *term, uint8_t data)
+static void
+token_utf8_print(struct vt_tokens *out, char32_t wc)
 {
-    switch (data) {
-        /*              exit                             current                          enter                            new state */
-    case 0x00 ... 0x17:
-    case 0x19:
-    case 0x1c ... 0x7f:                                  action_ignore(term);                                              return STATE_SOS_PM_APC_STRING;
-    }
-
-    return anywhere(term, data);
+    token_push_wcs(out, &wc, 1);
 }
 
-static enum state
-state_utf8_21_switch(struct terminal *term, uint8_t data)
+static size_t
+tokenize_utf8_run(struct vt_tokens *out, const uint8_t *p, size_t len)
 {
-    switch (data) {
-        /*              exit                             current                          enter                            new state */
-    case 0x80 ... 0xbf:                                  action_utf8_22(term, data);                                       return STATE_GROUND;
-    default:                                                                                                               return STATE_GROUND;
+    const size_t validated = utf8_validated_length(p, len);
+    const size_t max_count =
+        token_payload_room(out) / (sizeof(char32_t) + sizeof(int8_t));
+
+    char32_t wcs[128];
+    size_t i = 0;
+    size_t total = 0;
+    bool done = false;
+
+    while (!done && total < max_count) {
+        size_t count;
+        i += utf8_decode_run(
+            &p[i], len - i, validated > i ? validated - i : 0,
+            wcs, min(ALEN(wcs), max_count - total), &count, &done);
+
+        if (count > 0) {
+            token_push_wcs(out, wcs, count);
+            total += count;
+        }
     }
+
+    return i;
 }
 
-static enum state
-state_utf8_31_switch(struct terminal *term, uint8_t data)
+static void
+tokenize_action(struct vt_tokenizer *tok, struct vt_tokens *out,
+                enum action action, uint8_t c)
 {
-    switch (data) {
-        /*              exit                             current                          enter                            new state */
-    case 0x80 ... 0xbf:                                  action_utf8_32(term, data);                                       return STATE_UTF8_32;
-    default:                                                                                                               return STATE_GROUND;
+    switch (action) {
+    case ACTION_NONE:
+        break;
+
+    case ACTION_EXECUTE:
+        token_push(out, TOKEN_EXECUTE, c, 0, 0, 0);
+        break;
+
+    case ACTION_CLEAR:
+        tok->params.idx = 0;
+        tok->private = 0;
+        break;
+
+    case ACTION_PRINT:
+        token_push_bytes(out, TOKEN_PRINT, &c, 1);
+        break;
+
+    case ACTION_COLLECT:            action_collect(&tok->private, c);   break;
+    case ACTION_PARAM:              action_param(&tok->params, c);      break;
+    case ACTION_PARAM_NEW:          action_param_new(&tok->params, c);  break;
+    case ACTION_PARAM_NEW_SUBPARAM: action_param_new_subparam(&tok->params, c); break;
+
+    case ACTION_ESC_DISPATCH:
+        token_push(out, TOKEN_ESC_DISPATCH, c, tok->private, 0, 0);
+        break;
+
+    case ACTION_CSI_DISPATCH:
+        token_push_params(out, TOKEN_CSI_DISPATCH, c, tok);
+        break;
+
+    case ACTION_OSC_START:
+        token_push(out, TOKEN_OSC_START, c, 0, 0, 0);
+        break;
+
+    case ACTION_OSC_PUT:
+        token_push_bytes(out, TOKEN_OSC_PUT, &c, 1);
+        break;
+
+    case ACTION_OSC_END:
+    case ACTION_OSC_END_EXECUTE:
+    case ACTION_OSC_END_CLEAR:
+        token_push(out, TOKEN_OSC_END, c, 0, 0, 0);
+        if (action == ACTION_OSC_END_EXECUTE)
+            token_push(out, TOKEN_EXECUTE, c, 0, 0, 0);
+        else if (action == ACTION_OSC_END_CLEAR)
+            tokenize_action(tok, out, ACTION_CLEAR, c);
+        break;
+
+    case ACTION_HOOK:
+        token_push_params(out, TOKEN_HOOK, c, tok);
+        break;
+
+    case ACTION_PUT:
+        token_push_bytes(out, TOKEN_PUT, &c, 1);
+        break;
+
+    case ACTION_UNHOOK:
+    case ACTION_UNHOOK_EXECUTE:
+    case ACTION_UNHOOK_CLEAR:
+        token_push(out, TOKEN_UNHOOK, c, 0, 0, 0);
+        if (action == ACTION_UNHOOK_EXECUTE)
+            token_push(out, TOKEN_EXECUTE, c, 0, 0, 0);
+        else if (action == ACTION_UNHOOK_CLEAR)
+            tokenize_action(tok, out, ACTION_CLEAR, c);
+        break;
+
+    /* Same as action_utf8_*(), but records the code point */
+    case ACTION_UTF8_21: tok->utf8 = (c & 0x1f) << 6;   break;
+    case ACTION_UTF8_31: tok->utf8 = (c & 0x0f) << 12;  break;
+    case ACTION_UTF8_32: tok->utf8 |= (c & 0x3f) << 6;  break;
+    case ACTION_UTF8_41: tok->utf8 = (c & 0x07) << 18;  break;
+    case ACTION_UTF8_42: tok->utf8 |= (c & 0x3f) << 12; break;
+    case ACTION_UTF8_43: tok->utf8 |= (c & 0x3f) << 6;  break;
+
+    case ACTION_UTF8_22:
+        tok->utf8 |= c & 0x3f;
+        token_utf8_print(out, tok->utf8);
+        break;
+
+    case ACTION_UTF8_33:
+        tok->utf8 |= c & 0x3f;
+        if (likely(tok->utf8 < 0xd800 || tok->utf8 > 0xdfff))
+            token_utf8_print(out, tok->utf8);
+        break;
+
+    case ACTION_UTF8_44:
+        tok->utf8 |= c & 0x3f;
+        if (likely(tok->utf8 <= 0x10ffff))
+            token_utf8_print(out, tok->utf8);
+        break;
     }
 }
 
-static enum state
-state_utf8_32_switch(struct terminal *term, uint8_t data)
+void
+vt_tokenizer_init(struct vt_tokenizer *tok)
 {
-    switch (data) {
-        /*              exit                             current                          enter                            new state */
-    case 0x80 ... 0xbf:                                  action_utf8_33(term, data);                                       return STATE_GROUND;
-    default:                                                                                                               return STATE_GROUND;
-    }
+    *tok = (struct vt_tokenizer){.state = STATE_GROUND};
 }
 
-static enum state
-state_utf8_41_switch(struct terminal *term, uint8_t data)
+size_t
+vt_tokenize(struct vt_tokenizer *tok, const uint8_t *data, size_t len,
+            struct vt_tokens *out)
 {
-    switch (data) {
-        /*              exit                             current                          enter                            new state */
-    case 0x80 ... 0xbf:                                  action_utf8_42(term, data);                                       return STATE_UTF8_42;
-    default:                                                                                                               return STATE_GROUND;
+    /* Same as vt_from_slave(), except we record, rather than execute */
+    enum state current_state = tok->state;
+
+    const uint8_t *p = data;
+    const uint8_t *const end = data + len;
+
+    while (p < end && token_room(out) >= TOKEN_MAX_SIZE) {
+        if (current_state == STATE_GROUND) {
+            if (likely(*p >= 0x20 && *p <= 0x7e)) {
+                const size_t count = printable_ascii_run_length(
+                    p, min((size_t)(end - p), token_payload_room(out)));
+                xassert(count > 0);
+
+                token_push_bytes(out, TOKEN_PRINT, p, count);
+                p += count;
+                continue;
+            }
+
+            if (*p == '\x1b' && p + 1 < end && p[1] == '[') {
+                const size_t count = sgr_params_length(p + 2, end - p - 2);
+                if (count != SIZE_MAX) {
+                    token_push_bytes(out, TOKEN_SGR, p + 2, count);
+                    p += 2 + count + 1;
+                    continue;
+                }
+
+                tokenize_action(tok, out, ACTION_CLEAR, *p);
+                current_state = STATE_CSI_ENTRY;
+                p += 2;
+                continue;
+            }
+
+            if (*p >= 0x80) {
+                const size_t count = tokenize_utf8_run(out, p, end - p);
+                if (count > 0) {
+                    p += count;
+                    continue;
+                }
+            }
+        }
+
+        const struct transition *const row = transitions[current_state];
+        struct transition t;
+
+        do {
+            t = row[*p];
+
+            if (t.action == ACTION_PARAM)
+                action_param(&tok->params, *p);
+
+            else if ((t.action == ACTION_PUT || t.action == ACTION_OSC_PUT) &&
+                     t.state == current_state)
+            {
+                const size_t count = transition_run_length(
+                    row, p, min((size_t)(end - p), token_payload_room(out)));
+
+                token_push_bytes(
+                    out, t.action == ACTION_PUT ? TOKEN_PUT : TOKEN_OSC_PUT,
+                    p, count);
+
+                p += count;
+                continue;
+            }
+
+            else if (t.action != ACTION_NONE)
+                tokenize_action(tok, out, t.action, *p);
+
+            p++;
+        } while (t.state == current_state &&
+                 current_state != STATE_GROUND &&
+                 p < end &&
+                 token_room(out) >= TOKEN_MAX_SIZE);
+
+        current_state = t.state;
     }
+
+    tok->state = current_state;
+    return p - data;
 }
 
-static enum state
-state_utf8_42_switch(struct terminal *term, uint8_t data)
+static void
+params_from_token(struct terminal *term, const struct token *tok)
 {
-    switch (data) {
-        /*              exit                             current                          enter                            new state */
-    case 0x80 ... 0xbf:                                  action_utf8_43(term, data);                                       return STATE_UTF8_43;
-    default:                                                                                                               return STATE_GROUND;
+    const unsigned *v = (const unsigned *)(tok + 1);
+
+    term->vt.params.idx = tok->count;
+    term->vt.private = tok->private;
+
+    for (size_t i = 0; i < tok->count; i++) {
+        struct vt_param *param = &term->vt.params.v[i];
+
+        param->value = *v++;
+        param->sub.idx = *v++;
+        memcpy(param->sub.value, v, param->sub.idx * sizeof(unsigned));
+        v += param->sub.idx;
     }
 }
 
-static enum state
-state_utf8_43_switch(struct terminal *term, uint8_t data)
+static void
+sgr_from_token(struct terminal *term, const uint8_t *s, size_t len)
 {
-    switch (data) {
-        /*              exit                             current                          enter                            new state */
-    case 0x80 ... 0xbf:                                  action_utf8_44(term, data);                                       return STATE_GROUND;
-    default:                                                                                                               return STATE_GROUND;
+    if (csi_sgr_fast(term, s, len))
+        return;
+
+    /* Regular SGR; parameters are digits and ';' only */
+    action_clear(term);
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == ';')
+            action_param_new(&term->vt.params, s[i]);
+        else
+            action_param(&term->vt.params, s[i]);
     }
-}
 
-UNIGNORE_WARNINGS
+    csi_dispatch(term, 'm');
+}
 
 void
-vt_from_slave(struct terminal *term, const uint8_t *data, size_t len)
+vt_from_tokens(struct terminal *term, const struct vt_tokens *tokens)
 {
-    enum state current_state = term->vt.state;
+    const uint8_t *p = tokens->data;
+    const uint8_t *const end = tokens->data + tokens->len;
 
-    const uint8_t *p = data;
-    for (size_t i = 0; i < len; i++, p++) {
-        switch (current_state) {
-        case STATE_GROUND:              current_state = state_ground_switch(term, *p); break;
-        case STATE_ESCAPE:              current_state = state_escape_switch(term, *p); break;
-        case STATE_ESCAPE_INTERMEDIATE: current_state = state_escape_intermediate_switch(term, *p); break;
-        case STATE_CSI_ENTRY:           current_state = state_csi_entry_switch(term, *p); break;
-        case STATE_CSI_PARAM:           current_state = state_csi_param_switch(term, *p); break;
-        case STATE_CSI_INTERMEDIATE:    current_state = state_csi_intermediate_switch(term, *p); break;
-        case STATE_CSI_IGNORE:          current_state = state_csi_ignore_switch(term, *p); break;
-        case STATE_OSC_STRING:          current_state = state_osc_string_switch(term, *p); break;
-        case STATE_DCS_ENTRY:           current_state = state_dcs_entry_switch(term, *p); break;
-        case STATE_DCS_PARAM:           current_state = state_dcs_param_switch(term, *p); break;
-        case STATE_DCS_INTERMEDIATE:    current_state = state_dcs_intermediate_switch(term, *p); break;
-        case STATE_DCS_IGNORE:          current_state = state_dcs_ignore_switch(term, *p); break;
-        case STATE_DCS_PASSTHROUGH:     current_state = state_dcs_passthrough_switch(term, *p); break;
-        case STATE_SOS_PM_APC_STRING:   current_state = state_sos_pm_apc_string_switch(term, *p); break;
-
-        case STATE_UTF8_21:             current_state = state_utf8_21_switch(term, *p); break;
-        case STATE_UTF8_31:             current_state = state_utf8_31_switch(term, *p); break;
-        case STATE_UTF8_32:             current_state = state_utf8_32_switch(term, *p); break;
-        case STATE_UTF8_41:             current_state = state_utf8_41_switch(term, *p); break;
-        case STATE_UTF8_42:             current_state = state_utf8_42_switch(term, *p); break;
-        case STATE_UTF8_43:             current_state = state_utf8_43_switch(term, *p); break;
+    while (p < end) {
+        const struct token *tok = (const struct token *)p;
+        const uint8_t *payload = (const uint8_t *)(tok + 1);
+
+        switch (tok->type) {
+        case TOKEN_PRINT:
+            action_print_run(term, payload, tok->len);
+            break;
+
+        case TOKEN_UTF8: {
+            const char32_t *wcs = (const char32_t *)payload;
+            utf8_print_wcs(term, wcs, (const int8_t *)&wcs[tok->count],
+                           tok->count);
+            break;
         }
 
-        term->vt.state = current_state;
+        case TOKEN_EXECUTE:
+            action_execute(term, tok->c);
+            break;
+
+        case TOKEN_ESC_DISPATCH:
+            term->vt.params.idx = 0;
+            term->vt.private = tok->private;
+            action_esc_dispatch(term, tok->c);
+            break;
+
+        case TOKEN_CSI_DISPATCH:
+            params_from_token(term, tok);
+            action_csi_dispatch(term, tok->c);
+            break;
+
+        case TOKEN_SGR:
+            sgr_from_token(term, payload, tok->len);
+            break;
+
+        case TOKEN_OSC_START:
+            action_osc_start(term, tok->c);
+            break;
+
+        case TOKEN_OSC_PUT:
+            action_osc_put_run(term, payload, tok->len);
+            break;
+
+        case TOKEN_OSC_END:
+            action_osc_end(term, tok->c);
+            break;
+
+        case TOKEN_HOOK:
+            params_from_token(term, tok);
+            action_hook(term, tok->c);
+            break;
+
+        case TOKEN_PUT:
+            action_put_run(term, payload, tok->len);
+            break;
+
+        case TOKEN_UNHOOK:
+            action_unhook(term, tok->c);
+            break;
+        }
+
+        p += sizeof(*tok) + ((tok->len + 3) & ~(size_t)3);
+    }
+}
+
+UNITTEST
+{
+    const uint8_t input[] =
+        "ab\r\x1b[1;2:3H\x1b[31m\xc3\xa5\xe2\x82\xac\x1b(0\x1b]0;t\x07\x1bP1q#~\x1b\\";
+
+    uint8_t buf[TOKEN_MAX_SIZE * 2];
+    struct vt_tokens out = {.data = buf, .size = sizeof(buf)};
+    struct vt_tokenizer tok;
+
+    vt_tokenizer_init(&tok);
+
+    /* Split in two, in the middle of the CSI */
+    size_t consumed = vt_tokenize(&tok, input, 6, &out);
+    xassert(consumed == 6);
+    xassert(tok.state == STATE_CSI_PARAM);
+
+    consumed = vt_tokenize(&tok, &input[6], sizeof(input) - 1 - 6, &out);
+    xassert(consumed == sizeof(input) - 1 - 6);
+    xassert(tok.state == STATE_GROUND);
+
+    const struct {
+        enum token_type type;
+        uint8_t c;
+        uint32_t private;
+        size_t count;
+        size_t len;
+    } expected[] = {
+        {TOKEN_PRINT, .len = 2},
+        {TOKEN_EXECUTE, '\r'},
+        {TOKEN_CSI_DISPATCH, 'H', .count = 2, .len = 5 * sizeof(unsigned)},
+        {TOKEN_SGR, .len = 2},
+        {TOKEN_UTF8, .count = 2, .len = 2 * 5},
+        {TOKEN_ESC_DISPATCH, '0', '('},
+        {TOKEN_OSC_START, ']'},
+        {TOKEN_OSC_PUT, .len = 3},
+        {TOKEN_OSC_END, '\a'},
+        {TOKEN_HOOK, 'q', .count = 1, .len = 2 * sizeof(unsigned)},
+        {TOKEN_PUT, .len = 2},
+        {TOKEN_UNHOOK, '\x1b'},
+        {TOKEN_ESC_DISPATCH, '\\'},
+    };
+
+    const uint8_t *p = out.data;
+    for (size_t i = 0; i < ALEN(expected); i++) {
+        xassert(p < out.data + out.len);
+
+        const struct token *t = (const struct token *)p;
+        xassert(t->type == expected[i].type);
+        xassert(t->c == expected[i].c);
+        xassert(t->private == expected[i].private);
+        xassert(t->count == expected[i].count);
+        xassert(t->len == expected[i].len);
+
+        p += sizeof(*t) + ((t->len + 3) & ~(size_t)3);
     }
+    xassert(p == out.data + out.len);
+
+    /* Parameters, with sub-parameters, of the CSI */
+    const struct token *csi = (const struct token *)(
+        out.data + sizeof(struct token) + 4 + sizeof(struct token));
+    const unsigned *v = (const unsigned *)(csi + 1);
+    xassert(v[0] == 1 && v[1] == 0);
+    xassert(v[2] == 2 && v[3] == 1 && v[4] == 3);
+
+    /* Tokenizing stops when the output is full */
+    uint8_t small[TOKEN_MAX_SIZE + 16];
+    out = (struct vt_tokens){.data = small, .size = sizeof(small)};
+    vt_tokenizer_init(&tok);
+
+    uint8_t ascii[4096];
+    memset(ascii, 'x', sizeof(ascii));
+    consumed = vt_tokenize(&tok, ascii, sizeof(ascii), &out);
+    xassert(consumed == sizeof(small) - sizeof(struct token));
+    xassert(out.len == out.size);
 }
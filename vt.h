@@ -8,6 +8,12 @@
 
 void vt_from_slave(struct terminal *term, const uint8_t *data, size_t len);
 
+/* tweak.threaded-parser */
+void vt_tokenizer_init(struct vt_tokenizer *tok);
+size_t vt_tokenize(struct vt_tokenizer *tok, const uint8_t *data, size_t len,
+                   struct vt_tokens *out);
+void vt_from_tokens(struct terminal *term, const struct vt_tokens *tokens);
+
 static inline int
 vt_param_get(const struct terminal *term, size_t idx, int default_value)
 {